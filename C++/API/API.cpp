@@ -1,4 +1,478 @@
 #include "include/API.h"
+#include "include/columnar.h"
+#include "include/compact.h"
+#include "include/csv_reader.h"
+#include "include/mapped_file.h"
+#include "include/reactor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <random>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// SSE2 is used to find characters that need escaping in upload strings.
+// Every x86-64 compiler defines this, other systems use the plain loop.
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// std::to_chars gives the shortest round trip text for doubles (C++17).
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+// Most rows any field in one of the data maps has.
+template <typename T>
+static size_t most_rows(const std::map<std::string, std::vector<T> > &data) {
+  size_t rows = 0;
+  typename std::map<std::string, std::vector<T> >::const_iterator field;
+
+  for (field = data.begin(); field != data.end(); field++) {
+    rows = std::max(rows, field->second.size());
+  }
+  return rows;
+}
+
+// Runs a vector of values through a field's downsampler, if it has one.
+// The values kept are written over the start of the vector.
+template <typename T>
+static void downsample(std::map<std::string, downsampler> &downsamplers,
+                       const std::string &field_name, std::vector<T> &values) {
+  std::map<std::string, downsampler>::iterator stage;
+  stage = downsamplers.find(field_name);
+
+  if (stage == downsamplers.end()) {
+    return;
+  }
+
+  stage->second.reset();          // The field's data is being replaced.
+  size_t kept = 0;
+  T ready[DOWNSAMPLE_MAX_READY];
+
+  for (size_t i = 0; i < values.size(); i++) {
+    size_t count = stage->second.push(values[i], ready);
+    for (size_t j = 0; j < count; j++) {
+      values[kept++] = ready[j];
+    }
+  }
+  values.resize(kept);
+}
+
+/*  The credential cache (see set_credential_cache_ttl), shared by every
+ *  iSENSE object. The key is the API URL, email and a hash of the password,
+ *  so a different password or server is checked again.                       */
+struct credential_check {
+  bool checking;                // An object is asking iSENSE right now
+  bool valid;
+  long http_code;               // What iSENSE answered
+  std::chrono::steady_clock::time_point expires;
+
+  credential_check() : checking(false), valid(false), http_code(0) {}
+};
+
+static std::mutex credential_lock;
+static std::condition_variable credential_checked;
+static std::map<std::string, credential_check> credential_cache;
+static long credential_ttl = CREDENTIAL_CACHE_SECONDS;
+
+// The password itself is never kept in the cache, only a hash of it salted
+// with a number picked when the program starts.
+static std::string credential_key(const std::string &api_URL,
+                                  const std::string &email,
+                                  const std::string &password) {
+  static const std::string salt = std::to_string(std::random_device()());
+  return api_URL + "\n" + email + "\n" +
+         std::to_string(std::hash<std::string>()(salt + password));
+}
+
+// A field's name and type ("" and 0 if the server left them out). The name
+// isn't copied, it lives as long as the field.
+static const std::string &field_name_of(const value &field) {
+  static const std::string no_name;
+  return field.is<object>() && field.get("name").is<std::string>() ?
+         field.get("name").get<std::string>() : no_name;
+}
+
+static int field_type_of(const value &field) {
+  return field.is<object>() && field.get("type").is<double>() ?
+         static_cast<int>(field.get("type").get<double>()) : 0;
+}
+
+/*  The project cache (see prefetch_projects), shared by every iSENSE object.
+ *  The key is the project's URL. A fetch adds its future before it starts,
+ *  so others asking for the same project wait for it instead of asking iSENSE
+ *  again. Finished fetches are kept for project_ttl seconds (by default they
+ *  aren't kept at all), failed ones are removed (their result is NULL).      */
+typedef std::shared_ptr<const value> shared_project;
+
+struct project_fetch {
+  std::shared_future<shared_project> project;
+  std::chrono::steady_clock::time_point expires;    // max() while fetching
+};
+
+static std::mutex project_lock;
+static std::map<std::string, project_fetch> project_cache;
+static long project_ttl = PROJECT_CACHE_SECONDS;
+
+// Hands the result of a fetch to everyone waiting for it.
+static void finish_project(const std::string &url, std::promise<shared_project> &fetch,
+                           shared_project project) {
+  {
+    std::lock_guard<std::mutex> guard(project_lock);
+    if (project && project_ttl > 0) {
+      project_cache[url].expires = std::chrono::steady_clock::now() +
+                                   std::chrono::seconds(project_ttl);
+    } else {
+      project_cache.erase(url);
+    }
+  }
+  fetch.set_value(project);
+}
+
+// A fetch added to the cache by find_project. If it is never finished (an
+// exception was thrown, say) it fails when it goes away, so nobody waits
+// for it forever.
+struct project_claim {
+  std::string url;
+  std::promise<shared_project> fetch;
+  bool registered;
+
+  project_claim() : registered(false) {}
+  ~project_claim() {
+    if (registered) {
+      finish(shared_project());
+    }
+  }
+
+  void finish(shared_project project) {
+    registered = false;
+    finish_project(url, fetch, project);
+  }
+};
+
+// Looks for a project in the cache. Returns true and sets found if it is
+// there or being fetched. Otherwise the caller fetches it and calls
+// claim.finish() when it is done.
+static bool find_project(const std::string &url, std::shared_future<shared_project> &found,
+                         project_claim &claim) {
+  std::lock_guard<std::mutex> guard(project_lock);
+  std::map<std::string, project_fetch>::iterator cached = project_cache.find(url);
+
+  if (cached != project_cache.end() &&
+      std::chrono::steady_clock::now() < cached->second.expires) {
+    found = cached->second.project;
+    return true;
+  }
+  project_fetch &entry = project_cache[url];
+  entry.project = claim.fetch.get_future().share();
+  entry.expires = std::chrono::steady_clock::time_point::max();
+  claim.url = url;
+  claim.registered = true;
+  return false;
+}
+
+/*  The call this thread is in (see set_timeouts). The outermost call sets
+ *  the deadline, and the calls it makes share it. with_timeout leaves its
+ *  time here for the next call the object makes on this thread.            */
+struct call_state {
+  int depth;
+  bool has_deadline;
+  std::chrono::steady_clock::time_point deadline;
+  const iSENSE *override_for;
+  long override_ms;
+};
+
+static thread_local call_state this_call;
+
+struct call_scope {
+  call_scope(const iSENSE *api, const request_limits &limits) {
+    if (this_call.depth++ > 0) {
+      return;
+    }
+    long ms = limits.call_ms;
+    if (this_call.override_for == api) {
+      ms = this_call.override_ms;
+    }
+    this_call.override_for = NULL;
+    this_call.has_deadline = ms > 0;
+    this_call.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+  }
+
+  ~call_scope() {
+    this_call.depth--;
+  }
+};
+
+// One request's view of its object's limits. generation is the number of
+// cancel() calls when it started, a new one stops it.
+struct request_watch {
+  request_limits *limits;
+  long generation;
+};
+
+static int check_cancel(void *arg, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+  request_watch *watch = static_cast<request_watch *>(arg);
+  return watch->limits->cancels != watch->generation;
+}
+
+// Sets the timeouts of a request. The time it gets is what's left of the
+// call it's in, or call_ms if it isn't in one. false (counted as a timeout)
+// if the call is out of time already.
+static bool limit_request(CURL *handle, request_watch &watch) {
+  request_limits &limits = *watch.limits;
+  long timeout = limits.call_ms;
+
+  if (this_call.depth > 0) {
+    timeout = 0;
+    if (this_call.has_deadline) {
+      timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  this_call.deadline - std::chrono::steady_clock::now()).count();
+      if (timeout <= 0) {
+        limits.timeouts++;
+        return false;
+      }
+    }
+  }
+
+  curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);     // Threads can't use alarms
+  curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, timeout);
+  curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, (long) limits.connect_ms);
+  curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, limits.stall_seconds > 0 ? 1L : 0L);
+  curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, (long) limits.stall_seconds);
+
+  watch.generation = limits.cancels;
+  curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, &check_cancel);
+  curl_easy_setopt(handle, CURLOPT_XFERINFODATA, &watch);
+  curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0L);
+  return true;
+}
+
+// Counts the requests that ran out of time.
+static CURLcode count_timeout(CURLcode result, request_limits *limits) {
+  if (result == CURLE_OPERATION_TIMEDOUT) {
+    limits->timeouts++;
+  }
+  return result;
+}
+
+// url moved to another endpoint (see set_endpoints). URLs that aren't on
+// any of them, such as media stored elsewhere, stay where they are.
+static std::string route(endpoint_set *endpoints, const std::string &url, size_t endpoint) {
+  size_t from = endpoints ? endpoints->find(url) : 0;
+  if (!endpoints || from == endpoints->size()) {
+    return url;
+  }
+  return endpoints->api_URL(endpoint) + url.substr(endpoints->api_URL(from).size());
+}
+
+// The same, to the best endpoint right now.
+static std::string route(endpoint_set *endpoints, const std::string &url) {
+  if (!endpoints) {
+    return url;
+  }
+  return route(endpoints, url, endpoints->pick(std::vector<bool>(endpoints->size(), false)));
+}
+
+// The server never saw these requests, so they can be sent again anywhere.
+static bool not_sent(CURLcode result) {
+  return result == CURLE_COULDNT_RESOLVE_HOST || result == CURLE_COULDNT_CONNECT;
+}
+
+/*  Runs a request on the object's shared connections (see set_http2), or on
+ *  its own connection when that's off. Sets the request's URL.
+ *
+ *  With endpoints it goes to the best one, and moves on to the next when
+ *  that fails: always if the request wasn't sent, and after any error or 5xx
+ *  answer if it is a read with a response to clear (reads into a file can't
+ *  be taken back once data arrived).                                       */
+static CURLcode perform(const request_context &context, CURL *handle, const std::string &url,
+                        std::string *response, bool read) {
+  endpoint_set *endpoints = context.endpoints.get();
+  std::vector<bool> tried(endpoints ? endpoints->size() : 1, false);
+  bool routed = endpoints && endpoints->find(url) != endpoints->size();
+  CURLcode result = CURLE_COULDNT_CONNECT;
+
+  while (true) {
+    size_t endpoint = routed ? endpoints->pick(tried) : 0;
+    if (endpoint == tried.size()) {
+      return result;              // All of them failed.
+    }
+    tried[endpoint] = true;
+    std::string target = routed ? route(endpoints, url, endpoint) : url;
+    curl_easy_setopt(handle, CURLOPT_URL, target.c_str());
+    if (response) {
+      response->clear();
+    }
+
+    request_watch watch = {context.limits.get(), 0};
+    if (!limit_request(handle, watch)) {
+      return CURLE_OPERATION_TIMEDOUT;
+    }
+    result = context.transport ? context.transport->perform(handle) : curl_easy_perform(handle);
+    count_timeout(result, context.limits.get());
+    if (!routed || result == CURLE_ABORTED_BY_CALLBACK) {
+      return result;              // Nowhere else to go, or cancelled.
+    }
+
+    long code = 0;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+    if (result == CURLE_OK && code < 500) {
+      // Only reads are timed, the time to the first byte of an upload
+      // includes sending it.
+      double seconds = -1;
+      if (read) {
+        curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &seconds);
+      }
+      endpoints->succeeded(endpoint, seconds);
+      return result;
+    }
+
+    endpoints->failed(endpoint);
+    if (!not_sent(result) && !(read && response)) {
+      return result;
+    }
+  }
+}
+
+// Media uploads are read out of the mapped file a piece at a time.
+struct media_source {
+  const char *data;
+  size_t size, offset;
+};
+
+static size_t read_media(char *buffer, size_t size, size_t nitems, void *arg) {
+  media_source *source = static_cast<media_source *>(arg);
+  size_t count = std::min(size * nitems, source->size - source->offset);
+
+  if (count > 0) {
+    memcpy(buffer, source->data + source->offset, count);
+    source->offset += count;
+  }
+  return count;
+}
+
+// curl goes back to the start if it has to send the file again.
+static int seek_media(void *arg, curl_off_t offset, int origin) {
+  media_source *source = static_cast<media_source *>(arg);
+  if (origin != SEEK_SET || offset < 0 || static_cast<size_t>(offset) > source->size) {
+    return CURL_SEEKFUNC_CANTSEEK;
+  }
+  source->offset = static_cast<size_t>(offset);
+  return CURL_SEEKFUNC_OK;
+}
+
+// The file calls media downloads use. Windows has its own names for them,
+// no ftruncate, and its rename won't replace a file that's already there.
+#ifdef WIN32
+static int open_part(const std::string &path) {
+  return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY,
+               _S_IREAD | _S_IWRITE);
+}
+static long long end_of(int fd) { return _lseeki64(fd, 0, SEEK_END); }
+static bool empty_part(int fd) { return _chsize_s(fd, 0) == 0; }
+static void close_part(int fd) { _close(fd); }
+static long write_part(int fd, const char *data, size_t size) {
+  return _write(fd, data, static_cast<unsigned>(std::min<size_t>(size, INT_MAX)));
+}
+static bool replace_file(const std::string &from, const std::string &to) {
+  std::remove(to.c_str());
+  return rename(from.c_str(), to.c_str()) == 0;
+}
+#else
+static int open_part(const std::string &path) {
+  return open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+}
+static long long end_of(int fd) { return lseek(fd, 0, SEEK_END); }
+static bool empty_part(int fd) { return ftruncate(fd, 0) == 0; }
+static void close_part(int fd) { close(fd); }
+static long write_part(int fd, const char *data, size_t size) {
+  return write(fd, data, size);
+}
+static bool replace_file(const std::string &from, const std::string &to) {
+  return rename(from.c_str(), to.c_str()) == 0;
+}
+#endif
+
+// Media downloads are written straight to a file descriptor.
+static size_t write_media(char *data, size_t size, size_t nmemb, void *arg) {
+  int fd = *static_cast<int *>(arg);
+  size_t total = size * nmemb, written = 0;
+
+  while (written < total) {
+    long count = write_part(fd, data + written, total - written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return 0;                             // Stops the download
+    }
+    written += count;
+  }
+  return total;
+}
+
+// A text part of a media upload's form.
+static void add_form_part(curl_mime *form, const char *name, const std::string &text) {
+  curl_mimepart *part = curl_mime_addpart(form);
+  curl_mime_name(part, name);
+  curl_mime_data(part, text.c_str(), text.size());
+}
+
+// Sets up a download of url into fd. Error pages aren't written to fd.
+static CURL *media_request(const std::string &url, int *fd, bool http2) {
+  CURL *handle = curl_easy_init();
+  if (handle) {
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &write_media);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, fd);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+    if (http2) {
+      curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2_0);
+      curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    }
+  }
+  return handle;
+}
+
+// libcurl's global init and cleanup aren't thread safe (in older versions),
+// so they are only called by the first user of libcurl and the last one to
+// stop. The users are iSENSE objects and their background field fetches,
+// which may outlive them.
+static std::mutex curl_users_lock;
+static size_t curl_users = 0;
+
+static void curl_acquire() {
+  std::lock_guard<std::mutex> guard(curl_users_lock);
+  if (curl_users++ == 0) {
+    curl_global_init(CURL_GLOBAL_ALL);
+  }
+}
+
+static void curl_release() {
+  std::lock_guard<std::mutex> guard(curl_users_lock);
+  if (--curl_users == 0) {
+    curl_global_cleanup();
+  }
+}
+
+// Make sure we actually got a project back before grabbing its fields.
+static bool is_project(const value &project) {
+  return project.is<object>() && project.get("fields").is<array>();
+}
 
 iSENSE::iSENSE() {                              // Default constructor
   upload_URL = EMPTY;
@@ -11,22 +485,57 @@ iSENSE::iSENSE() {                              // Default constructor
   contributor_label = "label";
   email = EMPTY;
   password = EMPTY;
-  curl_global_init(CURL_GLOBAL_ALL);            // Setup libcurl exactly once.
+  parse_backend = PARSE_PICOJSON;
+  thread_count = 0;
+  import_chunk_rows = IMPORT_CHUNK_ROWS;
+  incremental = false;
+  pending_rows = pending_bytes = 0;
+  flush_rows = flush_bytes = 0;
+  flush_ms = 0;
+  flush_running = flush_stop = flush_posted = async_upload = false;
+  flush_post_type = 0;
+  timestamp_digits = TIMESTAMP_MILLISECONDS;
+  compact_upload = server_compact = false;
+  memory_budget = resident_bytes = 0;
+  api_URL = devURL;
+  save_URLs();
+  fields_mode = FIELDS_NOW;
+  limits = std::make_shared<request_limits>();
+  set_timeouts(CONNECT_TIMEOUT_MS, 0, STALL_SECONDS);
+  curl_acquire();
 }
 
 // Constructor with parameters
 iSENSE::iSENSE(std::string proj_ID, std::string proj_title,
-               std::string label, std::string contr_key) {
+               std::string label, std::string contr_key, int fields_mode) {
+  parse_backend = PARSE_PICOJSON;               // Needed before getting fields
+  thread_count = 0;
+  import_chunk_rows = IMPORT_CHUNK_ROWS;
+  incremental = false;
+  pending_rows = pending_bytes = 0;
+  flush_rows = flush_bytes = 0;
+  flush_ms = 0;
+  flush_running = flush_stop = flush_posted = async_upload = false;
+  flush_post_type = 0;
+  timestamp_digits = TIMESTAMP_MILLISECONDS;
+  compact_upload = server_compact = false;
+  memory_budget = resident_bytes = 0;
+  api_URL = devURL;
+  limits = std::make_shared<request_limits>();
+  set_timeouts(CONNECT_TIMEOUT_MS, 0, STALL_SECONDS);
+  curl_acquire();                 // Before set_project_ID gets the fields.
+
+  this->fields_mode = fields_mode;
   set_project_ID(proj_ID);
   set_project_title(proj_title);
   set_project_label(label);
   set_contributor_key(contr_key);
-  curl_global_init(CURL_GLOBAL_ALL);            // Setup libcurl exactly once.
 }
 
 // Override the constructor, we need to make sure we cleanup libcurl.
 iSENSE::~iSENSE() {
-  curl_global_cleanup();          // Make sure to cleanup libcurl exactly ONCE.
+  stop_auto_flush();              // Uploads anything that's left.
+  curl_release();
 }
 
 // Similar to the constructor with parameters, but can be called at anytime
@@ -41,24 +550,271 @@ void iSENSE::set_project_all(std::string proj_ID, std::string proj_title,
 // Set the Project ID, and the upload/get URLs as well.
 void iSENSE::set_project_ID(std::string proj_ID) {
   project_ID = proj_ID;
-  upload_URL = devURL + "/projects/" + project_ID + "/jsonDataUpload";
-  get_URL = devURL + "/projects/" + project_ID;
-  get_project_fields();
+  save_URLs();
+  upload_URL = project_upload_URL;
+  get_URL = project_URL;
+
+  if (fields_mode == FIELDS_NOW) {
+    drop_fields();
+    get_project_fields();
+  } else {
+    start_fields(fields_mode == FIELDS_BACKGROUND);
+  }
+}
+
+// Requests already running on the old connections finish first.
+void iSENSE::set_http2(bool enabled) {
+  if (!enabled) {
+    transport.reset();
+  } else if (!transport) {
+    transport = std::make_shared<http_transport>(SHARED_HOST_CONNECTIONS);
+  }
+}
+
+void iSENSE::set_timeouts(long connect_ms, long call_ms, long stall_seconds) {
+  limits->connect_ms = connect_ms < 0 ? 0 : connect_ms;
+  limits->call_ms = call_ms < 0 ? 0 : call_ms;
+  limits->stall_seconds = stall_seconds < 0 ? 0 : stall_seconds;
+}
+
+iSENSE &iSENSE::with_timeout(long ms) {
+  this_call.override_for = this;
+  this_call.override_ms = ms < 0 ? 0 : ms;
+  return *this;
+}
+
+// The requests check for this about once a second (and whenever data
+// arrives), see check_cancel.
+void iSENSE::cancel() {
+  limits->cancels++;
+}
+
+long iSENSE::get_timeout_count() {
+  return limits->timeouts;
+}
+
+void iSENSE::set_fields_mode(int mode) {
+  fields_mode = mode;
+}
+
+std::shared_future<bool> iSENSE::fields_ready() {
+  if (fields_future.valid()) {
+    return fields_future;
+  }
+  std::promise<bool> ready;
+  ready.set_value(!fields_array.empty());
+  return ready.get_future().share();
+}
+
+// FIELDS_LAZY uses a deferred task, which runs when something first waits
+// for it. In the background a detached thread fulfils a promise, so nothing
+// waits for a fetch that was dropped. The task only writes to its own
+// pending slot, so a task that was dropped can still finish (or run) safely.
+void iSENSE::start_fields(bool background) {
+  drop_fields();
+  if (project_ID == EMPTY || project_ID.empty()) {
+    return;
+  }
+
+  std::string url = project_URL;
+  int backend = parse_backend;
+  request_context shared = context();
+  std::shared_ptr<std::shared_ptr<const value> > pending =
+    std::make_shared<std::shared_ptr<const value> >();
+
+  if (background) {
+    std::shared_ptr<std::promise<bool> > loaded = std::make_shared<std::promise<bool> >();
+    fields_future = loaded->get_future().share();
+
+    curl_acquire();                             // In case the object goes first
+    std::thread([pending, loaded, url, backend, shared]() {
+      try {
+        *pending = load_project(url, backend, shared, "set_project_ID()");
+        loaded->set_value(static_cast<bool>(*pending));
+      } catch (...) {
+        loaded->set_exception(std::current_exception());
+      }
+      curl_release();
+    }).detach();
+  } else {
+    fields_future = std::async(std::launch::deferred, [pending, url, backend, shared]() {
+      *pending = load_project(url, backend, shared, "set_project_ID()");
+      return static_cast<bool>(*pending);
+    }).share();
+  }
+  pending_project = pending;
+  pending_URL = url;
+}
+
+// Fields pulled down for another project or server are thrown away.
+void iSENSE::wait_for_fields() {
+  if (!pending_project) {
+    return;
+  }
+  bool loaded = fields_future.get();
+  std::shared_ptr<const value> project = *pending_project;
+  pending_project.reset();
+
+  if (loaded && pending_URL == project_URL) {
+    get_data = *project;
+    save_project_fields();
+  }
+}
+
+// Doesn't wait: a background fetch finishes on its own and is ignored.
+void iSENSE::drop_fields() {
+  fields_future = std::shared_future<bool>();
+  pending_project.reset();
+}
+
+// The API URL of a server, such as live_baseURL or "http://127.0.0.1:8080/".
+static std::string api_URL_of(std::string base_URL) {
+  while (!base_URL.empty() && base_URL[base_URL.size() - 1] == '/') {
+    base_URL.erase(base_URL.size() - 1);
+  }
+  return base_URL + "/api/v1";
+}
+
+// Points the API at another server, such as live_baseURL or local_baseURL.
+void iSENSE::set_base_URL(std::string base_URL) {
+  api_URL = api_URL_of(base_URL);
+  endpoints.reset();
+  save_URLs();
+
+  if (project_ID != EMPTY) {
+    upload_URL = project_upload_URL;
+    get_URL = project_URL;
+  }
+  if (pending_project) {
+    start_fields(fields_mode == FIELDS_BACKGROUND);   // Fields that haven't come in yet
+  }
+}
+
+// URLs are built with the first endpoint, perform moves them to the others.
+// The caches are keyed on those URLs too, since every endpoint has the same
+// projects.
+void iSENSE::set_endpoints(std::vector<std::string> base_URLs) {
+  if (base_URLs.empty()) {
+    std::cerr << "\nError in method: set_endpoints()\n";
+    std::cerr << "No base URLs were given.\n";
+    return;
+  }
+  set_base_URL(base_URLs[0]);
+
+  std::vector<std::string> api_URLs;
+  for (size_t i = 0; i < base_URLs.size(); i++) {
+    api_URLs.push_back(api_URL_of(base_URLs[i]));
+  }
+  endpoints = std::make_shared<endpoint_set>(api_URLs);
+}
+
+// The probes run at the same time on one multi handle, so a dead server
+// costs the connect timeout once, not once per server.
+bool iSENSE::probe_endpoints() {
+  call_scope scope(this, *limits);
+  if (!endpoints) {
+    std::cerr << "\nError in method: probe_endpoints()\n";
+    std::cerr << "No endpoints were set, see set_endpoints().\n";
+    return false;
+  }
+
+  CURLM *multi = curl_multi_init();
+  if (multi == NULL) {
+    std::cerr << "\nError in method: probe_endpoints()\n";
+    std::cerr << "Curl failed for some unknown reason.\n";
+    return false;
+  }
+
+  std::vector<CURL *> handles(endpoints->size(), NULL);
+  std::vector<std::string> urls(endpoints->size()), replies(endpoints->size());
+  std::vector<request_watch> watches(endpoints->size());
+  for (size_t i = 0; i < handles.size(); i++) {
+    urls[i] = endpoints->api_URL(i) + PROBE_PATH;
+    watches[i].limits = limits.get();
+    handles[i] = curl_easy_init();
+    if (handles[i] == NULL) {
+      std::cerr << "\nError in method: probe_endpoints()\n";
+      std::cerr << "Curl failed for some unknown reason.\n";
+      break;
+    }
+    curl_easy_setopt(handles[i], CURLOPT_URL, urls[i].c_str());
+    curl_easy_setopt(handles[i], CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+    curl_easy_setopt(handles[i], CURLOPT_WRITEDATA, &replies[i]);
+    if (!limit_request(handles[i], watches[i])) {
+      curl_easy_cleanup(handles[i]);
+      handles[i] = NULL;
+      break;                      // Out of time, the rest aren't started.
+    }
+    curl_multi_add_handle(multi, handles[i]);
+  }
+
+  int running = 1;
+  while (running > 0) {
+    curl_multi_perform(multi, &running);
+    if (running > 0) {
+      curl_multi_wait(multi, NULL, 0, 100, NULL);
+    }
+  }
+
+  // Each transfer's result, to tell the endpoints that failed.
+  std::vector<CURLcode> results(handles.size(), CURLE_COULDNT_CONNECT);
+  CURLMsg *message;
+  int left;
+  while ((message = curl_multi_info_read(multi, &left)) != NULL) {
+    for (size_t i = 0; i < handles.size(); i++) {
+      if (message->msg == CURLMSG_DONE && handles[i] == message->easy_handle) {
+        results[i] = count_timeout(message->data.result, limits.get());
+      }
+    }
+  }
+
+  bool any = false;
+  for (size_t i = 0; i < handles.size(); i++) {
+    if (handles[i] == NULL) {
+      continue;
+    }
+    long code = 0;
+    double seconds = 0;
+    curl_easy_getinfo(handles[i], CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(handles[i], CURLINFO_STARTTRANSFER_TIME, &seconds);
+
+    if (results[i] == CURLE_OK && code == HTTP_AUTHORIZED) {
+      endpoints->succeeded(i, seconds);
+      any = true;
+    } else if (results[i] != CURLE_ABORTED_BY_CALLBACK) {
+      endpoints->failed(i);
+    }
+    curl_multi_remove_handle(multi, handles[i]);
+    curl_easy_cleanup(handles[i]);
+  }
+  curl_multi_cleanup(multi);
+  return any;
+}
+
+request_context iSENSE::context() const {
+  request_context shared = {transport, limits, endpoints};
+  return shared;
+}
+
+void iSENSE::save_URLs() {
+  project_URL = api_URL + "/projects/" + project_ID;
+  project_upload_URL = project_URL + "/jsonDataUpload";
+  append_URL = api_URL + "/data_sets/append";
 }
 
 // The user should also set the project title
 void iSENSE::set_project_title(std::string proj_title) {
-  title = proj_title;
+  title = std::move(proj_title);
 }
 
 // This one is optional, by default the label will be "label".
 void iSENSE::set_project_label(std::string proj_label) {
-  contributor_label = proj_label;
+  contributor_label = std::move(proj_label);
 }
 
 // As well as the contributor key they will be using
 void iSENSE::set_contributor_key(std::string proj_key) {
-  contributor_key = proj_key;
+  contributor_key = std::move(proj_key);
 }
 
 // Users should not call this and should instead use the appendbyName methods.
@@ -69,6 +825,7 @@ void iSENSE::set_dataset_ID(std::string proj_dataset_ID) {
 // Sets both email & password at once. Checks for valid email / password.
 bool iSENSE::set_email_password(std::string proj_email,
                                 std::string proj_password) {
+  call_scope scope(this, *limits);
   email = proj_email;
   password = proj_password;
 
@@ -84,16 +841,35 @@ bool iSENSE::set_email_password(std::string proj_email,
 
 // Function that the user can call to just generate an ISO 8601 timestamp
 std::string iSENSE::generate_timestamp(void) {
-  time_t time_stamp;
-  time(&time_stamp);
-  char buffer[sizeof "2011-10-08T07:07:09Z"];
+  char buffer[TIMESTAMP_BUFFER_SIZE];
 
   // Timestamp is in the form of Year - Month - Day -- Hour - Minute - Seconds
-  strftime(buffer, sizeof buffer, "%Y-%m-%dT%H:%M:%SZ", gmtime(&time_stamp));
+  return std::string(buffer, generate_timestamp(buffer, TIMESTAMP_SECONDS));
+}
+
+// Doesn't use gmtime (which isn't thread safe) or allocate any memory.
+size_t iSENSE::generate_timestamp(char *buffer, int digits) {
+  return format_timestamp(buffer, timestamp_now(), digits);
+}
+
+long long iSENSE::timestamp_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
 
-  std::string cplusplus_timestamp(buffer);  // Convert char array to C++ string
+// Digits after the seconds for timestamps pushed with push_timestamp.
+void iSENSE::set_timestamp_digits(int digits) {
+  timestamp_digits = std::min(std::max(digits, 0), 9);
+}
+
+// Choose between picojson and the fast parser for JSON off iSENSE.
+void iSENSE::set_parse_backend(int backend) {
+  parse_backend = backend;
+}
 
-  return cplusplus_timestamp;
+// Number of threads get_all_datasets() uses. 0 means one per CPU core.
+void iSENSE::set_thread_count(int threads) {
+  thread_count = threads;
 }
 
 void iSENSE::clear_data(void) {     // Resets the object and clears the map.
@@ -108,11 +884,20 @@ void iSENSE::clear_data(void) {     // Resets the object and clears the map.
   password = EMPTY;
 
   map_data.clear();   // Clear the map_data
-
-  // Clear the picojson objects
+  number_data.clear();
+  timestamp_data.clear();
+  sent_rows.clear();
+  downsamplers.clear();
+  spilled.clear();
+  spilled_parts.clear();
+  unknown_fields.clear();
+  pending_rows = pending_bytes = resident_bytes = 0;
+  drop_fields();                    // Fields on the way for the old project
+  pending_URL.clear();
+
+  // Clear the upload string and picojson objects
   // Under the hood picojson::objects are STL maps and picojson::arrays are STL vectors.
-  upload_data.clear();
-  fields_data.clear();
+  upload_str.clear();
   owner_info.clear();
 
   // Uses picojson's = operator to clear the get_data obj and the fields obj.
@@ -123,112 +908,611 @@ void iSENSE::clear_data(void) {     // Resets the object and clears the map.
 
   // Clear the field array (STL vectors)
   fields_array.clear();
+  field_IDs.clear();
+  server_compact = false;
   media_objects.clear();
   data_sets.clear();
+  data_sets_URL.clear();
 }
 
-// Add one piece of data to the map of data.
-void iSENSE::push_back(std::string field_name, std::string data) {
-  map_data[field_name].push_back(data);
+// Only the data is cleared, the project / credentials / fields are kept.
+void iSENSE::clear_upload_data() {
+  std::lock_guard<std::mutex> guard(data_lock);
+  pending_rows = pending_bytes = resident_bytes = 0;
+  map_data.clear();
+  number_data.clear();
+  timestamp_data.clear();
+  sent_rows.clear();
+  spilled.clear();
+  spilled_parts.clear();
+  upload_str.clear();
+
+  // The fields stay downsampled, but the values waiting are dropped.
+  std::map<std::string, downsampler>::iterator stage;
+  for (stage = downsamplers.begin(); stage != downsamplers.end(); stage++) {
+    stage->second.reset();
+  }
 }
 
-// Add a field name / vector of strings (data) to the map.
-void iSENSE::push_vector(std::string field_name, std::vector<std::string> data) {
-  // This will store a copy of the vector<string> in the map.
-  // If you decide to add more data, you will need to use the push_back method.
-  map_data[field_name] = data;
+// See drop_sent_rows().
+void iSENSE::set_incremental_append(bool enabled) {
+  incremental = enabled;
 }
 
-// Searches for projects with the search term.
-std::vector<std::string> iSENSE::get_projects_search(std::string search_term) {
-  get_URL = devURL + "/projects?&search=" + search_term;
-  std::vector<std::string> project_titles;          // Vector of project titles.
-  http_code = get_data_funct(GET_NORMAL);           // get data off iSENSE.
+// Only used if the server supports it (see save_upload_encodings).
+void iSENSE::set_compact_upload(bool enabled) {
+  compact_upload = enabled;
+}
 
-  // Check for errors. We need to get a code 200 for this method.
-  if( !check_http_code(http_code, "get_projects_search()") ) {
-    return project_titles;                            // Return an empty vector
+// Data that is over the new budget already is spilled right away.
+void iSENSE::set_memory_budget(size_t bytes, std::string directory) {
+  std::lock_guard<std::mutex> guard(data_lock);
+  memory_budget = bytes;
+  spilled.set_directory(directory);
+  resident_bytes = resident_size();
+
+  if (memory_budget != 0 && resident_bytes > memory_budget) {
+    spill_rows();
   }
-  value projects_json;
+}
 
-  // Parse the JSON file, just like the main page of PicoJSON does.
-  std::string errors = parse(projects_json, json_str);
+size_t iSENSE::get_resident_bytes() {
+  std::lock_guard<std::mutex> guard(data_lock);
+  return resident_size();
+}
 
-  // If we have errors, print them out and quit.
-  if ( !errors.empty() ) {
-    std::cerr << "\nError in: get_projects_search(string search_term)";
-    std::cerr << "Error parsing JSON file.\n";
-    std::cerr << "Error was: " << errors << "\n";
-    return project_titles;                            // Return an empty vector
-  }
-  // Convert the JSON array (projects_json) into a vector of project title strings
-  array projects_array = projects_json.get<array>();
-  array::iterator it, the_begin, the_end;
-  the_begin = projects_array.begin();
-  the_end = projects_array.end();
+size_t iSENSE::get_spilled_bytes() {
+  std::lock_guard<std::mutex> guard(data_lock);
+  return spilled.bytes();
+}
 
-  // Check and see if the projects_title JSON array is empty
-  if (the_begin == the_end) {
-    std::cerr << "\nError in: get_projects_search(string search_term) \n";
-    std::cerr << "Project title array is empty.\n";
-    return project_titles;                            // Return an empty vector
-  }
+// Add one piece of data to the map of data.
+void iSENSE::push_back(const std::string &field_name, std::string data) {
+  std::lock_guard<std::mutex> guard(data_lock);
+  numbers_to_text(field_name);      // Keep the order if numbers were pushed.
+  timestamps_to_text(field_name);
+
+  std::vector<std::string> &text = map_data[field_name];
+  size_t bytes = data.size() + 3;
+  text.push_back(std::move(data));
+  count_pending(text.size(), bytes, 1);
+}
 
-  for (it = projects_array.begin(); it != projects_array.end(); it++) {
-    object obj = it->get<object>();                       // Get the current obj
-    std::string name = obj["name"].get<std::string>();    // Grab the field name
-    project_titles.push_back(name);                       // Add to the vector.
+// Add a field name / vector of strings (data) to the map.
+void iSENSE::push_vector(const std::string &field_name, std::vector<std::string> data) {
+  std::lock_guard<std::mutex> guard(data_lock);
+  size_t bytes = 0;
+  for (size_t i = 0; i < data.size(); i++) {
+    bytes += data[i].size() + 3;
   }
-  return project_titles;                    // Return a vector of project titles
+
+  // The vector is moved into the map (the caller's copy, or theirs if they
+  // used std::move). To add more data, use the push_back method.
+  number_data.erase(field_name);
+  timestamp_data.erase(field_name);
+  spilled.drop(field_name);
+  sent_rows.erase(field_name);      // Replaced, so none of it has been sent.
+  size_t rows = data.size();
+  map_data[field_name] = std::move(data);
+  count_pending(rows, bytes, rows);
 }
 
-bool iSENSE::get_check_user() {
-  if (email == EMPTY || email.empty()) {
-    std::cerr << "\nPlease set an email for this project.\n";
-    return false;
-  } else if (password == EMPTY || password.empty()) {
-    std::cerr << "\nPlease set a password for this project.\n";
-    return false;
-  }
+// Add one number to the map of numbers.
+void iSENSE::push_back(const std::string &field_name, double data) {
+  std::lock_guard<std::mutex> guard(data_lock);
 
-  get_URL = devURL + "/users/myInfo?email=" + email + "&password=" + password;
-  http_code = get_data_funct(GET_QUIET);         // quietly get data off iSENSE.
+  std::map<std::string, downsampler>::iterator stage;
+  if (downsamplers.empty() || (stage = downsamplers.find(field_name)) == downsamplers.end()) {
+    add_number(field_name, data);
+    return;
+  }
 
-  if (http_code == HTTP_AUTHORIZED) {
-    return true;
+  double ready[DOWNSAMPLE_MAX_READY];
+  size_t count = stage->second.push(data, ready);
+  for (size_t i = 0; i < count; i++) {
+    add_number(field_name, ready[i]);
   }
-  return false;
 }
 
-bool iSENSE::get_project_fields() {
-  if (project_ID == EMPTY || project_ID.empty()) {
-    std::cerr << "Error - project ID not set!\n";
-    return false;
-  }
+// Add a field name / vector of numbers to the map of numbers.
+void iSENSE::push_vector(const std::string &field_name, std::vector<double> data) {
+  std::lock_guard<std::mutex> guard(data_lock);
+  map_data.erase(field_name);
+  timestamp_data.erase(field_name);
+  spilled.drop(field_name);
+  sent_rows.erase(field_name);
+  downsample(downsamplers, field_name, data);
+  size_t rows = data.size();
+  number_data[field_name] = std::move(data);
+  count_pending(rows, rows * PENDING_NUMBER_BYTES);
+}
 
-  get_URL = devURL + "/projects/" + project_ID;
-  http_code = get_data_funct(GET_NORMAL);           // get data off iSENSE.
+void iSENSE::push_range(const std::string &field_name, const double *begin, const double *end) {
+  std::lock_guard<std::mutex> guard(data_lock);
+  add_numbers(field_name, begin, end);
+}
 
-  // Check for errors. We need to get a code 200 for this method.
-  if( !check_http_code(http_code, "get_projects_fields()") ) {
-    return false;                            // Return an empty vector
-  }
+// Numbers that go through a downsampler, or into a field that holds text,
+// take the same path as push_back. The rest are added in one go.
+void iSENSE::add_numbers(const std::string &field_name, const double *begin, const double *end) {
+  std::map<std::string, downsampler>::iterator stage = downsamplers.find(field_name);
+  if (stage != downsamplers.end()) {
+    double ready[DOWNSAMPLE_MAX_READY];
+    for (; begin != end; begin++) {
+      size_t count = stage->second.push(*begin, ready);
+      for (size_t i = 0; i < count; i++) {
+        add_number(field_name, ready[i]);
+      }
+    }
+    return;
+  }
+  if (map_data.count(field_name) != 0 || timestamp_data.count(field_name) != 0) {
+    for (; begin != end; begin++) {
+      add_number(field_name, *begin);
+    }
+    return;
+  }
 
-  // Parse the JSON file, just like the main page of PicoJSON does.
-  std::string errors = parse(get_data, json_str);
+  std::vector<double> &numbers = number_data[field_name];
+  numbers.insert(numbers.end(), begin, end);
+  count_pending(numbers.size(), (end - begin) * PENDING_NUMBER_BYTES);
+}
 
-  if ( !errors.empty() ) {    // If we have errors, print them out and quit.
-    std::cerr << "\nError parsing JSON file in method: get_project_fields()\n";
-    std::cerr << "Error was: " << errors;
+// Integers are saved as doubles, unless they are too big for a double to
+// hold exactly (more than 2^53). Then the whole field is saved as strings.
+void iSENSE::push_vector(const std::string &field_name, std::vector<long long> data) {
+  std::lock_guard<std::mutex> guard(data_lock);
+  const long long max_exact = 1LL << 53;
+  bool exact = true;
+
+  for (size_t i = 0; i < data.size() && exact; i++) {
+    exact = (data[i] <= max_exact && data[i] >= -max_exact);
+  }
+
+  timestamp_data.erase(field_name);
+  spilled.drop(field_name);
+  sent_rows.erase(field_name);
+
+  if (exact) {
+    map_data.erase(field_name);
+    std::vector<double> &numbers = number_data[field_name];
+    numbers.assign(data.begin(), data.end());
+    downsample(downsamplers, field_name, numbers);
+    count_pending(numbers.size(), numbers.size() * PENDING_NUMBER_BYTES);
+    return;
+  }
+
+  number_data.erase(field_name);
+  std::vector<std::string> &text = map_data[field_name];
+  text.clear();
+  text.reserve(data.size());
+
+  char buffer[NUMBER_BUFFER_SIZE];
+  for (size_t i = 0; i < data.size(); i++) {
+    text.push_back(std::string(buffer, format_integer(buffer, data[i])));
+  }
+  count_pending(data.size(), data.size() * PENDING_NUMBER_BYTES, data.size());
+}
+
+void iSENSE::push_timestamp(const std::string &field_name) {
+  push_timestamp(field_name, timestamp_now());
+}
+
+void iSENSE::push_timestamp(const std::string &field_name, long long nanoseconds) {
+  std::lock_guard<std::mutex> guard(data_lock);
+
+  std::map<std::string, downsampler>::iterator stage;
+  if (downsamplers.empty() || (stage = downsamplers.find(field_name)) == downsamplers.end()) {
+    add_time(field_name, nanoseconds);
+    return;
+  }
+
+  long long ready[DOWNSAMPLE_MAX_READY];
+  size_t count = stage->second.push(nanoseconds, ready);
+  for (size_t i = 0; i < count; i++) {
+    add_time(field_name, ready[i]);
+  }
+}
+
+// The window is rounded to a whole number of values.
+bool iSENSE::set_downsampling(std::string field_name, int method, double setting) {
+  bool windowed = (method == DOWNSAMPLE_MEAN || method == DOWNSAMPLE_MIN ||
+                   method == DOWNSAMPLE_MAX || method == DOWNSAMPLE_LTTB);
+
+  if (!windowed && method != DOWNSAMPLE_DEADBAND && method != DOWNSAMPLE_NONE) {
+    std::cerr << "\nError in method: set_downsampling()\n";
+    std::cerr << "Unknown downsampling method: " << method << "\n";
+    return false;
+  }
+  if ((windowed && !(setting >= 1)) || (method == DOWNSAMPLE_DEADBAND && !(setting >= 0))) {
+    std::cerr << "\nError in method: set_downsampling()\n";
+    std::cerr << "The window should be at least 1 and the deadband at least 0.\n";
     return false;
   }
 
-  fields = get_data.get("fields");      // Save the fields to the field array
-  fields_array = fields.get<array>();
+  std::lock_guard<std::mutex> guard(data_lock);
+
+  // Save what the old downsampler had waiting, so no values are lost.
+  std::map<std::string, downsampler>::iterator stage;
+  stage = downsamplers.find(field_name);
+
+  if (stage != downsamplers.end()) {
+    double numbers[DOWNSAMPLE_MAX_READY];
+    long long times[DOWNSAMPLE_MAX_READY];
+    bool has_times = stage->second.has_times();
+    size_t count = has_times ? stage->second.finish(times) : stage->second.finish(numbers);
+
+    for (size_t i = 0; i < count; i++) {
+      if (has_times) {
+        add_time(field_name, times[i]);
+      } else {
+        add_number(field_name, numbers[i]);
+      }
+    }
+    downsamplers.erase(stage);
+  }
+
+  if (method != DOWNSAMPLE_NONE) {
+    size_t window = windowed ? static_cast<size_t>(setting + 0.5) : 1;
+    downsamplers[field_name] = downsampler(method, window, windowed ? 0 : setting);
+  }
   return true;
 }
 
+double iSENSE::get_reduction_ratio(std::string field_name) {
+  std::lock_guard<std::mutex> guard(data_lock);
+  std::map<std::string, downsampler>::const_iterator stage;
+  stage = downsamplers.find(field_name);
+
+  if (stage == downsamplers.end()) {
+    return 1;
+  }
+  if (stage->second.values_out() == 0) {
+    return 0;
+  }
+  return static_cast<double>(stage->second.values_in()) / stage->second.values_out();
+}
+
+// Searches for projects with the search term.
+std::vector<std::string> iSENSE::get_projects_search(std::string search_term) {
+  get_URL = route(endpoints.get(), api_URL + "/projects?&search=" + search_term);
+  std::vector<std::string> project_titles;          // Vector of project titles.
+  http_code = get_data_funct(GET_NORMAL);           // get data off iSENSE.
+
+  // Check for errors. We need to get a code 200 for this method.
+  if( !check_http_code(http_code, "get_projects_search()") ) {
+    return project_titles;                            // Return an empty vector
+  }
+  value projects_json;
+
+  // Parse the JSON file, just like the main page of PicoJSON does.
+  std::string errors = parse_json(projects_json, json_str);
+
+  // If we have errors, print them out and quit.
+  if ( !errors.empty() ) {
+    std::cerr << "\nError in: get_projects_search(string search_term)";
+    std::cerr << "Error parsing JSON file.\n";
+    std::cerr << "Error was: " << errors << "\n";
+    return project_titles;                            // Return an empty vector
+  }
+  // Convert the JSON array (projects_json) into a vector of project title strings
+  array projects_array = projects_json.get<array>();
+  array::iterator it, the_begin, the_end;
+  the_begin = projects_array.begin();
+  the_end = projects_array.end();
+
+  // Check and see if the projects_title JSON array is empty
+  if (the_begin == the_end) {
+    std::cerr << "\nError in: get_projects_search(string search_term) \n";
+    std::cerr << "Project title array is empty.\n";
+    return project_titles;                            // Return an empty vector
+  }
+
+  for (it = projects_array.begin(); it != projects_array.end(); it++) {
+    object obj = it->get<object>();                       // Get the current obj
+    std::string name = obj["name"].get<std::string>();    // Grab the field name
+    project_titles.push_back(name);                       // Add to the vector.
+  }
+  return project_titles;                    // Return a vector of project titles
+}
+
+// Checks the email / password with iSENSE (or the credential cache).
+bool iSENSE::get_check_user() {
+  if (email == EMPTY || email.empty()) {
+    std::cerr << "\nPlease set an email for this project.\n";
+    return false;
+  } else if (password == EMPTY || password.empty()) {
+    std::cerr << "\nPlease set a password for this project.\n";
+    return false;
+  }
+
+  // Use the cached answer, or wait for another object that's asking.
+  std::string key = credential_key(api_URL, email, password);
+  bool cache = false;
+  {
+    std::unique_lock<std::mutex> guard(credential_lock);
+    std::map<std::string, credential_check>::iterator check;
+
+    while ((check = credential_cache.find(key)) != credential_cache.end() &&
+           check->second.checking) {
+      credential_checked.wait(guard);
+    }
+    if (check != credential_cache.end() &&
+        std::chrono::steady_clock::now() < check->second.expires) {
+      http_code = check->second.http_code;
+      return check->second.valid;
+    }
+    if (credential_ttl > 0) {
+      credential_cache[key].checking = true;
+      cache = true;
+    }
+  }
+
+  get_URL = route(endpoints.get(),
+                  api_URL + "/users/myInfo?email=" + email + "&password=" + password);
+  http_code = get_data_funct(GET_QUIET);         // quietly get data off iSENSE.
+  bool valid = (http_code == HTTP_AUTHORIZED);
+
+  if (cache) {
+    std::lock_guard<std::mutex> guard(credential_lock);
+    credential_check &check = credential_cache[key];
+    check.checking = false;
+
+    // Only answers from iSENSE are kept, not network errors.
+    if (valid || http_code == HTTP_UNAUTHORIZED) {
+      check.valid = valid;
+      check.http_code = http_code;
+      check.expires = std::chrono::steady_clock::now() + std::chrono::seconds(credential_ttl);
+    } else {
+      credential_cache.erase(key);
+    }
+    credential_checked.notify_all();
+  }
+  return valid;
+}
+
+// 0 turns the cache off, and empties it.
+void iSENSE::set_credential_cache_ttl(long seconds) {
+  std::lock_guard<std::mutex> guard(credential_lock);
+  credential_ttl = seconds < 0 ? 0 : seconds;
+
+  if (credential_ttl == 0) {
+    std::map<std::string, credential_check>::iterator check = credential_cache.begin();
+    while (check != credential_cache.end()) {
+      if (check->second.checking) {
+        check++;                    // Removed by the object asking
+      } else {
+        credential_cache.erase(check++);
+      }
+    }
+  }
+}
+
+void iSENSE::forget_credentials() {
+  std::lock_guard<std::mutex> guard(credential_lock);
+  std::map<std::string, credential_check>::iterator check;
+  check = credential_cache.find(credential_key(api_URL, email, password));
+
+  if (check != credential_cache.end() && !check->second.checking) {
+    credential_cache.erase(check);
+  }
+}
+
+bool iSENSE::get_project_fields() {
+  call_scope scope(this, *limits);
+  if (!fields_request()) {
+    return false;
+  }
+
+  shared_project project = load_project(get_URL, parse_backend, context(),
+                                        "get_projects_fields()");
+  if (!project) {
+    return false;
+  }
+  get_data = *project;
+  return save_project_fields();
+}
+
+shared_project iSENSE::load_project(std::string url, int backend,
+                                    request_context context, std::string method) {
+  // Use the cached project, or wait for another object that's getting it.
+  std::shared_future<shared_project> cached;
+  project_claim claim;
+
+  if (find_project(url, cached, claim)) {
+    shared_project project = cached.get();
+    if (!project) {
+      std::cerr << "\nError in method: " << method << "\n";
+      std::cerr << "Request **failed** (" << url << ")\n";
+    }
+    return project;
+  }
+
+  // get data off iSENSE.
+  std::string json;
+  long code = CURL_ERROR;
+  CURL *handle = curl_easy_init();
+  if (handle) {
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &json);
+
+    CURLcode result = perform(context, handle, url, &json, true);
+    if (result != CURLE_OK) {
+      fprintf(stderr, "curl_easy_perform() failed in get_data(): %s\n",
+              curl_easy_strerror(result));
+    }
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_cleanup(handle);
+  }
+
+  // Check for errors. We need to get a code 200 for this method.
+  std::shared_ptr<value> project;
+  if (check_http_code(code, method)) {
+    project = std::make_shared<value>();
+    std::string errors = backend == PARSE_FAST ? fast_parse(*project, json)
+                                               : parse(*project, json);
+    if (!errors.empty()) {
+      std::cerr << "\nError parsing JSON file in method: " << method << "\n";
+      std::cerr << "Error was: " << errors;
+      project.reset();
+    } else if (!is_project(*project)) {
+      std::cerr << "\nError in method: " << method << "\n";
+      std::cerr << "The project JSON does not contain a fields array.\n";
+      project.reset();
+    }
+  }
+
+  claim.finish(project);
+  return project;
+}
+
+// The transfers run at the same time on one curl multi handle, which keeps
+// the connections open between them (and multiplexes them over HTTP/2).
+bool iSENSE::prefetch_projects(std::vector<std::string> project_IDs) {
+  struct transfer {
+    std::string url, json;
+    CURL *handle;
+    project_claim claim;
+    request_watch watch;
+  };
+  std::vector<transfer> transfers(project_IDs.size());
+  std::vector<std::shared_future<shared_project> > others;
+  call_scope scope(this, *limits);
+  bool ok = true;
+
+  bool cache_on;
+  {
+    std::lock_guard<std::mutex> guard(project_lock);
+    cache_on = project_ttl > 0;
+  }
+  if (!cache_on) {
+    std::cerr << "\nError in method: prefetch_projects()\n";
+    std::cerr << "The project cache is off, call set_project_cache_ttl() first.\n";
+    return false;
+  }
+
+  CURLM *multi = curl_multi_init();
+  if (multi == NULL) {
+    std::cerr << "\nError in method: prefetch_projects()\n";
+    std::cerr << "Curl failed for some unknown reason.\n";
+    return false;
+  }
+  curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, PREFETCH_CONNECTIONS);
+#ifdef CURLPIPE_MULTIPLEX
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+  for (size_t i = 0; i < project_IDs.size(); i++) {
+    transfer &t = transfers[i];
+    t.url = api_URL + "/projects/" + project_IDs[i];
+    t.handle = NULL;
+
+    // Projects being fetched (maybe earlier in this list) are waited for
+    // once ours are done.
+    std::shared_future<shared_project> found;
+    if (find_project(t.url, found, t.claim)) {
+      others.push_back(found);
+      continue;
+    }
+
+    t.handle = curl_easy_init();
+    if (t.handle == NULL) {
+      std::cerr << "\nError in method: prefetch_projects()\n";
+      std::cerr << "Curl failed for some unknown reason.\n";
+      t.claim.finish(shared_project());
+      ok = false;
+      continue;
+    }
+    std::string target = route(endpoints.get(), t.url);
+    curl_easy_setopt(t.handle, CURLOPT_URL, target.c_str());
+    curl_easy_setopt(t.handle, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+    curl_easy_setopt(t.handle, CURLOPT_WRITEDATA, &t.json);
+    if (transport) {
+      curl_easy_setopt(t.handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2_0);
+      curl_easy_setopt(t.handle, CURLOPT_PIPEWAIT, 1L);
+    }
+    t.watch.limits = limits.get();
+    if (!limit_request(t.handle, t.watch)) {
+      curl_easy_cleanup(t.handle);
+      t.handle = NULL;
+      t.claim.finish(shared_project());
+      ok = false;
+      continue;
+    }
+    curl_multi_add_handle(multi, t.handle);
+  }
+
+  // Each project is parsed and handed out as soon as it arrives.
+  int running = 1;
+  while (running > 0) {
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *message;
+    int left;
+    while ((message = curl_multi_info_read(multi, &left)) != NULL) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+
+      size_t i = 0;
+      while (transfers[i].handle != message->easy_handle) {
+        i++;
+      }
+      transfer &t = transfers[i];
+
+      long code = 0;
+      curl_easy_getinfo(t.handle, CURLINFO_RESPONSE_CODE, &code);
+      count_timeout(message->data.result, limits.get());
+      std::shared_ptr<value> project = std::make_shared<value>();
+
+      if (message->data.result != CURLE_OK || code != HTTP_AUTHORIZED ||
+          !parse_json(*project, t.json).empty() || !is_project(*project)) {
+        std::cerr << "\nError in method: prefetch_projects()\n";
+        std::cerr << "Unable to get project " << project_IDs[i]
+                  << " (HTTP code " << code << ")\n";
+        project.reset();
+        ok = false;
+      }
+      t.claim.finish(project);
+
+      curl_multi_remove_handle(multi, t.handle);
+      curl_easy_cleanup(t.handle);
+      t.handle = NULL;
+    }
+
+    if (running > 0) {
+      curl_multi_wait(multi, NULL, 0, 1000, NULL);
+    }
+  }
+  curl_multi_cleanup(multi);
+
+  for (size_t i = 0; i < others.size(); i++) {
+    if (!others[i].get()) {
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// 0 turns the cache off, and empties it (fetches still running finish).
+void iSENSE::set_project_cache_ttl(long seconds) {
+  std::lock_guard<std::mutex> guard(project_lock);
+  project_ttl = seconds < 0 ? 0 : seconds;
+
+  if (project_ttl == 0) {
+    std::map<std::string, project_fetch>::iterator cached = project_cache.begin();
+    while (cached != project_cache.end()) {
+      if (cached->second.expires == std::chrono::steady_clock::time_point::max()) {
+        cached++;
+      } else {
+        project_cache.erase(cached++);
+      }
+    }
+  }
+}
+
 bool iSENSE::get_datasets_and_mediaobjects() {
+  call_scope scope(this, *limits);
   // Check that the project ID is set properly.
   // When the ID is set, the fields are also pulled down as well.
   if (project_ID == EMPTY || project_ID.empty()) {
@@ -239,7 +1523,8 @@ bool iSENSE::get_datasets_and_mediaobjects() {
 
   // The "?recur=true" will make iSENSE return:
   // ALL datasets in that project and ALL media objects in that project
-  get_URL = devURL + "/projects/" + project_ID + "?recur=true";
+  wait_for_fields();         // So they don't replace the fields saved below
+  get_URL = project_URL + "?recur=true";
   http_code = get_data_funct(GET_NORMAL);           // get data off iSENSE.
 
   // Check for errors. We need to get a code 200 for this method.
@@ -247,31 +1532,307 @@ bool iSENSE::get_datasets_and_mediaobjects() {
     return false;                            // Return an empty vector
   }
 
+  return parse_datasets_and_mediaobjects(json_str);
+}
+
+// Parse the JSON of a project (with ?recur=true) and save the fields,
+// datasets, media objects and owner info.
+bool iSENSE::parse_datasets_and_mediaobjects(std::string project_json) {
   // Parse the JSON file, just like the main page of PicoJSON does.
-  std::string errors = parse(get_data, json_str);
+  std::string errors = parse_json(get_data, project_json);
 
   if ( !errors.empty() ) {   // If we have errors, print them out and quit.
     std::cerr << "\nError in method: get_datasets_and_mediaobjects()\n";
     std::cerr << "Parsing JSON file failed. Error was: " << errors;
     return false;
   }
+
+  // Make sure we got a whole project back before saving its arrays.
+  if ( !get_data.is<object>() || !get_data.get("fields").is<array>() ||
+       !get_data.get("dataSets").is<array>() ) {
+    std::cerr << "\nError in method: get_datasets_and_mediaobjects()\n";
+    std::cerr << "The project JSON does not contain fields and datasets.\n";
+    return false;
+  }
+
   fields = get_data.get("fields");        // Save the fields to the field array
   fields_array = fields.get<array>();
+  save_field_IDs();
+  save_upload_encodings();
 
   value temp = get_data.get("dataSets");  // Save the datasets to the datasets array
   data_sets = temp.get<array>();
+  data_sets_URL = project_URL;            // Whose they are, for get_all_datasets
 
   temp = get_data.get("mediaObjects");    // Save the media objs to the media objs array
-  media_objects = temp.get<array>();
+  if (temp.is<array>()) {
+    media_objects = temp.get<array>();
+  }
 
   temp = get_data.get("owner");           // Save the owner info.
-  owner_info = temp.get<object>();
+  if (temp.is<object>()) {
+    owner_info = temp.get<object>();
+  }
+
+  return true;
+}
+
+std::vector<media_object> iSENSE::get_media_objects() {
+  call_scope scope(this, *limits);
+  std::vector<media_object> media;
+
+  if (!get_datasets_and_mediaobjects()) {
+    std::cerr << "\n\nError in method: get_media_objects()\n";
+    std::cerr << "Failed to get datasets and media objects.\n";
+    return media;
+  }
+
+  // Media URLs can be relative to the server (not the API).
+  std::string server = api_URL.substr(0, api_URL.rfind("/api/"));
+
+  for (array::iterator it = media_objects.begin(); it != media_objects.end(); it++) {
+    if (!it->is<object>()) {
+      continue;
+    }
+    // get() (unlike operator[]) doesn't add the members that are missing.
+    const value &obj = *it;
+    media_object current;
+    current.ID = obj.get("id").to_str();
+    current.name = obj.get("name").is<std::string>() ? obj.get("name").get<std::string>() : "";
+    current.type = obj.get("mediaType").is<std::string>() ?
+                   obj.get("mediaType").get<std::string>() : "";
+    current.URL = obj.get("src").is<std::string>() ? obj.get("src").get<std::string>() :
+                  obj.get("url").is<std::string>() ? obj.get("url").get<std::string>() : "";
+    if (!obj.get("dataSetId").is<picojson::null>()) {
+      current.dataset_ID = obj.get("dataSetId").to_str();
+    }
+    if (!current.URL.empty() && current.URL[0] == '/') {
+      current.URL = server + current.URL;
+    }
+    media.push_back(current);
+  }
+  return media;
+}
+
+bool iSENSE::upload_media(std::string path, int post_type, std::string dataset_name) {
+  call_scope scope(this, *limits);
+  if (post_type != POST_KEY && post_type != POST_EMAIL) {
+    std::cerr << "\nError in method: upload_media()\n";
+    std::cerr << "post_type should be POST_KEY or POST_EMAIL.\n";
+    return false;
+  }
+  if (!empty_project_check(post_type, "upload_media()", false)) {
+    return false;
+  }
+
+  std::string type = "project", ID = project_ID;
+  if (!dataset_name.empty()) {
+    if (!get_datasets_and_mediaobjects()) {
+      std::cerr << "\nError in method: upload_media()\n";
+      std::cerr << "Failed to get datasets and media objects.\n";
+      return false;
+    }
+    ID = get_dataset_ID(dataset_name);
+    if (ID == GET_ERROR) {
+      return false;
+    }
+    type = "data_set";
+  }
+
+  mapped_file file;
+  if (!file.open(path, true)) {
+    return false;
+  }
+  media_source source = {file.data(), file.size(), 0};
+  std::string name = path.substr(path.find_last_of("/\\") + 1);
+
+  CURL *handle = curl_easy_init();
+  if (!handle) {
+    return check_http_code(CURL_ERROR, "upload_media()");
+  }
+
+  curl_mime *form = curl_mime_init(handle);
+  add_form_part(form, "type", type);
+  add_form_part(form, "id", ID);
+  if (post_type == POST_KEY) {
+    add_form_part(form, "contribution_key", contributor_key);
+    add_form_part(form, "contributor_name", contributor_label);
+  } else {
+    add_form_part(form, "email", email);
+    add_form_part(form, "password", password);
+  }
+
+  // The file is read as it is sent.
+  curl_mimepart *upload = curl_mime_addpart(form);
+  curl_mime_name(upload, "upload");
+  curl_mime_filename(upload, name.c_str());
+  curl_mime_data_cb(upload, file.size(), &read_media, &seek_media, NULL, &source);
+
+  std::string media_URL = route(endpoints.get(), api_URL + "/media_objects");
+  curl_easy_setopt(handle, CURLOPT_MIMEPOST, form);
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA, &post_response);
+
+  CURLcode result = perform(context(), handle, media_URL, &post_response, false);
+  long code = CURL_ERROR;
+  if (result == CURLE_OK) {
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+  } else {
+    fprintf(stderr, "curl_easy_perform() failed in upload_media(): %s\n",
+            curl_easy_strerror(result));
+  }
+  curl_mime_free(form);
+  curl_easy_cleanup(handle);
+
+  // The password may have changed, so check it again next time.
+  if (code == HTTP_UNAUTHORIZED && post_type == POST_EMAIL) {
+    forget_credentials();
+  }
+  return check_http_code(code, "upload_media()");
+}
+
+bool iSENSE::download_media(const media_object &media, int fd) {
+  call_scope scope(this, *limits);
+  CURL *handle = media_request(media.URL, &fd, static_cast<bool>(transport));
+  if (!handle) {
+    return check_http_code(CURL_ERROR, "download_media()");
+  }
+
+  CURLcode result = perform(context(), handle, media.URL, NULL, true);
+  curl_easy_cleanup(handle);
 
+  if (result != CURLE_OK) {
+    std::cerr << "\nError in method: download_media()\n";
+    std::cerr << "Unable to download media object " << media.ID << ": "
+              << curl_easy_strerror(result) << "\n";
+    return false;
+  }
   return true;
 }
 
+// Like prefetch_projects, the downloads share the connections of one curl
+// multi handle. A server that doesn't do range requests (or a .part file
+// that is already whole) makes the download start over.
+bool iSENSE::download_media(const std::vector<media_object> &media, std::string directory) {
+  call_scope scope(this, *limits);
+  struct transfer {
+    std::string path;
+    int fd;
+    CURL *handle;
+    curl_off_t resume;
+    request_watch watch;
+  };
+  std::vector<transfer> transfers(media.size());
+
+  CURLM *multi = curl_multi_init();
+  if (multi == NULL) {
+    return check_http_code(CURL_ERROR, "download_media()");
+  }
+  curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, MEDIA_TRANSFERS);
+#ifdef CURLPIPE_MULTIPLEX
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+  bool ok = true;
+  for (size_t i = 0; i < media.size(); i++) {
+    transfer &t = transfers[i];
+    std::string name = media[i].ID + "_" + media[i].name;
+    std::replace(name.begin(), name.end(), '/', '_');
+    std::replace(name.begin(), name.end(), '\\', '_');
+    t.path = directory + "/" + name;
+    t.fd = -1;
+    t.handle = NULL;
+
+    if (std::ifstream(t.path.c_str()).good()) {
+      continue;                             // Downloaded already
+    }
+    t.fd = open_part(t.path + ".part");
+    if (t.fd < 0) {
+      std::cerr << "\nError in method: download_media()\n";
+      std::cerr << "Unable to write to " << t.path << ".part\n";
+      ok = false;
+      continue;
+    }
+    t.resume = end_of(t.fd);
+
+    t.handle = media_request(media[i].URL, &t.fd, static_cast<bool>(transport));
+    if (t.handle == NULL) {
+      check_http_code(CURL_ERROR, "download_media()");
+      close_part(t.fd);
+      ok = false;
+      continue;
+    }
+    curl_easy_setopt(t.handle, CURLOPT_RESUME_FROM_LARGE, t.resume);
+    t.watch.limits = limits.get();
+    if (!limit_request(t.handle, t.watch)) {
+      curl_easy_cleanup(t.handle);
+      close_part(t.fd);
+      t.handle = NULL;
+      ok = false;
+      continue;
+    }
+    curl_multi_add_handle(multi, t.handle);
+  }
+
+  int running = 1;
+  while (running > 0) {
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *message;
+    int left;
+    while ((message = curl_multi_info_read(multi, &left)) != NULL) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+
+      size_t i = 0;
+      while (transfers[i].handle != message->easy_handle) {
+        i++;
+      }
+      transfer &t = transfers[i];
+
+      CURLcode result = count_timeout(message->data.result, limits.get());
+      long code = 0;
+      curl_easy_getinfo(t.handle, CURLINFO_RESPONSE_CODE, &code);
+      curl_multi_remove_handle(multi, t.handle);
+
+      if (t.resume > 0 && (result == CURLE_RANGE_ERROR || code == HTTP_RANGE_NOT_SATISFIABLE)) {
+        if (empty_part(t.fd)) {
+          t.resume = 0;
+          curl_easy_setopt(t.handle, CURLOPT_RESUME_FROM_LARGE, t.resume);
+          curl_multi_add_handle(multi, t.handle);
+          running++;
+          continue;
+        }
+      }
+
+      close_part(t.fd);
+      if (result == CURLE_OK && replace_file(t.path + ".part", t.path)) {
+        curl_easy_cleanup(t.handle);
+        t.handle = NULL;
+        continue;
+      }
+
+      // The .part file is kept, so the next try carries on from there.
+      std::cerr << "\nError in method: download_media()\n";
+      std::cerr << "Unable to download media object " << media[i].ID << ": "
+                << curl_easy_strerror(result) << "\n";
+      curl_easy_cleanup(t.handle);
+      t.handle = NULL;
+      ok = false;
+    }
+
+    if (running > 0) {
+      curl_multi_wait(multi, NULL, 0, 1000, NULL);
+    }
+  }
+  curl_multi_cleanup(multi);
+  return ok;
+}
+
 std::vector<std::string> iSENSE::get_dataset(std::string dataset_name,
                                              std::string field_name) {
+  call_scope scope(this, *limits);
   std::vector<std::string> vector_data;
 
   // Make sure a valid project ID has been set
@@ -287,7 +1848,13 @@ std::vector<std::string> iSENSE::get_dataset(std::string dataset_name,
     std::cerr << "Failed to get datasets.\n";
     return vector_data;
   }
+  return read_dataset(dataset_name, field_name);
+}
 
+// Shared with async_iSENSE::get_dataset, which pulls the datasets down first.
+std::vector<std::string> iSENSE::read_dataset(std::string dataset_name,
+                                              std::string field_name) {
+  std::vector<std::string> vector_data;
   array::iterator it, the_begin, the_end;
   the_begin = data_sets.begin();
   the_end = data_sets.end();
@@ -309,373 +1876,2911 @@ std::vector<std::string> iSENSE::get_dataset(std::string dataset_name,
     return vector_data;   // this is an empty vector
   }
 
-  // This outer for loop is for going through all datasets in the project
-  for (it = data_sets.begin(); it != data_sets.end(); it++) {
-    object obj = it->get<object>();         // Get the current object
-    std::string id = obj["id"].to_str();    // Get that object's dataset ID
-
-    // If we have the right object, we can now start looking for the data array
-    if (id == dataset_ID) {
-      // obtain a const reference to the map (as seen on picoJSON github page)
-      const object& cur_obj = it->get<object>();
-
-      // This basically lets us iterate through the current object
-      for (object::const_iterator i = cur_obj.begin(); i != cur_obj.end(); i++) {
-        if (i->first == "data") {   // When we get here, we've found the data array! WOO HOO!
-          array dataset_list = i->second.get<array>();
-
-          // Go through the array and push_back data points for the given field name
-          for (array::iterator iter = dataset_list.begin(); iter != dataset_list.end(); iter++) {
-            object tmp_obj = iter->get<object>();               // Temp obj to
-            std::string data_pt = tmp_obj[field_ID].to_str();   // get data point.
-            vector_data.push_back(data_pt);                     // finally push_back.
-          }
-          return vector_data;   // Return the vector of data for the given field name.
-        }
-      }
-    }
+  // This outer for loop is for going through all datasets in the project.
+  // Everything is read through const references, the datasets can be big.
+  for (it = data_sets.begin(); it != data_sets.end(); it++) {
+    if (!it->is<object>() || it->get("id").to_str() != dataset_ID) {
+      continue;
+    }
+
+    // obtain a const reference to the map (as seen on picoJSON github page)
+    const object& cur_obj = it->get<object>();
+    object::const_iterator data = cur_obj.find("data");
+
+    if (data != cur_obj.end() && data->second.is<array>()) {  // Found the data array!
+      const array &dataset_list = data->second.get<array>();
+      vector_data.reserve(dataset_list.size());
+
+      // Go through the array and push_back data points for the given field name
+      for (array::const_iterator iter = dataset_list.begin(); iter != dataset_list.end(); iter++) {
+        vector_data.push_back(iter->get(field_ID).to_str());
+      }
+      return vector_data;   // Return the vector of data for the given field name.
+    }
+  }
+  std::cerr << "\n\nError in method: get_dataset(string, string)\n";
+  std::cerr << "Failed to get dataset. \n";
+  std::cerr << "Check the following & make sure they are correct:\n";
+  std::cerr << "field name, dataset name, project ID\n";
+
+  return vector_data;     // This should be empty, or may not contain all the data.
+}
+
+// Picks a query's rows as they go by (see dataset_query). Rows are numbered
+// however the caller likes: positions in the JSON or indexes in an array.
+struct row_picker {
+  bool window;
+  long long start, end;
+  size_t offset, limit, last;
+  size_t matched;                 // Rows inside the window so far
+  std::deque<size_t> picked;
+
+  row_picker(const dataset_query &query, bool window)
+    : window(window), start(query.start), end(query.end), offset(query.offset),
+      limit(query.limit), last(query.last), matched(0) {}
+
+  // Adds the next row (time is only used with a window). Returns false
+  // once none of the rows after it can be picked.
+  bool add(size_t row, bool has_time, long long time) {
+    if (window && (!has_time || time < start || time >= end)) {
+      return true;
+    }
+    size_t index = matched++;
+
+    if (last > 0) {
+      picked.push_back(row);
+      if (picked.size() > last) {
+        picked.pop_front();
+      }
+      return true;
+    }
+    if (index < offset) {
+      return true;
+    }
+    picked.push_back(row);
+    return limit == 0 || index + 1 < offset + limit;
+  }
+};
+
+std::vector<std::string> iSENSE::get_dataset(std::string dataset_name, std::string field_name,
+                                             const dataset_query &query) {
+  call_scope scope(this, *limits);
+  std::vector<std::string> vector_data;
+
+  if (project_ID == EMPTY || project_ID.empty()) {
+    std::cerr << "\n\nError in method: get_dataset(string, string, query)\n";
+    std::cerr << "Please set a project ID!\n";
+    return vector_data;
+  }
+
+  // The project page has the fields, and lists the datasets without their data.
+  wait_for_fields();
+  get_URL = project_URL;
+  http_code = get_data_funct(GET_NORMAL);
+  if (!check_http_code(http_code, "get_dataset()")) {
+    return vector_data;
+  }
+  std::string errors = parse_json(get_data, json_str);
+  if (!errors.empty() || !is_project(get_data)) {
+    std::cerr << "\n\nError in method: get_dataset(string, string, query)\n";
+    std::cerr << "The project JSON does not contain a fields array.\n";
+    return vector_data;
+  }
+  save_project_fields();
+
+  std::string field_ID = get_field_ID(field_name);
+  std::string time_ID = query.time_field.empty() ? "" : get_field_ID(query.time_field);
+  if (field_ID == GET_ERROR || time_ID == GET_ERROR) {
+    std::cerr << "\n\nError in method: get_dataset(string, string, query)\n";
+    std::cerr << "Check the field names are correct.\n";
+    return vector_data;
+  }
+  row_picker picker(query, !time_ID.empty());
+  long long time = 0;
+
+  if (!get_data.get("dataSets").is<array>()) {
+    if (!get_datasets_and_mediaobjects()) {
+      std::cerr << "\n\nError in method: get_dataset(string, string, query)\n";
+      std::cerr << "Failed to get datasets.\n";
+      return vector_data;
+    }
+
+    std::string dataset_ID = find_dataset_ID(dataset_name);
+    for (array::const_iterator it = data_sets.begin(); it != data_sets.end(); it++) {
+      if (!it->is<object>() || it->get("id").to_str() != dataset_ID ||
+          !it->get("data").is<array>()) {
+        continue;
+      }
+      const array &rows = it->get("data").get<array>();
+
+      for (size_t row = 0; row < rows.size(); row++) {
+        std::string text = picker.window ? rows[row].get(time_ID).to_str() : "";
+        bool has_time = picker.window && parse_timestamp(text.data(), text.size(), time);
+        if (!picker.add(row, has_time, time)) {
+          break;
+        }
+      }
+      for (size_t i = 0; i < picker.picked.size(); i++) {
+        vector_data.push_back(rows[picker.picked[i]].get(field_ID).to_str());
+      }
+      return vector_data;
+    }
+    std::cerr << "\n\nError in method: get_dataset(string, string, query)\n";
+    std::cerr << "Failed to find the dataset name in project # " << project_ID << "\n";
+    return vector_data;
+  }
+
+  std::string dataset_ID;
+  const array &listing = get_data.get("dataSets").get<array>();
+  for (size_t i = 0; i < listing.size() && dataset_ID.empty(); i++) {
+    if (listing[i].is<object>() && listing[i].get("name").to_str() == dataset_name) {
+      dataset_ID = listing[i].get("id").to_str();
+    }
+  }
+  if (dataset_ID.empty()) {
+    std::cerr << "\n\nError in method: get_dataset(string, string, query)\n";
+    std::cerr << "Failed to find the dataset name in project # " << project_ID << "\n";
+    return vector_data;
+  }
+
+  // Whatever the server can do is sent along. The rows are counted after the
+  // window, so they can only be sent if the window is too.
+  bool send_fields = false, send_window = false, send_rows = false;
+  const value &queries = get_data.get("dataQueries");
+  for (size_t i = 0; queries.is<array>() && i < queries.get<array>().size(); i++) {
+    std::string name = queries.get<array>()[i].to_str();
+    send_fields = send_fields || name == QUERY_FIELDS;
+    send_window = send_window || name == QUERY_WINDOW;
+    send_rows = send_rows || name == QUERY_ROWS;
+  }
+  send_window = send_window && picker.window;
+  send_rows = send_rows && (send_window || !picker.window);
+
+  get_URL = route(endpoints.get(), api_URL + "/data_sets/" + dataset_ID + "?recur=true");
+  if (send_fields) {
+    get_URL += "&fields=" + field_ID + (picker.window && !send_window ? "," + time_ID : "");
+  }
+  if (send_window) {
+    char buffer[TIMESTAMP_BUFFER_SIZE];
+    get_URL += "&time_field=" + time_ID;
+    if (query.start != LLONG_MIN) {
+      get_URL += "&start=" + std::string(buffer, format_timestamp(buffer, query.start, 9));
+    }
+    if (query.end != LLONG_MAX) {
+      get_URL += "&end=" + std::string(buffer, format_timestamp(buffer, query.end, 9));
+    }
+    picker.window = false;
+  }
+  if (send_rows) {
+    if (query.last > 0) {
+      get_URL += "&last=" + std::to_string((unsigned long long) query.last);
+    } else {
+      get_URL += "&offset=" + std::to_string((unsigned long long) query.offset);
+      if (query.limit > 0) {
+        get_URL += "&limit=" + std::to_string((unsigned long long) query.limit);
+      }
+    }
+    picker.offset = picker.limit = picker.last = 0;
+  }
+
+  http_code = get_data_funct(GET_NORMAL);
+  if (!check_http_code(http_code, "get_dataset()")) {
+    return vector_data;
+  }
+
+  // Only the time of each row is read on the way through, and only the
+  // picked rows' values are parsed.
+  const std::string &json = json_str;
+  bool scanned = scan_rows(json, [&](size_t row) {
+    size_t begin, end;
+    bool has_time = picker.window && find_member(json, row, time_ID, begin, end) &&
+                    json[begin] == '"' &&
+                    parse_timestamp(json.data() + begin + 1, end - begin - 2, time);
+    return picker.add(row, has_time, time);
+  });
+  if (!scanned) {
+    std::cerr << "\n\nError in method: get_dataset(string, string, query)\n";
+    std::cerr << "The dataset JSON does not contain a data array.\n";
+    return vector_data;
+  }
+
+  vector_data.reserve(picker.picked.size());
+  for (size_t i = 0; i < picker.picked.size(); i++) {
+    size_t begin, end;
+    value data;
+    if (find_member(json, picker.picked[i], field_ID, begin, end)) {
+      parse(data, json.begin() + begin, json.begin() + end, &errors);
+    }
+    vector_data.push_back(data.to_str());
+  }
+  return vector_data;
+}
+
+dataset_table iSENSE::get_all_datasets(std::vector<std::string> field_names) {
+  call_scope scope(this, *limits);
+  dataset_table table;
+
+  // Pull down the datasets if we don't have this project's yet.
+  if ((data_sets.empty() || data_sets_URL != project_URL) && !get_datasets_and_mediaobjects()) {
+    std::cerr << "\n\nError in method: get_all_datasets()\n";
+    std::cerr << "Failed to get datasets.\n";
+    return table;
+  }
+
+  // No field names means all of the fields.
+  if (field_names.empty()) {
+    for (size_t i = 0; i < fields_array.size(); i++) {
+      field_names.push_back(field_name_of(fields_array[i]));
+    }
+  }
+
+  // Set up one column per field.
+  for (size_t i = 0; i < field_names.size(); i++) {
+    size_t field = 0;
+
+    while (field < fields_array.size() &&
+           field_name_of(fields_array[field]) != field_names[i]) {
+      field++;
+    }
+    if (field == fields_array.size()) {
+      std::cerr << "\n\nError in method: get_all_datasets()\n";
+      std::cerr << "Unable to find the field: " << field_names[i] << "\n";
+      table.columns.clear();
+      return table;
+    }
+
+    table.columns.push_back(field_column(field));
+  }
+
+  // Find where each dataset's rows start, so every thread knows where
+  // to put its rows and the columns can be allocated up front.
+  std::vector<const array *> rows;
+  size_t total_rows = 0;
+
+  for (array::const_iterator it = data_sets.begin(); it != data_sets.end(); it++) {
+    if (!it->is<object>()) {
+      std::cerr << "\n\nError in method: get_all_datasets()\n";
+      std::cerr << "The project's datasets aren't all JSON objects.\n";
+      table.columns.clear();
+      return table;
+    }
+
+    const object &obj = it->get<object>();
+    object::const_iterator data = obj.find("data");
+
+    table.dataset_IDs.push_back(it->get("id").to_str());
+    table.dataset_names.push_back(it->get("name").to_str());
+    table.dataset_starts.push_back(total_rows);
+
+    if (data != obj.end() && data->second.is<array>()) {
+      rows.push_back(&data->second.get<array>());
+      total_rows += rows.back()->size();
+    } else {
+      rows.push_back(NULL);       // Dataset without any data.
+    }
+  }
+  table.dataset_starts.push_back(total_rows);
+
+  for (size_t i = 0; i < table.columns.size(); i++) {
+    dataset_column &column = table.columns[i];
+
+    if (column.field_type == FIELD_TEXT || column.field_type == FIELD_TIMESTAMP) {
+      column.text.resize(total_rows);
+    } else {
+      column.numbers.assign(total_rows, NAN);
+    }
+  }
+
+  // Big datasets are split into pieces, so the threads can share the work.
+  const size_t rows_per_task = 4096;
+  thread_pool pool(thread_count);
+
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (rows[i] == NULL) {
+      continue;
+    }
+    for (size_t first = 0; first < rows[i]->size(); first += rows_per_task) {
+      size_t last = std::min(first + rows_per_task, rows[i]->size());
+      size_t table_row = table.dataset_starts[i] + first;
+      const array *dataset = rows[i];
+
+      pool.submit([dataset, first, last, table_row, &table]() {
+        extract_rows(*dataset, first, last, table_row, table);
+      });
+    }
+  }
+  pool.wait();
+
+  return table;
+}
+
+bool iSENSE::export_datasets(std::string path, std::vector<std::string> field_names) {
+  call_scope scope(this, *limits);
+  dataset_table table = get_all_datasets(field_names);
+
+  if (table.columns.empty()) {
+    std::cerr << "\n\nError in method: export_datasets()\n";
+    std::cerr << "No data to export.\n";
+    return false;
+  }
+  return write_columnar_file(path, table);
+}
+
+// A dataset's signature, for sync_datasets: a 64 bit FNV-1a hash of its
+// listing on the project page, in hex.
+static std::string dataset_signature(const value &dataset) {
+  std::string listing = dataset.serialize();
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < listing.size(); i++) {
+    hash = (hash ^ static_cast<unsigned char>(listing[i])) * 1099511628211ULL;
+  }
+
+  char hex[17];
+  snprintf(hex, sizeof hex, "%016llx", hash);
+  return hex;
+}
+
+// The manifest is "project ID" and then "dataset_ID signature" per line.
+static bool read_manifest(const std::string &path, const std::string &project_ID,
+                          std::map<std::string, std::string> &signatures) {
+  std::ifstream file(path.c_str());
+  std::string word, ID, signature;
+
+  if (!(file >> word >> ID) || word != "project" || ID != project_ID) {
+    return false;
+  }
+  while (file >> ID >> signature) {
+    signatures[ID] = signature;
+  }
+  return true;
+}
+
+bool iSENSE::sync_datasets(std::string path, sync_counts *counts) {
+  call_scope scope(this, *limits);
+  if (project_ID == EMPTY || project_ID.empty()) {
+    std::cerr << "\nError in method: sync_datasets()\n";
+    std::cerr << "\nPlease set a project ID!\n";
+    return false;
+  }
+
+  // Servers that don't list the datasets on the project page are asked for
+  // all of the data, which is used as it is.
+  wait_for_fields();
+  get_URL = project_URL;
+  http_code = get_data_funct(GET_NORMAL);
+  if (!check_http_code(http_code, "sync_datasets()")) {
+    return false;
+  }
+  std::string errors = parse_json(get_data, json_str);
+
+  if (errors.empty() && is_project(get_data) && !get_data.get("dataSets").is<array>()) {
+    get_URL = project_URL + "?recur=true";
+    http_code = get_data_funct(GET_NORMAL);
+    if (!check_http_code(http_code, "sync_datasets()")) {
+      return false;
+    }
+    errors = parse_json(get_data, json_str);
+  }
+
+  if (!errors.empty() || !is_project(get_data) || !get_data.get("dataSets").is<array>()) {
+    std::cerr << "\nError in method: sync_datasets()\n";
+    std::cerr << "The project JSON does not contain fields and datasets.\n";
+    return false;
+  }
+  const array &datasets = get_data.get("dataSets").get<array>();
+  save_project_fields();
+
+  dataset_table table;
+  for (size_t field = 0; field < fields_array.size(); field++) {
+    table.columns.push_back(field_column(field));
+  }
+
+  // The old file is only used if it has the same fields, in the same order.
+  std::map<std::string, std::string> signatures;
+  std::map<std::string, size_t> old_datasets;
+  columnar_file old;
+  bool have_old = read_manifest(path + SYNC_MANIFEST, project_ID, signatures) &&
+                  old.open(path) && old.columns() == table.columns.size();
+
+  for (size_t i = 0; have_old && i < table.columns.size(); i++) {
+    have_old = old.field_ID(i).str() == table.columns[i].field_ID &&
+               old.field_type(i) == table.columns[i].field_type;
+  }
+  if (!have_old) {
+    signatures.clear();
+  }
+  for (size_t i = 0; have_old && i < old.datasets(); i++) {
+    old_datasets[old.dataset_ID(i).str()] = i;
+  }
+
+  // Sort the datasets into ones kept from the old file (old_index), ones
+  // with their data in the listing (rows) and ones to download.
+  const size_t not_kept = static_cast<size_t>(-1);
+  std::vector<std::string> new_signatures;       // One per table dataset
+  std::vector<size_t> old_index(datasets.size(), not_kept);
+  std::vector<const array *> rows(datasets.size(), NULL);
+  std::vector<std::string> download_IDs;
+  std::vector<size_t> download_index;
+  sync_counts done = {0, 0, 0, 0};
+
+  for (size_t i = 0; i < datasets.size(); i++) {
+    if (!datasets[i].is<object>()) {
+      continue;
+    }
+    const object &obj = datasets[i].get<object>();
+    object::const_iterator data = obj.find("data");
+    std::string ID = obj.find("id") == obj.end() ? "" : obj.find("id")->second.to_str();
+    std::string name = obj.find("name") == obj.end() ? "" : obj.find("name")->second.to_str();
+
+    table.dataset_IDs.push_back(ID);
+    table.dataset_names.push_back(name);
+    new_signatures.push_back(dataset_signature(datasets[i]));
+
+    std::map<std::string, std::string>::const_iterator signature = signatures.find(ID);
+    std::map<std::string, size_t>::const_iterator kept = old_datasets.find(ID);
+
+    if (signature != signatures.end() && signature->second == new_signatures.back() &&
+        kept != old_datasets.end()) {
+      old_index[i] = kept->second;
+      done.kept++;
+    } else if (data != obj.end() && data->second.is<array>()) {
+      rows[i] = &data->second.get<array>();
+      done.changed++;
+    } else {
+      download_IDs.push_back(ID);
+      download_index.push_back(i);
+      done.changed++;
+    }
+  }
+
+  std::vector<value> downloads;
+  if (!download_datasets(download_IDs, downloads)) {
+    return false;
+  }
+  for (size_t d = 0; d < downloads.size(); d++) {
+    rows[download_index[d]] = &downloads[d].get<array>();
+  }
+  done.downloaded = downloads.size();
+
+  for (std::map<std::string, size_t>::const_iterator it = old_datasets.begin();
+       it != old_datasets.end(); it++) {
+    if (std::find(table.dataset_IDs.begin(), table.dataset_IDs.end(), it->first) ==
+        table.dataset_IDs.end()) {
+      done.removed++;
+    }
+  }
+
+  // Lay the rows out in project order, same as get_all_datasets.
+  size_t total_rows = 0;
+  for (size_t i = 0; i < datasets.size(); i++) {
+    if (!datasets[i].is<object>()) {
+      continue;
+    }
+    table.dataset_starts.push_back(total_rows);
+    if (old_index[i] != not_kept) {
+      total_rows += old.dataset_start(old_index[i] + 1) - old.dataset_start(old_index[i]);
+    } else if (rows[i] != NULL) {
+      total_rows += rows[i]->size();
+    }
+  }
+  table.dataset_starts.push_back(total_rows);
+
+  for (size_t c = 0; c < table.columns.size(); c++) {
+    dataset_column &column = table.columns[c];
+
+    if (column.field_type == FIELD_TEXT || column.field_type == FIELD_TIMESTAMP) {
+      column.text.resize(total_rows);
+    } else {
+      column.numbers.assign(total_rows, NAN);
+    }
+  }
+
+  for (size_t i = 0, dataset = 0; i < datasets.size(); i++) {
+    if (!datasets[i].is<object>()) {
+      continue;
+    }
+    size_t start = table.dataset_starts[dataset++];
+
+    if (old_index[i] == not_kept) {
+      if (rows[i] != NULL) {
+        extract_rows(*rows[i], 0, rows[i]->size(), start, table);
+      }
+      continue;
+    }
+
+    size_t first = old.dataset_start(old_index[i]);
+    size_t count = old.dataset_start(old_index[i] + 1) - first;
+    for (size_t c = 0; c < table.columns.size(); c++) {
+      dataset_column &column = table.columns[c];
+
+      if (!column.text.empty()) {
+        for (size_t row = 0; row < count; row++) {
+          column.text[start + row] = old.text(c, first + row).str();
+        }
+      } else if (count > 0) {
+        memcpy(&column.numbers[start], old.numbers(c) + first, count * sizeof(double));
+      }
+    }
+  }
+  old.close();
+
+  // The file goes in before the manifest. If the manifest doesn't make it,
+  // the next sync downloads the datasets that changed this time again.
+  std::string part = path + ".part", manifest = path + SYNC_MANIFEST + ".part";
+  if (!write_columnar_file(part, table) || !replace_file(part, path)) {
+    std::cerr << "\nError in method: sync_datasets()\n";
+    std::cerr << "Unable to write " << path << "\n";
+    std::remove(part.c_str());
+    return false;
+  }
+
+  std::ofstream file(manifest.c_str());
+  file << "project " << project_ID << "\n";
+  for (size_t i = 0; i < new_signatures.size(); i++) {
+    file << table.dataset_IDs[i] << " " << new_signatures[i] << "\n";
+  }
+  file.close();
+
+  if (!file || !replace_file(manifest, path + SYNC_MANIFEST)) {
+    std::cerr << "\nError in method: sync_datasets()\n";
+    std::cerr << "Unable to write " << path << SYNC_MANIFEST << "\n";
+    std::remove(manifest.c_str());
+    return false;
+  }
+
+  if (counts != NULL) {
+    *counts = done;
+  }
+  return true;
+}
+
+bool iSENSE::download_datasets(const std::vector<std::string> &dataset_IDs,
+                               std::vector<value> &data) {
+  struct transfer {
+    std::string json;
+    CURL *handle;
+    request_watch watch;
+  };
+  std::vector<transfer> transfers(dataset_IDs.size());
+  data.assign(dataset_IDs.size(), value());
+  if (dataset_IDs.empty()) {
+    return true;
+  }
+
+  CURLM *multi = curl_multi_init();
+  if (multi == NULL) {
+    return check_http_code(CURL_ERROR, "sync_datasets()");
+  }
+  curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, SYNC_TRANSFERS);
+#ifdef CURLPIPE_MULTIPLEX
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+  bool ok = true;
+  for (size_t i = 0; i < dataset_IDs.size(); i++) {
+    transfer &t = transfers[i];
+    t.handle = curl_easy_init();
+    if (t.handle == NULL) {
+      std::cerr << "\nError in method: sync_datasets()\n";
+      std::cerr << "Curl failed for some unknown reason.\n";
+      ok = false;
+      continue;
+    }
+
+    std::string target = route(endpoints.get(),
+                               api_URL + "/data_sets/" + dataset_IDs[i] + "?recur=true");
+    curl_easy_setopt(t.handle, CURLOPT_URL, target.c_str());
+    curl_easy_setopt(t.handle, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+    curl_easy_setopt(t.handle, CURLOPT_WRITEDATA, &t.json);
+    if (transport) {
+      curl_easy_setopt(t.handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2_0);
+      curl_easy_setopt(t.handle, CURLOPT_PIPEWAIT, 1L);
+    }
+    t.watch.limits = limits.get();
+    if (!limit_request(t.handle, t.watch)) {
+      curl_easy_cleanup(t.handle);
+      t.handle = NULL;
+      ok = false;
+      continue;
+    }
+    curl_multi_add_handle(multi, t.handle);
+  }
+
+  // Each dataset is parsed as soon as it arrives, and its JSON freed.
+  int running = 1;
+  while (running > 0) {
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *message;
+    int left;
+    while ((message = curl_multi_info_read(multi, &left)) != NULL) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+
+      size_t i = 0;
+      while (transfers[i].handle != message->easy_handle) {
+        i++;
+      }
+      transfer &t = transfers[i];
+
+      long code = 0;
+      curl_easy_getinfo(t.handle, CURLINFO_RESPONSE_CODE, &code);
+      count_timeout(message->data.result, limits.get());
+      value dataset;
+
+      if (message->data.result == CURLE_OK && code == HTTP_AUTHORIZED &&
+          parse_json(dataset, t.json).empty() && dataset.is<object>() &&
+          dataset.get("data").is<array>()) {
+        data[i].swap(dataset.get<object>()["data"]);   // No copy of the rows
+      } else {
+        std::cerr << "\nError in method: sync_datasets()\n";
+        std::cerr << "Unable to get dataset " << dataset_IDs[i]
+                  << " (HTTP code " << code << ")\n";
+        ok = false;
+      }
+      std::string().swap(t.json);
+
+      curl_multi_remove_handle(multi, t.handle);
+      curl_easy_cleanup(t.handle);
+      t.handle = NULL;
+    }
+
+    if (running > 0) {
+      curl_multi_wait(multi, NULL, 0, 1000, NULL);
+    }
+  }
+  curl_multi_cleanup(multi);
+  return ok;
+}
+
+bool iSENSE::import_file(std::string path, int post_type) {
+  call_scope scope(this, *limits);
+  if (post_type != POST_KEY && post_type != POST_EMAIL) {
+    std::cerr << "\nError in method: import_file()\n";
+    std::cerr << "post_type should be POST_KEY or POST_EMAIL.\n";
+    return false;
+  }
+  if (!empty_project_check(post_type, "import_file()", false)) {
+    return false;
+  }
+  wait_for_fields();
+  if (fields_array.empty() && !get_project_fields()) {
+    std::cerr << "\nError in method: import_file()\n";
+    std::cerr << "Failed to get the project's fields.\n";
+    return false;
+  }
+
+  mapped_file file;
+  if (!file.open(path, true)) {
+    return false;
+  }
+  if (file.size() == 0) {                   // Nothing is mapped for empty files
+    std::cerr << "\nError in method: import_file()\n";
+    std::cerr << path << " is empty.\n";
+    return false;
+  }
+
+  // Each chunk is made and sent with upload_lock held, so the flush thread
+  // can upload in between (to its own dataset) but not in the middle of one.
+  int append_type = (post_type == POST_KEY) ? APPEND_KEY : APPEND_EMAIL;
+  size_t rows = 0;
+  bool first = true;
+  std::string import_ID;
+
+  if (file.size() >= COLUMNAR_MAGIC_SIZE &&
+      memcmp(file.data(), COLUMNAR_MAGIC, COLUMNAR_MAGIC_SIZE) == 0) {
+    file.close();
+    columnar_file columns_file;
+    if (!columns_file.open(path)) {
+      return false;
+    }
+
+    std::vector<std::string> names;
+    for (size_t i = 0; i < columns_file.columns(); i++) {
+      names.push_back(columns_file.field_name(i).str());
+    }
+    std::vector<int> columns = match_columns(names);
+    if (columns.empty()) {
+      return false;
+    }
+
+    while (true) {
+      std::unique_lock<std::mutex> uploading = lock_upload();
+      if (!first) {
+        set_dataset_ID(import_ID);
+      }
+      size_t count = format_columnar_rows(columns_file, rows, columns,
+                                          first ? post_type : append_type);
+      if (count == 0) {
+        break;
+      }
+      if (!upload_chunk(first, "import_file()")) {
+        return false;
+      }
+      import_ID = dataset_ID;
+      rows += count;
+      first = false;
+    }
+  } else {
+    // CSV: the delimiter is whichever of , tab or ; the header has most of.
+    const char *text = file.data();
+    const char *line_end = static_cast<const char *>(memchr(text, '\n', file.size()));
+    size_t header_size = line_end ? line_end - text : file.size();
+    char delimiter = ',';
+    size_t most = std::count(text, text + header_size, ',');
+
+    const char others[] = {'\t', ';'};
+    for (size_t i = 0; i < sizeof others; i++) {
+      size_t found = std::count(text, text + header_size, others[i]);
+      if (found > most) {
+        most = found;
+        delimiter = others[i];
+      }
+    }
+
+    csv_reader reader(text, file.size(), delimiter);
+    std::vector<csv_cell> header;
+    std::vector<std::string> names;
+
+    reader.next_row(header);
+    for (size_t i = 0; i < header.size(); i++) {
+      std::string name = header[i].str();
+      name.erase(0, name.find_first_not_of(" \t"));
+      name.erase(name.find_last_not_of(" \t") + 1);
+      names.push_back(name);
+    }
+    std::vector<int> columns = match_columns(names);
+    if (columns.empty()) {
+      return false;
+    }
+
+    std::vector<std::vector<csv_cell> > cells;
+    while (true) {
+      std::unique_lock<std::mutex> uploading = lock_upload();
+      if (!first) {
+        set_dataset_ID(import_ID);
+      }
+      size_t count = format_csv_rows(reader, columns, cells, first ? post_type : append_type);
+      if (count == 0) {
+        break;
+      }
+      if (!upload_chunk(first, "import_file()")) {
+        return false;
+      }
+      import_ID = dataset_ID;
+      rows += count;
+      first = false;
+    }
+  }
+
+  if (rows == 0) {
+    std::cerr << "\nError in method: import_file()\n";
+    std::cerr << path << " has no rows of data.\n";
+    return false;
+  }
+  return true;
+}
+
+void iSENSE::set_import_chunk_rows(size_t rows) {
+  import_chunk_rows = rows == 0 ? 1 : rows;
+}
+
+// 0 turns a limit off.
+void iSENSE::set_flush_policy(size_t max_rows, size_t max_bytes, long max_ms) {
+  std::lock_guard<std::mutex> guard(data_lock);
+  flush_rows = max_rows;
+  flush_bytes = max_bytes;
+  flush_ms = max_ms;
+  flush_wakeup.notify_one();
+}
+
+bool iSENSE::start_auto_flush(int post_type) {
+  if (flush_running) {
+    return true;
+  }
+  if (post_type != POST_KEY && post_type != POST_EMAIL) {
+    std::cerr << "\nError in method: start_auto_flush()\n";
+    std::cerr << "post_type should be POST_KEY or POST_EMAIL.\n";
+    return false;
+  }
+  if (!empty_project_check(post_type, "start_auto_flush()", false)) {
+    return false;
+  }
+  wait_for_fields();
+  if (fields_array.empty() && !get_project_fields()) {
+    std::cerr << "\nError in method: start_auto_flush()\n";
+    std::cerr << "Failed to get the project's fields.\n";
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(data_lock);
+    flush_post_type = post_type;
+    flush_posted = false;
+    flush_stop = false;
+    flush_running = true;
+  }
+  flush_thread = std::thread(&iSENSE::auto_flush_loop, this);
+  return true;
+}
+
+bool iSENSE::stop_auto_flush() {
+  if (!flush_running) {
+    return true;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(data_lock);
+    flush_stop = true;
+  }
+  flush_wakeup.notify_one();
+  flush_thread.join();
+
+  {
+    std::lock_guard<std::mutex> guard(data_lock);
+    flush_running = false;
+    finish_downsampling();
+  }
+  return flush();                 // Upload whatever is left.
+}
+
+// Uploads now, no matter what the flush policy is. One upload at a time, so
+// this waits if the flush thread is uploading.
+bool iSENSE::flush() {
+  call_scope scope(this, *limits);
+  std::unique_lock<std::mutex> upload_guard = lock_upload();
+  std::unique_lock<std::mutex> guard(data_lock);
+
+  // Rows pushed to names that aren't fields can't be sent. If they were all
+  // that was waiting, there is nothing to upload.
+  drop_unknown_fields();
+  pending_rows = waiting_rows();
+  if (pending_rows == 0) {
+    pending_bytes = 0;
+    return true;
+  }
+  if (flush_post_type == 0) {
+    std::cerr << "\nError in method: flush()\n";
+    std::cerr << "Call start_auto_flush() first.\n";
+    return false;
+  }
+
+  // The data is only locked while the upload string is made, so rows can
+  // be pushed back while it is being sent. The watermarks (sent_rows) make
+  // sure only the rows that were sent get removed afterwards.
+  bool first = !flush_posted;
+  int append_type = (flush_post_type == POST_KEY) ? APPEND_KEY : APPEND_EMAIL;
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+  if (!first) {
+    set_dataset_ID(flush_dataset_ID);       // import_file may have changed it
+  }
+  format_upload_string(first ? flush_post_type : append_type);
+  size_t sent_bytes = pending_bytes;
+  guard.unlock();
+
+  bool ok = upload_chunk(first, "flush()");
+  guard.lock();
+
+  if (!ok) {
+    sent_rows.clear();
+    retry_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(FLUSH_RETRY_MS);
+    return false;
+  }
+  flush_posted = true;
+  flush_dataset_ID = dataset_ID;
+  drop_sent_rows();
+
+  // Work out what's still waiting. Rows pushed back during the upload are
+  // no older than the start of it.
+  pending_rows = waiting_rows();
+
+  pending_bytes = (pending_rows == 0 || sent_bytes > pending_bytes) ? 0 : pending_bytes - sent_bytes;
+  first_pending = started;
+  return true;
+}
+
+// The field's ID, name, type and unit, without any data.
+dataset_column iSENSE::field_column(size_t field) const {
+  const value &info = fields_array[field];
+  dataset_column column;
+  column.field_ID = field_IDs[field];
+  column.field_name = field_name_of(info);
+  column.field_type = field_type_of(info);
+
+  if (info.is<object>() && info.get("unit").is<std::string>()) {
+    column.unit = info.get("unit").get<std::string>();
+  }
+  return column;
+}
+
+// Converts rows first up to last of a dataset into the table's columns,
+// starting at table_row. Each call writes to different rows of the columns,
+// so calls can run at the same time.
+void iSENSE::extract_rows(const array &rows, size_t first, size_t last,
+                          size_t table_row, dataset_table &table) {
+  for (size_t row = first; row < last; row++, table_row++) {
+    if (!rows[row].is<object>()) {
+      continue;
+    }
+    const object &obj = rows[row].get<object>();
+
+    for (size_t i = 0; i < table.columns.size(); i++) {
+      dataset_column &column = table.columns[i];
+      object::const_iterator data = obj.find(column.field_ID);
+
+      if (data == obj.end() || data->second.is<picojson::null>()) {
+        continue;                               // No data for this row.
+      }
+
+      if (!column.text.empty()) {
+        column.text[table_row] = data->second.to_str();
+      } else if (data->second.is<double>()) {
+        column.numbers[table_row] = data->second.get<double>();
+      } else if (data->second.is<std::string>()) {
+        // iSENSE usually sends numbers as strings, the whole string has to
+        // be a number or the row is left as NaN.
+        const std::string &text = data->second.get<std::string>();
+        char *end;
+        double number = strtod(text.c_str(), &end);
+
+        if (!text.empty() && end == text.c_str() + text.size()) {
+          column.numbers[table_row] = number;
+        }
+      }
+    }
+  }
+}
+
+bool iSENSE::post_json_key() {
+  call_scope scope(this, *limits);
+  if(!empty_project_check(POST_KEY, "post_json_key()")) {
+    return false;
+  }
+
+  upload_URL = project_upload_URL;
+  http_code = post_data_function(POST_KEY);
+
+  if(!check_http_code(http_code, "post_json_key()")) {
+    return false;
+  }
+  return true;
+}
+
+bool iSENSE::post_json_email() {
+  call_scope scope(this, *limits);
+  if(!empty_project_check(POST_EMAIL, "post_json_email()")) {
+    return false;
+  }
+
+  upload_URL = project_upload_URL;
+  http_code = post_data_function(POST_EMAIL);
+
+  if(!check_http_code(http_code, "post_json_email()")) {
+    return false;
+  }
+  return true;
+}
+
+// Append using a contributor key
+bool iSENSE::append_key_byID(std::string dataset_ID) {
+  call_scope scope(this, *limits);
+  if(!empty_project_check(APPEND_KEY, "append_key_byID")) {
+    return false;
+  }
+
+  set_dataset_ID(dataset_ID);                       // Set the dataset_ID
+  upload_URL = append_URL;                // Set the append API URL
+  http_code = post_data_function(APPEND_KEY);       // Call helper function.
+
+  if(!check_http_code(http_code, "append_key_byID")) {
+    return false;
+  }
+  return true;
+}
+
+// Appends to a dataset using its dataset name. Calls append_key_byID
+bool iSENSE::append_key_byName(std::string dataset_name) {
+  call_scope scope(this, *limits);
+  if(!empty_project_check(APPEND_KEY, "append_key_byName")) {
+    return false;
+  }
+
+  std::string dataset_ID = append_dataset_ID(dataset_name, "append_key_byName()");
+  if (dataset_ID != GET_ERROR) {
+    return append_key_byID(dataset_ID);     // Call append byID function.
+  }
+  return false;
+}
+
+// Append using email and password
+bool iSENSE::append_email_byID(std::string dataset_ID) {
+  call_scope scope(this, *limits);
+  if(!empty_project_check(APPEND_EMAIL,"append_email_byID")) {
+    return false;
+  }
+
+  set_dataset_ID(dataset_ID);                           // Set the dataset_ID
+  upload_URL = append_URL;                // Set the API URL
+  http_code = post_data_function(APPEND_EMAIL);         // Call helper function.
+
+  if(!check_http_code(http_code, "append_email_byID()")) {
+    return false;
+  }
+  return true;
+}
+
+// Appends to a dataset using its dataset name. Calls append_email_byID
+bool iSENSE::append_email_byName(std::string dataset_name) {
+  call_scope scope(this, *limits);
+  if(!empty_project_check(APPEND_EMAIL,"append_email_byName")) {
+    return false;
+  }
+
+  std::string dataset_ID = append_dataset_ID(dataset_name, "append_email_byName()");
+  if (dataset_ID != GET_ERROR) {
+    return append_email_byID(dataset_ID);   // Call append byID function.
+  }
+  return false;
+}
+
+// Checks the project ID and points get_URL at the project.
+bool iSENSE::fields_request() {
+  if (project_ID == EMPTY || project_ID.empty()) {
+    std::cerr << "Error - project ID not set!\n";
+    return false;
+  }
+  get_URL = project_URL;
+  drop_fields();            // These replace any that set_project_ID started.
+  return true;
+}
+
+// In incremental mode the same dataset is appended to over and over, so
+// the datasets are only pulled down again if it isn't in the ones we have.
+std::string iSENSE::known_dataset_ID(std::string dataset_name) {
+  return incremental ? find_dataset_ID(dataset_name) : GET_ERROR;
+}
+
+void iSENSE::dataset_name_error(std::string method) {
+  std::cerr << "\nError in method: " << method << "\n";
+  std::cerr << "Failed to find the dataset name in project # " << project_ID;
+}
+
+std::string iSENSE::append_dataset_ID(std::string dataset_name, std::string method) {
+  std::string dataset_ID = known_dataset_ID(dataset_name);
+  if (dataset_ID == GET_ERROR) {
+    get_datasets_and_mediaobjects();    // Make sure we've got all the datasets.
+    dataset_ID = get_dataset_ID(dataset_name);  // Get the dataset ID
+  }
+
+  // If we got here, we failed to find that dataset name in the current project.
+  if (dataset_ID == GET_ERROR) {
+    dataset_name_error(method);
+  }
+  return dataset_ID;
+}
+
+//******************************************************************************
+// Below this point are helper functions. Users should only call functions
+// above this point, as these are all called by the API functions.
+
+// GET data off of iSENSE using libcurl. Save the result in a MEMFILE called
+// JSON data. Do some magic on this file to get it into a C++ string.
+// Returns the HTTP code it gets, and stores data in a string.
+int iSENSE::get_data_funct(int get_type) {
+  curl = curl_easy_init();  // get curl handle
+  json_str.clear();         // If the json string was used previously, erase it.
+
+  if (curl) {
+    // Normal GET parameters
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &json_str);
+
+    // For get_check_user() we stop libcurl from outputting to STDOUT.
+    if (get_type == GET_QUIET) {
+      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &suppress_output);
+    }
+    // Perform the request, res will get the return code.
+    res = perform(context(), curl, get_URL, &json_str, true);
+
+    // Get HTTP code for error checking.
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_cleanup(curl);
+  }
+
+  // Check for errors.
+  if(res != CURLE_OK) {
+    fprintf(stderr, "curl_easy_perform() failed in get_data(): %s\n",
+            curl_easy_strerror(res));
+  }
+  return http_code;
+}
+
+// This function is called by all of the POST functions.
+int iSENSE::post_data_function(int post_type) {
+  // Upload_URL must have already been set. Otherwise the request will fail.
+  if (upload_URL == EMPTY || upload_URL.empty()) {
+    std::cerr << "\nError in method: post_data_function()\n";
+    std::cerr << "Please set a valid upload URL.\n";
+    return CURL_ERROR;
+  }
+
+  // Only one upload at a time, the auto flush thread waits for this one.
+  std::unique_lock<std::mutex> uploading = lock_upload();
+  format_post(post_type);                 // format the upload string
+  int code = send_upload();
+  post_sent(code);
+  return code;
+}
+
+// Sends upload_str to upload_URL. The response is saved in post_response.
+int iSENSE::send_upload() {
+  struct curl_slist *headers = NULL;
+  curl = upload_request(headers);         // cURL object
+  if (!curl) {
+    return CURL_ERROR;                // If curl fails, return CURL_ERROR (-1).
+  }
+
+  // Verbose debug output - turn this on if you are having problems uploading.
+  // std::cout << "\nrSENSE response: \n";
+  // curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+
+  perform(context(), curl, upload_URL, &post_response, false);  // Perform the request
+  http_code = upload_done(curl, headers);
+  return http_code;                   // Return the HTTP code we get from curl.
+}
+
+void iSENSE::format_post(int post_type) {
+  {
+    std::lock_guard<std::mutex> guard(data_lock);
+    finish_downsampling();
+  }
+  format_upload_string(post_type);
+}
+
+CURL *iSENSE::upload_request(struct curl_slist *&headers) {
+  CURL *handle = curl_easy_init();
+  post_response.clear();
+  if (!handle) {
+    return NULL;
+  }
+
+  headers = NULL;                         // Headers for uploading via JSON
+  headers = curl_slist_append(headers, "Accept: application/json");
+  headers = curl_slist_append(headers, "Accept-Charset: utf-8");
+  headers = curl_slist_append(headers, "charsets: utf-8");
+  headers = curl_slist_append(headers, "Content-Type: application/json");
+
+  // POST data. Rows spilled to disk are read back while it is sent.
+  if (spilled_parts.empty()) {
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDS, upload_str.c_str()); // JSON data
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, (long) upload_str.size());
+  } else {
+    curl_off_t length = upload_str.size();
+    for (size_t i = 0; i < spilled_parts.size(); i++) {
+      length += spilled_parts[i].bytes + (spilled_parts[i].comma ? 1 : 0);
+    }
+    streaming.rewind();
+    streaming.text_size = upload_str.size();
+
+    // Without "Expect:" libcurl waits for a 100 Continue before sending it.
+    headers = curl_slist_append(headers, "Expect:");
+    curl_easy_setopt(handle, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle, CURLOPT_READFUNCTION, &iSENSE::read_upload);
+    curl_easy_setopt(handle, CURLOPT_READDATA, this);
+    curl_easy_setopt(handle, CURLOPT_SEEKFUNCTION, &iSENSE::seek_upload);
+    curl_easy_setopt(handle, CURLOPT_SEEKDATA, this);
+    curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, length);
+  }
+  curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);            // JSON Headers
+
+  // Save the response instead of printing it (import_file needs the
+  // dataset ID in it).
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA, &post_response);
+  return handle;
+}
+
+long iSENSE::upload_done(CURL *handle, struct curl_slist *headers) {
+  long code = 0;
+  curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+  curl_easy_cleanup(handle);          // Clean up curl.
+  curl_slist_free_all(headers);
+
+  // With a memory budget, a big upload (after a long time offline) doesn't
+  // keep its memory. The spilled parts may have been dropped now, so an
+  // upload that had some isn't kept either.
+  if (!spilled_parts.empty()) {
+    upload_str.clear();
+    spilled_parts.clear();
+  }
+  if (memory_budget != 0 && upload_str.capacity() > memory_budget) {
+    std::string().swap(upload_str);
+  }
+
+  // The password may have changed, so check it again next time.
+  if (code == HTTP_UNAUTHORIZED && email != EMPTY) {
+    forget_credentials();
+  }
+  return code;
+}
+
+// iSENSE has the rows now, so they don't need to be sent again.
+void iSENSE::post_sent(long code) {
+  if (incremental && code == HTTP_AUTHORIZED) {
+    drop_sent_rows();
+  }
+}
+
+// Blocking uploads wait here for a coroutine upload to finish.
+std::unique_lock<std::mutex> iSENSE::lock_upload() {
+  std::unique_lock<std::mutex> guard(upload_lock);
+  while (async_upload) {
+    upload_idle.wait(guard);
+  }
+  return guard;
+}
+
+void iSENSE::end_async_upload() {
+  {
+    std::lock_guard<std::mutex> guard(upload_lock);
+    async_upload = false;
+  }
+  upload_idle.notify_all();
+}
+
+// The request owns its curl handle (and headers), they are cleaned up before
+// done is called. limits is kept alive with it, and the watch it points at.
+void iSENSE::start_get(request_reactor &reactor, std::function<void(int)> done) {
+  CURL *handle = curl_easy_init();
+  json_str.clear();
+  std::shared_ptr<request_watch> watch = std::make_shared<request_watch>();
+  watch->limits = limits.get();
+
+  if (!handle || !limit_request(handle, *watch)) {
+    if (handle) {
+      curl_easy_cleanup(handle);
+    }
+    done(CURL_ERROR);
+    return;
+  }
+  std::string url = route(endpoints.get(), get_URL);
+  curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA, &json_str);
+
+  std::shared_ptr<request_limits> shared_limits = limits;
+  reactor.start(handle, [handle, watch, shared_limits, done](CURLcode result) {
+    long code = 0;
+    if (count_timeout(result, shared_limits.get()) != CURLE_OK) {
+      fprintf(stderr, "curl request failed in start_get(): %s\n",
+              curl_easy_strerror(result));
+    }
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_cleanup(handle);
+    done(code);
+  });
+}
+
+void iSENSE::start_upload(request_reactor &reactor, std::function<void(int)> done) {
+  struct curl_slist *headers = NULL;
+  CURL *handle = upload_request(headers);
+  std::shared_ptr<request_watch> watch = std::make_shared<request_watch>();
+  watch->limits = limits.get();
+
+  if (!handle || !limit_request(handle, *watch)) {
+    if (handle) {
+      upload_done(handle, headers);
+    }
+    done(CURL_ERROR);
+    return;
+  }
+
+  std::string url = route(endpoints.get(), upload_URL);
+  curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+
+  std::shared_ptr<request_limits> shared_limits = limits;
+  reactor.start(handle, [this, handle, headers, watch, shared_limits, done](CURLcode result) {
+    count_timeout(result, shared_limits.get());
+    done(upload_done(handle, headers));
+  });
+}
+
+// Matches the columns of a file to the project's fields by name.
+// Returns the column of each field (-1 if it has none), or an empty vector
+// if none of the columns are fields.
+std::vector<int> iSENSE::match_columns(const std::vector<std::string> &names) {
+  std::vector<int> columns(fields_array.size(), -1);
+  bool found = false;
+
+  for (size_t column = 0; column < names.size(); column++) {
+    size_t field = 0;
+    while (field < fields_array.size() &&
+           field_name_of(fields_array[field]) != names[column]) {
+      field++;
+    }
+
+    if (field == fields_array.size()) {
+      std::cerr << "\nNote from method: import_file()\n";
+      std::cerr << "Skipping column \"" << names[column] << "\", it is not a field in ";
+      std::cerr << "project # " << project_ID << "\n";
+    } else if (columns[field] == -1) {
+      columns[field] = static_cast<int>(column);
+      found = true;
+    }
+  }
+
+  if (!found) {
+    std::cerr << "\nError in method: import_file()\n";
+    std::cerr << "None of the columns match the fields in project # " << project_ID << "\n";
+    columns.clear();
+  }
+  return columns;
+}
+
+// Formats the next rows of a CSV file into upload_str, one chunk at a time.
+// The cells are only pointed at (not copied) until they are written into
+// the upload string. Numbers are checked and copied over as they are, so
+// they are never converted to doubles and back.
+size_t iSENSE::format_csv_rows(csv_reader &reader, const std::vector<int> &columns,
+                               std::vector<std::vector<csv_cell> > &cells,
+                               int post_type) {
+  cells.resize(columns.size());
+  for (size_t i = 0; i < cells.size(); i++) {
+    cells[i].clear();
+  }
+
+  const csv_cell empty = {"", 0, false};
+  std::vector<csv_cell> row;
+  size_t rows = 0;
+
+  while (rows < import_chunk_rows && reader.next_row(row)) {
+    for (size_t i = 0; i < columns.size(); i++) {
+      if (columns[i] >= 0) {
+        size_t column = columns[i];
+        cells[i].push_back(column < row.size() ? row[column] : empty);
+      }
+    }
+    rows++;
+  }
+  if (rows == 0) {
+    return 0;
+  }
+
+  format_upload_start(post_type);
+  upload_str += ",\"data\":{";
+
+  std::string text;
+  for (size_t i = 0; i < columns.size(); i++) {
+    int type = field_type_of(fields_array[i]);
+    bool number = type != FIELD_TEXT && type != FIELD_TIMESTAMP;
+
+    if (i != 0) {
+      upload_str += ",";
+    }
+    format_json_string(upload_str, field_IDs[i]);
+    upload_str += ":[";
+
+    for (size_t row = 0; row < cells[i].size(); row++) {
+      const csv_cell &cell = cells[i][row];
+      if (row != 0) {
+        upload_str += ',';
+      }
+
+      // Numbers can't need escaping. Anything that isn't a number is
+      // uploaded as an empty string, the same as a missing value.
+      const char *start;
+      size_t count;
+      if (number) {
+        upload_str += '"';
+        if (cell.number(start, count)) {
+          upload_str.append(start, count);
+        }
+        upload_str += '"';
+      } else if (!cell.quoted) {
+        format_json_string(upload_str, cell.data, cell.length);
+      } else {
+        text = cell.str();
+        format_json_string(upload_str, text);
+      }
+    }
+    upload_str += "]";
+  }
+  upload_str += "}}";
+
+  return rows;
+}
+
+// Same as above for a columnar file, starting at row first.
+size_t iSENSE::format_columnar_rows(const columnar_file &file, size_t first,
+                                    const std::vector<int> &columns, int post_type) {
+  size_t last = std::min(file.rows(), first + import_chunk_rows);
+  if (first >= last) {
+    return 0;
+  }
+
+  format_upload_start(post_type);
+  upload_str += ",\"data\":{";
+
+  char number[NUMBER_BUFFER_SIZE];
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (i != 0) {
+      upload_str += ",";
+    }
+    format_json_string(upload_str, field_IDs[i]);
+    upload_str += ":[";
+
+    if (columns[i] >= 0) {
+      size_t column = columns[i];
+      const double *numbers = file.numbers(column);
+
+      for (size_t row = first; row < last; row++) {
+        if (row != first) {
+          upload_str += ',';
+        }
+        if (numbers != NULL) {
+          upload_str += '"';
+          upload_str.append(number, format_number(number, numbers[row]));
+          upload_str += '"';
+        } else {
+          text_ref text = file.text(column, row);
+          format_json_string(upload_str, text.data, text.length);
+        }
+      }
+    }
+    upload_str += "]";
+  }
+  upload_str += "}}";
+
+  return last - first;
+}
+
+// Uploads one chunk made by format_csv_rows / format_columnar_rows.
+// The first chunk makes a new dataset, the rest are appended to it.
+bool iSENSE::upload_chunk(bool first, std::string method) {
+  if (first) {
+    upload_URL = project_upload_URL;
+  } else {
+    upload_URL = append_URL;
+  }
+  http_code = send_upload();
+
+  if (!check_http_code(http_code, method)) {
+    return false;
+  }
+  if (!first) {
+    return true;
+  }
+
+  // The response is the new dataset, which has the ID to append to.
+  value response;
+  if (parse_json(response, post_response).empty() && response.is<object>()) {
+    const object &obj = response.get<object>();
+    object::const_iterator id = obj.find("id");
+
+    if (id != obj.end() && !id->second.is<picojson::null>()) {
+      set_dataset_ID(id->second.to_str());
+      return true;
+    }
+  }
+  std::cerr << "\nError in method: " << method << "\n";
+  std::cerr << "Unable to find the new dataset's ID in the response.\n";
+  return false;
+}
+
+// How the error messages below name a field type.
+static const char *field_type_name(int type) {
+  switch (type) {
+    case FIELD_TIMESTAMP: return "timestamp";
+    case FIELD_NUMBER:    return "number";
+    case FIELD_TEXT:      return "text";
+    case FIELD_LATITUDE:  return "latitude";
+    case FIELD_LONGITUDE: return "longitude";
+  }
+  return "unknown";
+}
+
+// The field IDs are looked up once here, so formatting a typed upload never
+// looks for a field by name. Every problem is printed, not just the first.
+bool iSENSE::bind_schema(const std::vector<schema_field> &schema,
+                         std::vector<std::string> &IDs, std::string &rest) {
+  wait_for_fields();
+  if (fields_array.empty() && !get_project_fields()) {
+    std::cerr << "\nError in method: bind_schema()\n";
+    std::cerr << "Failed to get the project's fields.\n";
+    return false;
+  }
+
+  std::vector<bool> used(fields_array.size(), false);
+  bool valid = true;
+  IDs.clear();
+
+  for (size_t i = 0; i < schema.size(); i++) {
+    size_t field = 0;
+    while (field < fields_array.size() &&
+           field_name_of(fields_array[field]) != schema[i].name) {
+      field++;
+    }
+
+    if (field == fields_array.size()) {
+      std::cerr << "\nError in method: bind_schema()\n";
+      std::cerr << "Field \"" << schema[i].name << "\" is not in project # "
+                << project_ID << "\n";
+      valid = false;
+      continue;
+    }
+
+    int type = field_type_of(fields_array[field]);
+    if (type != schema[i].field_type) {
+      std::cerr << "\nError in method: bind_schema()\n";
+      std::cerr << "Field \"" << schema[i].name << "\" is a " << field_type_name(type)
+                << " field, the schema has a " << field_type_name(schema[i].field_type)
+                << " field.\n";
+      valid = false;
+    }
+    if (used[field]) {
+      std::cerr << "\nError in method: bind_schema()\n";
+      std::cerr << "Field \"" << schema[i].name << "\" is in the schema twice.\n";
+      valid = false;
+    }
+    used[field] = true;
+    IDs.push_back(field_IDs[field]);
+  }
+
+  rest.clear();
+  for (size_t field = 0; field < fields_array.size(); field++) {
+    if (!used[field]) {
+      rest += ",";
+      format_json_string(rest, field_IDs[field]);
+      rest += ":[]";
+    }
+  }
+
+  if (!valid) {
+    IDs.clear();
+  }
+  return valid;
+}
+
+// Same steps as post_json_key and append_key_byName, with the data part
+// written by format instead of format_upload_string.
+bool iSENSE::upload_columns(int post_type, std::string dataset_name,
+                            const std::function<void(std::string &, bool, int)> &format,
+                            std::string method) {
+  call_scope scope(this, *limits);
+  if (post_type != POST_KEY && post_type != POST_EMAIL &&
+      post_type != APPEND_KEY && post_type != APPEND_EMAIL) {
+    std::cerr << "\nError in method: " << method << "\n";
+    std::cerr << "post_type should be POST_KEY, POST_EMAIL, APPEND_KEY or APPEND_EMAIL.\n";
+    return false;
+  }
+  if (!empty_project_check(post_type, method, false)) {
+    return false;
+  }
+
+  bool append = (post_type == APPEND_KEY || post_type == APPEND_EMAIL);
+  if (append) {
+    std::string ID = append_dataset_ID(dataset_name, method);
+    if (ID == GET_ERROR) {
+      return false;
+    }
+    set_dataset_ID(ID);
+  }
+
+  std::unique_lock<std::mutex> uploading = lock_upload();
+  bool compact = format_data_start(post_type);
+  format(upload_str, compact, timestamp_digits);
+  upload_str += "}}";
+
+  upload_URL = append ? append_URL : project_upload_URL;
+  http_code = send_upload();
+  return check_http_code(http_code, method);
+}
+
+std::string iSENSE::get_project_URL() {
+  return project_URL;
+}
+
+// Whether a field or dataset has the given name. Looks at the object in
+// place (no copies), and skips anything that isn't an object with a name.
+static bool named_object(const value &item, const std::string &name) {
+  if (!item.is<object>()) {
+    return false;
+  }
+  const object &obj = item.get<object>();
+  object::const_iterator found = obj.find("name");
+  return found != obj.end() && found->second.is<std::string>() &&
+         found->second.get<std::string>() == name;
+}
+
+// Convert field name to field ID
+std::string iSENSE::get_field_ID(std::string field_name) {
+  array::iterator it;
+  wait_for_fields();
+
+  // Check and see if the fields object is empty
+  if (fields.is<picojson::null>() == true) {
+    std::cerr << "\nError in method: get_field_ID()\n";
+    std::cerr << "Field array wasn't set up.\n";
+    std::cerr << "Have you pulled the fields off iSENSE?\n";
+    return GET_ERROR;
+  }
+
+  // We made an iterator above, that will let us run through the fields
+  for (it = fields_array.begin(); it != fields_array.end(); it++) {
+    if (named_object(*it, field_name)) {        // Found the given field name
+      return it->get("id").to_str();            // So return the field ID
+    }
+  }
+  std::cerr << "\nError in method: get_field_ID()\n";
+  std::cerr << "Unable to find the field ID for the given field name.\n";
+  return GET_ERROR;
+}
+
+// Convert dataset name to dataset ID
+std::string iSENSE::get_dataset_ID(std::string dataset_name) {
+  std::string dataset_ID = find_dataset_ID(dataset_name);
+
+  if (dataset_ID == GET_ERROR) {
+    std::cerr << "\nError in method: get_dataset_ID()\n";
+    std::cerr << "Unable to find the dataset ID for the given dataset name.\n";
+  }
+  return dataset_ID;
+}
+
+// Same as get_dataset_ID, without the error message.
+std::string iSENSE::find_dataset_ID(const std::string &dataset_name) {
+  array::iterator it;
+
+  // This is similar to the get_field_ID function loop.
+  for (it = data_sets.begin(); it != data_sets.end(); it++) {
+    if (named_object(*it, dataset_name)) {   // We found the dataset name
+      return it->get("id").to_str();         // So return the dataset ID
+    }
+  }
+  return GET_ERROR;
+}
+
+// Parse JSON pulled off iSENSE using the chosen backend.
+std::string iSENSE::parse_json(value &out, const std::string &json) {
+  if (parse_backend == PARSE_FAST) {
+    return fast_parse(out, json);
+  }
+  return parse(out, json);
+}
+
+// Parse the JSON of a project and save its fields. This is split out of
+// get_project_fields() so the fields can also be loaded without a GET request.
+bool iSENSE::parse_project_fields(std::string project_json) {
+  // Parse the JSON file, just like the main page of PicoJSON does.
+  std::string errors = parse_json(get_data, project_json);
+
+  if ( !errors.empty() ) {    // If we have errors, print them out and quit.
+    std::cerr << "\nError parsing JSON file in method: get_project_fields()\n";
+    std::cerr << "Error was: " << errors;
+    return false;
+  }
+  return save_project_fields();
+}
+
+bool iSENSE::save_project_fields() {
+  // Make sure we actually got a project back before grabbing its fields.
+  if ( !is_project(get_data) ) {
+    std::cerr << "\nError in method: get_project_fields()\n";
+    std::cerr << "The project JSON does not contain a fields array.\n";
+    return false;
+  }
+
+  fields = get_data.get("fields");      // Save the fields to the field array
+  fields_array = fields.get<array>();
+  save_field_IDs();
+  save_upload_encodings();
+  return true;
+}
+
+// Format JSON Upload strings.
+// The JSON is written straight into upload_str, no picojson objects are made.
+void iSENSE::format_upload_string(int post_type) {
+  wait_for_fields();
+
+  // Zeroed instead of cleared, so the map nodes are reused (no allocations).
+  std::map<std::string, size_t>::iterator sent;
+  for (sent = sent_rows.begin(); sent != sent_rows.end(); sent++) {
+    sent->second = 0;
+  }
+
+  // Check and see if the fields object is empty
+  if (fields.is<picojson::null>() == true) {
+    std::cerr << "\nError in method: format_upload_string()\n";
+    std::cerr << "Field array wasn't set up.\n";
+    std::cerr << "Have you pulled the fields off iSENSE?\n";
+    format_upload_start(post_type);
+    upload_str += "}";
+    return;
+  }
+
+  drop_unknown_fields();
+  bool compact = format_data_start(post_type);
+
+  // Run through the fields, field_IDs is in the same order as fields_array.
+  const std::vector<std::string> no_data;
+  for (size_t i = 0; i < fields_array.size(); i++) {
+    const std::string &name = field_name_of(fields_array[i]);
+
+    if (i != 0) {
+      upload_str += ",";
+    }
+
+    // Rows moved to disk (see set_memory_budget) are read back first.
+    if (!spilled.empty() && spilled.segments(name) != 0) {
+      sent_rows[name] = format_spilled(name, field_IDs[i]);
+      continue;
+    }
+
+    // Add the data in that field's vector to the upload string.
+    // Fields without any data are uploaded as an empty array.
+    std::map<std::string, std::vector<double> >::const_iterator numbers;
+    numbers = number_data.find(name);
+
+    if (numbers != number_data.end()) {
+      if (compact && !numbers->second.empty()) {
+        format_compact(upload_str, &numbers->second[0], numbers->second.size(), field_IDs[i]);
+      } else {
+        format_data(upload_str, numbers->second, field_IDs[i]);
+      }
+      sent_rows[name] = numbers->second.size();
+      continue;
+    }
+
+    std::map<std::string, std::vector<long long> >::const_iterator times;
+    times = timestamp_data.find(name);
+
+    if (times != timestamp_data.end()) {
+      if (compact && !times->second.empty()) {
+        format_compact(upload_str, &times->second[0], times->second.size(),
+                       field_IDs[i], timestamp_digits);
+      } else {
+        format_data(upload_str, times->second, field_IDs[i], timestamp_digits);
+      }
+      sent_rows[name] = times->second.size();
+      continue;
+    }
+
+    std::map<std::string, std::vector<std::string> >::const_iterator data;
+    data = map_data.find(name);
+    format_data(upload_str, data != map_data.end() ? data->second : no_data,
+                field_IDs[i]);
+
+    if (data != map_data.end()) {
+      sent_rows[name] = data->second.size();
+    }
+  }
+  upload_str += "}}";
+}
+
+// Number and timestamp fields are sent as compact base64 columns if the
+// server can read them.
+bool iSENSE::format_data_start(int post_type) {
+  bool compact = compact_upload && server_compact;
+  format_upload_start(post_type);
+  if (compact) {
+    upload_str += ",\"encoding\":";
+    format_json_string(upload_str, COMPACT_ENCODING);
+  }
+  upload_str += ",\"data\":{";
+  return compact;
+}
+
+// Starts the upload string: the title, then the key or email / password,
+// then the dataset ID when appending.
+void iSENSE::format_upload_start(int post_type) {
+  upload_str.clear();             // Keeps the memory from the last upload.
+  spilled_parts.clear();
+
+  upload_str += "{\"title\":";
+  format_json_string(upload_str, title);
+
+  switch (post_type) {
+    case POST_KEY:
+      upload_str += ",\"contribution_key\":";
+      format_json_string(upload_str, contributor_key);
+      upload_str += ",\"contributor_name\":";
+      format_json_string(upload_str, contributor_label);
+      break;
+
+    case APPEND_KEY:
+      upload_str += ",\"contribution_key\":";
+      format_json_string(upload_str, contributor_key);
+      upload_str += ",\"id\":";
+      format_json_string(upload_str, dataset_ID);
+      break;
+
+    case POST_EMAIL:
+      upload_str += ",\"email\":";
+      format_json_string(upload_str, email);
+      upload_str += ",\"password\":";
+      format_json_string(upload_str, password);
+      break;
+
+    case APPEND_EMAIL:
+      upload_str += ",\"email\":";
+      format_json_string(upload_str, email);
+      upload_str += ",\"password\":";
+      format_json_string(upload_str, password);
+      upload_str += ",\"id\":";
+      format_json_string(upload_str, dataset_ID);
+      break;
+  }
+}
+
+// This makes format_upload_string() much shorter.
+void iSENSE::format_data(std::string &buffer, const std::vector<std::string> &vect,
+                         const std::string &field_ID) {
+  format_json_string(buffer, field_ID);
+  buffer += ":[";
+  format_values(buffer, vect.data(), vect.size());
+  buffer += "]";
+}
+
+// Numbers are formatted straight into the buffer, batched one field at a time.
+// They are uploaded as strings, the same as if std::to_string had been used.
+void iSENSE::format_data(std::string &buffer, const std::vector<double> &vect,
+                         const std::string &field_ID) {
+  format_json_string(buffer, field_ID);
+  buffer += ":[";
+  format_values(buffer, vect.data(), vect.size());
+  buffer += "]";
+}
+
+void iSENSE::format_data(std::string &buffer, const std::vector<long long> &vect,
+                         const std::string &field_ID, int digits) {
+  format_json_string(buffer, field_ID);
+  buffer += ":[";
+  format_values(buffer, vect.data(), vect.size(), digits);
+  buffer += "]";
+}
+
+// The array is empty if the buffer ends with its opening bracket.
+void iSENSE::format_values(std::string &buffer, const std::string *text, size_t count) {
+  bool comma = !buffer.empty() && buffer[buffer.size() - 1] != '[';
+
+  for (size_t i = 0; i < count; i++) {
+    if (i != 0 || comma) {
+      buffer += ",";
+    }
+    format_json_string(buffer, text[i]);    // Add all the vector data.
+  }
+}
+
+void iSENSE::format_values(std::string &buffer, const double *values, size_t count) {
+  bool comma = !buffer.empty() && buffer[buffer.size() - 1] != '[';
+
+  // Room for every number, its quotes and a comma.
+  buffer.reserve(buffer.size() + count * (NUMBER_BUFFER_SIZE + 3));
+
+  char number[NUMBER_BUFFER_SIZE];
+  for (size_t i = 0; i < count; i++) {
+    if (i != 0 || comma) {
+      buffer += ',';
+    }
+    buffer += '"';
+    buffer.append(number, format_number(number, values[i]));
+    buffer += '"';
+  }
+}
+
+// Timestamps are formatted straight into the buffer. Samples taken in the
+// same second share the date and time part, so it is only worked out once
+// per second and copied for the rest.
+void iSENSE::format_values(std::string &buffer, const long long *times, size_t count,
+                           int digits) {
+  bool comma = !buffer.empty() && buffer[buffer.size() - 1] != '[';
+  buffer.reserve(buffer.size() + count * (TIMESTAMP_BUFFER_SIZE + 3));
+
+  char timestamp[TIMESTAMP_BUFFER_SIZE], fraction[TIMESTAMP_BUFFER_SIZE];
+  long long cached_second = 0;
+  bool cached = false;
+
+  for (size_t i = 0; i < count; i++) {
+    long long second = floor_divide(times[i], NANOSECONDS_PER_SECOND);
+
+    if (!cached || second != cached_second) {
+      format_timestamp(timestamp, second * NANOSECONDS_PER_SECOND, TIMESTAMP_SECONDS);
+      cached_second = second;
+      cached = true;
+    }
+
+    if (i != 0 || comma) {
+      buffer += ',';
+    }
+    buffer += '"';
+    buffer.append(timestamp, TIMESTAMP_PREFIX_SIZE);
+    buffer.append(fraction, format_fraction(fraction, times[i] - second * NANOSECONDS_PER_SECOND,
+                                            digits));
+    buffer += "Z\"";
+  }
+}
+
+// The compact columns (see compact.h) are base64, so they need no escaping.
+void iSENSE::format_compact(std::string &buffer, const double *values, size_t count,
+                            const std::string &field_ID) {
+  format_json_string(buffer, field_ID);
+  buffer += ":\"";
+  compact_encode(buffer, values, count);
+  buffer += '"';
+}
+
+void iSENSE::format_compact(std::string &buffer, const long long *times, size_t count,
+                            const std::string &field_ID, int digits) {
+  format_json_string(buffer, field_ID);
+  buffer += ":\"";
+  compact_encode(buffer, times, count, digits);
+  buffer += '"';
+}
+
+// Division that rounds down, so times before 1970 work.
+long long iSENSE::floor_divide(long long number, long long divisor) {
+  long long result = number / divisor;
+  if (number % divisor != 0 && (number < 0) != (divisor < 0)) {
+    result--;
+  }
+  return result;
+}
+
+bool iSENSE::parse_timestamp(const char *text, size_t length, long long &nanoseconds) {
+  static const char layout[] = "dddd-dd-ddTdd:dd:dd";
+  const size_t layout_length = sizeof layout - 1;
+
+  if (length < layout_length) {
+    return false;
+  }
+  for (size_t i = 0; i < layout_length; i++) {
+    bool digit = text[i] >= '0' && text[i] <= '9';
+    if (layout[i] == 'd' ? !digit : text[i] != layout[i]) {
+      return false;
+    }
+  }
+
+  // Two digits at a time, the same as format_timestamp writes them.
+  int number[7];
+  const int starts[] = {0, 2, 5, 8, 11, 14, 17};
+  for (int i = 0; i < 7; i++) {
+    number[i] = (text[starts[i]] - '0') * 10 + (text[starts[i] + 1] - '0');
+  }
+  long long year = number[0] * 100 + number[1];
+  int month = number[2], day = number[3];
+  if (month < 1 || month > 12 || day < 1 || day > 31 || number[4] > 23 ||
+      number[5] > 59 || number[6] > 60) {
+    return false;
+  }
+
+  // Year / month / day to days since 1970-01-01, the other way from
+  // format_timestamp.
+  year -= month <= 2 ? 1 : 0;
+  long long era = floor_divide(year, 400);
+  long long year_of_era = year - era * 400;
+  long long day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  long long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  long long days = era * 146097 + day_of_era - 719468;
+
+  // Digits past nanoseconds are dropped.
+  size_t pos = layout_length;
+  long long fraction = 0;
+  if (pos < length && text[pos] == '.') {
+    long long scale = NANOSECONDS_PER_SECOND / 10;
+    size_t first = ++pos;
+
+    while (pos < length && text[pos] >= '0' && text[pos] <= '9') {
+      fraction += (text[pos++] - '0') * scale;
+      scale /= 10;
+    }
+    if (pos == first) {
+      return false;
+    }
+  }
+
+  // Z, no zone (also UTC) or an offset from UTC: +HH:MM, +HHMM or +HH.
+  long long offset = 0;
+  if (pos < length && text[pos] == 'Z') {
+    pos++;
+  } else if (pos < length && (text[pos] == '+' || text[pos] == '-')) {
+    int sign = (text[pos++] == '-') ? -1 : 1;
+    int parts[2] = {0, 0};
+    for (int part = 0; part < 2 && pos < length; part++) {
+      if (part == 1 && text[pos] == ':') {
+        pos++;
+      }
+      if (pos + 2 > length || text[pos] < '0' || text[pos] > '9' ||
+          text[pos + 1] < '0' || text[pos + 1] > '9') {
+        return false;
+      }
+      parts[part] = (text[pos] - '0') * 10 + (text[pos + 1] - '0');
+      pos += 2;
+    }
+    if (parts[0] > 23 || parts[1] > 59) {
+      return false;
+    }
+    offset = sign * (parts[0] * 3600 + parts[1] * 60);
+  }
+  if (pos != length) {
+    return false;
+  }
+
+  long long seconds = days * 86400 + number[4] * 3600 + number[5] * 60 + number[6] - offset;
+  nanoseconds = seconds * NANOSECONDS_PER_SECOND + fraction;
+  return true;
+}
+
+// Writes ".123" (for 3 digits) for the nanoseconds into a second. Nothing
+// for 0 digits. Returns the number of characters.
+size_t iSENSE::format_fraction(char *buffer, long long nanoseconds, int digits) {
+  if (digits <= 0) {
+    return 0;
+  }
+  digits = std::min(digits, 9);
+
+  buffer[0] = '.';
+  for (int i = 9; i > 0; i--) {
+    if (i <= digits) {
+      buffer[i] = static_cast<char>('0' + nanoseconds % 10);
+    }
+    nanoseconds /= 10;
+  }
+  return digits + 1;
+}
+
+// Writes an ISO 8601 UTC timestamp, such as 2011-10-08T07:07:09.123Z.
+// The date is worked out with Howard Hinnant's civil_from_days algorithm,
+// so gmtime isn't needed.
+size_t iSENSE::format_timestamp(char *buffer, long long nanoseconds, int digits) {
+  long long seconds = floor_divide(nanoseconds, NANOSECONDS_PER_SECOND);
+  long long days = floor_divide(seconds, 86400);
+  long long time_of_day = seconds - days * 86400;
+
+  // Days since 1970-01-01 to year / month / day.
+  long long z = days + 719468;
+  long long era = floor_divide(z, 146097);
+  long long day_of_era = z - era * 146097;
+  long long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                           day_of_era / 146096) / 365;
+  long long day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 -
+                                        year_of_era / 100);
+  long long month_index = (5 * day_of_year + 2) / 153;
+  int day = static_cast<int>(day_of_year - (153 * month_index + 2) / 5 + 1);
+  int month = static_cast<int>(month_index < 10 ? month_index + 3 : month_index - 9);
+  long long year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+
+  const int fields[] = {static_cast<int>(year / 100), static_cast<int>(year % 100), month, day,
+                        static_cast<int>(time_of_day / 3600),
+                        static_cast<int>(time_of_day / 60 % 60),
+                        static_cast<int>(time_of_day % 60)};
+  const char separators[] = {0, 0, '-', '-', 'T', ':', ':'};
+  char *pos = buffer;
+
+  // Two digits at a time: "20" "11" "-10" "-08" "T07" ":07" ":09"
+  for (int i = 0; i < 7; i++) {
+    if (separators[i] != 0) {
+      *pos++ = separators[i];
+    }
+    *pos++ = static_cast<char>('0' + fields[i] / 10 % 10);
+    *pos++ = static_cast<char>('0' + fields[i] % 10);
+  }
+  pos += format_fraction(pos, nanoseconds - seconds * NANOSECONDS_PER_SECOND, digits);
+  *pos++ = 'Z';
+  return pos - buffer;
+}
+
+// Characters that picojson escapes: control characters, DEL, " \ and /
+static bool needs_escape(unsigned char c) {
+  return c < 0x20 || c == 0x7f || c == '"' || c == '\\' || c == '/';
+}
+
+// Returns the position of the first character that needs escaping (or the end).
+// Most upload data (numbers, names) has nothing to escape, so 16 characters
+// are checked at a time with SSE2 when it is available.
+static size_t find_escape(const char *str, size_t start, size_t length) {
+  size_t i = start;
+
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i del = _mm_set1_epi8(0x7f);
+  const __m128i control = _mm_set1_epi8(0x1f);
+
+  for (; i + 16 <= length; i += 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+
+    // A character is a control character if max(c, 0x1f) == 0x1f
+    __m128i found = _mm_cmpeq_epi8(_mm_max_epu8(chars, control), control);
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(chars, quote));
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(chars, backslash));
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(chars, slash));
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(chars, del));
+
+    int mask = _mm_movemask_epi8(found);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);     // Position of the first match
+    }
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (needs_escape(static_cast<unsigned char>(str[i]))) {
+      return i;
+    }
+  }
+  return length;
+}
+
+// Escapes a string the same way picojson's serialize() does.
+// Characters that do not need escaping are copied over in one go.
+void iSENSE::format_json_string(std::string &buffer, const std::string &str) {
+  format_json_string(buffer, str.data(), str.size());
+}
+
+void iSENSE::format_json_string(std::string &buffer, const char *chars, size_t length) {
+  size_t i = 0;
+
+  buffer += '"';
+
+  while (i < length) {
+    size_t next = find_escape(chars, i, length);
+    buffer.append(chars + i, next - i);       // Copy the part with no escapes
+
+    if (next == length) {
+      break;
+    }
+
+    char c = chars[next];
+    switch (c) {
+      case '"':  buffer += "\\\""; break;
+      case '\\': buffer += "\\\\"; break;
+      case '/':  buffer += "\\/";  break;
+      case '\b': buffer += "\\b";  break;
+      case '\f': buffer += "\\f";  break;
+      case '\n': buffer += "\\n";  break;
+      case '\r': buffer += "\\r";  break;
+      case '\t': buffer += "\\t";  break;
+      default: {
+        // Other control characters are written as \u00XX.
+        char hex[7];
+        snprintf(hex, sizeof hex, "\\u%04x", c & 0xff);
+        buffer += hex;
+        break;
+      }
+    }
+    i = next + 1;
+  }
+  buffer += '"';
+}
+
+// Two digit lookup table, so integers are written two digits at a time.
+static const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "7475767778798081828384858687888990919293949596979899";
+
+// Writes an integer into the buffer, returns the number of characters.
+size_t iSENSE::format_integer(char *buffer, long long number) {
+  char digits[NUMBER_BUFFER_SIZE];
+  char *end = digits + NUMBER_BUFFER_SIZE;
+  char *pos = end;
+
+  // Work with the unsigned value so the most negative number still works.
+  unsigned long long value = number < 0 ? 0ULL - number : number;
+
+  while (value >= 100) {
+    unsigned pair = static_cast<unsigned>(value % 100) * 2;
+    value /= 100;
+    *--pos = digit_pairs[pair + 1];
+    *--pos = digit_pairs[pair];
+  }
+  if (value >= 10) {
+    unsigned pair = static_cast<unsigned>(value) * 2;
+    *--pos = digit_pairs[pair + 1];
+    *--pos = digit_pairs[pair];
+  } else {
+    *--pos = static_cast<char>('0' + value);
+  }
+  if (number < 0) {
+    *--pos = '-';
+  }
+
+  size_t length = end - pos;
+  memcpy(buffer, pos, length);
+  return length;
+}
+
+// Writes a double into the buffer, returns the number of characters.
+// NaN and infinity have no JSON number, they are written as "" (no data).
+size_t iSENSE::format_number(char *buffer, double number) {
+  if (!std::isfinite(number)) {
+    return 0;
+  }
+
+  // Whole numbers (counts, timestamps, etc.) take the integer path.
+  if (number == std::floor(number) && std::fabs(number) < 9007199254740992.0) {
+    return format_integer(buffer, static_cast<long long>(number));
+  }
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  // Shortest round trip text (Ryu in most standard libraries).
+  std::to_chars_result result = std::to_chars(buffer, buffer + NUMBER_BUFFER_SIZE, number);
+  return result.ptr - buffer;
+#else
+  // Sensor readings usually have a few decimal places. If the number is
+  // exactly some integer / 10^places, write that integer with a decimal point.
+  // Division by an exact power of ten rounds the same way strtod does, so the
+  // text reads back as the same double.
+  static const double powers[] = {1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+  for (int places = 1; places <= 9; places++) {
+    double scaled = std::floor(number * powers[places - 1] + 0.5);
+
+    if (std::fabs(scaled) >= 9007199254740992.0) {
+      break;                                  // Too many digits for this.
+    }
+    if (scaled / powers[places - 1] != number) {
+      continue;
+    }
+
+    // Write the digits, then move the last "places" of them after a '.'
+    char digits[NUMBER_BUFFER_SIZE];
+    long long whole = static_cast<long long>(scaled);
+    size_t length = format_integer(digits, whole < 0 ? -whole : whole);
+    size_t pos = 0;
+
+    if (whole < 0) {
+      buffer[pos++] = '-';
+    }
+    if (length <= static_cast<size_t>(places)) {  // Less than 1, pad with 0s
+      buffer[pos++] = '0';
+      buffer[pos++] = '.';
+      memset(buffer + pos, '0', places - length);
+      pos += places - length;
+      memcpy(buffer + pos, digits, length);
+      return pos + length;
+    }
+    memcpy(buffer + pos, digits, length - places);
+    pos += length - places;
+    buffer[pos++] = '.';
+    memcpy(buffer + pos, digits + length - places, places);
+    return pos + places;
+  }
+
+  // Try 15 digits first (what most numbers need), then 16 and 17.
+  // 17 significant digits always read back as the same double.
+  int length = 0;
+  for (int precision = 15; precision <= 17; precision++) {
+    length = snprintf(buffer, NUMBER_BUFFER_SIZE, "%.*g", precision, number);
+    if (strtod(buffer, NULL) == number) {
+      break;
+    }
+  }
+  return length;
+#endif
+}
+
+// Returns the upload string made by format_upload_string(). The spilled
+// parts are put in from the back, so the places of the others stay right.
+const std::string &iSENSE::get_upload_string() {
+  if (spilled_parts.empty()) {
+    return upload_str;
+  }
+
+  std::lock_guard<std::mutex> guard(data_lock);
+  std::string rows, buffer;
+  for (size_t i = spilled_parts.size(); i-- > 0; ) {
+    const spilled_part &part = spilled_parts[i];
+    rows.clear();
+    for (size_t j = 0; j < part.segments.size(); j++) {
+      if (format_segment(buffer, part.field_name, part.segments[j], !rows.empty())) {
+        rows += buffer;
+      }
+    }
+    if (part.comma) {
+      rows += ',';
+    }
+    upload_str.insert(part.at, rows);
+  }
+  spilled_parts.clear();
+  return upload_str;
+}
+
+// Checks to see if the given project has been properly setup.
+// Shouldn't be any empty values, such as project ID, contributor key, etc.
+bool iSENSE::empty_project_check(int type, std::string method, bool need_data) {
+  // Check email based values, such as email & password.
+  if (type == POST_EMAIL || type == APPEND_EMAIL) {
+    if (email == EMPTY || email.empty()) {
+      std::cerr << "\nError in method: " << method << "\n";
+      std::cerr << "Please set an email address!\n";
+      return false;
+    }
+    if (password == EMPTY || password.empty()) {
+      std::cerr << "\nError in method: " << method << "\n";
+      std::cerr << "Please set a password!\n";
+      return false;
+    }
+  }
+  // Check key based values, such as contributor key and label.
+  if (type == POST_KEY || type == APPEND_KEY) {
+    if (contributor_key == EMPTY || contributor_key.empty()) {
+      std::cerr << "\nError in method: " << method << "\n";
+      std::cerr << "Please set a contributor key!\n";
+      return false;
+    }
+    if (contributor_label == "label" || contributor_label.empty()) {
+      // If a label wasn't set, automatically set it to "cURL"
+      contributor_label = "cURL";
+    }
+  }
+  // The rest are general checks that should not be empty, since the calling
+  // method depends on them being set properly.
+  if (project_ID == EMPTY || project_ID.empty()) {
+    std::cerr << "\nError in method: " << method << "\n";
+    std::cerr << "Please set a project ID!\n";
+    return false;
+  }
+  if (title == EMPTY || title.empty()) {
+    std::cerr << "\nError in method: " << method << "\n";
+    std::cerr << "Please set a project title!\n";
+    return false;
+  }
+  if (need_data && map_data.empty() && number_data.empty() && timestamp_data.empty() &&
+      spilled.empty()) {
+    std::cerr << "\nError in method: " << method << "\n";
+    std::cerr << "Map of keys/data is empty.\n";
+    std::cerr << "You should push some data back to this object.\n";
+    return false;
+  }
+  return true;
+}
+
+// Saves the field IDs as strings, in the same order as fields_array.
+void iSENSE::save_field_IDs() {
+  field_IDs.clear();
+
+  for (array::iterator it = fields_array.begin(); it != fields_array.end(); it++) {
+    field_IDs.push_back(it->get<object>()["id"].to_str());
+  }
+}
+
+// Servers that can decode compact uploads (see compact.h) list the encoding
+// in the project's "uploadEncodings". iSENSE doesn't, so it gets plain JSON.
+void iSENSE::save_upload_encodings() {
+  server_compact = false;
+  value encodings = get_data.get("uploadEncodings");
+
+  if (!encodings.is<array>()) {
+    return;
+  }
+  const array &list = encodings.get<array>();
+  for (size_t i = 0; i < list.size(); i++) {
+    if (list[i].is<std::string>() && list[i].get<std::string>() == COMPACT_ENCODING) {
+      server_compact = true;
+    }
+  }
+}
+
+// Removes the first count rows of a field, freeing their memory.
+template <typename T>
+static void drop_rows(std::map<std::string, std::vector<T> > &data,
+                      const std::string &field_name, size_t count) {
+  typename std::map<std::string, std::vector<T> >::iterator field;
+  field = data.find(field_name);
+
+  if (field == data.end() || count == 0) {
+    return;
+  }
+  std::vector<T> &rows = field->second;
+
+  if (count >= rows.size()) {
+    data.erase(field);
+  } else {
+    rows.erase(rows.begin(), rows.begin() + count);
+    std::vector<T>(rows).swap(rows);      // Shrink to the rows that are left
   }
-  std::cerr << "\n\nError in method: get_dataset(string, string)\n";
-  std::cerr << "Failed to get dataset. \n";
-  std::cerr << "Check the following & make sure they are correct:\n";
-  std::cerr << "field name, dataset name, project ID\n";
-
-  return vector_data;     // This should be empty, or may not contain all the data.
 }
 
-bool iSENSE::post_json_key() {
-  if(!empty_project_check(POST_KEY, "post_json_key()")) {
-    return false;
+// Rows pushed back to a name that isn't a field never go in the upload
+// string, so without this they would be waiting to be sent forever.
+void iSENSE::drop_unknown_fields() {
+  if (fields.is<picojson::null>()) {
+    return;
   }
 
-  upload_URL = devURL + "/projects/" + project_ID + "/jsonDataUpload";
-  http_code = post_data_function(POST_KEY);
-
-  if(!check_http_code(http_code, "post_json_key()")) {
-    return false;
+  // This runs before every upload, so the usual case (every name is a field)
+  // is checked without making any copies.
+  if (spilled.empty()) {
+    size_t known = 0;
+    for (size_t i = 0; i < fields_array.size(); i++) {
+      const std::string &name = field_name_of(fields_array[i]);
+      known += number_data.count(name) + timestamp_data.count(name) + map_data.count(name);
+    }
+    if (known == number_data.size() + timestamp_data.size() + map_data.size()) {
+      return;
+    }
   }
-  return true;
-}
 
-bool iSENSE::post_json_email() {
-  if(!empty_project_check(POST_EMAIL, "post_json_email()")) {
-    return false;
+  std::vector<std::string> names = spilled.field_names();
+  std::map<std::string, std::vector<double> >::const_iterator numbers;
+  for (numbers = number_data.begin(); numbers != number_data.end(); numbers++) {
+    names.push_back(numbers->first);
+  }
+  std::map<std::string, std::vector<long long> >::const_iterator times;
+  for (times = timestamp_data.begin(); times != timestamp_data.end(); times++) {
+    names.push_back(times->first);
+  }
+  std::map<std::string, std::vector<std::string> >::const_iterator data;
+  for (data = map_data.begin(); data != map_data.end(); data++) {
+    names.push_back(data->first);
   }
 
-  upload_URL = devURL + "/projects/" + project_ID + "/jsonDataUpload";
-  http_code = post_data_function(POST_EMAIL);
+  for (size_t i = 0; i < names.size(); i++) {
+    size_t field = 0;
+    while (field < fields_array.size() && field_name_of(fields_array[field]) != names[i]) {
+      field++;
+    }
+    if (field != fields_array.size()) {
+      continue;
+    }
 
-  if(!check_http_code(http_code, "post_json_email()")) {
-    return false;
+    if (unknown_fields.insert(names[i]).second) {
+      std::cerr << "\nNote from method: drop_unknown_fields()\n";
+      std::cerr << "Dropping the data pushed back to \"" << names[i]
+                << "\", it is not a field in project # " << project_ID << "\n";
+    }
+    number_data.erase(names[i]);
+    timestamp_data.erase(names[i]);
+    map_data.erase(names[i]);
+    spilled.drop(names[i]);
+  }
+
+  if (memory_budget != 0) {
+    resident_bytes = resident_size();
   }
-  return true;
 }
 
-// Append using a contributor key
-bool iSENSE::append_key_byID(std::string dataset_ID) {
-  if(!empty_project_check(APPEND_KEY, "append_key_byID")) {
-    return false;
+// The watermarks in sent_rows are how many rows of each field the last
+// upload string held. Those rows are always the first ones, since rows are
+// only ever added to the end, so they are the ones removed. A field's
+// spilled rows are older than the ones in memory, so they go first.
+void iSENSE::drop_sent_rows() {
+  std::map<std::string, size_t>::const_iterator it;
+
+  for (it = sent_rows.begin(); it != sent_rows.end(); it++) {
+    size_t count = it->second;
+    size_t on_disk = std::min(count, spilled.rows(it->first));
+    spilled.drop_rows(it->first, on_disk);
+    count -= on_disk;
+
+    drop_rows(number_data, it->first, count);
+    drop_rows(timestamp_data, it->first, count);
+    drop_rows(map_data, it->first, count);
   }
+  sent_rows.clear();
 
-  set_dataset_ID(dataset_ID);                       // Set the dataset_ID
-  upload_URL = devURL + "/data_sets/append";        // Set the append API URL
-  http_code = post_data_function(APPEND_KEY);       // Call helper function.
+  if (memory_budget != 0) {
+    resident_bytes = resident_size();
+  }
+}
 
-  if(!check_http_code(http_code, "append_key_byID")) {
-    return false;
+// Memory a field's rows take.
+template <typename T>
+static size_t column_bytes(const std::vector<T> &rows) {
+  return rows.capacity() * sizeof(T);
+}
+
+static size_t column_bytes(const std::vector<std::string> &rows) {
+  size_t bytes = rows.capacity() * sizeof(std::string);
+  for (size_t i = 0; i < rows.size(); i++) {
+    bytes += rows[i].size();
   }
-  return true;
+  return bytes;
 }
 
-// Appends to a dataset using its dataset name. Calls append_key_byID
-bool iSENSE::append_key_byName(std::string dataset_name) {
-  if(!empty_project_check(APPEND_KEY, "append_key_byName")) {
-    return false;
+// The field in one of the data maps that takes the most memory.
+template <typename T>
+static void biggest_field(const std::map<std::string, std::vector<T> > &data, int kind,
+                          std::string &name, int &biggest_kind, size_t &most) {
+  typename std::map<std::string, std::vector<T> >::const_iterator field;
+  for (field = data.begin(); field != data.end(); field++) {
+    size_t bytes = column_bytes(field->second);
+    if (bytes > most) {
+      name = field->first;
+      biggest_kind = kind;
+      most = bytes;
+    }
   }
+}
+
+// Rows of a field in one of the data maps.
+template <typename T>
+static size_t field_rows(const std::map<std::string, std::vector<T> > &data,
+                         const std::string &field_name) {
+  typename std::map<std::string, std::vector<T> >::const_iterator field;
+  field = data.find(field_name);
+  return field == data.end() ? 0 : field->second.size();
+}
 
-  get_datasets_and_mediaobjects();    // Make sure we've got all the datasets.
-  std::string dataset_ID = get_dataset_ID(dataset_name);  // Get the dataset ID
+// The biggest fields are moved out first, each one whole, so every spill
+// writes a few big segments instead of many small ones. Spilling down to
+// half the budget means it doesn't happen again for a while.
+void iSENSE::spill_rows() {
+  resident_bytes = resident_size();
+
+  while (memory_budget != 0 && resident_bytes > memory_budget / 2) {
+    std::string name;
+    int kind = 0;
+    size_t most = 0;
+    biggest_field(number_data, SPILL_NUMBERS, name, kind, most);
+    biggest_field(timestamp_data, SPILL_TIMESTAMPS, name, kind, most);
+    biggest_field(map_data, SPILL_TEXT, name, kind, most);
+
+    if (most == 0) {
+      return;
+    }
 
-  if (dataset_ID != GET_ERROR) {
-    return append_key_byID(dataset_ID);     // Call append byID function.
+    bool ok;
+    if (kind == SPILL_NUMBERS) {
+      const std::vector<double> &numbers = number_data[name];
+      ok = spilled.spill(name, numbers.data(), numbers.size());
+      if (ok) {
+        number_data.erase(name);
+      }
+    } else if (kind == SPILL_TIMESTAMPS) {
+      const std::vector<long long> &times = timestamp_data[name];
+      ok = spilled.spill(name, times.data(), times.size());
+      if (ok) {
+        timestamp_data.erase(name);
+      }
+    } else {
+      const std::vector<std::string> &text = map_data[name];
+      ok = spilled.spill(name, text.data(), text.size());
+      if (ok) {
+        map_data.erase(name);
+      }
+    }
+
+    if (!ok) {
+      std::cerr << "\nError in method: spill_rows()\n";
+      std::cerr << "The data is kept in memory, and the memory budget turned off.\n";
+      memory_budget = 0;
+      return;
+    }
+    resident_bytes -= std::min(most, resident_bytes);
   }
-  // If we got here, we failed to find that dataset name in the current project.
-  std::cerr << "\nError in method: append_key_byName()\n";
-  std::cerr << "Failed to find the dataset name in project # " << project_ID;
-  return false;
 }
 
-// Append using email and password
-bool iSENSE::append_email_byID(std::string dataset_ID) {
-  if(!empty_project_check(APPEND_EMAIL,"append_email_byID")) {
-    return false;
+size_t iSENSE::resident_size() const {
+  size_t bytes = 0;
+  std::map<std::string, std::vector<double> >::const_iterator numbers;
+  for (numbers = number_data.begin(); numbers != number_data.end(); numbers++) {
+    bytes += column_bytes(numbers->second);
+  }
+  std::map<std::string, std::vector<long long> >::const_iterator times;
+  for (times = timestamp_data.begin(); times != timestamp_data.end(); times++) {
+    bytes += column_bytes(times->second);
   }
+  std::map<std::string, std::vector<std::string> >::const_iterator text;
+  for (text = map_data.begin(); text != map_data.end(); text++) {
+    bytes += column_bytes(text->second);
+  }
+  return bytes;
+}
 
-  set_dataset_ID(dataset_ID);                           // Set the dataset_ID
-  upload_URL = devURL + "/data_sets/append";            // Set the API URL
-  http_code = post_data_function(APPEND_EMAIL);         // Call helper function.
+size_t iSENSE::rows_of(const std::string &field_name) const {
+  return spilled.rows(field_name) + field_rows(number_data, field_name) +
+         field_rows(timestamp_data, field_name) + field_rows(map_data, field_name);
+}
 
-  if(!check_http_code(http_code, "append_email_byID()")) {
-    return false;
+// The rows on disk are only measured here, they are read back again while
+// the upload is sent (see read_upload). A segment that can't be read back is
+// left out (the error is printed), but its rows are still counted as sent:
+// they are lost either way.
+size_t iSENSE::format_spilled(const std::string &field_name, const std::string &field_ID) {
+  format_json_string(upload_str, field_ID);
+  upload_str += ":[";
+
+  spilled_part part;
+  part.at = upload_str.size();
+  part.field_name = field_name;
+  part.bytes = 0;
+  std::string buffer;
+  for (size_t i = 0; i < spilled.segments(field_name); i++) {
+    if (format_segment(buffer, field_name, i, part.bytes != 0)) {
+      part.segments.push_back(i);
+      part.bytes += buffer.size();
+    }
   }
-  return true;
+
+  std::map<std::string, std::vector<double> >::const_iterator numbers;
+  std::map<std::string, std::vector<long long> >::const_iterator times;
+  std::map<std::string, std::vector<std::string> >::const_iterator text;
+  if ((numbers = number_data.find(field_name)) != number_data.end()) {
+    format_values(upload_str, numbers->second.data(), numbers->second.size());
+  } else if ((times = timestamp_data.find(field_name)) != timestamp_data.end()) {
+    format_values(upload_str, times->second.data(), times->second.size(), timestamp_digits);
+  } else if ((text = map_data.find(field_name)) != map_data.end()) {
+    format_values(upload_str, text->second.data(), text->second.size());
+  }
+  part.comma = part.bytes != 0 && upload_str.size() != part.at;
+  spilled_parts.push_back(part);
+
+  upload_str += "]";
+  return rows_of(field_name);
 }
 
-// Appends to a dataset using its dataset name. Calls append_email_byID
-bool iSENSE::append_email_byName(std::string dataset_name) {
-  if(!empty_project_check(APPEND_EMAIL,"append_email_byName")) {
+// The first character only tells format_values whether to start with a
+// comma, it is taken off again.
+bool iSENSE::format_segment(std::string &buffer, const std::string &field_name,
+                            size_t index, bool comma) const {
+  spill_segment segment;
+  if (!spilled.load(field_name, index, segment)) {
     return false;
   }
 
-  get_datasets_and_mediaobjects();      // Make sure we've got all the datasets
-  std::string dataset_ID = get_dataset_ID(dataset_name);  // Get the dataset ID
-
-  if (dataset_ID != GET_ERROR) {
-    return append_email_byID(dataset_ID);   // Call append byID function.
+  buffer.assign(1, comma ? ',' : '[');
+  if (segment.kind == SPILL_NUMBERS) {
+    format_values(buffer, segment.numbers.data(), segment.numbers.size());
+  } else if (segment.kind == SPILL_TIMESTAMPS) {
+    format_values(buffer, segment.times.data(), segment.times.size(), timestamp_digits);
+  } else {
+    format_values(buffer, segment.text.data(), segment.text.size());
   }
-  // If we got here, we failed to find that dataset name in the current project.
-  std::cerr << "\nError in method: append_email_byName()\n";
-  std::cerr << "Failed to find the dataset name in project # " << project_ID;
-  return false;
+  buffer.erase(0, 1);
+  return true;
 }
 
-//******************************************************************************
-// Below this point are helper functions. Users should only call functions
-// above this point, as these are all called by the API functions.
+void iSENSE::upload_stream::rewind() {
+  text = part = segment = part_bytes = buffer_sent = 0;
+  comma_sent = false;
+  buffer.clear();
+}
 
-// GET data off of iSENSE using libcurl. Save the result in a MEMFILE called
-// JSON data. Do some magic on this file to get it into a C++ string.
-// Returns the HTTP code it gets, and stores data in a string.
-int iSENSE::get_data_funct(int get_type) {
-  curl = curl_easy_init();  // get curl handle
-  json_str.clear();         // If the json string was used previously, erase it.
+// Copies upload_str up to the next spilled part, then formats the part's
+// segments one at a time. data_lock is held so nothing is spilled or dropped
+// while a segment is read. If the data was cleared while it was being sent
+// (or a segment can't be read back any more) the upload is stopped, since
+// its length was already sent.
+size_t iSENSE::read_upload(char *data, size_t size, size_t nmemb, void *api) {
+  iSENSE &self = *static_cast<iSENSE *>(api);
+  upload_stream &stream = self.streaming;
+  const std::vector<spilled_part> &parts = self.spilled_parts;
+  std::lock_guard<std::mutex> guard(self.data_lock);
+
+  if (self.upload_str.size() != stream.text_size) {
+    return CURL_READFUNC_ABORT;
+  }
 
-  if (curl) {
-    // Normal GET parameters
-    curl_easy_setopt(curl, CURLOPT_URL, get_URL.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &json_str);
+  size_t room = size * nmemb, written = 0;
+  while (written < room) {
+    if (stream.buffer_sent < stream.buffer.size()) {
+      size_t count = std::min(room - written, stream.buffer.size() - stream.buffer_sent);
+      memcpy(data + written, stream.buffer.data() + stream.buffer_sent, count);
+      stream.buffer_sent += count;
+      written += count;
+      continue;
+    }
 
-    // For get_check_user() we stop libcurl from outputting to STDOUT.
-    if (get_type == GET_QUIET) {
-      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &suppress_output);
+    size_t end = (stream.part < parts.size()) ? parts[stream.part].at : stream.text_size;
+    if (stream.text < end) {
+      size_t count = std::min(room - written, end - stream.text);
+      memcpy(data + written, self.upload_str.data() + stream.text, count);
+      stream.text += count;
+      written += count;
+      continue;
+    }
+    if (stream.part == parts.size()) {
+      break;                            // All of it was sent.
     }
-    // Perform the request, res will get the return code.
-    res = curl_easy_perform(curl);
 
-    // Get HTTP code for error checking.
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    // The next segment, then the comma before the rows in memory.
+    const spilled_part &part = parts[stream.part];
+    stream.buffer_sent = 0;
+    if (stream.segment < part.segments.size()) {
+      if (!self.format_segment(stream.buffer, part.field_name, part.segments[stream.segment],
+                               stream.part_bytes != 0)) {
+        return CURL_READFUNC_ABORT;
+      }
+      stream.part_bytes += stream.buffer.size();
+      stream.segment++;
+    } else if (stream.part_bytes != part.bytes) {
+      return CURL_READFUNC_ABORT;
+    } else if (part.comma && !stream.comma_sent) {
+      stream.buffer = ",";
+      stream.comma_sent = true;
+    } else {
+      stream.buffer.clear();
+      stream.part++;
+      stream.segment = stream.part_bytes = 0;
+      stream.comma_sent = false;
+    }
   }
+  return written;
+}
 
-  // Check for errors.
-  if(res != CURLE_OK) {
-    fprintf(stderr, "curl_easy_perform() failed in get_data(): %s\n",
-            curl_easy_strerror(res));
+// libcurl rewinds the upload if it has to send it again (after a redirect).
+int iSENSE::seek_upload(void *api, curl_off_t offset, int origin) {
+  if (origin != SEEK_SET || offset != 0) {
+    return CURL_SEEKFUNC_CANTSEEK;
   }
-  return http_code;
+  static_cast<iSENSE *>(api)->streaming.rewind();
+  return CURL_SEEKFUNC_OK;
 }
 
-// This function is called by all of the POST functions.
-int iSENSE::post_data_function(int post_type) {
-  // Upload_URL must have already been set. Otherwise the request will fail.
-  if (upload_URL == EMPTY || upload_URL.empty()) {
-    std::cerr << "\nError in method: post_data_function()\n";
-    std::cerr << "Please set a valid upload URL.\n";
-    return CURL_ERROR;
+// Most rows any field has waiting to be uploaded.
+size_t iSENSE::waiting_rows() const {
+  size_t rows = std::max(most_rows(map_data),
+                         std::max(most_rows(number_data), most_rows(timestamp_data)));
+  std::vector<std::string> spilled_fields = spilled.field_names();
+  for (size_t i = 0; i < spilled_fields.size(); i++) {
+    rows = std::max(rows, rows_of(spilled_fields[i]));
   }
+  return rows;
+}
 
-  format_upload_string(post_type);        // format the upload string
-  curl = curl_easy_init();                // cURL object
-
-  struct curl_slist *headers = NULL;      // Headers for uploading via JSON
-  headers = curl_slist_append(headers, "Accept: application/json");
-  headers = curl_slist_append(headers, "Accept-Charset: utf-8");
-  headers = curl_slist_append(headers, "charsets: utf-8");
-  headers = curl_slist_append(headers, "Content-Type: application/json");
-
-  if (curl) {
-    // Get the upload JSON as a std::string
-    std::string upload_str = (value(upload_data).serialize());
-
-    // POST data
-    curl_easy_setopt(curl, CURLOPT_URL, upload_URL.c_str());        // URL
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, upload_str.c_str()); // JSON data
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);            // JSON Headers
+// Called by the push functions (with data_lock held) after adding data.
+// field_rows is how many rows the field has now.
+void iSENSE::count_pending(size_t field_rows, size_t bytes, size_t strings) {
+  bool first = (pending_rows == 0);
 
-    // Disable output from curl.
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &suppress_output);
+  if (first) {
+    first_pending = std::chrono::steady_clock::now();
+  }
+  pending_rows = std::max(pending_rows, field_rows);
+  pending_bytes += bytes;
+
+  // The upload size (plus the strings themselves, with room for the vectors
+  // to grow) is close enough to the memory used to know when to work it out.
+  resident_bytes += bytes + strings * 2 * sizeof(std::string);
+  if (memory_budget != 0 && resident_bytes > memory_budget) {
+    spill_rows();
+  }
 
-    // Verbose debug output - turn this on if you are having problems uploading.
-    // std::cout << "\nrSENSE response: \n";
-    // curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+  // Wake the flush thread when it has a new deadline or a limit is hit.
+  if (flush_running && (first || (flush_rows != 0 && pending_rows >= flush_rows) ||
+                        (flush_bytes != 0 && pending_bytes >= flush_bytes))) {
+    flush_wakeup.notify_one();
+  }
+}
 
-    curl_easy_perform(curl);// Perform the request, res will get the return code
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    curl_easy_cleanup(curl);          // Clean up curl.
-    return http_code;                 // Return the HTTP code we get from curl.
+bool iSENSE::flush_due(std::chrono::steady_clock::time_point now) {
+  if (pending_rows == 0 || now < retry_time) {
+    return false;
   }
-  return CURL_ERROR;                  // If curl fails, return CURL_ERROR (-1).
+  return (flush_rows != 0 && pending_rows >= flush_rows) ||
+         (flush_bytes != 0 && pending_bytes >= flush_bytes) ||
+         (flush_ms > 0 && now >= first_pending + std::chrono::milliseconds(flush_ms));
 }
 
-// Convert field name to field ID
-std::string iSENSE::get_field_ID(std::string field_name) {
-  array::iterator it;
+// The flush thread. Sleeps until the flush policy says to upload.
+void iSENSE::auto_flush_loop() {
+  std::unique_lock<std::mutex> guard(data_lock);
 
-  // Check and see if the fields object is empty
-  if (fields.is<picojson::null>() == true) {
-    std::cerr << "\nError in method: get_field_ID()\n";
-    std::cerr << "Field array wasn't set up.\n";
-    std::cerr << "Have you pulled the fields off iSENSE?\n";
-    return GET_ERROR;
-  }
+  while (!flush_stop) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 
-  // We made an iterator above, that will let us run through the fields
-  for (it = fields_array.begin(); it != fields_array.end(); it++) {
-    object obj = it->get<object>();                    // Get the current object
-    std::string field_ID = obj["id"].to_str();         // Grab the field ID
-    std::string name = obj["name"].get<std::string>(); // Grab the field name
+    if (flush_due(now)) {
+      guard.unlock();
+      flush();
+      guard.lock();
+      continue;
+    }
 
-    if (name == field_name) {                   // Found the given field name
-      return field_ID;                          // So return the field ID
+    // Sleep until the oldest row is flush_ms old, or until a push wakes us.
+    if (pending_rows != 0 && flush_ms > 0) {
+      std::chrono::steady_clock::time_point deadline;
+      deadline = std::max(first_pending + std::chrono::milliseconds(flush_ms), retry_time);
+      flush_wakeup.wait_until(guard, deadline);
+    } else if (pending_rows != 0 && now < retry_time) {
+      flush_wakeup.wait_until(guard, retry_time);
+    } else {
+      flush_wakeup.wait(guard);
     }
   }
-  std::cerr << "\nError in method: get_field_ID()\n";
-  std::cerr << "Unable to find the field ID for the given field name.\n";
-  return GET_ERROR;
 }
 
-// Convert dataset name to dataset ID
-std::string iSENSE::get_dataset_ID(std::string dataset_name) {
-  array::iterator it;
-
-  // Check and see if the datasets object is empty
-  // Need to find out how to do this using picojson arrays
+// Adds a number to the field's numbers, or to its strings if it has some.
+void iSENSE::add_number(const std::string &field_name, double data) {
+  timestamps_to_text(field_name);
 
-  // This is similar to the get_field_ID function loop.
-  for (it = data_sets.begin(); it != data_sets.end(); it++) {
-    object obj = it->get<object>();                    // Get the current object
-    std::string dataset_ID = obj["id"].to_str();         // Grab the dataset ID
-    std::string name = obj["name"].get<std::string>(); // Grab the dataset name
+  std::map<std::string, std::vector<std::string> >::iterator text;
+  text = map_data.find(field_name);
 
-    if (name == dataset_name) {   // We found the dataset name
-      return dataset_ID;          // So return the dataset ID
-    }
+  // This field already has strings, so add the number as a string.
+  if (text != map_data.end()) {
+    char buffer[NUMBER_BUFFER_SIZE];
+    text->second.push_back(std::string(buffer, format_number(buffer, data)));
+    count_pending(text->second.size(), text->second.back().size() + 3, 1);
+    return;
   }
-  std::cerr << "\nError in method: get_dataset_ID()\n";
-  std::cerr << "Unable to find the dataset ID for the given dataset name.\n";
-  return GET_ERROR;
+  std::vector<double> &numbers = number_data[field_name];
+  numbers.push_back(data);
+  count_pending(numbers.size(), PENDING_NUMBER_BYTES);
 }
 
-// Format JSON Upload strings.
-void iSENSE::format_upload_string(int post_type) {
-  upload_data["title"] = value(title);
+// Times are saved as they are and only formatted when uploading. If the
+// field already has strings or numbers, the time is added as a string.
+void iSENSE::add_time(const std::string &field_name, long long nanoseconds) {
+  numbers_to_text(field_name);
 
-  switch (post_type) {
-    case POST_KEY:
-      upload_data["contribution_key"] = value(contributor_key);
-      upload_data["contributor_name"] = value(contributor_label);
-      break;
+  std::map<std::string, std::vector<std::string> >::iterator text;
+  text = map_data.find(field_name);
 
-    case APPEND_KEY:
-      upload_data["contribution_key"] = value(contributor_key);
-      upload_data["id"] = value(dataset_ID);
-      break;
+  if (text != map_data.end()) {
+    char buffer[TIMESTAMP_BUFFER_SIZE];
+    size_t length = format_timestamp(buffer, nanoseconds, timestamp_digits);
+    text->second.push_back(std::string(buffer, length));
+    count_pending(text->second.size(), length + 3, 1);
+    return;
+  }
+  std::vector<long long> &times = timestamp_data[field_name];
+  times.push_back(nanoseconds);
+  count_pending(times.size(), TIMESTAMP_BUFFER_SIZE);
+}
 
-    case POST_EMAIL:
-      upload_data["email"] = value(email);
-      upload_data["password"] = value(password);
-      break;
+// Part full windows are saved as they are (a mean of fewer values, etc).
+void iSENSE::finish_downsampling() {
+  std::map<std::string, downsampler>::iterator stage;
 
-    case APPEND_EMAIL:
-      upload_data["email"] = value(email);
-      upload_data["password"] = value(password);
-      upload_data["id"] = value(dataset_ID);
-      break;
+  for (stage = downsamplers.begin(); stage != downsamplers.end(); stage++) {
+    if (stage->second.has_times()) {
+      long long ready[DOWNSAMPLE_MAX_READY];
+      size_t count = stage->second.finish(ready);
+      for (size_t i = 0; i < count; i++) {
+        add_time(stage->first, ready[i]);
+      }
+    } else {
+      double ready[DOWNSAMPLE_MAX_READY];
+      size_t count = stage->second.finish(ready);
+      for (size_t i = 0; i < count; i++) {
+        add_number(stage->first, ready[i]);
+      }
+    }
   }
+}
 
-  array::iterator it;               // Grab all the fields using an iterator.
-  std::vector<std::string> *vect;   // Pointer to one of the vectors in the map
+// Turns the numbers saved for a field into strings, added to the end of
+// the field's strings. Does nothing if the field has no numbers.
+void iSENSE::numbers_to_text(const std::string &field_name) {
+  std::map<std::string, std::vector<double> >::iterator numbers;
+  numbers = number_data.find(field_name);
 
-  // Check and see if the fields object is empty
-  if (fields.is<picojson::null>() == true) {
-    std::cerr << "\nError in method: format_upload_string()\n";
-    std::cerr << "Field array wasn't set up.\n";
-    std::cerr << "Have you pulled the fields off iSENSE?\n";
+  if (numbers == number_data.end()) {
     return;
   }
 
-  // We made an iterator above, that will let us run through the fields
-  for (it = fields_array.begin(); it != fields_array.end(); it++) {
-    object obj = it->get<object>();                     // Get the current object
-    std::string field_ID = obj["id"].to_str();          // Grab the field ID
-    std::string name = obj["name"].get<std::string>();  // Grab the field name
+  std::vector<std::string> &text = map_data[field_name];
+  text.reserve(text.size() + numbers->second.size());
 
-    // Add the data in that field's vector to the fields_array object.
-    vect = &map_data[name];
-    format_data(vect, it, field_ID);
+  char buffer[NUMBER_BUFFER_SIZE];
+  for (size_t i = 0; i < numbers->second.size(); i++) {
+    text.push_back(std::string(buffer, format_number(buffer, numbers->second[i])));
   }
-  upload_data["data"] = value(fields_data);  // Add field_data obj to upload_data obj
+  number_data.erase(numbers);
 }
 
-// This makes format_upload_string() much shorter.
-void iSENSE::format_data(std::vector<std::string> *vect,
-                         array::iterator it, std::string field_ID) {
-  std::vector<std::string>::iterator x;
-  value::array data;        // picojson::value::array, represents a JSON array.
+// Same as above for timestamps.
+void iSENSE::timestamps_to_text(const std::string &field_name) {
+  std::map<std::string, std::vector<long long> >::iterator times;
+  times = timestamp_data.find(field_name);
 
-  for (x = vect -> begin(); x < vect -> end(); x++) {
-    data.push_back(value(*x));    // Push all the vector data into a JSON array.
+  if (times == timestamp_data.end()) {
+    return;
   }
-  fields_data[field_ID] = value(data); // Push the JSON array to the upload_data obj.
-}
 
-// Checks to see if the given project has been properly setup.
-// Shouldn't be any empty values, such as project ID, contributor key, etc.
-bool iSENSE::empty_project_check(int type, std::string method) {
-  // Check email based values, such as email & password.
-  if (type == POST_EMAIL || type == APPEND_EMAIL) {
-    if (email == EMPTY || email.empty()) {
-      std::cerr << "\nError in method: " << method << "\n";
-      std::cerr << "Please set an email address!\n";
-      return false;
-    }
-    if (password == EMPTY || password.empty()) {
-      std::cerr << "\nError in method: " << method << "\n";
-      std::cerr << "Please set a password!\n";
-      return false;
-    }
-  }
-  // Check key based values, such as contributor key and label.
-  if (type == POST_KEY || type == APPEND_KEY) {
-    if (contributor_key == EMPTY || contributor_key.empty()) {
-      std::cerr << "\nError in method: " << method << "\n";
-      std::cerr << "Please set a contributor key!\n";
-      return false;
-    }
-    if (contributor_label == "label" || contributor_label.empty()) {
-      // If a label wasn't set, automatically set it to "cURL"
-      contributor_label = "cURL";
-    }
-  }
-  // The rest are general checks that should not be empty, since the calling
-  // method depends on them being set properly.
-  if (project_ID == EMPTY || project_ID.empty()) {
-    std::cerr << "\nError in method: " << method << "\n";
-    std::cerr << "Please set a project ID!\n";
-    return false;
-  }
-  if (title == EMPTY || title.empty()) {
-    std::cerr << "\nError in method: " << method << "\n";
-    std::cerr << "Please set a project title!\n";
-    return false;
-  }
-  if (map_data.empty()) {
-    std::cerr << "\nError in method: " << method << "\n";
-    std::cerr << "Map of keys/data is empty.\n";
-    std::cerr << "You should push some data back to this object.\n";
-    return false;
+  std::vector<std::string> &text = map_data[field_name];
+  text.reserve(text.size() + times->second.size());
+
+  char buffer[TIMESTAMP_BUFFER_SIZE];
+  for (size_t i = 0; i < times->second.size(); i++) {
+    size_t length = format_timestamp(buffer, times->second[i], timestamp_digits);
+    text.push_back(std::string(buffer, length));
   }
-  return true;
+  timestamp_data.erase(times);
 }
 
 // Checks a given HTTP code for errors.
@@ -715,6 +4820,7 @@ bool iSENSE::check_http_code(int http_code, std::string method) {
 
 // Call this function to dump all the data in the given object.
 void iSENSE::debug() {
+  wait_for_fields();
   std::cout << "\nProject Title: " << title << "\n";
   std::cout << "Project ID: " << project_ID << "\n";
   std::cout << "Dataset ID: " << dataset_ID << "\n";
@@ -726,11 +4832,8 @@ void iSENSE::debug() {
   std::cout << "GET URL: " << get_URL << "\n";
   std::cout << "GET User URL: " << get_UserURL << "\n\n";
 
-  std::cout << "Upload string (picojson object): \n";
-  std::cout << value(upload_data).serialize() << "\n\n";
-
-  std::cout << "Upload Fields Data (picojson object) \n";
-  std::cout << value(fields_data).serialize() << "\n\n";
+  std::cout << "Upload string (JSON): \n";
+  std::cout << upload_str << "\n\n";
 
   std::cout << "GET Data (picojson value): \n";
   std::cout << get_data.serialize() << "\n\n";
@@ -766,6 +4869,29 @@ void iSENSE::debug() {
         }
         std::cout << "\n";
   }
+
+  std::map<std::string, std::vector<double> >::iterator num;
+  for (num = number_data.begin(); num != number_data.end(); num++) {
+    std::cout << num->first << " ";
+
+    for (size_t i = 0; i < num->second.size(); i++) {
+      std::cout << num->second[i] << " ";
+    }
+    std::cout << "\n";
+  }
+
+  std::map<std::string, std::vector<long long> >::iterator times;
+  char timestamp[TIMESTAMP_BUFFER_SIZE];
+  for (times = timestamp_data.begin(); times != timestamp_data.end(); times++) {
+    std::cout << times->first << " ";
+
+    for (size_t i = 0; i < times->second.size(); i++) {
+      std::cout.write(timestamp, format_timestamp(timestamp, times->second[i],
+                                                  timestamp_digits));
+      std::cout << " ";
+    }
+    std::cout << "\n";
+  }
 }
 
 
@@ -0,0 +1,631 @@
+#include "include/API.h"
+#include "include/columnar.h"
+#include "include/compact.h"
+#include "include/csv_reader.h"
+#include "include/mapped_file.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+// For picojson
+using namespace picojson;
+
+/* This file requires Google Benchmark. Please make sure to run the following
+ * command before compiling:
+ * sudo apt-get install libbenchmark-dev
+ * The above command will install Google Benchmark into your development
+ * environment.
+ */
+#include <benchmark/benchmark.h>
+
+/* This file benchmarks the upload / download JSON pipeline of the C++ API.
+ * None of these benchmarks touch the network - the project fields are loaded
+ * from a generated project JSON string with parse_project_fields().
+ * The following are benchmarked:
+ *
+ * format_upload_string()
+ * format_data()
+ * format_upload_string() + get_upload_string()
+ * format_upload_string() with numbers (push_vector of doubles)
+ * format_json_string()
+ * parse()               (on a ?recur=true project response)
+ * fast_parse()          (same, with the parser in json_parser.h)
+ * get_all_datasets()    (with 1 thread and one thread per core)
+ * columnar_file         (open an exported file and sum one column)
+ * format_csv_rows()     (import_file without the uploads)
+ * generate_timestamp()  (std::string and char buffer versions)
+ * format_upload_string() with timestamps (push_timestamp at 1 kHz)
+ * push_back() of numbers through set_downsampling() (each method)
+ * format_upload_string() with set_compact_upload() on and off (upload size)
+ *
+ * Every benchmark reports "allocs/op" and "alloc_bytes/op", counted by the
+ * operator new replacement below. The upload benchmarks format once before
+ * counting, so they show the steady state (the upload buffer is reused).
+ * format_upload_string() makes no allocations then (0 allocs/op for any
+ * number of fields), and those benchmarks report an error if it does.
+ *
+ * Run with:
+ * ./benchmark.out
+ * ./benchmark.out --benchmark_filter=format_upload_string
+ */
+
+//******************************************************************************
+// Counting allocator hook. Every call to operator new in this program
+// (including the ones made by the STL containers) goes through here.
+static std::atomic<size_t> alloc_count(0);
+static std::atomic<size_t> alloc_bytes(0);
+
+// These are never inlined, otherwise GCC thinks the free() calls below are
+// mismatched with the operator new() calls (-Wmismatched-new-delete).
+#ifdef __GNUC__
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE void* operator new(size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+BENCH_NOINLINE void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+BENCH_NOINLINE void operator delete(void *ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+// Counts allocations made between its creation and report().
+class alloc_counter {
+public:
+  alloc_counter() : count(alloc_count.load()), bytes(alloc_bytes.load()) {}
+
+  // Allocations made so far.
+  size_t allocations() const {
+    return alloc_count.load() - count;
+  }
+
+  // Adds the allocs/op and alloc_bytes/op counters to the benchmark.
+  void report(benchmark::State &state) {
+    state.counters["allocs/op"] = benchmark::Counter(
+      static_cast<double>(alloc_count.load() - count),
+      benchmark::Counter::kAvgIterations);
+    state.counters["alloc_bytes/op"] = benchmark::Counter(
+      static_cast<double>(alloc_bytes.load() - bytes),
+      benchmark::Counter::kAvgIterations);
+  }
+
+private:
+  size_t count, bytes;
+};
+
+//******************************************************************************
+// Helpers for making fake projects / datasets.
+
+const int bench_first_field_ID = 1000;
+
+// Field names are "Field 0", "Field 1", ...
+std::string bench_field_name(int field) {
+  return "Field " + std::to_string(field);
+}
+
+// JSON for a project with the given number of number fields.
+// Looks like what /api/v1/projects/ID returns.
+std::string bench_project_json(int num_fields) {
+  std::string json = "{\"id\":1,\"name\":\"Benchmark\",\"fields\":[";
+
+  for (int i = 0; i < num_fields; i++) {
+    if (i != 0) {
+      json += ",";
+    }
+    json += "{\"id\":" + std::to_string(bench_first_field_ID + i) +
+            ",\"type\":2,\"name\":\"" + bench_field_name(i) +
+            "\",\"unit\":\"m\",\"restrictions\":[]}";
+  }
+  return json + "]}";
+}
+
+// JSON for a project with one dataset, looks like ?recur=true.
+std::string bench_recur_json(int num_fields, int num_rows) {
+  std::string json = bench_project_json(num_fields);
+  json.erase(json.size() - 1);                  // Remove the closing brace
+  json += ",\"dataSets\":[{\"id\":1,\"name\":\"Benchmark\",\"data\":[";
+
+  for (int row = 0; row < num_rows; row++) {
+    json += (row == 0) ? "{" : ",{";
+
+    for (int i = 0; i < num_fields; i++) {
+      if (i != 0) {
+        json += ",";
+      }
+      json += "\"" + std::to_string(bench_first_field_ID + i) + "\":\"" +
+              std::to_string(row * 0.25) + "\"";
+    }
+    json += "}";
+  }
+  return json + "]}],\"mediaObjects\":[],\"owner\":{}}";
+}
+
+// Sets up an iSENSE object with fields and rows of fake data.
+void bench_setup(iSENSE &test, int num_fields, int num_rows) {
+  test.set_project_title("Benchmark");
+  test.set_contributor_key("key");
+  test.parse_project_fields(bench_project_json(num_fields));
+
+  for (int i = 0; i < num_fields; i++) {
+    std::vector<std::string> data;
+    data.reserve(num_rows);
+
+    for (int row = 0; row < num_rows; row++) {
+      data.push_back(std::to_string(row * 0.25));
+    }
+    test.push_vector(bench_field_name(i), data);
+  }
+}
+
+// Same as above, but pushes the data back as numbers.
+void bench_setup_numbers(iSENSE &test, int num_fields, int num_rows) {
+  test.set_project_title("Benchmark");
+  test.set_contributor_key("key");
+  test.parse_project_fields(bench_project_json(num_fields));
+
+  for (int i = 0; i < num_fields; i++) {
+    std::vector<double> data;
+    data.reserve(num_rows);
+
+    // A mix of whole numbers and readings with a few decimal places.
+    for (int row = 0; row < num_rows; row++) {
+      data.push_back(row % 2 == 0 ? row : row * 0.001 + 20.5);
+    }
+    test.push_vector(bench_field_name(i), data);
+  }
+}
+
+// Field counts from 1 - 200 with a fixed number of rows, and row counts
+// from 1 - 10M with a single field.
+void bench_sizes(benchmark::internal::Benchmark *bench) {
+  const int field_counts[] = {1, 10, 50, 200};
+  const int row_counts[] = {1, 1000, 100000, 1000000, 10000000};
+
+  for (int fields : field_counts) {
+    bench->Args({fields, 1000});
+  }
+  for (int rows : row_counts) {
+    bench->Args({1, rows});
+  }
+  bench->ArgNames({"fields", "rows"})->Unit(benchmark::kMicrosecond);
+}
+
+//******************************************************************************
+// Benchmarks
+
+// Time to turn map_data into the upload string.
+void BM_format_upload_string(benchmark::State &state) {
+  iSENSE test;
+  bench_setup(test, state.range(0), state.range(1));
+  test.format_upload_string(POST_KEY);        // Warm up the upload buffer
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    test.format_upload_string(POST_KEY);
+  }
+  if (counter.allocations() != 0) {
+    state.SkipWithError("format_upload_string() allocated after warming up");
+  }
+  counter.report(state);
+  state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(1));
+}
+BENCHMARK(BM_format_upload_string)->Apply(bench_sizes);
+
+// Time to format a single field's data into a JSON array.
+void BM_format_data(benchmark::State &state) {
+  std::string buffer;
+  std::vector<std::string> data;
+
+  for (int row = 0; row < state.range(1); row++) {
+    data.push_back(std::to_string(row * 0.25));
+  }
+  iSENSE::format_data(buffer, data, "1000");  // Warm up the buffer
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    buffer.clear();
+    iSENSE::format_data(buffer, data, "1000");
+  }
+  counter.report(state);
+  state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_format_data)
+  ->Args({1, 1})->Args({1, 1000})->Args({1, 100000})->Args({1, 1000000})
+  ->ArgNames({"fields", "rows"})->Unit(benchmark::kMicrosecond);
+
+// Time to make the JSON text that gets POSTed, reported in bytes per second.
+void BM_serialize_upload(benchmark::State &state) {
+  iSENSE test;
+  bench_setup(test, state.range(0), state.range(1));
+  test.format_upload_string(POST_KEY);        // Warm up the upload buffer
+
+  size_t bytes = 0;
+  alloc_counter counter;
+  for (auto _ : state) {
+    test.format_upload_string(POST_KEY);
+    const std::string &upload_str = test.get_upload_string();
+    bytes += upload_str.size();
+    benchmark::DoNotOptimize(upload_str.data());
+  }
+  if (counter.allocations() != 0) {
+    state.SkipWithError("format_upload_string() allocated after warming up");
+  }
+  counter.report(state);
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_serialize_upload)->Apply(bench_sizes);
+
+// Same as above with numbers, reported in bytes of payload per second.
+void BM_serialize_numbers(benchmark::State &state) {
+  iSENSE test;
+  bench_setup_numbers(test, state.range(0), state.range(1));
+  test.format_upload_string(POST_KEY);        // Warm up the upload buffer
+
+  size_t bytes = 0;
+  alloc_counter counter;
+  for (auto _ : state) {
+    test.format_upload_string(POST_KEY);
+    bytes += test.get_upload_string().size();
+  }
+  counter.report(state);
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_serialize_numbers)->Apply(bench_sizes);
+
+// Time to escape strings, with and without characters that need escaping.
+void BM_format_json_string(benchmark::State &state) {
+  std::string str(state.range(0), 'a');
+  if (state.range(1) != 0) {
+    for (size_t i = 0; i < str.size(); i += 64) {
+      str[i] = '/';                             // Escaped as \/
+    }
+  }
+
+  std::string buffer;
+  alloc_counter counter;
+  for (auto _ : state) {
+    buffer.clear();
+    iSENSE::format_json_string(buffer, str);
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  counter.report(state);
+  state.SetBytesProcessed(state.iterations() * str.size());
+}
+BENCHMARK(BM_format_json_string)
+  ->Args({16, 0})->Args({4096, 0})->Args({4096, 1})
+  ->ArgNames({"length", "escapes"});
+
+// Time to parse a ?recur=true response, like get_datasets_and_mediaobjects().
+void BM_parse_recur(benchmark::State &state) {
+  std::string json = bench_recur_json(state.range(0), state.range(1));
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    value get_data;
+    std::string errors = parse(get_data, json);
+    benchmark::DoNotOptimize(errors.data());
+  }
+  counter.report(state);
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_parse_recur)
+  ->Args({1, 1})->Args({10, 1000})->Args({50, 1000})->Args({200, 1000})
+  ->Args({1, 100000})->Args({1, 1000000})->Args({10, 1000000})->Args({1, 10000000})
+  ->ArgNames({"fields", "rows"})->Unit(benchmark::kMicrosecond);
+
+// Same as above with the fast parser (set_parse_backend(PARSE_FAST)).
+void BM_fast_parse_recur(benchmark::State &state) {
+  std::string json = bench_recur_json(state.range(0), state.range(1));
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    value get_data;
+    std::string errors = fast_parse(get_data, json);
+    benchmark::DoNotOptimize(errors.data());
+  }
+  counter.report(state);
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_fast_parse_recur)
+  ->Args({1, 1})->Args({10, 1000})->Args({50, 1000})->Args({200, 1000})
+  ->Args({1, 100000})->Args({1, 1000000})->Args({10, 1000000})->Args({1, 10000000})
+  ->ArgNames({"fields", "rows"})->Unit(benchmark::kMicrosecond);
+
+// Stage 1 of the fast parser on its own (finding the structural characters).
+void BM_find_structurals(benchmark::State &state) {
+  std::string json = bench_recur_json(state.range(0), state.range(1));
+  std::vector<size_t> positions;
+
+  for (auto _ : state) {
+    find_structurals(json, positions);
+    benchmark::DoNotOptimize(positions.data());
+  }
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_find_structurals)
+  ->Args({10, 100000})->ArgNames({"fields", "rows"})->Unit(benchmark::kMicrosecond);
+
+// Time to pull every field out of every dataset into columns.
+// Arguments are fields, datasets, rows per dataset and threads (0 = per core).
+void BM_get_all_datasets(benchmark::State &state) {
+  int num_fields = state.range(0);
+  std::string dataset = bench_recur_json(num_fields, state.range(2));
+
+  // Copy the one dataset a few times, to make a project with many datasets.
+  size_t start = dataset.find("\"dataSets\":[") + 12;
+  size_t end = dataset.find("],\"mediaObjects\"");
+  std::string one = dataset.substr(start, end - start);
+  std::string datasets = one;
+  for (int i = 1; i < state.range(1); i++) {
+    datasets += "," + one;
+  }
+  std::string json = dataset.substr(0, start) + datasets + dataset.substr(end);
+
+  iSENSE test;
+  test.parse_datasets_and_mediaobjects(json);
+  test.set_thread_count(state.range(3));
+
+  for (auto _ : state) {
+    dataset_table table = test.get_all_datasets(std::vector<std::string>());
+    benchmark::DoNotOptimize(table.columns.data());
+  }
+  state.SetItemsProcessed(state.iterations() * num_fields * state.range(1) * state.range(2));
+}
+BENCHMARK(BM_get_all_datasets)
+  ->Args({10, 32, 10000, 1})->Args({10, 32, 10000, 0})
+  ->ArgNames({"fields", "datasets", "rows", "threads"})
+  ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Time to open an exported columnar file and add up one of its columns.
+// Compare with BM_get_all_datasets, which has to parse the JSON every time.
+void BM_columnar_file(benchmark::State &state) {
+  iSENSE test;
+  test.parse_datasets_and_mediaobjects(bench_recur_json(10, state.range(0)));
+
+  std::string path = "benchmark_export.isense";
+  test.export_datasets(path, std::vector<std::string>());
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    columnar_file file;
+    file.open(path);
+
+    const double *numbers = file.numbers(1);
+    double sum = 0;
+    for (size_t i = 0; i < file.rows(); i++) {
+      sum += numbers[i];
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  counter.report(state);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  std::remove(path.c_str());
+}
+BENCHMARK(BM_columnar_file)->Arg(100000)->ArgName("rows")->Unit(benchmark::kMicrosecond);
+
+// Time to turn a CSV file into upload chunks, as import_file does (without
+// sending them). Arguments are fields and rows.
+void BM_import_csv(benchmark::State &state) {
+  int num_fields = state.range(0);
+  iSENSE test;
+  bench_setup(test, num_fields, 0);
+
+  std::string csv;
+  for (int i = 0; i < num_fields; i++) {
+    csv += (i == 0 ? "" : ",") + bench_field_name(i);
+  }
+  for (int row = 0; row < state.range(1); row++) {
+    for (int i = 0; i < num_fields; i++) {
+      csv += (i == 0 ? "\n" : ",") + std::to_string(row * 0.25 + i);
+    }
+  }
+
+  std::string path = "benchmark_import.csv";
+  std::FILE *out = std::fopen(path.c_str(), "wb");
+  std::fwrite(csv.data(), 1, csv.size(), out);
+  std::fclose(out);
+
+  std::vector<std::vector<csv_cell> > cells;
+  alloc_counter counter;
+  for (auto _ : state) {
+    mapped_file file;
+    file.open(path, true);
+    csv_reader reader(file.data(), file.size());
+
+    std::vector<csv_cell> header;
+    std::vector<std::string> names;
+    reader.next_row(header);
+    for (size_t i = 0; i < header.size(); i++) {
+      names.push_back(header[i].str());
+    }
+    std::vector<int> columns = test.match_columns(names);
+
+    while (test.format_csv_rows(reader, columns, cells, POST_KEY) != 0) {
+      benchmark::DoNotOptimize(test.get_upload_string().data());
+    }
+  }
+  counter.report(state);
+  state.SetBytesProcessed(state.iterations() * csv.size());
+  std::remove(path.c_str());
+}
+BENCHMARK(BM_import_csv)
+  ->Args({10, 200000})->ArgNames({"fields", "rows"})->Unit(benchmark::kMillisecond);
+
+// Time to make one timestamp, the old way (std::string, one second).
+void BM_generate_timestamp(benchmark::State &state) {
+  iSENSE test;
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    std::string timestamp = test.generate_timestamp();
+    benchmark::DoNotOptimize(timestamp.data());
+  }
+  counter.report(state);
+}
+BENCHMARK(BM_generate_timestamp);
+
+// Same, with the thread safe version (char buffer, milliseconds).
+void BM_generate_timestamp_buffer(benchmark::State &state) {
+  char buffer[TIMESTAMP_BUFFER_SIZE];
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(iSENSE::generate_timestamp(buffer, TIMESTAMP_MILLISECONDS));
+  }
+  counter.report(state);
+}
+BENCHMARK(BM_generate_timestamp_buffer);
+
+// Time to format a timestamp field of 1 kHz samples into the upload string.
+void BM_serialize_timestamps(benchmark::State &state) {
+  iSENSE test;
+  bench_setup(test, 1, 0);
+
+  long long start = 1318057629LL * NANOSECONDS_PER_SECOND;
+  for (int row = 0; row < state.range(0); row++) {
+    test.push_timestamp(bench_field_name(0), start + row * 1000000LL);
+  }
+  test.format_upload_string(POST_KEY);        // Warm up the upload buffer
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    test.format_upload_string(POST_KEY);
+  }
+  if (counter.allocations() != 0) {
+    state.SkipWithError("format_upload_string() allocated after warming up");
+  }
+  counter.report(state);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_serialize_timestamps)->Arg(100000)->ArgName("rows")->Unit(benchmark::kMicrosecond);
+
+// Time to push back a noisy sine wave one number at a time, downsampled with
+// each method (window of 10, deadband of 0.1). "ratio" is values in per
+// value kept.
+void BM_push_downsampled(benchmark::State &state) {
+  const int rows = 100000;
+  std::vector<double> signal(rows);
+  for (int row = 0; row < rows; row++) {
+    signal[row] = std::sin(row / 100.0) + (row % 7) * 0.01;
+  }
+
+  iSENSE test;
+  bench_setup(test, 1, 0);
+  int method = state.range(0);
+  test.set_downsampling(bench_field_name(0), method, method == DOWNSAMPLE_DEADBAND ? 0.1 : 10);
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    test.clear_upload_data();
+    for (int row = 0; row < rows; row++) {
+      test.push_back(bench_field_name(0), signal[row]);
+    }
+  }
+  counter.report(state);
+  state.counters["ratio"] = test.get_reduction_ratio(bench_field_name(0));
+  state.SetItemsProcessed(state.iterations() * rows);
+}
+BENCHMARK(BM_push_downsampled)
+  ->Arg(DOWNSAMPLE_NONE)->Arg(DOWNSAMPLE_MEAN)->Arg(DOWNSAMPLE_MAX)
+  ->Arg(DOWNSAMPLE_LTTB)->Arg(DOWNSAMPLE_DEADBAND)
+  ->ArgName("method")->Unit(benchmark::kMicrosecond);
+
+// Time to hand a field 100,000 numbers: 0 copies a vector in, 1 moves it in,
+// 2 adds doubles with push_range and 3 converts floats with push_range.
+// "allocs/op" only counts the push itself, the field was cleared before.
+void BM_push_vector(benchmark::State &state) {
+  const int rows = 100000;
+  std::vector<double> signal(rows);
+  std::vector<float> floats(rows);
+  for (int row = 0; row < rows; row++) {
+    signal[row] = floats[row] = row * 0.25f;
+  }
+
+  iSENSE test;
+  bench_setup(test, 1, 0);
+  const std::string field = bench_field_name(0);
+  int mode = state.range(0);
+  size_t allocs = 0, bytes = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    test.clear_upload_data();
+    std::vector<double> data(signal);
+    size_t count = alloc_count.load(), size = alloc_bytes.load();
+    state.ResumeTiming();
+
+    if (mode == 0) {
+      test.push_vector(field, data);
+    } else if (mode == 1) {
+      test.push_vector(field, std::move(data));
+    } else if (mode == 2) {
+      const double *values = signal.data();
+      test.push_range(field, values, values + rows);
+    } else {
+      test.push_range(field, floats.begin(), floats.end());
+    }
+
+    state.PauseTiming();
+    allocs += alloc_count.load() - count;
+    bytes += alloc_bytes.load() - size;
+    state.ResumeTiming();
+  }
+  state.counters["allocs/op"] = benchmark::Counter(static_cast<double>(allocs),
+                                                   benchmark::Counter::kAvgIterations);
+  state.counters["alloc_bytes/op"] = benchmark::Counter(static_cast<double>(bytes),
+                                                        benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * rows);
+}
+BENCHMARK(BM_push_vector)->DenseRange(0, 3)->ArgName("mode")->Unit(benchmark::kMicrosecond);
+
+// Time to format 1 kHz timestamps and a sensor reading (one decimal place)
+// as plain JSON (compact:0) or compact columns (compact:1). "upload_bytes"
+// is the size of the upload string.
+void BM_compact_upload(benchmark::State &state) {
+  const int rows = 100000;
+  iSENSE test;
+  test.set_project_title("Benchmark");
+  test.set_contributor_key("key");
+
+  // A server that can read compact uploads.
+  std::string project = bench_project_json(2);
+  project.insert(1, "\"uploadEncodings\":[\"" + COMPACT_ENCODING + "\"],");
+  test.parse_project_fields(project);
+  test.set_compact_upload(state.range(0) == 1);
+
+  long long start = 1318057629LL * NANOSECONDS_PER_SECOND;
+  for (int row = 0; row < rows; row++) {
+    test.push_timestamp(bench_field_name(0), start + row * 1000000LL);
+    test.push_back(bench_field_name(1), std::round(200 + 50 * std::sin(row / 500.0)) / 10);
+  }
+  test.format_upload_string(POST_KEY);        // Warm up the upload buffer
+
+  alloc_counter counter;
+  for (auto _ : state) {
+    test.format_upload_string(POST_KEY);
+  }
+  if (counter.allocations() != 0) {
+    state.SkipWithError("format_upload_string() allocated after warming up");
+  }
+  counter.report(state);
+  state.counters["upload_bytes"] = test.get_upload_string().size();
+  state.SetItemsProcessed(state.iterations() * rows);
+}
+BENCHMARK(BM_compact_upload)->Arg(0)->Arg(1)->ArgName("compact")->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
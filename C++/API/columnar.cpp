@@ -0,0 +1,398 @@
+#include "include/columnar.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+const uint32_t COLUMNAR_BYTE_ORDER = 0x01020304;
+const uint64_t HEADER_SIZE = 64;
+
+// Header fields, as indexes into the header when read as uint64s.
+const int HEADER_ROWS = 2;
+const int HEADER_COLUMNS = 3;
+const int HEADER_DATASETS = 4;
+const int HEADER_DATASETS_OFFSET = 5;
+const int HEADER_SCHEMA_OFFSET = 6;
+const int HEADER_FILE_SIZE = 7;
+
+// Size of one column's entry in the schema section.
+const uint64_t SCHEMA_ENTRY_SIZE = 16;
+
+// Text and timestamp fields are kept as text, like get_all_datasets does.
+static uint32_t column_storage(const dataset_column &column) {
+  if (column.field_type == FIELD_TEXT || column.field_type == FIELD_TIMESTAMP) {
+    return COLUMN_TEXT;
+  }
+  return COLUMN_NUMBERS;
+}
+
+// Rounds up to the next multiple of 8.
+static uint64_t align8(uint64_t size) {
+  return (size + 7) & ~static_cast<uint64_t>(7);
+}
+
+//******************************************************************************
+// Writing
+
+// Writes to a file, keeping track of the position.
+class columnar_writer {
+public:
+  columnar_writer(std::FILE *file) : file(file), position(0), ok(true) {}
+
+  void write(const void *data, size_t size) {
+    if (ok && size != 0 && std::fwrite(data, 1, size, file) != size) {
+      ok = false;
+    }
+    position += size;
+  }
+
+  void write64(uint64_t number) {
+    write(&number, sizeof number);
+  }
+
+  // Writes zeros up to the next multiple of 8.
+  void pad() {
+    static const char zeros[8] = {0};
+    write(zeros, align8(position) - position);
+  }
+
+  // Writes a list of strings (see columnar.h).
+  void write_strings(const std::vector<std::string> &strings) {
+    write64(strings.size());
+
+    uint64_t offset = 0;
+    write64(offset);
+    for (size_t i = 0; i < strings.size(); i++) {
+      offset += strings[i].size();
+      write64(offset);
+    }
+    for (size_t i = 0; i < strings.size(); i++) {
+      write(strings[i].data(), strings[i].size());
+    }
+    pad();
+  }
+
+  std::FILE *file;
+  uint64_t position;
+  bool ok;
+};
+
+bool write_columnar_file(const std::string &path, const dataset_table &table) {
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    std::cerr << "\nError in method: write_columnar_file()\n";
+    std::cerr << "Unable to open " << path << " for writing.\n";
+    return false;
+  }
+
+  uint64_t rows = table.dataset_starts.empty() ? 0 : table.dataset_starts.back();
+  uint64_t columns = table.columns.size();
+  uint64_t datasets = table.dataset_IDs.size();
+  columnar_writer out(file);
+
+  // The header is written again at the end, once the offsets are known.
+  char header[HEADER_SIZE] = {0};
+  out.write(header, sizeof header);
+
+  // Dataset section
+  uint64_t datasets_offset = out.position;
+  for (size_t i = 0; i < table.dataset_starts.size(); i++) {
+    out.write64(table.dataset_starts[i]);
+  }
+  if (table.dataset_starts.empty()) {
+    out.write64(0);
+  }
+  out.write_strings(table.dataset_IDs);
+  out.write_strings(table.dataset_names);
+
+  // Schema section. The column data comes right after it, so the data
+  // offsets can be worked out now.
+  uint64_t schema_offset = out.position;
+  std::vector<std::string> field_IDs, field_names, units;
+
+  for (size_t i = 0; i < table.columns.size(); i++) {
+    field_IDs.push_back(table.columns[i].field_ID);
+    field_names.push_back(table.columns[i].field_name);
+    units.push_back(table.columns[i].unit);
+  }
+
+  uint64_t data_offset = schema_offset + columns * SCHEMA_ENTRY_SIZE;
+  uint64_t strings_size[3] = {0, 0, 0};
+  const std::vector<std::string> *schema_strings[3] = {&field_IDs, &field_names, &units};
+
+  for (int list = 0; list < 3; list++) {
+    uint64_t chars = 0;
+    for (size_t i = 0; i < schema_strings[list]->size(); i++) {
+      chars += (*schema_strings[list])[i].size();
+    }
+    strings_size[list] = 8 + 8 * (columns + 1) + align8(chars);
+    data_offset += strings_size[list];
+  }
+
+  for (size_t i = 0; i < table.columns.size(); i++) {
+    const dataset_column &column = table.columns[i];
+    uint32_t entry[2];
+    entry[0] = column.field_type;
+    entry[1] = column_storage(column);
+    out.write(entry, sizeof entry);
+    out.write64(data_offset);
+
+    // Work out where the next column's data starts.
+    if (entry[1] == COLUMN_NUMBERS) {
+      data_offset += align8(rows * sizeof(double));
+    } else {
+      uint64_t chars = 0;
+      for (size_t row = 0; row < rows && row < column.text.size(); row++) {
+        chars += column.text[row].size();
+      }
+      data_offset += 8 + 8 * (rows + 1) + align8(chars);
+    }
+  }
+  out.write_strings(field_IDs);
+  out.write_strings(field_names);
+  out.write_strings(units);
+
+  // Column data
+  for (size_t i = 0; i < table.columns.size(); i++) {
+    const dataset_column &column = table.columns[i];
+
+    // Columns shorter than the table (there shouldn't be any) are filled
+    // in with NaN / empty strings, so the offsets above stay right.
+    if (column_storage(column) == COLUMN_NUMBERS) {
+      size_t have = std::min<size_t>(column.numbers.size(), rows);
+      out.write(column.numbers.data(), have * sizeof(double));
+      for (size_t row = have; row < rows; row++) {
+        double missing = NAN;
+        out.write(&missing, sizeof missing);
+      }
+      out.pad();
+    } else if (column.text.size() == rows) {
+      out.write_strings(column.text);
+    } else {
+      std::vector<std::string> text(column.text);
+      text.resize(rows);
+      out.write_strings(text);
+    }
+  }
+
+  // Now the header.
+  uint64_t file_size = out.position;
+  memcpy(header, COLUMNAR_MAGIC, COLUMNAR_MAGIC_SIZE);
+  memcpy(header + 8, &COLUMNAR_BYTE_ORDER, 4);
+  memcpy(header + 12, &COLUMNAR_VERSION, 4);
+
+  uint64_t fields[] = {rows, columns, datasets, datasets_offset, schema_offset, file_size};
+  memcpy(header + 16, fields, sizeof fields);
+
+  bool ok = out.ok && std::fseek(file, 0, SEEK_SET) == 0 &&
+            std::fwrite(header, 1, sizeof header, file) == sizeof header;
+  ok = (std::fclose(file) == 0) && ok;
+
+  if (!ok) {
+    std::cerr << "\nError in method: write_columnar_file()\n";
+    std::cerr << "Failed writing to " << path << "\n";
+  }
+  return ok;
+}
+
+//******************************************************************************
+// Reading
+
+columnar_file::columnar_file() {
+  base = NULL;
+  size = 0;
+  header = starts = NULL;
+  dataset_IDs = dataset_names = schema = NULL;
+  field_IDs = field_names = units = NULL;
+}
+
+columnar_file::~columnar_file() {
+  close();
+}
+
+bool columnar_file::open(const std::string &path) {
+  close();
+
+  if (!file.open(path)) {
+    return false;
+  }
+  base = file.data();
+  size = file.size();
+
+  // Check the header, then every offset, so nothing reads past the file.
+  header = reinterpret_cast<const uint64_t *>(base);
+  uint32_t byte_order = 0, version = 0;
+  if (base != NULL && size >= HEADER_SIZE) {
+    memcpy(&byte_order, base + 8, 4);
+    memcpy(&version, base + 12, 4);
+  }
+
+  bool ok = base != NULL && size >= HEADER_SIZE &&
+            memcmp(base, COLUMNAR_MAGIC, COLUMNAR_MAGIC_SIZE) == 0 &&
+            byte_order == COLUMNAR_BYTE_ORDER && version == COLUMNAR_VERSION &&
+            header[HEADER_FILE_SIZE] == size;
+
+  uint64_t offset = ok ? header[HEADER_DATASETS_OFFSET] : 0;
+  uint64_t datasets = ok ? header[HEADER_DATASETS] : 0;
+  uint64_t columns = ok ? header[HEADER_COLUMNS] : 0;
+
+  ok = ok && offset % 8 == 0 && datasets < size / 8 && offset + 8 * (datasets + 1) <= size;
+  if (ok) {
+    starts = reinterpret_cast<const uint64_t *>(base + offset);
+    offset = check_strings(offset + 8 * (datasets + 1), dataset_IDs, datasets);
+    offset = check_strings(offset, dataset_names, datasets);
+    ok = offset != 0 && starts[datasets] == header[HEADER_ROWS];
+  }
+
+  offset = ok ? header[HEADER_SCHEMA_OFFSET] : 0;
+  ok = ok && offset % 8 == 0 && columns < size / SCHEMA_ENTRY_SIZE &&
+       offset + columns * SCHEMA_ENTRY_SIZE <= size;
+  if (ok) {
+    schema = base + offset;
+    offset = check_strings(offset + columns * SCHEMA_ENTRY_SIZE, field_IDs, columns);
+    offset = check_strings(offset, field_names, columns);
+    offset = check_strings(offset, units, columns);
+    ok = offset != 0;
+  }
+
+  // Check each column's data fits in the file.
+  for (size_t i = 0; ok && i < columns; i++) {
+    uint64_t data_offset;
+    memcpy(&data_offset, schema + i * SCHEMA_ENTRY_SIZE + 8, 8);
+
+    if (storage(i) == COLUMN_NUMBERS) {
+      ok = data_offset % 8 == 0 && rows() <= size / sizeof(double) &&
+           data_offset + rows() * sizeof(double) <= size;
+    } else {
+      const char *list;
+      ok = storage(i) == COLUMN_TEXT && check_strings(data_offset, list, rows()) != 0;
+    }
+  }
+
+  if (!ok) {
+    std::cerr << "\nError in method: columnar_file::open()\n";
+    std::cerr << path << " is not a valid columnar dataset file.\n";
+    close();
+  }
+  return ok;
+}
+
+void columnar_file::close() {
+  file.close();
+  base = NULL;
+  size = 0;
+}
+
+size_t columnar_file::rows() const {
+  return base == NULL ? 0 : header[HEADER_ROWS];
+}
+
+size_t columnar_file::columns() const {
+  return base == NULL ? 0 : header[HEADER_COLUMNS];
+}
+
+size_t columnar_file::datasets() const {
+  return base == NULL ? 0 : header[HEADER_DATASETS];
+}
+
+size_t columnar_file::dataset_start(size_t dataset) const {
+  return starts[dataset];
+}
+
+text_ref columnar_file::dataset_ID(size_t dataset) const {
+  return get_string(dataset_IDs, dataset);
+}
+
+text_ref columnar_file::dataset_name(size_t dataset) const {
+  return get_string(dataset_names, dataset);
+}
+
+text_ref columnar_file::field_ID(size_t column) const {
+  return get_string(field_IDs, column);
+}
+
+text_ref columnar_file::field_name(size_t column) const {
+  return get_string(field_names, column);
+}
+
+text_ref columnar_file::unit(size_t column) const {
+  return get_string(units, column);
+}
+
+int columnar_file::field_type(size_t column) const {
+  uint32_t type;
+  memcpy(&type, schema + column * SCHEMA_ENTRY_SIZE, 4);
+  return type;
+}
+
+uint32_t columnar_file::storage(size_t column) const {
+  uint32_t type;
+  memcpy(&type, schema + column * SCHEMA_ENTRY_SIZE + 4, 4);
+  return type;
+}
+
+int columnar_file::find_column(const std::string &name) const {
+  for (size_t i = 0; i < columns(); i++) {
+    text_ref field = field_name(i);
+    if (field.length == name.size() && memcmp(field.data, name.data(), name.size()) == 0) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+const double *columnar_file::numbers(size_t column) const {
+  if (storage(column) != COLUMN_NUMBERS) {
+    return NULL;
+  }
+  uint64_t data_offset;
+  memcpy(&data_offset, schema + column * SCHEMA_ENTRY_SIZE + 8, 8);
+  return reinterpret_cast<const double *>(base + data_offset);
+}
+
+text_ref columnar_file::text(size_t column, size_t row) const {
+  if (storage(column) != COLUMN_TEXT) {
+    text_ref empty = {"", 0};
+    return empty;
+  }
+  uint64_t data_offset;
+  memcpy(&data_offset, schema + column * SCHEMA_ENTRY_SIZE + 8, 8);
+  return get_string(base + data_offset, row);
+}
+
+uint64_t columnar_file::check_strings(uint64_t offset, const char *&list,
+                                      uint64_t count) const {
+  // uint64 count, uint64 offsets[count + 1], then the characters.
+  if (offset == 0 || offset % 8 != 0 || offset + 8 > size || count >= size / 8) {
+    return 0;
+  }
+  const uint64_t *numbers = reinterpret_cast<const uint64_t *>(base + offset);
+  uint64_t chars_offset = offset + 8 + 8 * (count + 1);
+
+  if (numbers[0] != count || chars_offset > size || numbers[1] != 0) {
+    return 0;
+  }
+
+  // The offsets can't go backwards or past the end of the file.
+  for (uint64_t i = 1; i <= count; i++) {
+    if (numbers[i + 1] < numbers[i]) {
+      return 0;
+    }
+  }
+  uint64_t end = chars_offset + align8(numbers[count + 1]);
+  if (numbers[count + 1] > size || end > size) {
+    return 0;
+  }
+
+  list = base + offset;
+  return end;
+}
+
+text_ref columnar_file::get_string(const char *list, size_t index) const {
+  const uint64_t *numbers = reinterpret_cast<const uint64_t *>(list);
+  const char *chars = list + 8 + 8 * (numbers[0] + 1);
+
+  text_ref str = {chars + numbers[index + 1], numbers[index + 2] - numbers[index + 1]};
+  return str;
+}
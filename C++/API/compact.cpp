@@ -0,0 +1,496 @@
+#include "include/compact.h"
+
+#include <cmath>
+#include <cstring>
+
+static const char base64_chars[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Writes bits straight out as base64 text, 6 at a time, so the bits never
+// need a buffer of their own.
+class bit_writer {
+public:
+  explicit bit_writer(std::string &out) : out(out), buffer(0), used(0), bits(0) {}
+
+  // Writes the lowest count bits of value (count can be 1 to 64).
+  void write(uint64_t value, int count) {
+    if (count > 32) {
+      write(value >> 32, count - 32);
+      count = 32;
+    }
+    value &= (1ULL << count) - 1;
+
+    buffer = (buffer << count) | value;
+    used += count;
+    bits += count;
+    while (used >= 6) {
+      used -= 6;
+      out += base64_chars[(buffer >> used) & 63];
+    }
+  }
+
+  void write_varint(uint64_t value) {
+    while (value >= 0x80) {
+      write((value & 0x7F) | 0x80, 8);
+      value >>= 7;
+    }
+    write(value, 8);
+  }
+
+  // Pads to a whole byte, then to a whole base64 group with '='.
+  void finish() {
+    if (bits % 8 != 0) {
+      write(0, 8 - bits % 8);
+    }
+    if (used > 0) {
+      out += base64_chars[(buffer << (6 - used)) & 63];
+      used = 0;
+    }
+    for (size_t bytes = bits / 8; bytes % 3 != 0; bytes++) {
+      out += '=';
+    }
+  }
+
+private:
+  std::string &out;
+  uint64_t buffer;      // Bits not written out yet are the lowest used bits.
+  int used;
+  size_t bits;          // Bits written so far
+};
+
+// Reads the bits of decoded base64.
+class bit_reader {
+public:
+  explicit bit_reader(const std::string &bytes) : bytes(bytes), pos(0) {}
+
+  bool read(int count, uint64_t &value) {
+    if (pos + count > bytes.size() * 8) {
+      return false;
+    }
+    value = 0;
+    for (int i = 0; i < count; i++, pos++) {
+      unsigned char byte = bytes[pos / 8];
+      value = (value << 1) | ((byte >> (7 - pos % 8)) & 1);
+    }
+    return true;
+  }
+
+  bool read_varint(uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint64_t byte;
+      if (!read(8, byte)) {
+        return false;
+      }
+      value |= (byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t bits_left() const {
+    return bytes.size() * 8 - pos;
+  }
+
+private:
+  const std::string &bytes;
+  size_t pos;
+};
+
+static int leading_zeros(uint64_t value) {
+#ifdef __GNUC__
+  return __builtin_clzll(value);
+#else
+  int count = 0;
+  for (uint64_t bit = 1ULL << 63; (value & bit) == 0; bit >>= 1) {
+    count++;
+  }
+  return count;
+#endif
+}
+
+static int trailing_zeros(uint64_t value) {
+#ifdef __GNUC__
+  return __builtin_ctzll(value);
+#else
+  int count = 0;
+  for (uint64_t bit = 1; (value & bit) == 0; bit <<= 1) {
+    count++;
+  }
+  return count;
+#endif
+}
+
+// true if value fits in a two's complement number of bits.
+static bool fits(long long value, int bits) {
+  long long limit = 1LL << (bits - 1);
+  return value >= -limit && value < limit;
+}
+
+// The lowest count bits of value, as a signed number.
+static long long sign_extend(uint64_t value, int count) {
+  if (count < 64 && (value >> (count - 1)) != 0) {
+    value |= ~0ULL << count;
+  }
+  return static_cast<long long>(value);
+}
+
+// 10 to the power of 0 - 9. Nanoseconds per unit of a timestamp with that
+// many digits after the seconds is powers_of_ten[9 - digits].
+static const long long powers_of_ten[] = {
+  1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+  100000000LL, 1000000000LL
+};
+
+// Writes integers as the change in the difference between them (see
+// compact.h). Unsigned math, so huge jumps wrap around instead of
+// overflowing. The reader wraps them back the same way.
+class delta_writer {
+public:
+  explicit delta_writer(bit_writer &writer)
+    : writer(writer), previous(0), delta(0), first(true) {}
+
+  void write(long long value) {
+    if (first) {
+      writer.write(value, 64);
+      previous = value;
+      first = false;
+      return;
+    }
+
+    uint64_t new_delta = static_cast<uint64_t>(value) - previous;
+    long long change = static_cast<long long>(new_delta - delta);
+    previous = value;
+    delta = new_delta;
+
+    if (change == 0) {
+      writer.write(0, 1);
+    } else if (fits(change, 12)) {
+      writer.write(2, 2);
+      writer.write(change, 12);
+    } else if (fits(change, 20)) {
+      writer.write(6, 3);
+      writer.write(change, 20);
+    } else if (fits(change, 32)) {
+      writer.write(14, 4);
+      writer.write(change, 32);
+    } else {
+      writer.write(15, 4);
+      writer.write(change, 64);
+    }
+  }
+
+private:
+  bit_writer &writer;
+  uint64_t previous, delta;
+  bool first;
+};
+
+class delta_reader {
+public:
+  explicit delta_reader(bit_reader &reader)
+    : reader(reader), previous(0), delta(0), first(true) {}
+
+  bool read(long long &value) {
+    uint64_t bits;
+
+    if (first) {
+      if (!reader.read(64, bits)) {
+        return false;
+      }
+      first = false;
+    } else {
+      // Count the 1s before the first 0 (at most 4) to get the size.
+      static const int sizes[] = {0, 12, 20, 32, 64};
+      int ones = 0;
+      uint64_t bit = 1;
+      while (ones < 4 && bit == 1) {
+        if (!reader.read(1, bit)) {
+          return false;
+        }
+        ones += static_cast<int>(bit);
+      }
+
+      uint64_t change = 0;
+      if (ones != 0) {
+        if (!reader.read(sizes[ones], change)) {
+          return false;
+        }
+        change = static_cast<uint64_t>(sign_extend(change, sizes[ones]));
+      }
+      delta += change;
+      bits = previous + delta;
+    }
+
+    previous = bits;
+    value = static_cast<long long>(bits);
+    return true;
+  }
+
+private:
+  bit_reader &reader;
+  uint64_t previous, delta;
+  bool first;
+};
+
+// true if value is exactly some integer / 10^digits, the integer being
+// small enough for a double to hold exactly.
+static bool is_decimal(double value, int digits, long long &integer) {
+  double scaled = value * powers_of_ten[digits];
+  if (!(std::fabs(scaled) < 9007199254740992.0)) {     // 2^53, also catches NaN
+    return false;
+  }
+  integer = std::llround(scaled);
+  double back = static_cast<double>(integer) / powers_of_ten[digits];
+  return memcmp(&back, &value, sizeof value) == 0;     // -0.0 isn't 0.0 here
+}
+
+// The fewest digits after the point (up to 9) that every value can be written
+// with exactly, or -1 if there aren't any. Most sensors give values like
+// 21.3, which the XOR encoding doesn't do well with.
+static int decimal_digits(const double *values, size_t count) {
+  int digits = 0;
+  long long integer;
+
+  for (size_t i = 0; i < count; i++) {
+    while (!is_decimal(values[i], digits, integer)) {
+      if (++digits > 9) {
+        return -1;
+      }
+    }
+  }
+
+  // Values checked before digits went up are checked again.
+  for (size_t i = 0; i < count; i++) {
+    if (!is_decimal(values[i], digits, integer)) {
+      return -1;
+    }
+  }
+  return digits;
+}
+
+void compact_encode(std::string &out, const double *values, size_t count) {
+  bit_writer writer(out);
+  int digits = decimal_digits(values, count);
+
+  if (digits >= 0) {
+    writer.write(COMPACT_DECIMALS, 8);
+    writer.write(digits, 8);
+    writer.write_varint(count);
+
+    delta_writer integers(writer);
+    long long integer;
+    for (size_t i = 0; i < count; i++) {
+      is_decimal(values[i], digits, integer);
+      integers.write(integer);
+    }
+    writer.finish();
+    return;
+  }
+
+  writer.write(COMPACT_NUMBERS, 8);
+  writer.write_varint(count);
+
+  uint64_t previous = 0;
+  int leading = -1, trailing = 0;       // The window of the last '11'
+
+  for (size_t i = 0; i < count; i++) {
+    uint64_t bits;
+    memcpy(&bits, &values[i], sizeof bits);
+
+    if (i == 0) {
+      writer.write(bits, 64);
+      previous = bits;
+      continue;
+    }
+
+    uint64_t change = bits ^ previous;
+    previous = bits;
+    if (change == 0) {
+      writer.write(0, 1);
+      continue;
+    }
+
+    int zeros = leading_zeros(change);
+    int zeros_after = trailing_zeros(change);
+    if (zeros > 31) {
+      zeros = 31;                       // Only 5 bits to save it in
+    }
+
+    if (leading >= 0 && zeros >= leading && zeros_after >= trailing) {
+      writer.write(2, 2);
+      writer.write(change >> trailing, 64 - leading - trailing);
+    } else {
+      int length = 64 - zeros - zeros_after;
+      writer.write(3, 2);
+      writer.write(zeros, 5);
+      writer.write(length & 63, 6);
+      writer.write(change >> zeros_after, length);
+      leading = zeros;
+      trailing = zeros_after;
+    }
+  }
+  writer.finish();
+}
+
+void compact_encode(std::string &out, const long long *times, size_t count, int digits) {
+  digits = digits < 0 ? 0 : (digits > 9 ? 9 : digits);
+  long long unit = powers_of_ten[9 - digits];
+
+  bit_writer writer(out);
+  writer.write(COMPACT_TIMESTAMPS, 8);
+  writer.write(digits, 8);
+  writer.write_varint(count);
+
+  delta_writer integers(writer);
+  for (size_t i = 0; i < count; i++) {
+    long long time = times[i] / unit;
+    if (times[i] % unit < 0) {
+      time--;                           // Round down before 1970 too
+    }
+    integers.write(time);
+  }
+  writer.finish();
+}
+
+// Turns base64 text back into bytes. Returns false if it isn't base64.
+static bool decode_base64(const std::string &text, std::string &bytes) {
+  if (text.size() % 4 != 0) {
+    return false;
+  }
+  bytes.clear();
+  bytes.reserve(text.size() / 4 * 3);
+
+  uint32_t buffer = 0;
+  int used = 0;
+  size_t padding = 0;
+
+  for (size_t i = 0; i < text.size(); i++) {
+    const char *found = strchr(base64_chars, text[i]);
+
+    if (text[i] == '=' && i + 2 >= text.size()) {
+      padding++;
+      continue;
+    }
+    if (found == NULL || text[i] == '\0' || padding != 0) {
+      return false;
+    }
+    buffer = (buffer << 6) | (found - base64_chars);
+    used += 6;
+    if (used >= 8) {
+      used -= 8;
+      bytes += static_cast<char>((buffer >> used) & 0xFF);
+    }
+  }
+  return true;
+}
+
+bool compact_decode(const std::string &text, std::vector<double> &values) {
+  std::string bytes;
+  if (!decode_base64(text, bytes)) {
+    return false;
+  }
+
+  bit_reader reader(bytes);
+  uint64_t type, digits = 0, count;
+  if (!reader.read(8, type) || (type != COMPACT_NUMBERS && type != COMPACT_DECIMALS) ||
+      (type == COMPACT_DECIMALS && (!reader.read(8, digits) || digits > 9)) ||
+      !reader.read_varint(count) || count > reader.bits_left()) {
+    return false;                       // Every value takes at least one bit.
+  }
+
+  values.clear();
+  values.reserve(count);
+
+  if (type == COMPACT_DECIMALS) {
+    delta_reader integers(reader);
+    long long integer;
+    for (uint64_t i = 0; i < count; i++) {
+      if (!integers.read(integer)) {
+        return false;
+      }
+      values.push_back(static_cast<double>(integer) / powers_of_ten[digits]);
+    }
+    return true;
+  }
+
+  uint64_t previous = 0;
+  int leading = -1, trailing = 0;
+
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t bits, flag;
+
+    if (i == 0) {
+      if (!reader.read(64, bits)) {
+        return false;
+      }
+    } else {
+      if (!reader.read(1, flag)) {
+        return false;
+      }
+      bits = previous;
+
+      if (flag == 1) {
+        uint64_t kind, change;
+        if (!reader.read(1, kind)) {
+          return false;
+        }
+        if (kind == 1) {
+          uint64_t zeros, length;
+          if (!reader.read(5, zeros) || !reader.read(6, length)) {
+            return false;
+          }
+          length = (length == 0) ? 64 : length;
+          if (zeros + length > 64) {
+            return false;
+          }
+          leading = zeros;
+          trailing = 64 - zeros - length;
+        } else if (leading < 0) {
+          return false;                 // '10' before any '11'
+        }
+        if (!reader.read(64 - leading - trailing, change)) {
+          return false;
+        }
+        bits ^= change << trailing;
+      }
+    }
+
+    double value;
+    memcpy(&value, &bits, sizeof value);
+    values.push_back(value);
+    previous = bits;
+  }
+  return true;
+}
+
+bool compact_decode(const std::string &text, std::vector<long long> &times, int &digits) {
+  std::string bytes;
+  if (!decode_base64(text, bytes)) {
+    return false;
+  }
+
+  bit_reader reader(bytes);
+  uint64_t type, digit_count, count;
+  if (!reader.read(8, type) || type != COMPACT_TIMESTAMPS || !reader.read(8, digit_count) ||
+      digit_count > 9 || !reader.read_varint(count) || count > reader.bits_left()) {
+    return false;
+  }
+  digits = static_cast<int>(digit_count);
+  long long unit = powers_of_ten[9 - digits];
+
+  times.clear();
+  times.reserve(count);
+  delta_reader integers(reader);
+  long long time;
+
+  for (uint64_t i = 0; i < count; i++) {
+    if (!integers.read(time)) {
+      return false;
+    }
+    times.push_back(time * unit);
+  }
+  return true;
+}
@@ -0,0 +1,177 @@
+#include "include/coroutines.h"
+
+// Empty unless the compiler has coroutines (see coroutines.h).
+#ifdef ISENSE_COROUTINES
+
+// Results are saved before they're tested: GCC 12 destroys the task awaited
+// in an if condition before it's done.
+
+async_iSENSE::async_iSENSE(iSENSE &api, request_reactor &reactor)
+  : api(api), reactor(reactor) {}
+
+http_awaiter async_iSENSE::get() {
+  iSENSE *target = &api;
+  request_reactor *loop = &reactor;
+  return http_awaiter{[target, loop](std::function<void(int)> done) {
+    target->start_get(*loop, done);
+  }, 0, false, false};
+}
+
+http_awaiter async_iSENSE::upload() {
+  iSENSE *target = &api;
+  request_reactor *loop = &reactor;
+  return http_awaiter{[target, loop](std::function<void(int)> done) {
+    target->start_upload(*loop, done);
+  }, 0, false, false};
+}
+
+isense_task<bool> async_iSENSE::get_project_fields() {
+  if (!api.fields_request()) {
+    co_return false;
+  }
+  api.http_code = co_await get();
+
+  if (!api.check_http_code(api.http_code, "get_projects_fields()")) {
+    co_return false;
+  }
+  co_return api.parse_project_fields(api.json_str);
+}
+
+// Fields that are in already are saved, otherwise they're pulled down again
+// here (waiting for the other thread would block).
+isense_task<bool> async_iSENSE::fields_in() {
+  if (!api.pending_project) {
+    co_return true;
+  }
+  if (api.fields_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+    api.wait_for_fields();
+    co_return true;
+  }
+  co_return co_await get_project_fields();
+}
+
+isense_task<bool> async_iSENSE::get_datasets_and_mediaobjects() {
+  if (api.project_ID == EMPTY || api.project_ID.empty()) {
+    std::cerr << "\nError in method: get_datasets_and_mediaobjects()\n";
+    std::cerr << "\nPlease set a project ID!\n";
+    co_return false;
+  }
+
+  // The fields come with the datasets, so any still on the way are dropped.
+  api.drop_fields();
+  api.get_URL = api.project_URL + "?recur=true";
+  api.http_code = co_await get();
+
+  if (!api.check_http_code(api.http_code, "get_datasets_and_mediaobjects()")) {
+    co_return false;
+  }
+  co_return api.parse_datasets_and_mediaobjects(api.json_str);
+}
+
+isense_task<std::vector<std::string> > async_iSENSE::get_dataset(std::string dataset_name,
+                                                                 std::string field_name) {
+  if (api.project_ID == EMPTY || api.project_ID.empty()) {
+    std::cerr << "\n\nError in method: get_dataset(string, string)\n";
+    std::cerr << "Please set a project ID!\n";
+    co_return std::vector<std::string>();
+  }
+  bool found = co_await get_datasets_and_mediaobjects();
+  if (!found) {
+    std::cerr << "\n\nError in method: get_dataset(string, string)\n";
+    std::cerr << "Failed to get datasets.\n";
+    co_return std::vector<std::string>();
+  }
+  co_return api.read_dataset(dataset_name, field_name);
+}
+
+isense_task<bool> async_iSENSE::post_json_key() {
+  return post(POST_KEY, "", "post_json_key()");
+}
+
+isense_task<bool> async_iSENSE::post_json_email() {
+  return post(POST_EMAIL, "", "post_json_email()");
+}
+
+isense_task<bool> async_iSENSE::append_key_byID(std::string dataset_ID) {
+  return post(APPEND_KEY, dataset_ID, "append_key_byID");
+}
+
+isense_task<bool> async_iSENSE::append_email_byID(std::string dataset_ID) {
+  return post(APPEND_EMAIL, dataset_ID, "append_email_byID()");
+}
+
+isense_task<bool> async_iSENSE::append_key_byName(std::string dataset_name) {
+  return append_byName(APPEND_KEY, dataset_name, "append_key_byName()");
+}
+
+isense_task<bool> async_iSENSE::append_email_byName(std::string dataset_name) {
+  return append_byName(APPEND_EMAIL, dataset_name, "append_email_byName()");
+}
+
+// Ends a coroutine upload when the task is done with it, or destroyed first.
+struct async_upload_end {
+  iSENSE &api;
+  ~async_upload_end() {
+    api.end_async_upload();
+  }
+};
+
+// Same steps as post_json_key / append_key_byID and post_data_function. The
+// dataset ID is only set once the task runs. No lock is held while the
+// request runs: async_upload makes the blocking uploads (and the flush
+// thread) wait, and a second coroutine upload of the same object fails.
+isense_task<bool> async_iSENSE::post(int type, std::string dataset_ID, std::string method) {
+  if (!api.empty_project_check(type, method)) {
+    co_return false;
+  }
+  bool ready = co_await fields_in();
+  if (!ready) {
+    co_return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> uploading(api.upload_lock);
+    if (api.async_upload) {
+      std::cerr << "\nError in method: " << method << "\n";
+      std::cerr << "Another upload of this object is still running.\n";
+      co_return false;
+    }
+    api.async_upload = true;
+
+    if (!dataset_ID.empty()) {
+      api.set_dataset_ID(dataset_ID);
+    }
+    bool append = (type == APPEND_KEY || type == APPEND_EMAIL);
+    api.upload_URL = append ? api.append_URL : api.project_upload_URL;
+    api.format_post(type);
+  }
+  async_upload_end end{api};
+
+  long code = co_await upload();
+  api.http_code = code;
+  api.post_sent(code);
+  co_return api.check_http_code(code, method);
+}
+
+isense_task<bool> async_iSENSE::append_byName(int type, std::string dataset_name,
+                                              std::string method) {
+  if (!api.empty_project_check(type, method)) {
+    co_return false;
+  }
+
+  // See iSENSE::append_key_byName.
+  std::string dataset_ID = api.known_dataset_ID(dataset_name);
+  if (dataset_ID == GET_ERROR) {
+    co_await get_datasets_and_mediaobjects();
+    dataset_ID = api.get_dataset_ID(dataset_name);
+  }
+
+  if (dataset_ID == GET_ERROR) {
+    api.dataset_name_error(method);
+    co_return false;
+  }
+  co_return co_await post(type, dataset_ID,
+                          type == APPEND_KEY ? "append_key_byID" : "append_email_byID()");
+}
+
+#endif
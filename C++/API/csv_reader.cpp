@@ -0,0 +1,202 @@
+#include "include/csv_reader.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+std::string csv_cell::str() const {
+  if (!quoted) {
+    return std::string(data, length);
+  }
+
+  std::string result;
+  result.reserve(length);
+  for (size_t i = 0; i < length; i++) {
+    result += data[i];
+    if (data[i] == '"' && i + 1 < length && data[i + 1] == '"') {
+      i++;                        // "" is one quote
+    }
+  }
+  return result;
+}
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool csv_cell::number(const char *&start, size_t &count) const {
+  const char *first = data;
+  const char *last = data + length;
+
+  while (first < last && (*first == ' ' || *first == '\t')) {
+    first++;
+  }
+  while (last > first && (last[-1] == ' ' || last[-1] == '\t')) {
+    last--;
+  }
+
+  // [+-] digits [. digits] [e [+-] digits], with at least one digit before
+  // the exponent.
+  const char *c = first;
+  if (c < last && (*c == '-' || *c == '+')) {
+    c++;
+  }
+  const char *digits = c;
+  while (c < last && is_digit(*c)) {
+    c++;
+  }
+  size_t num_digits = c - digits;
+  if (c < last && *c == '.') {
+    digits = ++c;
+    while (c < last && is_digit(*c)) {
+      c++;
+    }
+    num_digits += c - digits;
+  }
+  if (num_digits == 0) {
+    return false;
+  }
+  if (c < last && (*c == 'e' || *c == 'E')) {
+    c++;
+    if (c < last && (*c == '-' || *c == '+')) {
+      c++;
+    }
+    digits = c;
+    while (c < last && is_digit(*c)) {
+      c++;
+    }
+    if (c == digits) {
+      return false;
+    }
+  }
+  if (c != last) {
+    return false;
+  }
+
+  start = first;
+  count = last - first;
+  return true;
+}
+
+csv_reader::csv_reader(const char *text, size_t size, char delimiter)
+  : text(text), size(size), pos(0), delimiter(delimiter) {
+  // Skip a UTF-8 byte order mark, which some programs put at the start.
+  if (size >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0) {
+    pos = 3;
+  }
+}
+
+size_t csv_reader::position() const {
+  return pos;
+}
+
+// Most cells are short numbers, but text cells can be long, so the search
+// looks at 16 bytes at a time.
+size_t csv_reader::find_special(size_t start) const {
+  size_t i = start;
+
+#ifdef __SSE2__
+  const __m128i delimiters = _mm_set1_epi8(delimiter);
+  const __m128i carriage_returns = _mm_set1_epi8('\r');
+  const __m128i newlines = _mm_set1_epi8('\n');
+  const __m128i quotes = _mm_set1_epi8('"');
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+    __m128i found = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(block, delimiters), _mm_cmpeq_epi8(block, quotes)),
+      _mm_or_si128(_mm_cmpeq_epi8(block, carriage_returns), _mm_cmpeq_epi8(block, newlines)));
+
+    int mask = _mm_movemask_epi8(found);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; i < size; i++) {
+    char c = text[i];
+    if (c == delimiter || c == '\r' || c == '\n' || c == '"') {
+      return i;
+    }
+  }
+  return size;
+}
+
+bool csv_reader::next_row(std::vector<csv_cell> &cells) {
+  cells.clear();
+
+  while (pos < size && (text[pos] == '\r' || text[pos] == '\n')) {
+    pos++;                        // Blank lines
+  }
+  if (pos >= size) {
+    return false;
+  }
+
+  while (true) {
+    csv_cell cell;
+
+    if (text[pos] == '"') {
+      // Quoted cell, ends at a " that isn't followed by another ".
+      size_t start = ++pos;
+      size_t end = size;          // If the closing quote is missing
+      while (pos < size) {
+        const char *quote = static_cast<const char *>(memchr(text + pos, '"', size - pos));
+        if (quote == NULL) {
+          pos = size;
+          break;
+        }
+        pos = quote - text + 1;
+        if (pos < size && text[pos] == '"') {
+          pos++;
+          continue;
+        }
+        end = pos - 1;
+        break;
+      }
+      cell.data = text + start;
+      cell.length = end - start;
+      cell.quoted = true;
+
+      // Anything between the closing quote and the delimiter is ignored.
+      while (pos < size && text[pos] != delimiter && text[pos] != '\r' && text[pos] != '\n') {
+        pos++;
+      }
+    } else {
+      // A quote in the middle of a cell is just a character.
+      size_t end = find_special(pos);
+      while (end < size && text[end] == '"') {
+        end = find_special(end + 1);
+      }
+      cell.data = text + pos;
+      cell.length = end - pos;
+      cell.quoted = false;
+      pos = end;
+    }
+    cells.push_back(cell);
+
+    if (pos >= size) {
+      return true;
+    }
+    if (text[pos] == delimiter) {
+      pos++;
+      if (pos == size) {
+        csv_cell empty = {text + pos, 0, false};
+        cells.push_back(empty);   // The row ends with an empty cell
+        return true;
+      }
+      continue;
+    }
+
+    // End of the row: \n, \r\n or \r
+    if (text[pos] == '\r') {
+      pos++;
+    }
+    if (pos < size && text[pos] == '\n') {
+      pos++;
+    }
+    return true;
+  }
+}
@@ -0,0 +1,240 @@
+#include "include/downsampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Average of a bucket of values (LTTB).
+static double average(const std::vector<double> &values) {
+  double total = 0;
+  for (size_t i = 0; i < values.size(); i++) {
+    total += values[i];
+  }
+  return total / values.size();
+}
+
+downsampler::downsampler() {
+  method = DOWNSAMPLE_NONE;
+  window = 1;
+  deadband = 0;
+  pushed = kept = 0;
+  times = false;
+  reset();
+}
+
+downsampler::downsampler(int method, size_t window, double deadband) {
+  this->method = method;
+  this->window = window == 0 ? 1 : window;
+  this->deadband = deadband;
+  pushed = kept = 0;
+  times = false;
+  reset();
+}
+
+size_t downsampler::push(double value, double *ready) {
+  size_t count = add(value, ready);
+  pushed++;
+  kept += count;
+  return count;
+}
+
+size_t downsampler::push(long long value, long long *ready) {
+  times = true;
+  if (!have_base) {
+    base = value;
+    have_base = true;
+  }
+
+  double offsets[DOWNSAMPLE_MAX_READY];
+  size_t count = push(static_cast<double>(value - base), offsets);
+
+  for (size_t i = 0; i < count; i++) {
+    ready[i] = base + std::llround(offsets[i]);
+  }
+  return count;
+}
+
+size_t downsampler::finish(double *ready) {
+  size_t count = drain(ready);
+  kept += count;
+  reset();
+  return count;
+}
+
+size_t downsampler::finish(long long *ready) {
+  long long first = base;         // finish() starts over, which clears base
+  double offsets[DOWNSAMPLE_MAX_READY];
+  size_t count = finish(offsets);
+
+  for (size_t i = 0; i < count; i++) {
+    ready[i] = first + std::llround(offsets[i]);
+  }
+  return count;
+}
+
+void downsampler::reset() {
+  base = 0;
+  have_base = false;
+  total = 0;
+  count = 0;
+  last_kept = 0;
+  any_kept = false;
+  current.clear();
+  next.clear();
+  kept_x = kept_y = 0;
+  position = 0;
+  started = false;
+}
+
+bool downsampler::has_times() const {
+  return times;
+}
+
+size_t downsampler::values_in() const {
+  return pushed;
+}
+
+size_t downsampler::values_out() const {
+  return kept;
+}
+
+size_t downsampler::add(double value, double *ready) {
+  switch (method) {
+    case DOWNSAMPLE_MEAN:
+    case DOWNSAMPLE_MIN:
+    case DOWNSAMPLE_MAX:
+      if (count == 0) {
+        total = value;
+      } else if (method == DOWNSAMPLE_MEAN) {
+        total += value;
+      } else if (method == DOWNSAMPLE_MIN) {
+        total = std::min(total, value);
+      } else {
+        total = std::max(total, value);
+      }
+
+      if (++count < window) {
+        return 0;
+      }
+      return drain(ready);
+
+    case DOWNSAMPLE_DEADBAND:
+      // Written this way round so a NaN is always kept.
+      if (any_kept && std::fabs(value - last_kept) <= deadband) {
+        return 0;
+      }
+      last_kept = value;
+      any_kept = true;
+      ready[0] = value;
+      return 1;
+
+    case DOWNSAMPLE_LTTB:
+      if (!started) {
+        started = true;
+        kept_x = position++;
+        kept_y = value;
+        ready[0] = value;
+        return 1;
+      }
+
+      if (next.capacity() == 0) {
+        current.reserve(window);
+        next.reserve(window);
+      }
+      next.push_back(value);
+      position++;
+
+      if (next.size() < window) {
+        return 0;
+      }
+      if (current.empty()) {
+        current.swap(next);
+        return 0;
+      }
+
+      // current is picked from now that the bucket after it is known.
+      {
+        double next_x = position - next.size();
+        double current_x = next_x - current.size();
+        size_t best = pick(&current[0], current.size(), current_x,
+                           next_x + (next.size() - 1) / 2.0, average(next));
+        kept_x = current_x + best;
+        kept_y = current[best];
+        ready[0] = kept_y;
+      }
+      current.swap(next);
+      next.clear();
+      return 1;
+
+    default:
+      ready[0] = value;
+      return 1;
+  }
+}
+
+// Writes out what's waiting, without starting over.
+size_t downsampler::drain(double *ready) {
+  switch (method) {
+    case DOWNSAMPLE_MEAN:
+    case DOWNSAMPLE_MIN:
+    case DOWNSAMPLE_MAX:
+      if (count == 0) {
+        return 0;
+      }
+      ready[0] = (method == DOWNSAMPLE_MEAN) ? total / count : total;
+      count = 0;
+      return 1;
+
+    case DOWNSAMPLE_LTTB: {
+      // The last value is always kept. If two buckets are waiting the first
+      // is picked from as usual, otherwise the bucket is picked from using
+      // the last value as the next bucket.
+      if (current.empty() && next.empty()) {
+        return 0;
+      }
+      double next_x = position - next.size();
+      double current_x = next_x - current.size();
+      const std::vector<double> &bucket = current.empty() ? next : current;
+      double bucket_x = current.empty() ? next_x : current_x;
+
+      size_t ready_count = 0;
+      if (!current.empty() && !next.empty()) {
+        size_t best = pick(&current[0], current.size(), current_x,
+                           next_x + (next.size() - 1) / 2.0, average(next));
+        ready[ready_count++] = current[best];
+        ready[ready_count++] = next.back();
+      } else {
+        if (bucket.size() > 1) {
+          size_t best = pick(&bucket[0], bucket.size() - 1, bucket_x,
+                             position - 1, bucket.back());
+          ready[ready_count++] = bucket[best];
+        }
+        ready[ready_count++] = bucket.back();
+      }
+
+      current.clear();
+      next.clear();
+      return ready_count;
+    }
+
+    default:
+      return 0;
+  }
+}
+
+size_t downsampler::pick(const double *values, size_t size, double first_x,
+                         double cx, double cy) const {
+  size_t best = 0;
+  double best_area = -1;
+
+  for (size_t i = 0; i < size; i++) {
+    // Twice the triangle's area, which picks the same value.
+    double x = first_x + i;
+    double area = std::fabs((kept_x - cx) * (values[i] - kept_y) -
+                            (kept_x - x) * (cy - kept_y));
+    if (area > best_area) {
+      best_area = area;
+      best = i;
+    }
+  }
+  return best;
+}
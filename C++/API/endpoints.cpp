@@ -0,0 +1,82 @@
+#include "include/endpoints.h"
+
+// Weight of a new time in the averages. Recent times count the most, so a
+// server that slows down loses its requests quickly.
+static const double LATENCY_WEIGHT = 0.3;
+
+endpoint_set::endpoint_set(const std::vector<std::string> &api_URLs) {
+  for (size_t i = 0; i < api_URLs.size(); i++) {
+    endpoint current;
+    current.api_URL = api_URLs[i];
+    current.latency = 0;
+    current.timed = false;
+    endpoints.push_back(current);
+  }
+}
+
+size_t endpoint_set::size() const {
+  return endpoints.size();
+}
+
+const std::string &endpoint_set::api_URL(size_t endpoint) const {
+  return endpoints[endpoint].api_URL;
+}
+
+size_t endpoint_set::find(const std::string &url) const {
+  for (size_t i = 0; i < endpoints.size(); i++) {
+    if (url.compare(0, endpoints[i].api_URL.size(), endpoints[i].api_URL) == 0) {
+      return i;
+    }
+  }
+  return endpoints.size();
+}
+
+size_t endpoint_set::pick(const std::vector<bool> &tried) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  size_t best = endpoints.size(), down = endpoints.size();
+
+  for (size_t i = 0; i < endpoints.size(); i++) {
+    if (tried[i]) {
+      continue;
+    }
+    const endpoint &current = endpoints[i];
+
+    if (current.down_until > now) {
+      if (down == endpoints.size() || current.down_until < endpoints[down].down_until) {
+        down = i;
+      }
+    } else if (best == endpoints.size() || current.latency < endpoints[best].latency) {
+      best = i;
+    }
+  }
+  return best != endpoints.size() ? best : down;
+}
+
+void endpoint_set::succeeded(size_t endpoint, double seconds) {
+  std::lock_guard<std::mutex> guard(lock);
+  struct endpoint &current = endpoints[endpoint];
+  current.down_until = std::chrono::steady_clock::time_point();
+
+  if (seconds >= 0) {
+    current.latency = current.timed ? current.latency + LATENCY_WEIGHT * (seconds - current.latency)
+                                    : seconds;
+    current.timed = true;
+  }
+}
+
+void endpoint_set::failed(size_t endpoint) {
+  std::lock_guard<std::mutex> guard(lock);
+  endpoints[endpoint].down_until = std::chrono::steady_clock::now() +
+                                   std::chrono::seconds(ENDPOINT_RETRY_SECONDS);
+}
+
+bool endpoint_set::healthy(size_t endpoint) {
+  std::lock_guard<std::mutex> guard(lock);
+  return endpoints[endpoint].down_until <= std::chrono::steady_clock::now();
+}
+
+double endpoint_set::latency_ms(size_t endpoint) {
+  std::lock_guard<std::mutex> guard(lock);
+  return endpoints[endpoint].latency * 1000;
+}
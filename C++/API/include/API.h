@@ -11,15 +11,39 @@
 #endif
 
 #include "picojson/picojson.h"
+#include "json_parser.h"
+#include "thread_pool.h"
+#include "downsampler.h"
+#include "endpoints.h"
+#include "spill.h"
+#include "transport.h"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <map>
+#include <set>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <ctime>
 
 // For picojson
 using namespace picojson;
 
+// Used by import_file (see columnar.h and csv_reader.h)
+class columnar_file;
+class csv_reader;
+struct csv_cell;
+
+// Used by the coroutine interface (see coroutines.h and reactor.h)
+class request_reactor;
+
 // Currently only rSENSE is supported. In the future, allow switching between dev and live.
 const std::string dev_baseURL = "http://rsense-dev.cs.uml.edu";
 const std::string devURL = "http://rsense-dev.cs.uml.edu/api/v1";
@@ -32,6 +56,10 @@ const std::string liveURL = "https://isenseproject.org/api/v1";
 const int GET_NORMAL = 1;
 const int GET_QUIET = 2;
 
+// JSON parsing constants (see set_parse_backend)
+const int PARSE_PICOJSON = 1;
+const int PARSE_FAST = 2;
+
 // POST related constants
 const int POST_KEY = 1;
 const int APPEND_KEY = 2;
@@ -43,6 +71,7 @@ const int HTTP_AUTHORIZED = 200;
 const int HTTP_UNAUTHORIZED = 401;
 const int HTTP_NOT_FOUND = 404;
 const int HTTP_CONFLICT = 409;
+const int HTTP_RANGE_NOT_SATISFIABLE = 416;
 const int HTTP_UNPROC_ENTRY = 422;
 const int CURL_ERROR = -1;
 
@@ -50,16 +79,179 @@ const int CURL_ERROR = -1;
 const std::string GET_ERROR = "ERROR";
 const std::string EMPTY = "-----";
 
+// Size of the char buffers used by format_number / format_integer.
+const int NUMBER_BUFFER_SIZE = 32;
+
+// Rows uploaded per request by import_file (see set_import_chunk_rows)
+const size_t IMPORT_CHUNK_ROWS = 50000;
+
+// How long email / password checks are cached (see set_credential_cache_ttl)
+const long CREDENTIAL_CACHE_SECONDS = 300;
+
+// When set_project_ID gets the project's fields (see set_fields_mode).
+const int FIELDS_NOW = 0;           // Right away, set_project_ID waits for them
+const int FIELDS_LAZY = 1;          // The first time they are needed
+const int FIELDS_BACKGROUND = 2;    // On another thread, started right away
+
+// HTTP/2 mode (see set_http2): the most HTTP/1.1 connections kept open to
+// one server, when it doesn't speak HTTP/2.
+const long SHARED_HOST_CONNECTIONS = 4;
+
+// Default timeouts (see set_timeouts).
+const long CONNECT_TIMEOUT_MS = 10000;
+const long STALL_SECONDS = 60;
+
+// What probe_endpoints asks each endpoint for (after the API URL).
+const std::string PROBE_PATH = "/projects?per_page=1";
+
+// Most media objects download_media downloads at once.
+const long MEDIA_TRANSFERS = 4;
+
+// What get_dataset queries a server can take in the dataset URL, listed in
+// the project's "dataQueries". QUERY_FIELDS is fields=ID,ID, QUERY_WINDOW
+// is time_field=ID&start=&end= (ISO 8601) and QUERY_ROWS is offset= and
+// limit= or last=. iSENSE lists none.
+const std::string QUERY_FIELDS = "fields";
+const std::string QUERY_WINDOW = "window";
+const std::string QUERY_ROWS = "rows";
+
+// Dataset sync (see sync_datasets). The manifest is kept in the columnar
+// file's path plus SYNC_MANIFEST, and at most SYNC_TRANSFERS datasets are
+// downloaded at once.
+const std::string SYNC_MANIFEST = ".manifest";
+const long SYNC_TRANSFERS = 8;
+
+// Project cache (see prefetch_projects). How long projects are kept (by
+// default only while they are being fetched), and the most connections
+// prefetch_projects opens to one server.
+const long PROJECT_CACHE_SECONDS = 0;
+const long PREFETCH_CONNECTIONS = 8;
+
+// Auto flush (see set_flush_policy). Numbers are counted as this many bytes
+// of upload, and a failed upload is tried again after FLUSH_RETRY_MS.
+const size_t PENDING_NUMBER_BYTES = 16;
+const long FLUSH_RETRY_MS = 1000;
+
+// push_range converts other iterators' values to doubles this many at a time.
+const size_t PUSH_RANGE_CHUNK = 256;
+
+/*  Timestamps (see push_timestamp). The number of digits after the seconds:
+ *  2011-10-08T07:07:09Z, 2011-10-08T07:07:09.123Z, and so on.                 */
+const int TIMESTAMP_SECONDS = 0;
+const int TIMESTAMP_MILLISECONDS = 3;
+const int TIMESTAMP_MICROSECONDS = 6;
+const int TIMESTAMP_NANOSECONDS = 9;
+
+// Size of the char buffers for timestamps, and the part before the fraction.
+const int TIMESTAMP_BUFFER_SIZE = 32;
+const size_t TIMESTAMP_PREFIX_SIZE = sizeof "2011-10-08T07:07:09" - 1;
+const long long NANOSECONDS_PER_SECOND = 1000000000LL;
+
+// Field types, as iSENSE numbers them ("type" in the fields array)
+const int FIELD_TIMESTAMP = 1;
+const int FIELD_NUMBER = 2;
+const int FIELD_TEXT = 3;
+const int FIELD_LATITUDE = 4;
+const int FIELD_LONGITUDE = 5;
+
+/*  One field's data, from every dataset in a project (see get_all_datasets).
+ *  Number, latitude and longitude fields are converted to doubles and saved in
+ *  numbers (NaN where a row has no number). Text and timestamp fields are
+ *  saved as strings in text. Only one of the two vectors is used.             */
+struct dataset_column {
+  std::string field_name;
+  std::string field_ID;
+  int field_type;                   // FIELD_NUMBER, FIELD_TEXT, etc.
+  std::string unit;
+  std::vector<double> numbers;
+  std::vector<std::string> text;
+};
+
+/*  Data from all datasets in a project, one column per field.
+ *  The rows of each dataset follow each other, in the order of the datasets.
+ *  Dataset i has rows dataset_starts[i] up to (not including)
+ *  dataset_starts[i + 1]. dataset_starts has one more entry than there are
+ *  datasets, the last one being the total number of rows.                     */
+struct dataset_table {
+  std::vector<std::string> dataset_IDs;
+  std::vector<std::string> dataset_names;
+  std::vector<size_t> dataset_starts;
+  std::vector<dataset_column> columns;
+};
+
+/*  Which rows of a dataset get_dataset returns. Rows whose time_field is
+ *  outside [start, end) are left out first (rows without a time too, if
+ *  a window is set). Then offset rows are skipped and at most limit rows
+ *  kept, or only the last rows are kept if last isn't 0.
+ *  Times are read with parse_timestamp: ISO 8601 strings in UTC or with an
+ *  offset from it. Other times (such as numbers of seconds) count as rows
+ *  without a time.                                                          */
+struct dataset_query {
+  std::string time_field;           // Timestamp field name, "" for no window
+  long long start, end;             // Nanoseconds since 1970
+  size_t offset;
+  size_t limit;                     // 0 for no limit
+  size_t last;                      // 0 for all
+
+  dataset_query() : start(LLONG_MIN), end(LLONG_MAX), offset(0), limit(0), last(0) {}
+};
+
+// What sync_datasets did with the project's datasets.
+struct sync_counts {
+  size_t kept;                      // Unchanged, copied from the old file
+  size_t changed;                   // New or changed
+  size_t downloaded;                // Changed ones pulled down (in parallel)
+  size_t removed;                   // In the old file, not in the project
+};
+
+/*  Timeouts and cancelling for an iSENSE object's requests (see
+ *  set_timeouts). Shared with the requests running on other threads.       */
+struct request_limits {
+  std::atomic<long> connect_ms, call_ms, stall_seconds;
+  std::atomic<long> cancels;        // cancel() calls so far
+  std::atomic<long> timeouts;       // Requests that ran out of time
+};
+
+/*  What an iSENSE object's requests share. Copied into the requests that
+ *  run on other threads.                                                  */
+struct request_context {
+  std::shared_ptr<http_transport> transport;  // See set_http2, NULL when off
+  std::shared_ptr<request_limits> limits;     // See set_timeouts, never NULL
+  std::shared_ptr<endpoint_set> endpoints;    // See set_endpoints, NULL if unset
+};
+
+/*  A media object (a picture, an audio clip...) attached to a project or one
+ *  of its datasets, see get_media_objects.                                    */
+struct media_object {
+  std::string ID;
+  std::string name;
+  std::string type;           // mediaType, such as "image"
+  std::string URL;            // Where to download it from
+  std::string dataset_ID;     // Empty if it is attached to the project
+};
+
+// A field of a typed schema (see schema.h): its name and type (FIELD_NUMBER...).
+struct schema_field {
+  const char *name;
+  int field_type;
+};
+
 class iSENSE {
 public:
   // Constructors
   iSENSE();
   iSENSE(std::string proj_ID, std::string proj_title,
-         std::string label, std::string contr_key);
+         std::string label, std::string contr_key,
+         int fields_mode = FIELDS_NOW);
 
   // Destructor for cleaning up stuff.
   ~iSENSE();
 
+  // An iSENSE object can't be copied: it owns locks, the auto flush thread
+  // and its connections. Make one per project and pass it by reference.
+  iSENSE(const iSENSE &) = delete;
+  iSENSE &operator=(const iSENSE &) = delete;
+
   // Similar to the constructor with parameters, but called after
   // the object is created. This way you can change the title/project ID/etc.
   void set_project_all(std::string proj_ID, std::string proj_title,
@@ -68,6 +260,69 @@ public:
   // These can be used to manually project data. Be sure to set a contributor
   // key or email / password as well!
   void set_project_ID(std::string proj_ID);
+
+  /*  By default set_project_ID (and the constructor with parameters) pulls the
+   *  project's fields off iSENSE before returning, which takes a round trip
+   *  (or the whole curl timeout when offline). FIELDS_LAZY only saves the
+   *  project ID, and the fields are pulled down the first time something
+   *  needs them. FIELDS_BACKGROUND starts pulling them down on another thread.
+   *  Set this (or pass it to the constructor) before the project ID. Changing
+   *  the base URL afterwards starts over with the new server (a fetch that
+   *  the constructor started from the default server is dropped).           */
+  void set_fields_mode(int mode);
+
+  /*  Becomes true once the fields are in, false if they couldn't be pulled
+   *  down. Waiting on it gets them with FIELDS_LAZY, so start many objects
+   *  with FIELDS_BACKGROUND and then wait for them all.                      */
+  std::shared_future<bool> fields_ready();
+
+  // Which server to use, rSENSE (dev_baseURL) by default. For example
+  // live_baseURL, or a test server such as "http://127.0.0.1:8080".
+  void set_base_URL(std::string base_URL);
+
+  /*  Several servers with the same projects, such as a local mirror and
+   *  live_baseURL, most preferred first. Each request goes to the fastest
+   *  healthy one (see endpoints.h), timed by the requests already made. When
+   *  a server can't be reached the request moves on to the next one. Reads
+   *  also move on after errors and 5xx answers, uploads only when nothing
+   *  was sent, so a dataset is never made twice. set_base_URL goes back to
+   *  a single server.                                                       */
+  void set_endpoints(std::vector<std::string> base_URLs);
+
+  /*  Times every endpoint with a small request (PROBE_PATH), all at once.
+   *  Healthy ones that answer first get the requests after that. Returns
+   *  true if any of them answered. Probing is manual: nothing calls this in
+   *  the background, so call it again now and then if the servers' speeds
+   *  change (in between, the requests made keep the timings up to date).    */
+  bool probe_endpoints();
+
+  /*  HTTP/2 mode. All of this object's requests (including ones made at the
+   *  same time by the auto flush thread or FIELDS_BACKGROUND) share one
+   *  connection per server, asking for HTTP/2 so they are multiplexed on it.
+   *  Servers that don't speak HTTP/2 get HTTP/1.1 on kept alive connections.
+   *  Off by default: every request opens its own connection. Turn it on
+   *  before starting auto flush.                                           */
+  void set_http2(bool enabled);
+
+  /*  Timeouts, so a server that stops answering can't hang a call.
+   *  connect_ms limits connecting to the server. call_ms limits a whole call,
+   *  such as post_json_key or set_project_ID: calls made up of many requests
+   *  (append_key_byName gets the datasets, then uploads) share it. Transfers
+   *  that send or receive nothing for stall_seconds are dropped. 0 means no
+   *  limit. The defaults are CONNECT_TIMEOUT_MS, no call limit and
+   *  STALL_SECONDS. Requests made outside of a call (by the auto flush thread
+   *  or FIELDS_BACKGROUND) get call_ms each.                                  */
+  void set_timeouts(long connect_ms, long call_ms, long stall_seconds);
+
+  // Sets call_ms for the next call made on this thread, such as
+  // api.with_timeout(500).post_json_key().
+  iSENSE &with_timeout(long ms);
+
+  // Stops the requests running now, from any thread. Their calls fail.
+  void cancel();
+
+  // How many requests ran out of time (or stalled) so far.
+  long get_timeout_count();
   void set_project_title(std::string proj_title);
   void set_contributor_key(std::string proj_key);
   void set_project_label(std::string proj_label);
@@ -76,7 +331,50 @@ public:
   // Returns true if the email / password are valid, or false if they are not.
   bool set_email_password(std::string proj_email, std::string proj_password);
 
+  /*  Chooses how JSON pulled off iSENSE is parsed:
+   *    PARSE_PICOJSON (default) - picojson::parse
+   *    PARSE_FAST - the SSE2 two stage parser in json_parser.h. Much faster for
+   *                 big projects (get_datasets_and_mediaobjects), and falls
+   *                 back to picojson if it has any trouble with the JSON.       */
+  void set_parse_backend(int backend);
+
   void clear_data();    // Resets the object and clears the map.
+
+  // Clears only the data that was pushed back. The project ID, title,
+  // key / email and fields are kept.
+  void clear_upload_data();
+
+  /*  Incremental mode, for programs that keep adding rows to the same dataset.
+   *  After every successful post / append the rows that were sent are removed
+   *  (and their memory freed), so the next append only sends the rows pushed
+   *  back since then. If an upload fails nothing is removed, and the rows are
+   *  sent again with the next one. The append_*_byName functions also stop
+   *  pulling down every dataset on each call, once they know the dataset ID.
+   *  Off by default.                                                          */
+  void set_incremental_append(bool enabled);
+
+  /*  Compact uploads. Number and timestamp fields are sent as a compact
+   *  binary column (see compact.h) instead of JSON text, which is several
+   *  times smaller for sensor data. Only used if the server says it can read
+   *  them when the fields are pulled down, otherwise plain JSON is sent.
+   *  Off by default.                                                          */
+  void set_compact_upload(bool enabled);
+
+  /*  Memory budget, for programs that may be offline for a long time. Once
+   *  the pushed back data takes more than bytes of memory, the biggest
+   *  fields' rows are moved to segment files in directory (see spill.h)
+   *  until it takes half of that. They are read back a segment at a time
+   *  while the upload is sent (the upload string doesn't hold them either),
+   *  and the files are deleted once their rows are dropped (incremental
+   *  mode, auto flush) or cleared. Fields with spilled rows are sent as
+   *  JSON arrays, not compact columns. 0 (the default) means no limit. If a
+   *  segment can't be written the error is printed and the budget is turned
+   *  off, so nothing is lost.                                                */
+  void set_memory_budget(size_t bytes, std::string directory = ".");
+
+  // Bytes of pushed back data in memory, and in segment files.
+  size_t get_resident_bytes();
+  size_t get_spilled_bytes();
   void debug();         // For debugging, this method dumps all the data.
 
   /*  This function will push data back to the map.
@@ -87,22 +385,120 @@ public:
    *  Note: this function merely pushes a single piece of data to the map.
    *  If you want to add more than one string of data, you should used either
    *  a loop or create a vector of strings and push that back to the object
-   *  using the push_vector function below.                                      */
-  void push_back(std::string field_name, std::string data);
+   *  using the push_vector function below.
+   *  Data pushed back to a name that isn't one of the project's fields is
+   *  dropped when the upload string is made (a note is printed the first
+   *  time), since it can never be uploaded.                                      */
+  void push_back(const std::string &field_name, std::string data);
 
   /* Add a field name / vector of strings (data) to the map.
    * See above notes. Behaves similar to the push_back function.
-   * Also if you push a vector back, it makes a copy of the vector and saves it
-   * in the map. You will need to use the push_back function to add more data!   */
-  void push_vector(std::string field_name, std::vector<std::string> data);
+   * Also if you push a vector back, it replaces the field's data with it. Pass
+   * it with std::move to hand it over without copying, otherwise a copy is
+   * saved. You will need to use the push_back function to add more data!      */
+  void push_vector(const std::string &field_name, std::vector<std::string> data);
+
+  /* Numbers can be pushed back without converting them to strings first.
+   * They are saved as numbers and only turned into text when the upload string
+   * is made, which is much faster than calling std::to_string on each one.
+   * A field should hold either numbers or strings. If strings are pushed to a
+   * field that has numbers (or the other way around), the numbers are turned
+   * into strings, so the order of the data is kept.
+   * NaN and infinity have no JSON number, they are uploaded as empty values
+   * (""), the same as a blank cell.                                             */
+  void push_back(const std::string &field_name, double data);
+  void push_vector(const std::string &field_name, std::vector<double> data);
+  void push_vector(const std::string &field_name, std::vector<long long> data);
+
+  /* Adds many numbers to the end of a field, like calling push_back for each
+   * one but without a lock / lookup per number. Any iterator of numbers
+   * works (float *, std::deque<int>::iterator...), all under a single lock.
+   * Arrays of doubles are added straight from memory, other values are
+   * converted PUSH_RANGE_CHUNK at a time.                                     */
+  void push_range(const std::string &field_name, const double *begin, const double *end);
+
+  void push_range(const std::string &field_name, double *begin, double *end) {
+    push_range(field_name, static_cast<const double *>(begin),
+               static_cast<const double *>(end));
+  }
+
+  template <class Iterator>
+  void push_range(const std::string &field_name, Iterator begin, Iterator end) {
+    std::lock_guard<std::mutex> guard(data_lock);
+    double chunk[PUSH_RANGE_CHUNK];
+    while (begin != end) {
+      size_t count = 0;
+      for (; count < PUSH_RANGE_CHUNK && begin != end; ++begin) {
+        chunk[count++] = static_cast<double>(*begin);
+      }
+      add_numbers(field_name, chunk, chunk + count);
+    }
+  }
 
   // Note: only returns the timestamp, does not add it to the map.
   std::string generate_timestamp(void);
 
+  // Same as above, but thread safe and without allocating any memory.
+  // Writes the current time with digits after the seconds (TIMESTAMP_SECONDS,
+  // TIMESTAMP_MILLISECONDS, ...) into a buffer of TIMESTAMP_BUFFER_SIZE.
+  // Returns the length, the buffer is not null terminated.
+  static size_t generate_timestamp(char *buffer, int digits);
+
+  // The current time, in nanoseconds since 1970-01-01 UTC.
+  static long long timestamp_now();
+
+  /*  Timestamp fields can be given raw times instead of strings. The times
+   *  (nanoseconds since 1970-01-01 UTC, or now) are saved as numbers and only
+   *  formatted when the upload string is made, with set_timestamp_digits
+   *  digits after the seconds (default TIMESTAMP_MILLISECONDS).
+   *  Much faster than generate_timestamp for fast sensors.                    */
+  void push_timestamp(const std::string &field_name);
+  void push_timestamp(const std::string &field_name, long long nanoseconds);
+  void set_timestamp_digits(int digits);
+
+  /*  Downsampling, for fast signals that only need to be plotted. Numbers and
+   *  timestamps pushed back to the field go through a downsampler (see
+   *  downsampler.h) before they are saved, so fewer rows are uploaded.
+   *  setting is the window (values pushed per value kept) for DOWNSAMPLE_MEAN,
+   *  DOWNSAMPLE_MIN, DOWNSAMPLE_MAX and DOWNSAMPLE_LTTB, or the deadband for
+   *  DOWNSAMPLE_DEADBAND. DOWNSAMPLE_NONE turns it off. Strings aren't
+   *  downsampled.
+   *  Each field is downsampled on its own, so rows only stay lined up if the
+   *  fields use the same window (a timestamp field with DOWNSAMPLE_MEAN gets
+   *  the middle of each window). Values waiting for a window to fill up are
+   *  saved when a post / append is made, or when auto flush stops.
+   *  Returns false if the method or setting isn't valid.                      */
+  bool set_downsampling(std::string field_name, int method, double setting);
+
+  // Values pushed back to a downsampled field for each value kept, so 10 means
+  // a tenth of the values are uploaded. 1 if the field isn't downsampled, 0 if
+  // nothing has been kept yet.
+  double get_reduction_ratio(std::string field_name);
+
   // iSENSE API functions
   bool get_check_user();      // Verifies email / password.
+
+  /*  Email / password checks (set_email_password, get_check_user) are cached
+   *  for every iSENSE object in the program, so a program that makes many
+   *  objects with the same account only asks iSENSE once. If objects check
+   *  the same account at the same time, one asks and the rest wait for it.
+   *  Results are kept for seconds (default CREDENTIAL_CACHE_SECONDS), 0 turns
+   *  the cache off. An upload that gets HTTP 401 removes the account from
+   *  the cache, in case the password was changed.                            */
+  static void set_credential_cache_ttl(long seconds);
   bool get_project_fields();  // GETs fields off iSENSE
 
+  /*  Pulls down many projects at once, in parallel over shared connections,
+   *  and caches them for every iSENSE object in the program. set_project_ID /
+   *  get_project_fields then get the fields from the cache instead of asking
+   *  iSENSE. If objects ask for the same project at the same time (prefetched
+   *  or not), only one request is made and they all share the parsed result.
+   *  Finished projects are kept for set_project_cache_ttl seconds (default
+   *  PROJECT_CACHE_SECONDS, 0 keeps nothing), so prefetching needs a TTL.
+   *  Returns false if any of the projects couldn't be pulled down.            */
+  bool prefetch_projects(std::vector<std::string> project_IDs);
+  static void set_project_cache_ttl(long seconds);
+
   // This function grabs fields, datasets, media objects and owner information
   // Saves these arrays into picojson arrays.
   bool get_datasets_and_mediaobjects();
@@ -113,8 +509,97 @@ public:
   // Return a vector of data given a field name
   std::vector<std::string> get_dataset(std::string dataset_name, std::string field_name);
 
-  // Future: return a map of media objects
-  // map<std::string, vector<std::string>> get_media_objects();
+  /*  Same, for only the rows the query picks (see dataset_query above).
+   *  The project page is used to find the dataset, and only that dataset is
+   *  pulled down. The field, time window and row range are sent along in
+   *  the URL to servers that list them in the project's "dataQueries"
+   *  (QUERY_FIELDS, QUERY_WINDOW, QUERY_ROWS). The rest are picked out as
+   *  the dataset is read, so rows that aren't returned are never parsed.
+   *  Servers that don't list the datasets on the project page get the old
+   *  way (get_datasets_and_mediaobjects) with the query applied after.    */
+  std::vector<std::string> get_dataset(std::string dataset_name, std::string field_name,
+                                       const dataset_query &query);
+
+  /*  Returns the data for the given field names from ALL datasets, as numbers
+   *  or strings depending on the field type (see dataset_table above).
+   *  An empty vector of field names returns every field.
+   *  The datasets are split up between threads (see set_thread_count), which
+   *  is much faster than calling get_dataset for each dataset and field.
+   *  If the project's datasets have not been pulled down yet (or the project
+   *  or server changed since), this pulls them down. Otherwise the ones
+   *  already pulled down are used: call get_datasets_and_mediaobjects first
+   *  to get the latest. On errors the table returned has no columns.          */
+  dataset_table get_all_datasets(std::vector<std::string> field_names);
+
+  // Number of threads used by get_all_datasets. 0 (default) is one per core.
+  void set_thread_count(int threads);
+
+  /*  Saves the data for the given field names from ALL datasets to a columnar
+   *  file (see columnar.h), which can be memory mapped with columnar_file.
+   *  Field names work the same as get_all_datasets.
+   *  Returns false if the data could not be pulled down or the file written. */
+  bool export_datasets(std::string path, std::vector<std::string> field_names);
+
+  /*  Keeps a columnar file of ALL fields and datasets (as export_datasets
+   *  writes it) up to date, pulling down only the datasets that changed.
+   *  The project page lists the datasets without their data; a manifest
+   *  next to the file (path + SYNC_MANIFEST) has a signature of each listing
+   *  from the last sync. Datasets with the same signature are copied from the
+   *  old file, new or changed ones are downloaded (SYNC_TRANSFERS at a time)
+   *  and deleted ones are left out. The first sync, or one after the fields
+   *  change, downloads everything.
+   *  The file and manifest are only replaced once everything is in, so a
+   *  failed sync leaves the last one as it was. counts (if not NULL) is set
+   *  to what happened to the datasets. Returns false on errors.             */
+  bool sync_datasets(std::string path, sync_counts *counts = NULL);
+
+  /*  Uploads a file of data from disk as a new dataset, named with the project
+   *  title. The file can be CSV (the first row has the field names, the
+   *  delimiter can be a comma, tab or semicolon) or a columnar file made by
+   *  export_datasets. Columns are matched to the project's fields by name,
+   *  other columns are skipped. Number cells that aren't numbers are uploaded
+   *  as empty.
+   *  The file is memory mapped and uploaded in chunks (set_import_chunk_rows):
+   *  the first chunk makes the dataset and the rest are appended to it, so
+   *  files bigger than the RAM can be imported. Nothing is added to the map.
+   *  post_type is POST_KEY or POST_EMAIL (a key or email / password must be
+   *  set, the same as for post_json_key / post_json_email).                    */
+  bool import_file(std::string path, int post_type);
+
+  // Rows uploaded per request by import_file. Default is IMPORT_CHUNK_ROWS.
+  void set_import_chunk_rows(size_t rows);
+
+  /*  Auto flush - uploads pushed back data for you.
+   *
+   *  The data is uploaded once max_rows rows, about max_bytes bytes of JSON,
+   *  or max_ms milliseconds have built up since the oldest row that hasn't
+   *  been uploaded, whichever comes first (0 turns a limit off).
+   *  start_auto_flush starts a thread that does the uploads. The first upload
+   *  makes a new dataset (post_type is POST_KEY or POST_EMAIL) and the rest
+   *  are appended to it. Only rows that haven't been uploaded are sent, and
+   *  they are removed once iSENSE has them. Failed uploads are tried again.
+   *  The push functions can be called from any thread while it runs, but
+   *  don't call the post / append functions yourself.
+   *  stop_auto_flush (or the destructor) uploads what's left and stops the
+   *  thread. flush() uploads right away.                                      */
+  void set_flush_policy(size_t max_rows, size_t max_bytes, long max_ms);
+  bool start_auto_flush(int post_type);
+  bool stop_auto_flush();
+  bool flush();
+
+  /*  Media objects attached to the project and its datasets.
+   *  upload_media streams a file off the disk (it's memory mapped, never read
+   *  in as a whole) and attaches it to the project, or to the dataset if a
+   *  name is given. post_type is POST_KEY or POST_EMAIL.
+   *  download_media streams a media object into a file descriptor. Given many,
+   *  it downloads MEDIA_TRANSFERS at a time into a directory, each file named
+   *  ID_name. Files are written to ID_name.part first: a download that was cut
+   *  off carries on where it stopped (with a range request), and files that
+   *  are already there are skipped.                                           */
+  std::vector<media_object> get_media_objects();
+  bool upload_media(std::string path, int post_type, std::string dataset_name = "");
+  bool download_media(const media_object &media, int fd);
+  bool download_media(const std::vector<media_object> &media, std::string directory);
 
   bool post_json_email();          // Post using a email / password
   bool post_json_key();            // Post using contributor key
@@ -143,15 +628,219 @@ public:
   std::string get_dataset_ID(std::string dataset_name);
   std::string get_field_ID(std::string field_name);
 
+  // Same as get_dataset_ID, but doesn't print an error if there isn't one.
+  std::string find_dataset_ID(const std::string &dataset_name);
+
+  // Removes this object's email / password from the credential cache.
+  void forget_credentials();
+
   // Error methods - makes error checking simple.
-  bool empty_project_check(int type, std::string method);
-  bool check_http_code(int http_code, std::string method);
+  // need_data = false skips checking that data has been pushed back.
+  bool empty_project_check(int type, std::string method, bool need_data = true);
+  static bool check_http_code(int http_code, std::string method);
+
+  // Saves the fields_array field IDs as strings (see field_IDs below).
+  void save_field_IDs();
+
+  // Checks if the server can read compact uploads (see set_compact_upload).
+  void save_upload_encodings();
+
+  // Removes the rows sent by the last upload (see set_incremental_append).
+  void drop_sent_rows();
+
+  // Removes the rows pushed back to names that aren't fields of the project,
+  // which can never be uploaded. Prints a note the first time for each name.
+  // Does nothing if the fields aren't in.
+  void drop_unknown_fields();
+
+  // Memory budget helpers (data_lock held). spill_rows moves rows to segment
+  // files until the data fits in half the budget, resident_size works out
+  // the memory the data takes and rows_of is a field's rows (with spilled).
+  void spill_rows();
+  size_t resident_size() const;
+  size_t rows_of(const std::string &field_name) const;
+
+  // Formats a field that has spilled rows into the upload string: a
+  // spilled_part for the rows on disk, then the rows in memory. Returns the
+  // number of rows.
+  size_t format_spilled(const std::string &field_name, const std::string &field_ID);
+
+  // Formats a spilled segment into buffer, after a comma if comma is set.
+  // Returns false if the segment can't be read back.
+  bool format_segment(std::string &buffer, const std::string &field_name, size_t index,
+                      bool comma) const;
+
+  // libcurl functions that send upload_str with the spilled parts read back
+  // into it (see upload_request). Only rewinding to the start is supported.
+  static size_t read_upload(char *data, size_t size, size_t nmemb, void *api);
+  static int seek_upload(void *api, curl_off_t offset, int origin);
+
+  // Auto flush helpers. count_pending is called by the push functions, with
+  // the number of strings added (for the memory budget). flush_due says if
+  // the flush policy wants an upload (data_lock held).
+  void count_pending(size_t field_rows, size_t bytes, size_t strings = 0);
+  bool flush_due(std::chrono::steady_clock::time_point now);
+
+  // Most rows any field has waiting, in memory or spilled (data_lock held).
+  size_t waiting_rows() const;
+  void auto_flush_loop();
+
+  // Saves a number / time (after downsampling) to the field. data_lock held.
+  void add_number(const std::string &field_name, double data);
+  void add_time(const std::string &field_name, long long nanoseconds);
+
+  // Same as push_range for doubles, with data_lock held.
+  void add_numbers(const std::string &field_name, const double *begin, const double *end);
+
+  // Saves the values waiting in the downsamplers (data_lock held).
+  void finish_downsampling();
+
+  // Turns the numbers saved for a field into strings in map_data.
+  void numbers_to_text(const std::string &field_name);
+  void timestamps_to_text(const std::string &field_name);
+
+  // Parses JSON with the backend chosen by set_parse_backend().
+  // Returns the error message, or an empty string if there were no errors.
+  std::string parse_json(value &out, const std::string &json);
+
+  // Parses a project's JSON (as returned by /projects/ID) and saves the fields.
+  bool parse_project_fields(std::string project_json);
+
+  // Saves the fields of the project in get_data.
+  bool save_project_fields();
+
+  // Gets a project off iSENSE, or from the project cache (see
+  // prefetch_projects). Only uses its arguments, so it can run on another
+  // thread. NULL if that failed (the errors are printed for method).
+  static std::shared_ptr<const value> load_project(std::string url, int backend,
+                                                   request_context context,
+                                                   std::string method);
+
+  // The transport, limits and endpoints this object's requests use.
+  request_context context() const;
+
+  // Works out the project's URLs, after the project ID or server changed.
+  void save_URLs();
+
+  // Deferred fields (see set_fields_mode). start_fields starts getting the
+  // project's fields (on another thread if background is true),
+  // wait_for_fields saves them once they're in and drop_fields throws them away.
+  void start_fields(bool background);
+  void wait_for_fields();
+  void drop_fields();
+
+  // Same as above for /projects/ID?recur=true, also saves the datasets,
+  // media objects and owner info.
+  bool parse_datasets_and_mediaobjects(std::string project_json);
+
+  // Converts the data in one dataset's rows into the table columns.
+  // Used by get_all_datasets, one call per piece of work given to a thread.
+  static void extract_rows(const array &rows, size_t first, size_t last,
+                           size_t table_row, dataset_table &table);
+
+  // An empty table column for fields_array[field].
+  dataset_column field_column(size_t field) const;
+
+  // Used by sync_datasets. Pulls down the data of each dataset ID (in
+  // parallel) into data, as parsed JSON arrays. Returns false if any failed.
+  bool download_datasets(const std::vector<std::string> &dataset_IDs,
+                         std::vector<value> &data);
 
   // This formats the upload string
   void format_upload_string(int post_type);
 
-  // This formats one FIELD ID : DATA pair
-  void format_data(std::vector<std::string> *vect, array::iterator it, std::string field_ID);
+  // Starts the upload string, everything before the data (title, key, etc.)
+  void format_upload_start(int post_type);
+
+  // The same, up to and including "data":{ (and the encoding before it).
+  // Returns true if the data is to be written as compact columns.
+  bool format_data_start(int post_type);
+
+  /*  Used by import_file. Formats the next chunk of rows from a CSV file or
+   *  columnar file into the upload string, for the fields in columns (the
+   *  column of each field in fields_array, -1 for none - see match_columns).
+   *  cells is kept between calls so its memory gets reused.
+   *  Returns the number of rows formatted, 0 at the end of the file.           */
+  size_t format_csv_rows(csv_reader &reader, const std::vector<int> &columns,
+                         std::vector<std::vector<csv_cell> > &cells, int post_type);
+  size_t format_columnar_rows(const columnar_file &file, size_t first,
+                              const std::vector<int> &columns, int post_type);
+
+  // Matches a file's column names to fields_array. Empty if nothing matches.
+  std::vector<int> match_columns(const std::vector<std::string> &names);
+
+  // Uploads a chunk made by the above. The first makes the dataset, the rest
+  // are appended to it. method is the name used in error messages.
+  bool upload_chunk(bool first, std::string method);
+
+  /*  Typed schemas (see schema.h). bind_schema checks the schema's fields
+   *  against the project's (pulling them down if they aren't in yet) and
+   *  saves the field ID of each in IDs. The project's other fields are
+   *  written to rest, as empty arrays that go after the schema's columns.
+   *  upload_columns uploads the data that format writes (compact says if
+   *  it can write compact columns, digits is set_timestamp_digits) as a new
+   *  dataset for POST_KEY / POST_EMAIL, or appended to dataset_name for
+   *  APPEND_KEY / APPEND_EMAIL.                                             */
+  bool bind_schema(const std::vector<schema_field> &schema,
+                   std::vector<std::string> &IDs, std::string &rest);
+  bool upload_columns(int post_type, std::string dataset_name,
+                      const std::function<void(std::string &, bool, int)> &format,
+                      std::string method);
+
+  // The server and project the fields are for (bind_schema's IDs only fit
+  // that project).
+  std::string get_project_URL();
+
+  // Returns the upload string made by format_upload_string (JSON text).
+  // Rows spilled to disk are read back into it, so with a memory budget the
+  // whole upload is in memory afterwards.
+  const std::string &get_upload_string();
+
+  // This formats one "FIELD ID":[DATA] pair onto the end of the buffer.
+  static void format_data(std::string &buffer, const std::vector<std::string> &vect,
+                          const std::string &field_ID);
+
+  // Same as above, for a field that holds numbers.
+  static void format_data(std::string &buffer, const std::vector<double> &vect,
+                          const std::string &field_ID);
+
+  // The values of the above, without the field ID and brackets. A comma is put
+  // before them unless they are the first in the array.
+  static void format_values(std::string &buffer, const std::string *text, size_t count);
+  static void format_values(std::string &buffer, const double *values, size_t count);
+  static void format_values(std::string &buffer, const long long *times, size_t count,
+                            int digits);
+
+  // Adds a string to the buffer as a quoted, escaped JSON string.
+  static void format_json_string(std::string &buffer, const std::string &str);
+  static void format_json_string(std::string &buffer, const char *str, size_t length);
+
+  // Same as above, for a timestamp field (times from push_timestamp).
+  static void format_data(std::string &buffer, const std::vector<long long> &vect,
+                          const std::string &field_ID, int digits);
+
+  // Same as above, as a compact column (see set_compact_upload).
+  static void format_compact(std::string &buffer, const double *values, size_t count,
+                             const std::string &field_ID);
+  static void format_compact(std::string &buffer, const long long *times, size_t count,
+                             const std::string &field_ID, int digits);
+
+  // Writes a timestamp (nanoseconds since 1970) into a char buffer of
+  // TIMESTAMP_BUFFER_SIZE, as ISO 8601 UTC. Returns the length.
+  static size_t format_timestamp(char *buffer, long long nanoseconds, int digits);
+
+  // The other way: reads "YYYY-MM-DDTHH:MM:SS[.fraction]" followed by Z,
+  // nothing (also UTC) or an offset such as +05:30 into nanoseconds since
+  // 1970. Returns false for anything else.
+  static bool parse_timestamp(const char *text, size_t length, long long &nanoseconds);
+  static size_t format_fraction(char *buffer, long long nanoseconds, int digits);
+  static long long floor_divide(long long number, long long divisor);
+
+  // Write a number into a char buffer of NUMBER_BUFFER_SIZE. Returns the length.
+  // Doubles use the shortest text that reads back as the same number. NaN and
+  // infinity write nothing (length 0), so they are uploaded as "".
+  static size_t format_number(char *buffer, double number);
+  static size_t format_integer(char *buffer, long long number);
 
   // This function makes a GET request via libcurl
   int get_data_funct(int get_type);
@@ -159,6 +848,48 @@ public:
   // This function makes a POST request via libcurl
   int post_data_function(int post_type);
 
+  // POSTs the upload string to upload_URL, saves the response in post_response.
+  int send_upload();
+
+  /*  The parts of an upload that the calls above share with the coroutine
+   *  versions (see coroutines.h). format_post makes the upload string,
+   *  upload_request sets up the POST of it (without the URL), upload_done
+   *  cleans that up and returns the HTTP code, and post_sent drops the rows
+   *  iSENSE got. upload_lock is held from format_post to post_sent (or
+   *  async_upload is set, see below).                                        */
+  void format_post(int post_type);
+  CURL *upload_request(struct curl_slist *&headers);
+  long upload_done(CURL *handle, struct curl_slist *headers);
+  void post_sent(long code);
+
+  /*  A coroutine upload doesn't hold upload_lock while it waits for the
+   *  server (it may be resumed on another thread). It sets async_upload
+   *  instead, and end_async_upload clears it. lock_upload takes upload_lock
+   *  for the other uploads once no coroutine upload is running, so they
+   *  mustn't be made on the reactor's thread while one is.                  */
+  std::unique_lock<std::mutex> lock_upload();
+  void end_async_upload();
+
+  // The same for getting the fields, dataset IDs by name and their errors.
+  bool fields_request();
+  std::string known_dataset_ID(std::string dataset_name);
+  void dataset_name_error(std::string method);
+
+  // The ID of the dataset to append to by name, pulling the datasets down if
+  // it isn't known. Prints an error for method and returns GET_ERROR if the
+  // project doesn't have it.
+  std::string append_dataset_ID(std::string dataset_name, std::string method);
+
+  /*  The same two requests without waiting, for the coroutine interface (see
+   *  coroutines.h). The request runs on reactor, and done gets the HTTP code
+   *  from the reactor's run(). Each request gets call_ms, and goes to the
+   *  best endpoint without moving on if that one fails.                      */
+  void start_get(request_reactor &reactor, std::function<void(int)> done);
+  void start_upload(request_reactor &reactor, std::function<void(int)> done);
+
+  // The data of one field in one of the datasets that were pulled down.
+  std::vector<std::string> read_dataset(std::string dataset_name, std::string field_name);
+
   // libcurl function for getting data. See:
   // http://www.velvetcache.org/2008/10/24/better-libcurl-from-c
   static int writeCallback(char* data, size_t size, size_t nmemb, std::string *buffer);
@@ -176,15 +907,43 @@ protected:
   bool append_email_byID(std::string dataset_ID);
 
 private:
-  /*  These two picojson objects will be used to upload to iSENSE.
-   *  The upload_data object contains the entire upload string, in JSON format.
-   *  Picojson can output this to a string and then we can pass that string
-   *  to libcurl.
-   *  The fields_data object is the object that the 'data' part
-   *  contains in the upload_data object.
-   *  Basically it is a bunch of key:values, with the key being the field ID
-   *  and the value being an array of data (numbers/text/GPS coordinates/etc.    */
-  object upload_data, fields_data, owner_info;
+  friend class async_iSENSE;      // The coroutine versions of the calls
+
+  /*  The upload string is written straight into this buffer as JSON text,
+   *  which is then passed to libcurl. Its 'data' part is a bunch of key:values,
+   *  with the key being the field ID and the value being an array of data
+   *  (numbers/text/GPS coordinates/etc.)
+   *  The buffer is cleared but never freed between uploads, so once it has
+   *  grown to the size of an upload, formatting does not allocate any memory.  */
+  std::string upload_str;
+
+  /*  With a memory budget, the rows a field has on disk aren't put in
+   *  upload_str. A spilled_part says where they go, and they are read back
+   *  a segment at a time while the upload is sent (see read_upload), so the
+   *  whole upload is never in memory. streaming is how far it has got.      */
+  struct spilled_part {
+    size_t at;                    // Where in upload_str the rows go
+    std::string field_name;
+    std::vector<size_t> segments; // The segments that could be read back
+    size_t bytes;                 // Length of their rows as JSON
+    bool comma;                   // The field has rows in memory after them
+  };
+  struct upload_stream {
+    size_t text_size;             // Size of upload_str when it was sent
+    size_t text;                  // Bytes of upload_str sent
+    size_t part, segment;         // Next spilled part and segment
+    size_t part_bytes;            // Bytes of the part's rows formatted
+    bool comma_sent;
+    std::string buffer;           // Rows of a segment, or the comma
+    size_t buffer_sent;
+
+    void rewind();
+  };
+  std::vector<spilled_part> spilled_parts;
+  upload_stream streaming;
+
+  // Owner information pulled off iSENSE.
+  object owner_info;
 
   /*  These three objects are the data that is pulled off iSENSE.
    *  The get_data object contains all the data we can pull off of iSENSE
@@ -193,18 +952,95 @@ private:
    *  fields_array has that same data in an array form for iterating through it. */
   value get_data, fields;
   array fields_array, data_sets, media_objects;
+  std::string data_sets_URL;      // project_URL of the project data_sets is from
+
+  /*  The IDs of the fields in fields_array (same order), as strings.
+   *  Saved when the fields are pulled down so that formatting an upload
+   *  does not need to convert every field ID again.                            */
+  std::vector<std::string> field_IDs;
 
   /*  Data to be uploaded to iSENSE. The string is the field name,
    *  the vector of strings contains all the data for that field name.           */
   std::map<std::string, std::vector<std::string> > map_data;
 
+  /*  Same as map_data, for fields that numbers were pushed back to, and for
+   *  fields given times with push_timestamp.
+   *  A field name is only ever in one of the three maps.                        */
+  std::map<std::string, std::vector<double> > number_data;
+  std::map<std::string, std::vector<long long> > timestamp_data;
+  int timestamp_digits;           // Digits after the seconds for timestamp_data
+
+  // Downsampling for the fields that have it (see set_downsampling).
+  std::map<std::string, downsampler> downsamplers;
+
+  /*  Watermarks for incremental mode: the number of rows of each field that
+   *  format_upload_string put in the upload string.                          */
+  std::map<std::string, size_t> sent_rows;
+  bool incremental;
+
+  // Names drop_unknown_fields has printed a note about.
+  std::set<std::string> unknown_fields;
+
+  /*  Deferred fields (see set_fields_mode). The task behind fields_future
+   *  writes the project to pending_project, which is only read once the
+   *  future is ready. pending_project is NULL when nothing is waiting, and
+   *  pending_URL is the project_URL it is for.                           */
+  int fields_mode;
+  std::shared_future<bool> fields_future;
+  std::shared_ptr<std::shared_ptr<const value> > pending_project;
+  std::string pending_URL;
+
+  // Shared connections (see set_http2), NULL when off.
+  std::shared_ptr<http_transport> transport;
+
+  // Timeouts and cancelling (see set_timeouts), never NULL.
+  std::shared_ptr<request_limits> limits;
+
+  // Servers to pick from (see set_endpoints), NULL for just api_URL.
+  std::shared_ptr<endpoint_set> endpoints;
+
+  // Compact uploads: turned on by the user / supported by the server.
+  bool compact_upload, server_compact;
+
+  /*  Memory budget (see set_memory_budget), 0 = no limit. resident_bytes is
+   *  counted up by the push functions and set to resident_size() by
+   *  spill_rows. Rows moved out of memory are kept in spilled. The budget
+   *  is also read by send_upload, which doesn't hold data_lock.             */
+  std::atomic<size_t> memory_budget;
+  size_t resident_bytes;
+  spill_store spilled;
+
+  /*  Auto flush. data_lock guards the pushed back data and the variables
+   *  below, since the flush thread uses them. upload_lock makes sure only one
+   *  upload happens at a time (see lock_upload).                             */
+  std::mutex data_lock, upload_lock;
+  std::condition_variable upload_idle;    // async_upload was cleared
+  bool async_upload;              // A coroutine upload is running
+  std::condition_variable flush_wakeup;   // Wakes the flush thread
+  std::thread flush_thread;
+  size_t pending_rows;            // Most rows any field has waiting
+  size_t pending_bytes;           // Estimated JSON size of the waiting rows
+  std::chrono::steady_clock::time_point first_pending;  // Oldest waiting row
+  std::chrono::steady_clock::time_point retry_time;     // After a failed upload
+  size_t flush_rows, flush_bytes; // Flush policy, 0 = no limit
+  long flush_ms;
+  int flush_post_type;            // POST_KEY or POST_EMAIL
+  bool flush_running;             // The thread has been started
+  bool flush_stop;                // Tells the thread to stop
+  bool flush_posted;              // The dataset has been made, so append
+  std::string flush_dataset_ID;   // to this one
+
   //bool usingDev;            // Whether the user wants iSENSE or rSENSE
                               // (currently not implemented, future idea)
 
   // Data needed for processing the upload request
+  std::string api_URL;            // Base of the API URLs (see set_base_URL)
   std::string get_UserURL;        // URL to test credentials
   std::string get_URL;            // URL to get JSON from
   std::string upload_URL;         // URL to upload JSON to
+  std::string project_URL;        // The URLs below are set by save_URLs
+  std::string project_upload_URL; // jsonDataUpload of the project
+  std::string append_URL;         // data_sets/append
   std::string title;              // title for the dataset
   std::string project_ID;         // project ID of the project
   std::string dataset_ID;         // dataset ID for appending
@@ -220,6 +1056,10 @@ private:
   CURLcode res;                   // curl response code
   long http_code;                 // HTTP status code
   std::string json_str;           // JSON from GET requests
+  std::string post_response;      // Response to the last POST
+  int parse_backend;              // PARSE_PICOJSON or PARSE_FAST
+  int thread_count;               // Threads for get_all_datasets, 0 = per core
+  size_t import_chunk_rows;       // Rows per request for import_file
 };
 
 #endif
@@ -0,0 +1,125 @@
+#ifndef columnar_h
+#define columnar_h
+
+#include "API.h"
+#include "mapped_file.h"
+#include <stdint.h>
+#include <string>
+
+/*  Columnar dataset files.
+ *
+ *  iSENSE::export_datasets() writes the datasets of a project (a dataset_table,
+ *  see get_all_datasets) to a file on disk, one column per field. The
+ *  columnar_file class below memory maps that file, so the data can be used
+ *  again without pulling it off iSENSE or parsing any JSON.
+ *
+ *  File layout. Every number is in the byte order of the machine that wrote
+ *  the file (checked when reading), every section starts on an 8 byte boundary.
+ *
+ *    Header (64 bytes):
+ *      char     magic[8]         COLUMNAR_MAGIC, "iSENSEdb"
+ *      uint32   byte_order       0x01020304
+ *      uint32   version          COLUMNAR_VERSION
+ *      uint64   rows, columns, datasets
+ *      uint64   datasets_offset  Start of the dataset section
+ *      uint64   schema_offset    Start of the schema section
+ *      uint64   file_size
+ *
+ *    Dataset section:
+ *      uint64   dataset_starts[datasets + 1]
+ *      strings  dataset IDs, dataset names
+ *
+ *    Schema section:
+ *      per column: uint32 field_type, uint32 storage, uint64 data_offset
+ *      strings  field IDs, field names, units
+ *
+ *    Column data, at data_offset:
+ *      COLUMN_NUMBERS: double[rows]
+ *      COLUMN_TEXT:    strings (one per row)
+ *
+ *    "strings" is a list of strings:
+ *      uint64 count, uint64 offsets[count + 1], the characters (padded to 8)
+ *      String i is characters offsets[i] up to offsets[i + 1].               */
+
+// The first 8 bytes of every columnar file.
+const char COLUMNAR_MAGIC[] = "iSENSEdb";
+const size_t COLUMNAR_MAGIC_SIZE = 8;
+
+const uint32_t COLUMNAR_VERSION = 1;
+
+// How a column's data is stored
+const uint32_t COLUMN_NUMBERS = 1;
+const uint32_t COLUMN_TEXT = 2;
+
+// Writes a dataset table to a columnar file. Returns false if the file could
+// not be written.
+bool write_columnar_file(const std::string &path, const dataset_table &table);
+
+// A string inside of a columnar_file (not null terminated).
+struct text_ref {
+  const char *data;
+  size_t length;
+
+  std::string str() const { return std::string(data, length); }
+};
+
+/*  Reads a columnar file, by memory mapping it (see mapped_file.h). Nothing is copied - the numbers
+ *  and text point straight into the file, and the OS reads in the parts of the
+ *  file that are used. The pointers are valid until the file is closed.       */
+class columnar_file {
+public:
+  columnar_file();
+  ~columnar_file();
+
+  // Opens (maps) the file. Returns false if the file is missing or broken.
+  bool open(const std::string &path);
+  void close();
+
+  size_t rows() const;
+  size_t columns() const;
+  size_t datasets() const;
+
+  // Dataset i has rows dataset_start(i) up to dataset_start(i + 1).
+  size_t dataset_start(size_t dataset) const;
+  text_ref dataset_ID(size_t dataset) const;
+  text_ref dataset_name(size_t dataset) const;
+
+  // Column info (the schema, taken from the project fields).
+  text_ref field_ID(size_t column) const;
+  text_ref field_name(size_t column) const;
+  text_ref unit(size_t column) const;
+  int field_type(size_t column) const;      // FIELD_NUMBER, FIELD_TEXT, etc.
+  uint32_t storage(size_t column) const;    // COLUMN_NUMBERS or COLUMN_TEXT
+
+  // Returns the column number of a field name, or -1 if there isn't one.
+  int find_column(const std::string &field_name) const;
+
+  // All of a COLUMN_NUMBERS column (rows() doubles), or NULL for text columns.
+  const double *numbers(size_t column) const;
+
+  // One row of a COLUMN_TEXT column (empty for number columns).
+  text_ref text(size_t column, size_t row) const;
+
+private:
+  mapped_file file;
+  const char *base;           // Start of the mapped file
+  size_t size;                // Size of the file
+
+  // Pointers into the file, set up by open()
+  const uint64_t *header;
+  const uint64_t *starts;
+  const char *dataset_IDs, *dataset_names;
+  const char *schema;
+  const char *field_IDs, *field_names, *units;
+
+  // Checks the list of strings at offset has count strings that fit in the
+  // file. Sets list to point at it and returns the offset after it (0 if bad).
+  uint64_t check_strings(uint64_t offset, const char *&list, uint64_t count) const;
+  text_ref get_string(const char *list, size_t index) const;
+
+  // Not copyable.
+  columnar_file(const columnar_file &);
+  columnar_file &operator=(const columnar_file &);
+};
+
+#endif
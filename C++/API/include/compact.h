@@ -0,0 +1,66 @@
+#ifndef compact_h
+#define compact_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*  Compact upload encoding for number and timestamp fields.
+ *
+ *  iSENSE::set_compact_upload turns this on. It is only used with servers
+ *  that list COMPACT_ENCODING in the project's "uploadEncodings" array, any
+ *  other server gets plain JSON. The upload then has "encoding":"isense-
+ *  compact-1", and each number / timestamp field's data is base64 text
+ *  instead of a JSON array. Text fields are always JSON arrays.
+ *
+ *  Sensor data changes slowly and timestamps go up in steps that are nearly
+ *  the same, so most values take a few bits instead of 10 - 25 characters.
+ *  The encoding follows Facebook's Gorilla time series format.
+ *
+ *  The base64 decodes to a stream of bits, most significant bit first, padded
+ *  with 0 bits to a whole byte:
+ *    8 bits    COMPACT_NUMBERS, COMPACT_DECIMALS or COMPACT_TIMESTAMPS
+ *    8 bits    Not for COMPACT_NUMBERS: digits after the point / seconds (0 - 9)
+ *    varint    Number of values, 7 bits per byte, lowest bits first, the top
+ *              bit of a byte set if more bytes follow
+ *
+ *  Decimals are numbers that can all be written exactly with that many digits
+ *  after the point (such as 21.3). They are sent as integers (213) the same
+ *  way as timestamps, which is much smaller than the XOR below.
+ *
+ *  Other numbers (doubles), each XORed with the value before:
+ *    64 bits   The first value
+ *    '0'       Same as the value before
+ *    '10'      The XOR's meaningful bits fit in the window of the last '11'
+ *              (same leading / trailing zeros or more), then those bits
+ *    '11'      5 bits of leading zeros, 6 bits of meaningful bit count
+ *              (0 means 64), then the meaningful bits
+ *
+ *  Timestamps are counted in units of the digits (milliseconds for 3 digits,
+ *  rounded down). Timestamps and decimals are sent as the change in the
+ *  difference between values (the difference before the first one is 0):
+ *    64 bits   The first value
+ *    '0'       Same difference as before
+ *    '10'      12 bits (two's complement)
+ *    '110'     20 bits
+ *    '1110'    32 bits
+ *    '1111'    64 bits                                                      */
+
+const std::string COMPACT_ENCODING = "isense-compact-1";
+const int COMPACT_NUMBERS = 1;
+const int COMPACT_TIMESTAMPS = 2;
+const int COMPACT_DECIMALS = 3;
+
+// Adds the encoded values to the end of out, as base64 (without quotes).
+void compact_encode(std::string &out, const double *values, size_t count);
+
+// Same for timestamps (nanoseconds since 1970), kept to digits after the
+// seconds (TIMESTAMP_SECONDS ... TIMESTAMP_NANOSECONDS, see API.h).
+void compact_encode(std::string &out, const long long *times, size_t count, int digits);
+
+/*  Decoders, for servers and tests. Return false if the text isn't a valid
+ *  column of that type. Timestamps come back in nanoseconds.                  */
+bool compact_decode(const std::string &text, std::vector<double> &values);
+bool compact_decode(const std::string &text, std::vector<long long> &times, int &digits);
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef coroutines_h
+#define coroutines_h
+
+#include "API.h"
+#include "reactor.h"
+
+/*  Coroutine versions of the iSENSE calls, for programs built around an event
+ *  loop. The rest of the API is C++11, this part needs C++20 coroutines
+ *  (-std=c++20), and is left out otherwise. ISENSE_COROUTINES is defined when
+ *  it's there.
+ *
+ *  async_iSENSE wraps an iSENSE object and a request_reactor (see reactor.h).
+ *  Its calls return an isense_task, which another coroutine co_awaits:
+ *
+ *    isense_task<bool> upload(async_iSENSE &client) {
+ *      bool ok = co_await client.post_json_key();
+ *      ...
+ *    }
+ *
+ *  While a call waits for the server the thread running the reactor goes on
+ *  with the other tasks, so one thread can run thousands of them (one iSENSE
+ *  object each, an object still makes one call at a time). The tasks at the
+ *  top are started with start(), then the reactor is run:
+ *
+ *    std::vector<isense_task<bool> > tasks;
+ *    ... tasks.push_back(upload(client)); tasks.back().start(); ...
+ *    reactor.run();          // Returns once every task is done
+ *
+ *  Everything else (pushing data, setting the project...) is done on the iSENSE
+ *  object as usual. Calls without a coroutine version (set_email_password,
+ *  set_project_ID with FIELDS_NOW...) still block the thread.                 */
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define ISENSE_COROUTINES 1
+
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*  A call that hasn't finished yet. Nothing runs until it's awaited (or
+ *  started), and the call goes away with the task.                          */
+template <class T>
+class isense_task {
+public:
+  struct promise_type {
+    T value;
+    std::coroutine_handle<> waiting;    // Resumed when this task is done
+
+    isense_task get_return_object() {
+      return isense_task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    struct final_awaiter {
+      bool await_ready() noexcept {
+        return false;
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> done) noexcept {
+        std::coroutine_handle<> next = done.promise().waiting;
+        return next ? next : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept {
+      return {};
+    }
+
+    void return_value(T result) {
+      value = std::move(result);
+    }
+    void unhandled_exception() {
+      std::terminate();                 // The API doesn't throw.
+    }
+  };
+
+  isense_task(isense_task &&other) noexcept
+    : coroutine(std::exchange(other.coroutine, {})), started(other.started) {}
+
+  ~isense_task() {
+    if (coroutine) {
+      coroutine.destroy();
+    }
+  }
+
+  // co_await runs the task, and gives back its result once it's done.
+  bool await_ready() const noexcept {
+    return false;
+  }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) noexcept {
+    coroutine.promise().waiting = waiting;
+    started = true;
+    return coroutine;
+  }
+  T await_resume() {
+    return std::move(coroutine.promise().value);
+  }
+
+  // For the tasks at the top: start() runs it until it waits for a request,
+  // the reactor does the rest. result() is only there once done() is true.
+  void start() {
+    if (!started) {
+      started = true;
+      coroutine.resume();
+    }
+  }
+  bool done() const {
+    return coroutine.done();
+  }
+  T &result() {
+    return coroutine.promise().value;
+  }
+
+private:
+  explicit isense_task(std::coroutine_handle<promise_type> coroutine)
+    : coroutine(coroutine), started(false) {}
+
+  std::coroutine_handle<promise_type> coroutine;
+  bool started;
+};
+
+/*  Awaits a request started by start (iSENSE::start_get / start_upload),
+ *  which calls back with the HTTP code. Requests that fail before they are
+ *  handed to the reactor call back right away, so that doesn't suspend.    */
+struct http_awaiter {
+  std::function<void(std::function<void(int)>)> start;
+  int code;
+  bool finished, suspended;
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+  bool await_suspend(std::coroutine_handle<> waiting) {
+    finished = suspended = false;
+    start([this, waiting](int result) {
+      code = result;
+      finished = true;
+      if (suspended) {
+        waiting.resume();
+      }
+    });
+    suspended = !finished;
+    return suspended;
+  }
+  int await_resume() const noexcept {
+    return code;
+  }
+};
+
+class async_iSENSE {
+public:
+  // Both have to outlive the calls.
+  async_iSENSE(iSENSE &api, request_reactor &reactor);
+
+  // Same as the iSENSE calls with these names.
+  isense_task<bool> get_project_fields();
+  isense_task<bool> get_datasets_and_mediaobjects();
+  isense_task<std::vector<std::string> > get_dataset(std::string dataset_name,
+                                                     std::string field_name);
+  isense_task<bool> post_json_key();
+  isense_task<bool> post_json_email();
+  isense_task<bool> append_key_byID(std::string dataset_ID);
+  isense_task<bool> append_key_byName(std::string dataset_name);
+  isense_task<bool> append_email_byID(std::string dataset_ID);
+  isense_task<bool> append_email_byName(std::string dataset_name);
+
+private:
+  http_awaiter get();                 // GETs api.get_URL
+  http_awaiter upload();              // POSTs api.upload_str to api.upload_URL
+
+  // The shared parts of the calls above. type is POST_KEY, APPEND_EMAIL...
+  // and dataset_ID is the dataset to append to ("" for new datasets).
+  isense_task<bool> post(int type, std::string dataset_ID, std::string method);
+  isense_task<bool> append_byName(int type, std::string dataset_name, std::string method);
+
+  // Gets the fields if set_project_ID left them for later, without blocking.
+  isense_task<bool> fields_in();
+
+  iSENSE &api;
+  request_reactor &reactor;
+};
+
+#endif
+
+#endif
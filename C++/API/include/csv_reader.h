@@ -0,0 +1,50 @@
+#ifndef csv_reader_h
+#define csv_reader_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*  Splits CSV text (usually a mapped_file) into rows and cells, without
+ *  copying it. Used by iSENSE::import_file.
+ *
+ *  Rows end with \n or \r\n. Cells in double quotes can hold the delimiter,
+ *  new lines and "" (an escaped quote), as in RFC 4180. Everything else is
+ *  taken as is. The delimiter search uses SSE2 when it is available.          */
+
+// One cell of a CSV row. Points into the CSV text.
+struct csv_cell {
+  const char *data;
+  size_t length;
+  bool quoted;        // true if the cell was in quotes (data is inside them)
+
+  // The cell's text, with any "" turned back into ".
+  std::string str() const;
+
+  // true if the cell (ignoring spaces around it) is a plain decimal number,
+  // such as -12, 3.5 or 1.5e-3. Sets start / count to the number's text.
+  bool number(const char *&start, size_t &count) const;
+};
+
+class csv_reader {
+public:
+  csv_reader(const char *text, size_t size, char delimiter = ',');
+
+  // Reads the next row into cells. Returns false when there are no rows left.
+  // Blank lines are skipped.
+  bool next_row(std::vector<csv_cell> &cells);
+
+  // How far into the text the reader is.
+  size_t position() const;
+
+private:
+  const char *text;
+  size_t size;
+  size_t pos;
+  char delimiter;
+
+  // Finds the next delimiter, \r, \n or " at or after start (size if none).
+  size_t find_special(size_t start) const;
+};
+
+#endif
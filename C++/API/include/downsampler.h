@@ -0,0 +1,91 @@
+#ifndef downsampler_h
+#define downsampler_h
+
+#include <cstddef>
+#include <vector>
+
+// Downsampling methods (see iSENSE::set_downsampling)
+const int DOWNSAMPLE_NONE = 0;
+const int DOWNSAMPLE_MEAN = 1;
+const int DOWNSAMPLE_MIN = 2;
+const int DOWNSAMPLE_MAX = 3;
+const int DOWNSAMPLE_LTTB = 4;
+const int DOWNSAMPLE_DEADBAND = 5;
+
+// Most values that can come out of one call to push or finish.
+const size_t DOWNSAMPLE_MAX_READY = 2;
+
+/*  Cuts down the values pushed back to one field before they are uploaded.
+ *  Values go in one at a time and come out as soon as they are ready, so
+ *  only one window of values is kept (two for LTTB), however many are pushed.
+ *
+ *  DOWNSAMPLE_MEAN / MIN / MAX   One value for every window values.
+ *  DOWNSAMPLE_LTTB               One value for every window values, picked by
+ *                                Largest Triangle Three Buckets so a plot of
+ *                                the data keeps its shape (peaks are kept, not
+ *                                averaged away). The x of each value is its
+ *                                position, so the values should be evenly
+ *                                spaced in time. The first value is always kept.
+ *  DOWNSAMPLE_DEADBAND           Only keeps a value if it is more than deadband
+ *                                away from the last value kept. A deadband of
+ *                                0 only drops values that repeat.              */
+class downsampler {
+public:
+  downsampler();
+  downsampler(int method, size_t window, double deadband);
+
+  // Adds a value. The values that are ready to upload are written to ready
+  // (DOWNSAMPLE_MAX_READY of them at most). Returns how many there are.
+  size_t push(double value, double *ready);
+
+  // Same for timestamps (nanoseconds). They are worked out relative to the
+  // first one, so no precision is lost to doubles.
+  size_t push(long long value, long long *ready);
+
+  // Writes out the values still waiting (a window that isn't full yet), then
+  // starts over as if nothing had been pushed.
+  size_t finish(double *ready);
+  size_t finish(long long *ready);
+
+  // Drops the values still waiting and starts over.
+  void reset();
+
+  bool has_times() const;       // true if timestamps were pushed
+  size_t values_in() const;     // Values pushed so far
+  size_t values_out() const;    // Values that came out so far
+
+private:
+  int method;
+  size_t window;
+  double deadband;
+  size_t pushed, kept;
+  bool times;
+
+  long long base;               // First timestamp, see push(long long)
+  bool have_base;
+
+  // MEAN / MIN / MAX: the window so far (total is the min / max for those).
+  double total;
+  size_t count;
+
+  // DEADBAND: the last value kept.
+  double last_kept;
+  bool any_kept;
+
+  // LTTB: the bucket waiting for the next one to fill up, the bucket being
+  // filled, the last value kept (x, y) and the x of the next value.
+  std::vector<double> current, next;
+  double kept_x, kept_y;
+  double position;
+  bool started;
+
+  size_t add(double value, double *ready);
+  size_t drain(double *ready);
+
+  // The index of the value (the first one's x is first_x) that makes the
+  // biggest triangle with the last value kept and (cx, cy).
+  size_t pick(const double *values, size_t size, double first_x,
+              double cx, double cy) const;
+};
+
+#endif
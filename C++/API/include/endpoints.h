@@ -0,0 +1,57 @@
+#ifndef endpoints_h
+#define endpoints_h
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// How long an endpoint that failed is left alone before it's tried again.
+const long ENDPOINT_RETRY_SECONDS = 30;
+
+/*  The servers an iSENSE object can send its requests to (see
+ *  iSENSE::set_endpoints), such as a local mirror and iSENSE itself.
+ *
+ *  Every endpoint keeps an average of how long it takes to answer (the time
+ *  to the first byte, so big transfers don't count against it). Requests go
+ *  to the healthy endpoint with the lowest average, ones that haven't been
+ *  timed yet first, in the order they were given. An endpoint that fails is
+ *  unhealthy for ENDPOINT_RETRY_SECONDS, or until it succeeds again.
+ *  If none are healthy, the one that has been down longest is tried.
+ *
+ *  Thread safe.                                                                */
+class endpoint_set {
+public:
+  // The API URLs of the endpoints (such as devURL), most preferred first.
+  explicit endpoint_set(const std::vector<std::string> &api_URLs);
+
+  size_t size() const;
+  const std::string &api_URL(size_t endpoint) const;
+
+  // The endpoint whose API URL url starts with, size() if none.
+  size_t find(const std::string &url) const;
+
+  // The endpoint to use next, leaving out the ones tried is true for.
+  // size() once they have all been tried.
+  size_t pick(const std::vector<bool> &tried);
+
+  // Called after each request. seconds < 0 if it shouldn't be timed.
+  void succeeded(size_t endpoint, double seconds);
+  void failed(size_t endpoint);
+
+  bool healthy(size_t endpoint);
+  double latency_ms(size_t endpoint);     // 0 if it hasn't been timed
+
+private:
+  struct endpoint {
+    std::string api_URL;
+    double latency;                       // Average, in seconds
+    bool timed;
+    std::chrono::steady_clock::time_point down_until;
+  };
+
+  std::vector<endpoint> endpoints;        // Only the URLs are read unlocked
+  std::mutex lock;
+};
+
+#endif
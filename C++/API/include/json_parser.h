@@ -0,0 +1,46 @@
+#ifndef json_parser_h
+#define json_parser_h
+
+#include "picojson/picojson.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+/*  A faster JSON parser for large GET responses (like ?recur=true).
+ *
+ *  It works in two stages, the same way simdjson does:
+ *    1. Find every structural character ({ } [ ] : ,), every string and every
+ *       number / true / false / null. This looks at 64 characters at a time,
+ *       using SSE2 when the compiler supports it.
+ *    2. Walk that list of positions and build the picojson values.
+ *
+ *  The result is exactly the same picojson value that picojson::parse makes.
+ *  If anything goes wrong (bad JSON, nesting that is too deep), it falls back
+ *  to picojson::parse, so the error messages are also the same.              */
+
+// Same as picojson::parse(value&, const std::string&). Returns an empty
+// string on success, or the error message from picojson on failure.
+std::string fast_parse(picojson::value &out, const std::string &json);
+
+// Stage 1 on its own. Fills the positions of all the structural characters,
+// string starts (the opening quote) and number / literal starts in the JSON.
+// Returns false if a string is never closed.
+bool find_structurals(const std::string &json, std::vector<size_t> &positions);
+
+/*  Streaming reads of one dataset's rows (the JSON of /data_sets/ID), for
+ *  iSENSE::get_dataset queries. Rows are found and single values picked out
+ *  of them without parsing anything else, so rows that aren't wanted are
+ *  never turned into picojson values. Keys are compared as written (field
+ *  IDs are never escaped).                                                   */
+
+// Calls visit with the position of each element of the top level "data"
+// array, in order, until visit returns false. Returns false if there isn't a
+// data array or the JSON of the rows it got to is broken.
+bool scan_rows(const std::string &json, const std::function<bool(size_t)> &visit);
+
+// Finds the member called key of the object at json[pos]. Sets begin and end
+// around the text of its value. Returns false if there isn't one.
+bool find_member(const std::string &json, size_t pos, const std::string &key,
+                 size_t &begin, size_t &end);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef mapped_file_h
+#define mapped_file_h
+
+#include <cstddef>
+#include <string>
+
+/*  A read only file in memory.
+ *
+ *  On Linux / Mac OS X the file is memory mapped with mmap, so nothing is read
+ *  until it is used and files bigger than the RAM work fine. On Windows the
+ *  file is read into memory instead.
+ *  Used by columnar_file and by iSENSE::import_file.                          */
+class mapped_file {
+public:
+  mapped_file();
+  ~mapped_file();
+
+  // Maps the file. Returns false (and prints an error) if it can't be opened.
+  // sequential tells the OS the file will be read once from start to end, so
+  // it can read ahead and drop pages that have been used.
+  bool open(const std::string &path, bool sequential = false);
+  void close();
+
+  const char *data() const;     // NULL if no file is open
+  size_t size() const;
+
+private:
+  const char *base;
+  size_t length;
+  bool mapped;                  // true if mmap was used, false if read in
+
+  // Not copyable.
+  mapped_file(const mapped_file &);
+  mapped_file &operator=(const mapped_file &);
+};
+
+#endif
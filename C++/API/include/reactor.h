@@ -0,0 +1,59 @@
+#ifndef reactor_h
+#define reactor_h
+
+#ifdef WIN32
+#include <curl.h>
+#else
+#include <curl/curl.h>
+#endif
+
+#include <functional>
+#include <set>
+
+// Most connections a reactor keeps open to one server.
+const long REACTOR_HOST_CONNECTIONS = 16;
+
+/*  A single threaded event loop for requests, used by the coroutine
+ *  interface (see coroutines.h).
+ *
+ *  start() hands a request to the loop and returns right away. The thread
+ *  that owns the reactor then calls run() (or run_once() from its own event
+ *  loop), which runs every request on one curl multi handle and calls each
+ *  one's done function once it's over. Thousands of requests can be running
+ *  with no threads but that one: they share kept alive connections, and
+ *  HTTP/2 servers get them multiplexed.
+ *
+ *  Not thread safe: only the owning thread may use it, done functions
+ *  included (they can start more requests).                                  */
+class request_reactor {
+public:
+  explicit request_reactor(long max_host_connections = REACTOR_HOST_CONNECTIONS);
+
+  // Requests still running are stopped, and done with CURLE_ABORTED_BY_CALLBACK.
+  ~request_reactor();
+
+  // Runs the request set up on handle. done gets its result, from run().
+  void start(CURL *handle, std::function<void(CURLcode)> done);
+
+  // Waits up to timeout_ms for requests to make progress, then calls done for
+  // the ones that are over. false once nothing is running.
+  bool run_once(long timeout_ms);
+
+  // Runs until every request (and the ones their done functions start) is over.
+  void run();
+
+  size_t running() const;
+
+private:
+  bool finish();                        // Calls done for finished requests
+
+  CURLM *multi;
+  std::set<CURL *> handles;             // Running, each one's done is its PRIVATE
+  bool stopping;
+
+  // Not copyable.
+  request_reactor(const request_reactor &);
+  request_reactor &operator=(const request_reactor &);
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef schema_h
+#define schema_h
+
+#include "API.h"
+#include <tuple>
+#include <type_traits>
+
+/*  Typed schemas, for programs that always upload the same fields.
+ *
+ *  Each field is declared once as a type, and the data is kept in a
+ *  typed_data with one vector per field:
+ *
+ *    ISENSE_FIELD(temperature, "Temperature", FIELD_NUMBER);
+ *    ISENSE_FIELD(sample_time, "Time", FIELD_TIMESTAMP);
+ *
+ *    typed_data<sample_time, temperature> data;
+ *    data.push_back<sample_time>(iSENSE::timestamp_now());
+ *    data.push_back<temperature>(21.5);
+ *    data.upload(api, POST_KEY);
+ *
+ *  Pushing to a field that isn't in the schema, or a value of the wrong type,
+ *  doesn't compile. The column is picked at compile time, so a push is just a
+ *  vector push_back (no lock or lookup by name, unlike iSENSE::push_back).
+ *  Field names and types are checked against the project once, by bind (or
+ *  the first upload), which fails if any of them are wrong instead of
+ *  uploading empty arrays. Uploads then write each column with its saved
+ *  field ID.
+ *
+ *  Number, latitude and longitude fields hold doubles, timestamp fields
+ *  nanoseconds since 1970 (formatted as set_timestamp_digits says) and text
+ *  fields strings. Compact uploads are used if they are turned on, the same
+ *  as for the pushed back data. Nothing is downsampled.                      */
+
+// The type of value a field holds.
+template <int Type> struct field_value { typedef double type; };
+template <> struct field_value<FIELD_TIMESTAMP> { typedef long long type; };
+template <> struct field_value<FIELD_TEXT> { typedef std::string type; };
+
+// Declares a field of a schema as the type tag.
+#define ISENSE_FIELD(tag, field_name, type_of_field)                          \
+  struct tag {                                                                \
+    enum { type = type_of_field };                                            \
+    typedef field_value<type_of_field>::type value_type;                      \
+    static const char *name() { return field_name; }                          \
+  }
+
+// true if Field is one of Fields.
+template <class Field, class... Fields>
+struct has_field : std::false_type {};
+
+template <class Field, class First, class... Rest>
+struct has_field<Field, First, Rest...>
+  : std::integral_constant<bool, std::is_same<Field, First>::value ||
+                                 has_field<Field, Rest...>::value> {};
+
+// true if no field is in Fields twice.
+template <class... Fields>
+struct distinct_fields : std::true_type {};
+
+template <class First, class... Rest>
+struct distinct_fields<First, Rest...>
+  : std::integral_constant<bool, !has_field<First, Rest...>::value &&
+                                 distinct_fields<Rest...>::value> {};
+
+// The column of Field in Fields.
+template <class Field, class... Fields>
+struct field_index;
+
+template <class Field, class... Rest>
+struct field_index<Field, Field, Rest...> : std::integral_constant<size_t, 0> {};
+
+template <class Field, class First, class... Rest>
+struct field_index<Field, First, Rest...>
+  : std::integral_constant<size_t, 1 + field_index<Field, Rest...>::value> {};
+
+template <class... Fields>
+class typed_data {
+  static_assert(sizeof...(Fields) > 0, "A schema needs at least one field");
+  static_assert(distinct_fields<Fields...>::value, "A field is in the schema twice");
+
+public:
+  typed_data() : bound(NULL) {}
+
+  // Adds a value to the end of Field's column.
+  template <class Field>
+  void push_back(typename Field::value_type data) {
+    column<Field>().push_back(std::move(data));
+  }
+
+  // Field's column, to reserve, fill or read it directly.
+  template <class Field>
+  std::vector<typename Field::value_type> &column() {
+    static_assert(has_field<Field, Fields...>::value, "The field isn't in this schema");
+    return std::get<field_index<Field, Fields...>::value>(columns);
+  }
+
+  // Most rows any column has.
+  size_t rows() const {
+    size_t sizes[] = {std::get<field_index<Fields, Fields...>::value>(columns).size()...};
+    size_t most = 0;
+    for (size_t i = 0; i < sizeof...(Fields); i++) {
+      most = sizes[i] > most ? sizes[i] : most;
+    }
+    return most;
+  }
+
+  // Empties the columns, keeping their memory.
+  void clear() {
+    int cleared[] = {(column<Fields>().clear(), 0)...};
+    (void) cleared;
+  }
+
+  /*  Checks the schema against api's project and saves the field IDs.
+   *  Errors are printed for each field that is wrong. upload binds again
+   *  by itself when given another iSENSE object, or when the object's
+   *  server or project changed since the last bind.                         */
+  bool bind(iSENSE &api) {
+    std::vector<schema_field> schema = {{Fields::name(), Fields::type}...};
+    bound = NULL;
+    if (!api.bind_schema(schema, field_IDs, rest)) {
+      return false;
+    }
+    bound = &api;
+    bound_URL = api.get_project_URL();
+    return true;
+  }
+
+  /*  Uploads the columns to api's project: a new dataset for POST_KEY /
+   *  POST_EMAIL, or appended to dataset_name for APPEND_KEY / APPEND_EMAIL.
+   *  The data is kept, call clear() once it's uploaded.                      */
+  bool upload(iSENSE &api, int post_type, std::string dataset_name = "") {
+    if ((bound != &api || bound_URL != api.get_project_URL()) && !bind(api)) {
+      return false;
+    }
+    return api.upload_columns(post_type, dataset_name,
+                              [this](std::string &buffer, bool compact, int digits) {
+                                format(buffer, compact, digits);
+                              }, "typed_data::upload()");
+  }
+
+  // Writes the "data" object's members (see format_upload_string). bind first.
+  void format(std::string &buffer, bool compact, int digits) const {
+    size_t first = buffer.size();
+    int written[] = {(format_column(buffer, first,
+                                    std::get<field_index<Fields, Fields...>::value>(columns),
+                                    field_IDs[field_index<Fields, Fields...>::value],
+                                    compact, digits), 0)...};
+    (void) written;
+    buffer += rest;
+  }
+
+private:
+  std::tuple<std::vector<typename Fields::value_type>...> columns;
+  std::vector<std::string> field_IDs;     // Saved by bind, in schema order
+  std::string rest;                       // The project's other fields
+  const iSENSE *bound;                    // The object bind was last given
+  std::string bound_URL;                  // and its server and project then
+
+  // One "FIELD ID":[DATA] pair, with a comma before all but the first.
+  static void format_column(std::string &buffer, size_t first,
+                            const std::vector<double> &data, const std::string &ID,
+                            bool compact, int) {
+    if (buffer.size() != first) {
+      buffer += ",";
+    }
+    if (compact && !data.empty()) {
+      iSENSE::format_compact(buffer, &data[0], data.size(), ID);
+    } else {
+      iSENSE::format_data(buffer, data, ID);
+    }
+  }
+
+  static void format_column(std::string &buffer, size_t first,
+                            const std::vector<long long> &data, const std::string &ID,
+                            bool compact, int digits) {
+    if (buffer.size() != first) {
+      buffer += ",";
+    }
+    if (compact && !data.empty()) {
+      iSENSE::format_compact(buffer, &data[0], data.size(), ID, digits);
+    } else {
+      iSENSE::format_data(buffer, data, ID, digits);
+    }
+  }
+
+  static void format_column(std::string &buffer, size_t first,
+                            const std::vector<std::string> &data, const std::string &ID,
+                            bool, int) {
+    if (buffer.size() != first) {
+      buffer += ",";
+    }
+    iSENSE::format_data(buffer, data, ID);
+  }
+};
+
+#endif
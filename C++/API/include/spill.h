@@ -0,0 +1,86 @@
+#ifndef spill_h
+#define spill_h
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+// What a segment holds (see spill_store).
+const int SPILL_NUMBERS = 1;
+const int SPILL_TIMESTAMPS = 2;
+const int SPILL_TEXT = 3;
+
+// A segment read back by spill_store::load. Only the vector of its kind is used.
+struct spill_segment {
+  int kind;
+  std::vector<double> numbers;
+  std::vector<long long> times;
+  std::vector<std::string> text;
+};
+
+/*  Rows of pushed back data moved out of memory, for iSENSE::set_memory_budget.
+ *
+ *  Each spill writes some of a field's rows to a new segment file. A field's
+ *  spilled rows are always its oldest: they come before the rows it still
+ *  has in memory, in the order they were spilled.
+ *
+ *  Numbers and timestamps are written with the compact encoding (compact.h),
+ *  timestamps in nanoseconds, so nothing is lost and sensor data takes a few
+ *  bits per value. Text is each string's length (4 bytes) and then its bytes.
+ *  Segments are named isense-spill-PID-N in the directory, and deleted when
+ *  their rows are dropped or the store is destroyed.
+ *
+ *  Not thread safe (iSENSE only uses it with data_lock held).                */
+class spill_store {
+public:
+  spill_store();
+  ~spill_store();               // Deletes the segment files
+
+  // Where new segments are written, "." by default.
+  void set_directory(const std::string &directory);
+
+  // Writes count rows to a new segment after the field's other spilled rows.
+  // Returns false (and prints an error) if the file couldn't be written.
+  bool spill(const std::string &field_name, const double *values, size_t count);
+  bool spill(const std::string &field_name, const long long *times, size_t count);
+  bool spill(const std::string &field_name, const std::string *text, size_t count);
+
+  // Reads the index'th segment of a field back, without the rows dropped from
+  // it. The vectors' memory is reused. Returns false (and prints an error)
+  // if the file couldn't be read.
+  bool load(const std::string &field_name, size_t index, spill_segment &segment) const;
+
+  size_t segments(const std::string &field_name) const;
+  size_t rows(const std::string &field_name) const;   // Spilled rows left
+  std::vector<std::string> field_names() const;       // Fields with any
+  size_t bytes() const;         // Size of the segment files
+  bool empty() const;
+
+  // Drops the field's first count spilled rows (all of them with drop).
+  // Segments are deleted once all of their rows are dropped.
+  void drop_rows(const std::string &field_name, size_t count);
+  void drop(const std::string &field_name);
+  void clear();
+
+private:
+  struct segment_file {
+    std::string path;
+    int kind;                   // SPILL_NUMBERS, SPILL_TIMESTAMPS or SPILL_TEXT
+    size_t rows;                // Rows in the file
+    size_t skip;                // Rows at the start that were dropped
+    size_t bytes;               // Size of the file
+  };
+  std::map<std::string, std::vector<segment_file> > fields;
+  std::string directory;
+  size_t file_bytes;
+
+  bool write(const std::string &field_name, int kind, size_t count, const std::string &data);
+  void remove_file(const segment_file &segment);
+
+  // Not copyable.
+  spill_store(const spill_store &);
+  spill_store &operator=(const spill_store &);
+};
+
+#endif
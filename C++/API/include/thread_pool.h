@@ -0,0 +1,63 @@
+#ifndef thread_pool_h
+#define thread_pool_h
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*  A small work stealing thread pool.
+ *
+ *  Every thread has its own queue of tasks. Submitted tasks are handed out to
+ *  the queues in turn. A thread runs tasks from the back of its own queue and,
+ *  when that is empty, steals from the front of the other threads' queues.
+ *  That way a thread that got the small tasks helps out the ones that got the
+ *  big tasks, instead of sitting idle.
+ *
+ *  Tasks should not throw exceptions.                                          */
+class thread_pool {
+public:
+  // Starts the threads. 0 (or less) means one per CPU core.
+  explicit thread_pool(int num_threads);
+
+  // Waits for all of the tasks to finish, then stops the threads.
+  ~thread_pool();
+
+  void submit(std::function<void()> task);    // Add a task to the pool
+  void wait();                                // Wait for all tasks to finish
+  int size() const;                           // Number of threads
+
+  // Number of CPU cores (at least 1).
+  static int hardware_threads();
+
+private:
+  // One of these per thread. Each has its own lock, so threads mostly
+  // don't wait on each other.
+  struct task_queue {
+    std::mutex lock;
+    std::deque<std::function<void()> > tasks;
+  };
+
+  void run(int id);                                   // A thread's main loop
+  bool take_task(int id, std::function<void()> &task);
+
+  std::vector<std::unique_ptr<task_queue> > queues;
+  std::vector<std::thread> threads;
+
+  std::mutex state_lock;                // Protects the variables below
+  std::condition_variable work_ready;   // Signalled when a task is submitted
+  std::condition_variable all_done;     // Signalled when pending reaches 0
+  size_t queued;                        // Tasks in the queues
+  size_t pending;                       // Tasks submitted but not finished
+  size_t next_queue;                    // Queue for the next submitted task
+  bool stopping;
+
+  // Not copyable.
+  thread_pool(const thread_pool &);
+  thread_pool &operator=(const thread_pool &);
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef transport_h
+#define transport_h
+
+#ifdef WIN32
+#include <curl.h>
+#else
+#include <curl/curl.h>
+#endif
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*  Shared connections for one iSENSE object (see iSENSE::set_http2).
+ *
+ *  Requests from any thread are handed to one thread, which runs them all on
+ *  one curl multi handle. They ask for HTTP/2 (h2 over https, an h2c upgrade
+ *  over http) and wait for a connection to multiplex on instead of opening
+ *  their own, so all the requests running at once share one connection per
+ *  host. Servers that don't speak HTTP/2 get HTTP/1.1: the requests then
+ *  take turns on up to max_host_connections kept alive connections.
+ *
+ *  With libcurl older than 7.68 requests run on their own, as before.        */
+class http_transport {
+public:
+  explicit http_transport(long max_host_connections);
+
+  // Waits for the requests that are running, then stops the thread.
+  ~http_transport();
+
+  // Runs a request set up on handle, like curl_easy_perform.
+  CURLcode perform(CURL *handle);
+
+  long connections();     // Connections opened so far
+  long last_version();    // CURL_HTTP_VERSION_1_1 / _2_0 of the last request
+
+private:
+  struct request {
+    CURL *handle;
+    CURLcode result;
+    bool done;
+  };
+
+  void run();                           // The thread's main loop
+  void count(CURL *handle);             // Saves connections() / last_version()
+
+  CURLM *multi;
+  std::thread thread;
+
+  std::mutex lock;                      // Protects the variables below
+  std::condition_variable finished;     // Signalled when requests are done
+  std::vector<request *> queued;        // Not handed to curl yet
+  std::vector<request *> running;
+  long connect_count, version;
+  bool stopping;
+
+  // Not copyable.
+  http_transport(const http_transport &);
+  http_transport &operator=(const http_transport &);
+};
+
+#endif
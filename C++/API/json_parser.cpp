@@ -0,0 +1,609 @@
+#include "include/json_parser.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+// SSE2 is used to look at 16 characters at a time, when the compiler
+// supports it. Every x86-64 compiler does, other systems use plain loops.
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// For picojson
+using namespace picojson;
+
+// JSON nested deeper than this is left to picojson.
+const int MAX_DEPTH = 1024;
+
+//******************************************************************************
+// Stage 1: find the structural characters.
+
+// Bit masks for one 64 character block. Bit i is for character i.
+struct block_masks {
+  uint64_t quote;         // "
+  uint64_t backslash;     // \ (backslash)
+  uint64_t op;            // { } [ ] : ,
+  uint64_t space;         // space, tab, newline, carriage return
+};
+
+#ifdef __SSE2__
+// Returns a 16 bit mask of the characters in chars equal to c.
+static inline uint64_t match16(__m128i chars, char c) {
+  return static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8(c))));
+}
+#endif
+
+// Fills the masks for the 64 characters starting at block.
+static void classify_block(const char *block, block_masks &masks) {
+  masks.quote = masks.backslash = masks.op = masks.space = 0;
+
+#ifdef __SSE2__
+  for (int i = 0; i < 64; i += 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i));
+
+    masks.quote |= match16(chars, '"') << i;
+    masks.backslash |= match16(chars, '\\') << i;
+    masks.op |= (match16(chars, '{') | match16(chars, '}') |
+                 match16(chars, '[') | match16(chars, ']') |
+                 match16(chars, ':') | match16(chars, ',')) << i;
+    masks.space |= (match16(chars, ' ') | match16(chars, '\t') |
+                    match16(chars, '\n') | match16(chars, '\r')) << i;
+  }
+#else
+  for (int i = 0; i < 64; i++) {
+    uint64_t bit = 1ULL << i;
+
+    switch (block[i]) {
+      case '"':  masks.quote |= bit; break;
+      case '\\': masks.backslash |= bit; break;
+      case '{': case '}': case '[': case ']': case ':': case ',':
+        masks.op |= bit;
+        break;
+      case ' ': case '\t': case '\n': case '\r':
+        masks.space |= bit;
+        break;
+    }
+  }
+#endif
+}
+
+// Bit i of the result is the XOR of bits 0..i of x.
+// Run on the quote mask, this gives the characters that are inside strings.
+static inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+// Position of the lowest set bit.
+static inline int lowest_bit(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_ctzll(x);
+#else
+  int bit = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+bool find_structurals(const std::string &json, std::vector<size_t> &positions) {
+  const char *chars = json.data();
+  size_t length = json.size();
+
+  positions.clear();
+  positions.reserve(length / 4);
+
+  // Carried over from one block to the next.
+  bool escape_next = false;       // Last block ended with an unescaped backslash
+  uint64_t in_string = 0;         // All ones if the last block ended in a string
+  uint64_t last_atom = 0;         // 1 if the last block ended in a number / literal
+
+  for (size_t base = 0; base < length; base += 64) {
+    block_masks masks;
+
+    // The last block is padded with spaces.
+    if (base + 64 <= length) {
+      classify_block(chars + base, masks);
+    } else {
+      char padded[64];
+      memset(padded, ' ', sizeof padded);
+      memcpy(padded, chars + base, length - base);
+      classify_block(padded, masks);
+    }
+
+    // Find the escaped characters. Backslashes are rare, so they are
+    // handled one at a time: a backslash that is not escaped itself
+    // escapes the character after it.
+    uint64_t escaped = escape_next ? 1 : 0;
+    escape_next = false;
+
+    for (uint64_t slashes = masks.backslash; slashes != 0; slashes &= slashes - 1) {
+      int bit = lowest_bit(slashes);
+
+      if ((escaped >> bit) & 1) {
+        continue;
+      }
+      if (bit == 63) {
+        escape_next = true;
+      } else {
+        escaped |= 1ULL << (bit + 1);
+      }
+    }
+
+    // Characters inside strings (including the opening quote).
+    uint64_t quotes = masks.quote & ~escaped;
+    uint64_t strings = prefix_xor(quotes) ^ in_string;
+    in_string = (strings >> 63) ? ~0ULL : 0;
+
+    // Numbers / true / false / null: anything else outside of strings.
+    uint64_t atoms = ~(masks.op | masks.space | quotes | strings);
+    uint64_t atom_starts = atoms & ~((atoms << 1) | last_atom);
+    last_atom = atoms >> 63;
+
+    uint64_t structurals = (masks.op & ~strings) | (quotes & strings) | atom_starts;
+
+    for (; structurals != 0; structurals &= structurals - 1) {
+      positions.push_back(base + lowest_bit(structurals));
+    }
+  }
+
+  return in_string == 0;              // Every string was closed.
+}
+
+//******************************************************************************
+// Stage 2: build the picojson values.
+
+// Returns the position of the first ", \ or control character (or the end).
+static size_t find_string_end(const char *chars, size_t start, size_t length) {
+  size_t i = start;
+
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+
+  for (; i + 16 <= length; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(chars + i));
+
+    // A character is a control character if max(c, 0x1f) == 0x1f
+    __m128i found = _mm_cmpeq_epi8(_mm_max_epu8(block, control), control);
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(block, quote));
+    found = _mm_or_si128(found, _mm_cmpeq_epi8(block, backslash));
+
+    int mask = _mm_movemask_epi8(found);
+    if (mask != 0) {
+      return i + lowest_bit(mask);
+    }
+  }
+#endif
+
+  for (; i < length; i++) {
+    unsigned char c = chars[i];
+    if (c == '"' || c == '\\' || c < 0x20) {
+      return i;
+    }
+  }
+  return length;
+}
+
+// Reads 4 hex digits, returns -1 if they are not hex digits.
+static int read_hex4(const char *chars, size_t pos, size_t length) {
+  if (pos + 4 > length) {
+    return -1;
+  }
+
+  int code = 0;
+  for (size_t i = pos; i < pos + 4; i++) {
+    char c = chars[i];
+    int digit;
+
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return -1;
+    }
+    code = code * 16 + digit;
+  }
+  return code;
+}
+
+// Adds a unicode code point to the string as UTF-8 (same as picojson).
+static void append_utf8(std::string &out, int code) {
+  if (code < 0x80) {
+    out += static_cast<char>(code);
+  } else if (code < 0x800) {
+    out += static_cast<char>(0xc0 | (code >> 6));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  } else if (code < 0x10000) {
+    out += static_cast<char>(0xe0 | (code >> 12));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  } else {
+    out += static_cast<char>(0xf0 | (code >> 18));
+    out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  }
+}
+
+class fast_json_builder {
+public:
+  fast_json_builder(const std::string &json, const std::vector<size_t> &positions)
+    : chars(json.c_str()), length(json.size()), positions(positions), index(0) {}
+
+  // Parses the whole document into out.
+  bool build(value &out) {
+    return parse_value(out, 0) && index == positions.size();
+  }
+
+private:
+  const char *chars;                      // The JSON (null terminated)
+  size_t length;
+  const std::vector<size_t> &positions;   // From stage 1
+  size_t index;                           // Next position to look at
+
+  // Returns the character at the next position, or 0 if there are none left.
+  char peek() {
+    return index < positions.size() ? chars[positions[index]] : 0;
+  }
+
+  bool parse_value(value &out, int depth) {
+    if (index >= positions.size() || depth > MAX_DEPTH) {
+      return false;
+    }
+
+    size_t pos = positions[index++];
+
+    switch (chars[pos]) {
+      case '{': return parse_object(out, depth);
+      case '[': return parse_array(out, depth);
+      case '"': {
+        out = value(string_type, false);
+        return parse_string(out.get<std::string>(), pos);
+      }
+      case '}': case ']': case ':': case ',':
+        return false;
+      default:
+        return parse_atom(out, pos);
+    }
+  }
+
+  bool parse_object(value &out, int depth) {
+    out = value(object_type, false);
+    object &obj = out.get<object>();
+
+    if (peek() == '}') {
+      index++;
+      return true;
+    }
+
+    std::string key;
+    while (true) {
+      // "key" : value
+      if (peek() != '"') {
+        return false;
+      }
+      key.clear();
+      if (!parse_string(key, positions[index++]) || peek() != ':') {
+        return false;
+      }
+      index++;
+
+      // Keys usually come in order, so try adding at the end of the map first.
+      // If the key is already there, the new value replaces the old one.
+      object::iterator slot = obj.insert(obj.end(), std::make_pair(key, value()));
+      if (!parse_value(slot->second, depth + 1)) {
+        return false;
+      }
+
+      // Then either , or }
+      char next = peek();
+      index++;
+      if (next == '}') {
+        return true;
+      }
+      if (next != ',') {
+        return false;
+      }
+    }
+  }
+
+  bool parse_array(value &out, int depth) {
+    out = value(array_type, false);
+    array &arr = out.get<array>();
+
+    if (peek() == ']') {
+      index++;
+      return true;
+    }
+
+    while (true) {
+      arr.push_back(value());
+      if (!parse_value(arr.back(), depth + 1)) {
+        return false;
+      }
+
+      // Then either , or ]
+      char next = peek();
+      index++;
+      if (next == ']') {
+        return true;
+      }
+      if (next != ',') {
+        return false;
+      }
+    }
+  }
+
+  // pos is the opening quote.
+  bool parse_string(std::string &out, size_t pos) {
+    size_t i = pos + 1;
+
+    while (true) {
+      size_t end = find_string_end(chars, i, length);
+      out.append(chars + i, end - i);         // Copy the part with no escapes
+
+      if (end >= length || static_cast<unsigned char>(chars[end]) < 0x20) {
+        return false;
+      }
+      if (chars[end] == '"') {
+        return true;
+      }
+
+      // Backslash escape.
+      i = end + 2;
+      switch (chars[end + 1]) {
+        case '"':  out += '"';  break;
+        case '\\': out += '\\'; break;
+        case '/':  out += '/';  break;
+        case 'b':  out += '\b'; break;
+        case 'f':  out += '\f'; break;
+        case 'n':  out += '\n'; break;
+        case 'r':  out += '\r'; break;
+        case 't':  out += '\t'; break;
+        case 'u': {
+          int code = read_hex4(chars, i, length);
+          i += 4;
+          if (code < 0 || (code >= 0xdc00 && code <= 0xdfff)) {
+            return false;
+          }
+
+          // A high surrogate must be followed by \u and a low surrogate.
+          if (code >= 0xd800 && code <= 0xdbff) {
+            if (i + 2 > length || chars[i] != '\\' || chars[i + 1] != 'u') {
+              return false;
+            }
+            int low = read_hex4(chars, i + 2, length);
+            if (low < 0xdc00 || low > 0xdfff) {
+              return false;
+            }
+            i += 6;
+            code = 0x10000 + (((code - 0xd800) << 10) | (low - 0xdc00));
+          }
+          append_utf8(out, code);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+  }
+
+  // Numbers, true, false and null.
+  bool parse_atom(value &out, size_t pos) {
+    size_t end = pos;
+
+    if (matches(pos, "true", end)) {
+      out = value(true);
+    } else if (matches(pos, "false", end)) {
+      out = value(false);
+    } else if (matches(pos, "null", end)) {
+      out = value();
+    } else {
+      // Same rules as picojson: starts with a digit or '-', made of the
+      // characters 0-9 + - e E . and all of it must be read by strtod.
+      if (!((chars[pos] >= '0' && chars[pos] <= '9') || chars[pos] == '-')) {
+        return false;
+      }
+      end = pos;
+      while (end < length && (strchr("0123456789+-eE.", chars[end]) != NULL) &&
+             chars[end] != '\0') {
+        end++;
+      }
+
+      char *number_end;
+      double number = strtod(chars + pos, &number_end);
+      if (number_end != chars + end) {
+        return false;
+      }
+      out = value(number);
+    }
+
+    // The atom has to end at a structural character or whitespace.
+    if (end < length) {
+      char c = chars[end];
+      if (!(c == ',' || c == ']' || c == '}' || c == ' ' || c == '\t' ||
+            c == '\n' || c == '\r')) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // True if the text at pos is word. Sets end to the character after it.
+  bool matches(size_t pos, const char *word, size_t &end) {
+    size_t word_length = strlen(word);
+
+    if (pos + word_length > length || strncmp(chars + pos, word, word_length) != 0) {
+      return false;
+    }
+    end = pos + word_length;
+    return true;
+  }
+};
+
+std::string fast_parse(value &out, const std::string &json) {
+  std::vector<size_t> positions;
+
+  if (find_structurals(json, positions)) {
+    fast_json_builder builder(json, positions);
+
+    if (builder.build(out)) {
+      return "";
+    }
+  }
+
+  // Something was wrong (or unusual) with the JSON. Let picojson parse it
+  // so the result and error message are exactly what picojson gives.
+  out = value();
+  return parse(out, json);
+}
+
+//******************************************************************************
+// Streaming reads of a dataset's rows (see scan_rows). Nothing is built, the
+// values that aren't wanted are only stepped over.
+
+struct row_scanner {
+  const char *chars;
+  size_t length;
+
+  size_t skip_space(size_t pos) const {
+    while (pos < length && (chars[pos] == ' ' || chars[pos] == '\t' ||
+                            chars[pos] == '\n' || chars[pos] == '\r')) {
+      pos++;
+    }
+    return pos;
+  }
+
+  // pos is at the opening quote. Returns the position after the closing one,
+  // or length if there isn't one.
+  size_t skip_string(size_t pos) const {
+    pos++;
+    while (pos < length) {
+      pos = find_string_end(chars, pos, length);
+      if (pos >= length) {
+        break;
+      }
+      if (chars[pos] == '"') {
+        return pos + 1;
+      }
+      pos += (chars[pos] == '\\') ? 2 : 1;    // Escapes and control characters
+    }
+    return length;
+  }
+
+  // Returns the position after the value starting at pos (length if broken).
+  size_t skip_value(size_t pos) const {
+    if (pos >= length) {
+      return length;
+    }
+    if (chars[pos] == '"') {
+      return skip_string(pos);
+    }
+    if (chars[pos] != '{' && chars[pos] != '[') {
+      while (pos < length && chars[pos] != ',' && chars[pos] != '}' && chars[pos] != ']' &&
+             chars[pos] != ' ' && chars[pos] != '\t' && chars[pos] != '\n' &&
+             chars[pos] != '\r') {
+        pos++;                                // Number, true, false or null
+      }
+      return pos;
+    }
+
+    int depth = 0;
+    while (pos < length) {
+      char c = chars[pos];
+      if (c == '"') {
+        pos = skip_string(pos);
+        continue;
+      }
+      if (c == '{' || c == '[') {
+        depth++;
+      } else if ((c == '}' || c == ']') && --depth == 0) {
+        return pos + 1;
+      }
+      pos++;
+    }
+    return length;
+  }
+
+  // Finds the member called key of the object at pos, as in find_member.
+  bool find(size_t pos, const std::string &key, size_t &begin, size_t &end) const {
+    pos = skip_space(pos);
+    if (pos >= length || chars[pos] != '{') {
+      return false;
+    }
+    pos = skip_space(pos + 1);
+
+    while (pos < length && chars[pos] == '"') {
+      size_t name_end = skip_string(pos);
+      size_t colon = skip_space(name_end);
+      if (colon >= length || chars[colon] != ':') {
+        return false;
+      }
+      size_t value = skip_space(colon + 1);
+
+      size_t after = skip_value(value);
+      if (name_end - pos - 2 == key.size() && key.compare(0, key.size(), chars + pos + 1,
+                                                           key.size()) == 0) {
+        begin = value;
+        end = after;
+        return after > value;
+      }
+
+      pos = skip_space(after);
+      if (pos >= length || chars[pos] != ',') {
+        return false;                         // The end of the object
+      }
+      pos = skip_space(pos + 1);
+    }
+    return false;
+  }
+};
+
+bool scan_rows(const std::string &json, const std::function<bool(size_t)> &visit) {
+  row_scanner scanner = {json.data(), json.size()};
+  size_t data_begin, data_end;
+
+  if (!scanner.find(0, "data", data_begin, data_end) || json[data_begin] != '[') {
+    return false;
+  }
+
+  size_t pos = scanner.skip_space(data_begin + 1);
+  if (pos < data_end && json[pos] == ']') {
+    return true;                              // No rows
+  }
+  while (pos < data_end) {
+    size_t after = scanner.skip_value(pos);
+    if (after == pos || !visit(pos)) {
+      return after != pos;
+    }
+
+    pos = scanner.skip_space(after);
+    if (pos < data_end && json[pos] == ']') {
+      return true;
+    }
+    if (pos >= data_end || json[pos] != ',') {
+      return false;
+    }
+    pos = scanner.skip_space(pos + 1);
+  }
+  return false;
+}
+
+bool find_member(const std::string &json, size_t pos, const std::string &key,
+                 size_t &begin, size_t &end) {
+  row_scanner scanner = {json.data(), json.size()};
+  return scanner.find(pos, key, begin, end);
+}
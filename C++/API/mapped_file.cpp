@@ -0,0 +1,110 @@
+#include "include/mapped_file.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file::mapped_file() {
+  base = NULL;
+  length = 0;
+  mapped = false;
+}
+
+mapped_file::~mapped_file() {
+  close();
+}
+
+bool mapped_file::open(const std::string &path, bool sequential) {
+  close();
+
+#ifndef WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "\nError in method: mapped_file::open()\n";
+    std::cerr << "Unable to open " << path << "\n";
+    return false;
+  }
+
+  struct stat info;
+  bool ok = fstat(fd, &info) == 0;
+
+  // mmap can't map an empty file, so there's nothing to do for those.
+  if (ok && info.st_size > 0) {
+    void *memory = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ok = memory != MAP_FAILED;
+
+    if (ok) {
+      base = static_cast<const char *>(memory);
+      length = info.st_size;
+      mapped = true;
+#ifdef MADV_SEQUENTIAL
+      if (sequential) {
+        madvise(memory, length, MADV_SEQUENTIAL);
+      }
+#endif
+    }
+  }
+  ::close(fd);                  // The mapping stays after the file is closed.
+#else
+  (void) sequential;
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    std::cerr << "\nError in method: mapped_file::open()\n";
+    std::cerr << "Unable to open " << path << "\n";
+    return false;
+  }
+
+  bool ok = std::fseek(file, 0, SEEK_END) == 0;
+  long file_size = ok ? std::ftell(file) : -1;
+  ok = file_size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+
+  if (ok && file_size > 0) {
+    char *memory = static_cast<char *>(std::malloc(file_size));
+    ok = memory != NULL && std::fread(memory, 1, file_size, file) == (size_t) file_size;
+
+    if (ok) {
+      base = memory;
+      length = file_size;
+    } else {
+      std::free(memory);
+    }
+  }
+  std::fclose(file);
+#endif
+
+  if (!ok) {
+    std::cerr << "\nError in method: mapped_file::open()\n";
+    std::cerr << "Unable to read " << path << "\n";
+  }
+  return ok;
+}
+
+void mapped_file::close() {
+  if (base != NULL) {
+#ifndef WIN32
+    if (mapped) {
+      munmap(const_cast<char *>(base), length);
+    }
+#else
+    std::free(const_cast<char *>(base));
+#endif
+  }
+  base = NULL;
+  length = 0;
+  mapped = false;
+}
+
+const char *mapped_file::data() const {
+  return base;
+}
+
+size_t mapped_file::size() const {
+  return length;
+}
@@ -0,0 +1,100 @@
+#include "include/reactor.h"
+
+#include <vector>
+
+typedef std::function<void(CURLcode)> done_function;
+
+request_reactor::request_reactor(long max_host_connections) {
+  stopping = false;
+  multi = curl_multi_init();
+  if (multi != NULL) {
+#ifdef CURLPIPE_MULTIPLEX
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_host_connections);
+  }
+}
+
+request_reactor::~request_reactor() {
+  stopping = true;
+  while (!handles.empty()) {
+    CURL *handle = *handles.begin();
+    handles.erase(handles.begin());
+    curl_multi_remove_handle(multi, handle);
+
+    char *data = NULL;
+    curl_easy_getinfo(handle, CURLINFO_PRIVATE, &data);
+    done_function *done = reinterpret_cast<done_function *>(data);
+    (*done)(CURLE_ABORTED_BY_CALLBACK);
+    delete done;
+  }
+  if (multi != NULL) {
+    curl_multi_cleanup(multi);
+  }
+}
+
+// Requests started while the reactor is going away fail right away.
+void request_reactor::start(CURL *handle, std::function<void(CURLcode)> done) {
+  if (multi == NULL || stopping) {
+    done(multi == NULL ? CURLE_FAILED_INIT : CURLE_ABORTED_BY_CALLBACK);
+    return;
+  }
+  curl_easy_setopt(handle, CURLOPT_PRIVATE, new done_function(done));
+#ifdef CURLPIPE_MULTIPLEX
+  curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+#endif
+  handles.insert(handle);
+  curl_multi_add_handle(multi, handle);
+}
+
+bool request_reactor::run_once(long timeout_ms) {
+  if (handles.empty()) {
+    return false;
+  }
+
+  int still_running = 0;
+  curl_multi_perform(multi, &still_running);
+  if (!finish()) {
+    curl_multi_wait(multi, NULL, 0, timeout_ms, NULL);
+    curl_multi_perform(multi, &still_running);
+    finish();
+  }
+  return !handles.empty();
+}
+
+void request_reactor::run() {
+  while (run_once(1000)) {
+  }
+}
+
+size_t request_reactor::running() const {
+  return handles.size();
+}
+
+// The done functions are called after curl's messages have been read, since
+// they can add requests to the multi handle.
+bool request_reactor::finish() {
+  std::vector<std::pair<done_function *, CURLcode> > finished;
+
+  CURLMsg *message;
+  int left;
+  while ((message = curl_multi_info_read(multi, &left)) != NULL) {
+    if (message->msg != CURLMSG_DONE) {
+      continue;
+    }
+    CURL *handle = message->easy_handle;
+    CURLcode result = message->data.result;
+    char *data = NULL;
+    curl_easy_getinfo(handle, CURLINFO_PRIVATE, &data);
+
+    curl_multi_remove_handle(multi, handle);
+    handles.erase(handle);
+    finished.push_back(std::make_pair(reinterpret_cast<done_function *>(data), result));
+  }
+
+  for (size_t i = 0; i < finished.size(); i++) {
+    (*finished[i].first)(finished[i].second);
+    delete finished[i].first;
+  }
+  return !finished.empty();
+}
@@ -0,0 +1,253 @@
+#include "include/spill.h"
+#include "include/compact.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+
+#ifndef WIN32
+#include <unistd.h>             // getpid
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+// Numbers the segment files, so stores in the same directory never clash.
+static std::atomic<unsigned long> next_segment(0);
+
+// Reads a whole file into data.
+static bool read_file(const std::string &path, std::string &data) {
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+
+  bool ok = std::fseek(file, 0, SEEK_END) == 0;
+  long file_size = ok ? std::ftell(file) : -1;
+  ok = file_size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+
+  if (ok) {
+    data.resize(file_size);
+    ok = file_size == 0 || std::fread(&data[0], 1, file_size, file) == (size_t) file_size;
+  }
+  std::fclose(file);
+  return ok;
+}
+
+spill_store::spill_store() : directory("."), file_bytes(0) {}
+
+spill_store::~spill_store() {
+  clear();
+}
+
+void spill_store::set_directory(const std::string &directory) {
+  this->directory = directory.empty() ? "." : directory;
+}
+
+bool spill_store::spill(const std::string &field_name, const double *values, size_t count) {
+  std::string data;
+  compact_encode(data, values, count);
+  return write(field_name, SPILL_NUMBERS, count, data);
+}
+
+bool spill_store::spill(const std::string &field_name, const long long *times, size_t count) {
+  std::string data;
+  compact_encode(data, times, count, 9);      // Nanoseconds, nothing is rounded
+  return write(field_name, SPILL_TIMESTAMPS, count, data);
+}
+
+bool spill_store::spill(const std::string &field_name, const std::string *text, size_t count) {
+  std::string data;
+  size_t size = 0;
+  for (size_t i = 0; i < count; i++) {
+    size += sizeof(uint32_t) + text[i].size();
+  }
+  data.reserve(size);
+
+  for (size_t i = 0; i < count; i++) {
+    uint32_t length = static_cast<uint32_t>(text[i].size());
+    data.append(reinterpret_cast<const char *>(&length), sizeof length);
+    data += text[i];
+  }
+  return write(field_name, SPILL_TEXT, count, data);
+}
+
+bool spill_store::write(const std::string &field_name, int kind, size_t count,
+                        const std::string &data) {
+  if (count == 0) {
+    return true;
+  }
+
+  segment_file segment;
+  segment.path = directory + "/isense-spill-" + std::to_string((long long) getpid()) +
+                 "-" + std::to_string(next_segment++);
+  segment.kind = kind;
+  segment.rows = count;
+  segment.skip = 0;
+  segment.bytes = data.size();
+
+  std::FILE *file = std::fopen(segment.path.c_str(), "wb");
+  bool ok = file != NULL && std::fwrite(data.data(), 1, data.size(), file) == data.size();
+  if (file != NULL) {
+    ok = (std::fclose(file) == 0) && ok;
+  }
+
+  if (!ok) {
+    std::cerr << "\nError in method: spill_store::spill()\n";
+    std::cerr << "Unable to write " << segment.path << "\n";
+    std::remove(segment.path.c_str());
+    return false;
+  }
+  fields[field_name].push_back(segment);
+  file_bytes += segment.bytes;
+  return true;
+}
+
+bool spill_store::load(const std::string &field_name, size_t index,
+                       spill_segment &segment) const {
+  std::map<std::string, std::vector<segment_file> >::const_iterator field;
+  field = fields.find(field_name);
+  if (field == fields.end() || index >= field->second.size()) {
+    return false;
+  }
+
+  const segment_file &file = field->second[index];
+  segment.kind = file.kind;
+  segment.numbers.clear();
+  segment.times.clear();
+  segment.text.clear();
+
+  std::string data;
+  bool ok = read_file(file.path, data);
+  int digits;
+
+  if (ok && file.kind == SPILL_NUMBERS) {
+    ok = compact_decode(data, segment.numbers) && segment.numbers.size() == file.rows;
+    if (ok) {
+      segment.numbers.erase(segment.numbers.begin(), segment.numbers.begin() + file.skip);
+    }
+  } else if (ok && file.kind == SPILL_TIMESTAMPS) {
+    ok = compact_decode(data, segment.times, digits) && segment.times.size() == file.rows;
+    if (ok) {
+      segment.times.erase(segment.times.begin(), segment.times.begin() + file.skip);
+    }
+  } else if (ok) {
+    size_t at = 0;
+    for (size_t row = 0; ok && row < file.rows; row++) {
+      uint32_t length = 0;
+      ok = at + sizeof length <= data.size();
+      if (ok) {
+        memcpy(&length, data.data() + at, sizeof length);
+        at += sizeof length;
+        ok = length <= data.size() - at;
+      }
+      if (ok && row >= file.skip) {
+        segment.text.push_back(data.substr(at, length));
+      }
+      at += length;
+    }
+  }
+
+  if (!ok) {
+    std::cerr << "\nError in method: spill_store::load()\n";
+    std::cerr << "Unable to read " << file.rows - file.skip << " rows of \"" << field_name
+              << "\" back from " << file.path << "\n";
+  }
+  return ok;
+}
+
+size_t spill_store::segments(const std::string &field_name) const {
+  std::map<std::string, std::vector<segment_file> >::const_iterator field;
+  field = fields.find(field_name);
+  return field == fields.end() ? 0 : field->second.size();
+}
+
+size_t spill_store::rows(const std::string &field_name) const {
+  std::map<std::string, std::vector<segment_file> >::const_iterator field;
+  field = fields.find(field_name);
+  if (field == fields.end()) {
+    return 0;
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < field->second.size(); i++) {
+    count += field->second[i].rows - field->second[i].skip;
+  }
+  return count;
+}
+
+std::vector<std::string> spill_store::field_names() const {
+  std::vector<std::string> names;
+  std::map<std::string, std::vector<segment_file> >::const_iterator field;
+  for (field = fields.begin(); field != fields.end(); field++) {
+    names.push_back(field->first);
+  }
+  return names;
+}
+
+size_t spill_store::bytes() const {
+  return file_bytes;
+}
+
+bool spill_store::empty() const {
+  return fields.empty();
+}
+
+// A segment that is only partly dropped stays on disk, with skip set.
+void spill_store::drop_rows(const std::string &field_name, size_t count) {
+  std::map<std::string, std::vector<segment_file> >::iterator field;
+  field = fields.find(field_name);
+  if (field == fields.end()) {
+    return;
+  }
+
+  std::vector<segment_file> &segments = field->second;
+  size_t dropped = 0;
+  while (dropped < segments.size() && count > 0) {
+    segment_file &segment = segments[dropped];
+    size_t left = segment.rows - segment.skip;
+
+    if (count < left) {
+      segment.skip += count;
+      break;
+    }
+    count -= left;
+    remove_file(segment);
+    dropped++;
+  }
+
+  segments.erase(segments.begin(), segments.begin() + dropped);
+  if (segments.empty()) {
+    fields.erase(field);
+  }
+}
+
+void spill_store::drop(const std::string &field_name) {
+  std::map<std::string, std::vector<segment_file> >::iterator field;
+  field = fields.find(field_name);
+  if (field == fields.end()) {
+    return;
+  }
+
+  for (size_t i = 0; i < field->second.size(); i++) {
+    remove_file(field->second[i]);
+  }
+  fields.erase(field);
+}
+
+void spill_store::clear() {
+  std::map<std::string, std::vector<segment_file> >::iterator field;
+  for (field = fields.begin(); field != fields.end(); field++) {
+    for (size_t i = 0; i < field->second.size(); i++) {
+      remove_file(field->second[i]);
+    }
+  }
+  fields.clear();
+}
+
+void spill_store::remove_file(const segment_file &segment) {
+  std::remove(segment.path.c_str());
+  file_bytes -= segment.bytes;
+}
@@ -1,4 +1,26 @@
 #include "include/API.h"
+#include "include/columnar.h"
+#include "include/compact.h"
+#include "include/coroutines.h"
+#include "include/csv_reader.h"
+#include "include/schema.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>    // mkdir
+#include <unistd.h>      // truncate, close
+
+// For the local test server
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
 
 // For picojson
 using namespace picojson;
@@ -28,6 +50,24 @@ using namespace picojson;
  * append_email_byName()
  * append_key_byID()
  * append_key_byName()
+ * format_upload_string()
+ * format_number()
+ * format_integer()
+ * fast_parse()
+ * get_all_datasets()
+ * export_datasets() / columnar_file
+ * csv_reader
+ * format_csv_rows() / format_columnar_rows() (used by import_file)
+ * drop_sent_rows() / clear_upload_data() (incremental appends)
+ * flush_due() / start_auto_flush() / stop_auto_flush()
+ * format_timestamp() / push_timestamp()
+ * set_downsampling() / downsampler
+ * compact_encode() / set_compact_upload() (with a local test server)
+ * get_check_user() credential cache (with a local test server)
+ * typed_data / bind_schema() (typed schemas, with a local test server)
+ * set_memory_budget() / spill_store (with a local test server)
+ * sync_datasets() (with a local test server)
+ * get_dataset() queries / parse_timestamp() / scan_rows() (with a local test server)
  *
  */
 
@@ -44,6 +84,351 @@ const std::string test_project_label = "Boost";
 const std::string test_search_true = "test";
 const std::string test_search_empty = "abcdefghig";
 
+// Project JSON used by the tests that do not need to talk to iSENSE.
+const std::string test_offline_project =
+  "{\"id\":1,\"name\":\"Offline\",\"fields\":["
+  "{\"id\":10,\"type\":1,\"name\":\"Timestamp\",\"unit\":\"\"},"
+  "{\"id\":11,\"type\":2,\"name\":\"Number\",\"unit\":\"m\"},"
+  "{\"id\":12,\"type\":3,\"name\":\"Text\",\"unit\":\"\"}]}";
+
+// Same project with two datasets, as returned with ?recur=true.
+const std::string test_offline_datasets =
+  "{\"id\":1,\"name\":\"Offline\",\"fields\":["
+  "{\"id\":10,\"type\":1,\"name\":\"Timestamp\",\"unit\":\"\"},"
+  "{\"id\":11,\"type\":2,\"name\":\"Number\",\"unit\":\"m\"},"
+  "{\"id\":12,\"type\":3,\"name\":\"Text\",\"unit\":\"\"}],"
+  "\"dataSets\":["
+  "{\"id\":100,\"name\":\"First\",\"data\":["
+  "{\"10\":\"2015-01-01T00:00:00Z\",\"11\":\"1.5\",\"12\":\"a\"},"
+  "{\"10\":\"2015-01-01T00:00:01Z\",\"11\":2,\"12\":\"b\"}]},"
+  "{\"id\":101,\"name\":\"Second\",\"data\":["
+  "{\"11\":\"\",\"12\":\"c\"}]}],"
+  "\"mediaObjects\":[],\"owner\":{\"name\":\"Boost\"}}";
+
+/*
+ * A tiny HTTP server on 127.0.0.1, standing in for iSENSE so uploads can be
+ * tested without the network (the tests using it don't need iSENSE). GET requests are answered with the project JSON
+ * it was given, POST requests with {"id":5} (or next_dataset, counting up, if
+ * it isn't 0), and the POST bodies are saved.
+ * One request per connection. Every answer has HTTP code status (200).
+ * GETs of /media/... get the media set with set_media instead, honouring
+ * "Range: bytes=N-" if ranges is true. GETs of a path given to set_page
+ * (query included) get that page instead, and every GET path is saved.
+ */
+class local_server {
+ public:
+  explicit local_server(std::string project_json)
+    : status(200), requests(0), delay_ms(0), ranges(true), media_sent(0), next_dataset(0),
+      project_json(project_json), port(0), stopping(false) {
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;                       // Any free port
+    socklen_t length = sizeof address;
+
+    if (bind(listener, (sockaddr *) &address, sizeof address) == 0 &&
+        listen(listener, 8) == 0 &&
+        getsockname(listener, (sockaddr *) &address, &length) == 0) {
+      port = ntohs(address.sin_port);
+      thread = std::thread(&local_server::serve, this);
+    }
+  }
+
+  ~local_server() {
+    stopping = true;
+    shutdown(listener, SHUT_RDWR);              // Wakes up accept()
+    if (thread.joinable()) {
+      thread.join();
+    }
+    close(listener);
+  }
+
+  std::string base_URL() const {
+    return "http://127.0.0.1:" + std::to_string(port);
+  }
+
+  std::vector<std::string> posts() {
+    std::lock_guard<std::mutex> guard(lock);
+    return bodies;
+  }
+
+  void set_media(std::string data) {
+    std::lock_guard<std::mutex> guard(lock);
+    media = data;
+  }
+
+  void set_page(std::string path, std::string page) {
+    std::lock_guard<std::mutex> guard(lock);
+    pages[path] = page;
+  }
+
+  std::vector<std::string> gets() {
+    std::lock_guard<std::mutex> guard(lock);
+    return get_paths;
+  }
+
+  std::atomic<int> status;
+  std::atomic<int> requests;                    // Requests answered so far
+  std::atomic<int> delay_ms;                    // Wait before answering
+  std::atomic<bool> ranges;                     // Range requests for media
+  std::atomic<size_t> media_sent;               // Media bytes sent so far
+  std::atomic<int> next_dataset;                // ID of the next POST's dataset
+
+ private:
+  std::string project_json;
+  int listener, port;
+  std::atomic<bool> stopping;
+  std::thread thread;
+  std::mutex lock;
+  std::vector<std::string> bodies;
+  std::string media;
+  std::map<std::string, std::string> pages;
+  std::vector<std::string> get_paths;
+
+  void serve() {
+    while (!stopping) {
+      int client = accept(listener, NULL, NULL);
+      if (client < 0) {
+        continue;
+      }
+
+      // Read the headers, then Content-Length bytes of body.
+      std::string request;
+      char buffer[4096];
+      size_t body_start = std::string::npos, body_size = 0;
+      while (body_start == std::string::npos || request.size() < body_start + body_size) {
+        ssize_t got = recv(client, buffer, sizeof buffer, 0);
+        if (got <= 0) {
+          break;
+        }
+        request.append(buffer, got);
+
+        size_t end = request.find("\r\n\r\n");
+        if (body_start == std::string::npos && end != std::string::npos) {
+          body_start = end + 4;
+          size_t header = request.find("Content-Length: ");
+          if (header != std::string::npos && header < end) {
+            body_size = strtoul(request.c_str() + header + 16, NULL, 10);
+          }
+        }
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+      std::string body = "{\"id\":5}", headers;
+      int code = status;
+      if (request.compare(0, 11, "GET /media/") == 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t range = request.find("Range: bytes=");
+        size_t from = (ranges && range != std::string::npos) ?
+                      strtoul(request.c_str() + range + 13, NULL, 10) : 0;
+        body = from < media.size() ? media.substr(from) : "";
+        if (from >= media.size() && from > 0) {
+          code = 416;
+        } else if (from > 0) {
+          code = 206;
+          headers = "Content-Range: bytes " + std::to_string(from) + "-" +
+                    std::to_string(media.size() - 1) + "/" +
+                    std::to_string(media.size()) + "\r\n";
+        }
+        media_sent += body.size();
+      } else if (request.compare(0, 4, "GET ") == 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        std::string path = request.substr(4, request.find(' ', 4) - 4);
+        get_paths.push_back(path);
+        body = pages.count(path) ? pages[path] : project_json;
+      } else if (body_start != std::string::npos) {
+        std::lock_guard<std::mutex> guard(lock);
+        bodies.push_back(request.substr(body_start));
+        if (next_dataset != 0) {
+          body = "{\"id\":" + std::to_string(next_dataset++) + "}";
+        }
+      }
+
+      std::string response = "HTTP/1.1 " + std::to_string(code) + " Status\r\n" + headers +
+                             "Content-Type: application/json\r\n"
+                             "Connection: close\r\nContent-Length: " +
+                             std::to_string(body.size()) + "\r\n\r\n" + body;
+      requests++;                               // Counted before it's seen
+      send(client, response.data(), response.size(), MSG_NOSIGNAL);
+      close(client);
+    }
+  }
+};
+
+/*
+ * A stand-in for an HTTP/2 server without TLS (h2c), for set_http2. The first
+ * request on a connection asks to upgrade to HTTP/2 (RFC 7540 section 3.2),
+ * then every request on the connection gets the project JSON (POSTs too).
+ * Requests are answered batch at a time, or after half a second, so
+ * max_streams shows how many were multiplexed at once. Only the frames curl
+ * sends are understood, and the request headers aren't read.
+ */
+class h2c_server {
+ public:
+  h2c_server(std::string project_json, size_t batch)
+    : connections(0), requests(0), max_streams(0), project_json(project_json),
+      batch(batch), port(0), stopping(false) {
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;                       // Any free port
+    socklen_t length = sizeof address;
+
+    if (bind(listener, (sockaddr *) &address, sizeof address) == 0 &&
+        listen(listener, 8) == 0 &&
+        getsockname(listener, (sockaddr *) &address, &length) == 0) {
+      port = ntohs(address.sin_port);
+      thread = std::thread(&h2c_server::serve, this);
+    }
+  }
+
+  ~h2c_server() {
+    stopping = true;
+    shutdown(listener, SHUT_RDWR);              // Wakes up accept()
+    if (thread.joinable()) {
+      thread.join();
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+      clients[i].join();
+    }
+    close(listener);
+  }
+
+  std::string base_URL() const {
+    return "http://127.0.0.1:" + std::to_string(port);
+  }
+
+  std::atomic<int> connections, requests;
+  std::atomic<size_t> max_streams;              // Most answered at once
+
+ private:
+  std::string project_json;
+  size_t batch;
+  int listener, port;
+  std::atomic<bool> stopping;
+  std::thread thread;
+  std::vector<std::thread> clients;
+
+  void serve() {
+    while (!stopping) {
+      int client = accept(listener, NULL, NULL);
+      if (client >= 0) {
+        connections++;
+        clients.push_back(std::thread(&h2c_server::talk, this, client));
+      }
+    }
+  }
+
+  static bool read_bytes(int client, char *buffer, size_t size) {
+    while (size > 0) {
+      ssize_t got = recv(client, buffer, size, 0);
+      if (got <= 0) {
+        return false;
+      }
+      buffer += got;
+      size -= got;
+    }
+    return true;
+  }
+
+  static void send_frame(int client, int type, int flags, unsigned stream,
+                         const std::string &payload) {
+    std::string frame;
+    frame += char(payload.size() >> 16);
+    frame += char(payload.size() >> 8);
+    frame += char(payload.size());
+    frame += char(type);
+    frame += char(flags);
+    frame += char(stream >> 24);
+    frame += char(stream >> 16);
+    frame += char(stream >> 8);
+    frame += char(stream);
+    frame += payload;
+    send(client, frame.data(), frame.size(), MSG_NOSIGNAL);
+  }
+
+  // HEADERS with only :status 200 (HPACK static table entry 8), then DATA.
+  void answer(int client, std::vector<unsigned> &streams) {
+    if (streams.size() > max_streams) {
+      max_streams = streams.size();
+    }
+    for (size_t i = 0; i < streams.size(); i++) {
+      requests++;
+      send_frame(client, 1, 4, streams[i], std::string(1, char(0x88)));
+      send_frame(client, 0, 1, streams[i], project_json);
+    }
+    streams.clear();
+  }
+
+  void talk(int client) {
+    // The HTTP/1.1 request asking to upgrade (GETs have no body).
+    std::string request;
+    char buffer[4096];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+      ssize_t got = recv(client, buffer, sizeof buffer, 0);
+      if (got <= 0) {
+        close(client);
+        return;
+      }
+      request.append(buffer, got);
+    }
+    std::string upgrade = "HTTP/1.1 101 Switching Protocols\r\n"
+                          "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    send(client, upgrade.data(), upgrade.size(), MSG_NOSIGNAL);
+    send_frame(client, 4, 0, 0, "");            // Our SETTINGS
+
+    // The upgraded request is stream 1. Then the client's preface.
+    std::vector<unsigned> waiting(1, 1);
+    size_t preface = 24 - (request.size() - request.find("\r\n\r\n") - 4);
+    if (!read_bytes(client, buffer, preface)) {
+      close(client);
+      return;
+    }
+
+    while (!stopping) {
+      pollfd readable = {client, POLLIN, 0};
+      if (poll(&readable, 1, 500) == 0) {
+        answer(client, waiting);                // Nothing else is coming
+        continue;
+      }
+
+      unsigned char header[9];
+      if (!read_bytes(client, (char *) header, 9)) {
+        break;
+      }
+      size_t length = (header[0] << 16) | (header[1] << 8) | header[2];
+      int type = header[3], flags = header[4];
+      unsigned stream = ((header[5] & 0x7f) << 24) | (header[6] << 16) |
+                        (header[7] << 8) | header[8];
+      std::string payload(length, '\0');
+      if (length > 0 && !read_bytes(client, &payload[0], length)) {
+        break;
+      }
+
+      if (type == 4 && !(flags & 1)) {
+        send_frame(client, 4, 1, 0, "");        // SETTINGS ACK
+      } else if (type == 6 && !(flags & 1)) {
+        send_frame(client, 6, 1, 0, payload);   // PING ACK
+      } else if (type == 7) {
+        break;                                  // GOAWAY
+      } else if ((type == 0 || type == 1) && (flags & 1)) {
+        waiting.push_back(stream);              // END_STREAM: request done
+      }
+
+      if (waiting.size() >= batch) {
+        answer(client, waiting);
+      }
+    }
+    close(client);
+  }
+};
+
 /*
  * This is a derived class to quickly test the append_byID functions.
  * It is derived from iSENSE, and by doing this I can create a public function
@@ -295,3 +680,1575 @@ BOOST_AUTO_TEST_CASE(append_withDatasetName_byKey) {
 
   BOOST_REQUIRE(test.append_key_byName(test_dataset_name_key) == true);
 }
+
+// Test the upload string formatting (does not need iSENSE).
+BOOST_AUTO_TEST_CASE(format_upload_string) {
+  iSENSE test;
+
+  BOOST_REQUIRE(test.parse_project_fields(test_offline_project) == true);
+  test.set_project_title("Format Test");
+  test.set_contributor_key("123");
+  test.set_project_label("Boost");
+
+  test.push_back("Number", "1.5");
+  test.push_back("Number", "2");
+  test.push_back("Text", "A \"quoted\" line\n");
+
+  test.format_upload_string(POST_KEY);
+
+  // Fields without data are uploaded as empty arrays.
+  BOOST_REQUIRE(test.get_upload_string() ==
+    "{\"title\":\"Format Test\",\"contribution_key\":\"123\","
+    "\"contributor_name\":\"Boost\",\"data\":{\"10\":[],"
+    "\"11\":[\"1.5\",\"2\"],\"12\":[\"A \\\"quoted\\\" line\\n\"]}}");
+
+  // The upload string is valid JSON.
+  value upload;
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("12").get(0).get<std::string>() ==
+                "A \"quoted\" line\n");
+}
+
+// Test formatting numbers for the upload string (does not need iSENSE).
+BOOST_AUTO_TEST_CASE(format_numbers) {
+  char buffer[NUMBER_BUFFER_SIZE];
+
+  // Doubles use the shortest text that reads back as the same double.
+  const double numbers[] = {0.1, 1.0 / 3.0, -2.5, 123456.789, 1e-300, 5e21,
+                            -0.0042, 20.501, 1e-9, 0.30000000000000004};
+  for (double number : numbers) {
+    std::string text(buffer, iSENSE::format_number(buffer, number));
+    BOOST_REQUIRE(strtod(text.c_str(), NULL) == number);
+  }
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_number(buffer, 0.1)) == "0.1");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_number(buffer, 42.0)) == "42");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_number(buffer, -0.0042)) == "-0.0042");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_number(buffer, 20.501)) == "20.501");
+  BOOST_REQUIRE(iSENSE::format_number(buffer, NAN) == 0);
+
+  // Integers, including the most negative one.
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_integer(buffer, 0)) == "0");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_integer(buffer, -1234567)) == "-1234567");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_integer(buffer, LLONG_MIN)) ==
+                "-9223372036854775808");
+
+  // Mixing numbers and strings in one field keeps the order.
+  iSENSE test;
+  BOOST_REQUIRE(test.parse_project_fields(test_offline_project) == true);
+  test.set_project_title("Number Test");
+  test.set_contributor_key("123");
+  test.push_back("Number", 1.5);
+  test.push_back("Number", "two");
+  test.push_back("Number", 3.0);
+  std::vector<long long> big = {1, 1LL << 60};
+  test.push_vector("Text", big);
+
+  test.format_upload_string(POST_KEY);
+  value upload;
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() == "[\"1.5\",\"two\",\"3\"]");
+  BOOST_REQUIRE(upload.get("data").get("12").serialize() ==
+                "[\"1\",\"1152921504606846976\"]");
+}
+
+// Test that the fast parser gives the same results as picojson.
+BOOST_AUTO_TEST_CASE(push_range) {
+  iSENSE test;
+  BOOST_REQUIRE(test.parse_project_fields(test_offline_project) == true);
+  test.set_project_title("Range Test");
+  test.set_contributor_key("123");
+
+  // Ranges add to the end of a field, from any kind of numbers.
+  const double doubles[] = {1.5, 2.5};
+  std::vector<float> floats = {3.5f, 4};
+  std::deque<int> ints = {5, 6};
+  test.push_range("Number", doubles, doubles + 2);
+  test.push_range("Number", floats.begin(), floats.end());
+  test.push_range("Number", ints.begin(), ints.end());
+  double more[] = {7, 8};
+  std::vector<double> last = {9};
+  test.push_range("Number", more, more + 2);
+  test.push_range("Number", last.begin(), last.end());
+
+  // A range after text is added as text, in order.
+  std::vector<std::string> text = {"a", "b"};
+  test.push_vector("Text", std::move(text));
+  test.push_range("Text", doubles, doubles + 1);
+
+  test.format_upload_string(POST_KEY);
+  value upload;
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() ==
+                "[\"1.5\",\"2.5\",\"3.5\",\"4\",\"5\",\"6\",\"7\",\"8\",\"9\"]");
+  BOOST_REQUIRE(upload.get("data").get("12").serialize() == "[\"a\",\"b\",\"1.5\"]");
+}
+
+BOOST_AUTO_TEST_CASE(fast_parse_matches_picojson) {
+  const std::string documents[] = {
+    test_offline_project,
+    "[]", "{}", " [ 1 , -2.5e3 , 0.1 , true , false , null ] ",
+    "{\"a\":{\"b\":[[],[{}],\"c\"]},\"a\":\"duplicate key\"}",
+    "[\"escapes \\\" \\\\ \\/ \\b \\f \\n \\r \\t\", \"\\u00e9 \\u20ac \\ud83d\\ude00\"]",
+    "[\"a backslash at the end \\\\\", \"\\\\\\\"\"]",
+    "{\"long string that crosses the 64 character blocks used by stage one\":"
+    "\"and a value that is also long enough to cross into the next block\"}",
+    "[01, 1., 123abc]", "123 trailing", "[1 2]", "[tru]", "[\"unclosed]",
+    "{\"a\" 1}", "[1,]", "[\"\\ud800\"]", "[\"bad \\x escape\"]", "",
+  };
+
+  for (const std::string &json : documents) {
+    value expected, actual;
+    std::string expected_errors = parse(expected, json);
+    std::string actual_errors = fast_parse(actual, json);
+
+    BOOST_CHECK_EQUAL(actual_errors, expected_errors);
+    BOOST_CHECK_EQUAL(actual.serialize(), expected.serialize());
+  }
+
+  // The backend can be chosen on the iSENSE object.
+  iSENSE test;
+  test.set_parse_backend(PARSE_FAST);
+  BOOST_REQUIRE(test.parse_project_fields(test_offline_project) == true);
+  BOOST_REQUIRE(test.get_field_ID("Number") == "11");
+}
+
+// Test pulling every dataset into columns (does not need iSENSE).
+BOOST_AUTO_TEST_CASE(get_all_datasets) {
+  iSENSE test;
+  BOOST_REQUIRE(test.parse_datasets_and_mediaobjects(test_offline_datasets) == true);
+
+  // The result should be the same no matter how many threads are used.
+  const int thread_counts[] = {1, 4};
+  for (int threads : thread_counts) {
+    test.set_thread_count(threads);
+    dataset_table table = test.get_all_datasets(std::vector<std::string>());
+
+    BOOST_REQUIRE(table.columns.size() == 3);
+    BOOST_REQUIRE(table.dataset_names.size() == 2);
+    BOOST_REQUIRE(table.dataset_IDs[1] == "101");
+    BOOST_REQUIRE(table.dataset_starts == std::vector<size_t>({0, 2, 3}));
+
+    const dataset_column &number = table.columns[1];
+    BOOST_REQUIRE(number.field_type == FIELD_NUMBER && number.unit == "m");
+    BOOST_REQUIRE(number.numbers.size() == 3 && number.text.empty());
+    BOOST_REQUIRE(number.numbers[0] == 1.5 && number.numbers[1] == 2);
+    BOOST_REQUIRE(std::isnan(number.numbers[2]));       // Empty string
+
+    const dataset_column &timestamp = table.columns[0];
+    BOOST_REQUIRE(timestamp.text[1] == "2015-01-01T00:00:01Z");
+    BOOST_REQUIRE(timestamp.text[2] == "");              // Not in the row
+  }
+
+  // Only some fields, in the order asked for.
+  std::vector<std::string> names = {"Text", "Number"};
+  dataset_table table = test.get_all_datasets(names);
+  BOOST_REQUIRE(table.columns.size() == 2);
+  BOOST_REQUIRE(table.columns[0].text == std::vector<std::string>({"a", "b", "c"}));
+
+  // A field that doesn't exist.
+  names.push_back("Not a field");
+  BOOST_REQUIRE(test.get_all_datasets(names).columns.empty());
+
+  // A listing with something other than a dataset in it.
+  iSENSE malformed;
+  BOOST_REQUIRE(malformed.parse_datasets_and_mediaobjects(
+    test_offline_project.substr(0, test_offline_project.size() - 1) +
+    ",\"dataSets\":[{\"id\":102,\"name\":\"Other\",\"data\":[]},7]}") == true);
+  BOOST_REQUIRE(malformed.get_all_datasets(std::vector<std::string>()).columns.empty());
+  BOOST_REQUIRE(malformed.get_dataset_ID("Other") == "102");    // Skips the 7
+
+  // Another project's datasets are pulled down, not the old ones reused.
+  local_server server(test_offline_project.substr(0, test_offline_project.size() - 1) +
+                      ",\"dataSets\":[{\"id\":102,\"name\":\"Other\",\"data\":[]}]}");
+  test.set_base_URL(server.base_URL());
+  test.set_fields_mode(FIELDS_LAZY);
+  test.set_project_ID("93");
+  table = test.get_all_datasets(std::vector<std::string>());
+  BOOST_REQUIRE(table.dataset_IDs == std::vector<std::string>({"102"}));
+}
+
+BOOST_AUTO_TEST_CASE(export_datasets) {
+  iSENSE test;
+  BOOST_REQUIRE(test.parse_datasets_and_mediaobjects(test_offline_datasets) == true);
+
+  std::string path = "test_export.isense";
+  BOOST_REQUIRE(test.export_datasets(path, std::vector<std::string>()) == true);
+
+  columnar_file file;
+  BOOST_REQUIRE(file.open(path) == true);
+  BOOST_REQUIRE(file.rows() == 3 && file.columns() == 3 && file.datasets() == 2);
+  BOOST_REQUIRE(file.dataset_start(1) == 2 && file.dataset_start(2) == 3);
+  BOOST_REQUIRE(file.dataset_ID(1).str() == "101");
+  BOOST_REQUIRE(file.dataset_name(0).str() == "First");
+
+  int number = file.find_column("Number");
+  BOOST_REQUIRE(number == 1);
+  BOOST_REQUIRE(file.field_ID(number).str() == "11" && file.unit(number).str() == "m");
+  BOOST_REQUIRE(file.storage(number) == COLUMN_NUMBERS);
+  BOOST_REQUIRE(file.numbers(number)[0] == 1.5 && file.numbers(number)[1] == 2);
+  BOOST_REQUIRE(std::isnan(file.numbers(number)[2]));
+
+  int text = file.find_column("Text");
+  BOOST_REQUIRE(file.storage(text) == COLUMN_TEXT && file.numbers(text) == NULL);
+  BOOST_REQUIRE(file.text(text, 2).str() == "c");
+  BOOST_REQUIRE(file.text(0, 1).str() == "2015-01-01T00:00:01Z");
+  BOOST_REQUIRE(file.find_column("Not a field") == -1);
+
+  // A cut off file should not open.
+  file.close();
+  BOOST_REQUIRE(truncate(path.c_str(), 100) == 0);
+  BOOST_REQUIRE(file.open(path) == false);
+  BOOST_REQUIRE(file.rows() == 0);
+
+  std::remove(path.c_str());
+}
+
+// Test splitting CSV text into cells (does not need iSENSE).
+BOOST_AUTO_TEST_CASE(csv_reader_cells) {
+  std::string csv = "a,\"b,\"\"c\"\"\",,\r\n\n 1.5e3 ,x\"y,\"line\nbreak\"";
+  csv_reader reader(csv.data(), csv.size());
+  std::vector<csv_cell> cells;
+
+  BOOST_REQUIRE(reader.next_row(cells) == true);
+  BOOST_REQUIRE(cells.size() == 4);
+  BOOST_REQUIRE(cells[0].str() == "a");
+  BOOST_REQUIRE(cells[1].quoted && cells[1].str() == "b,\"c\"");
+  BOOST_REQUIRE(cells[2].length == 0 && cells[3].length == 0);
+
+  // The blank line is skipped.
+  BOOST_REQUIRE(reader.next_row(cells) == true);
+  BOOST_REQUIRE(cells.size() == 3);
+  BOOST_REQUIRE(cells[1].str() == "x\"y");
+  BOOST_REQUIRE(cells[2].str() == "line\nbreak");
+
+  const char *number;
+  size_t count;
+  BOOST_REQUIRE(cells[0].number(number, count) && std::string(number, count) == "1.5e3");
+  BOOST_REQUIRE(cells[1].number(number, count) == false);
+  BOOST_REQUIRE(reader.next_row(cells) == false);
+
+  const char *not_numbers[] = {"", "-", ".", "1e", "1.2.3", "0x10", "nan"};
+  for (const char *text : not_numbers) {
+    csv_cell cell = {text, strlen(text), false};
+    BOOST_REQUIRE(cell.number(number, count) == false);
+  }
+}
+
+// Test formatting the chunks that import_file uploads (does not need iSENSE).
+BOOST_AUTO_TEST_CASE(import_chunks) {
+  iSENSE test;
+  BOOST_REQUIRE(test.parse_project_fields(test_offline_project) == true);
+  test.set_project_title("Import Test");
+  test.set_contributor_key("123");
+  test.set_project_label("Boost");
+  test.set_import_chunk_rows(2);
+
+  // Columns in a different order, an extra column, and a bad number.
+  std::string csv = "Text,Extra,Number\n\"a \"\"b\"\"\",x, 1.5\nc,y,two\nd,z,-3";
+  csv_reader reader(csv.data(), csv.size());
+  std::vector<csv_cell> header;
+  std::vector<std::string> names;
+
+  reader.next_row(header);
+  for (size_t i = 0; i < header.size(); i++) {
+    names.push_back(header[i].str());
+  }
+  std::vector<int> columns = test.match_columns(names);
+  BOOST_REQUIRE(columns == std::vector<int>({-1, 2, 0}));
+
+  std::vector<std::vector<csv_cell> > cells;
+  BOOST_REQUIRE(test.format_csv_rows(reader, columns, cells, POST_KEY) == 2);
+  BOOST_REQUIRE(test.get_upload_string() ==
+    "{\"title\":\"Import Test\",\"contribution_key\":\"123\","
+    "\"contributor_name\":\"Boost\",\"data\":{\"10\":[],"
+    "\"11\":[\"1.5\",\"\"],\"12\":[\"a \\\"b\\\"\",\"c\"]}}");
+
+  // The rest are appended.
+  BOOST_REQUIRE(test.format_csv_rows(reader, columns, cells, APPEND_KEY) == 1);
+  value upload;
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").get(0).get<std::string>() == "-3");
+  BOOST_REQUIRE(upload.contains("id"));
+  BOOST_REQUIRE(test.format_csv_rows(reader, columns, cells, APPEND_KEY) == 0);
+
+  // Nothing matches.
+  BOOST_REQUIRE(test.match_columns(std::vector<std::string>({"Extra"})).empty());
+
+  // A columnar file, made by export_datasets.
+  std::string path = "test_import.isense";
+  iSENSE source;
+  BOOST_REQUIRE(source.parse_datasets_and_mediaobjects(test_offline_datasets) == true);
+  BOOST_REQUIRE(source.export_datasets(path, std::vector<std::string>()) == true);
+
+  columnar_file file;
+  BOOST_REQUIRE(file.open(path) == true);
+  columns = test.match_columns(std::vector<std::string>({"Timestamp", "Number", "Text"}));
+
+  BOOST_REQUIRE(test.format_columnar_rows(file, 2, columns, POST_KEY) == 1);
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").get(0).get<std::string>() == "");
+  BOOST_REQUIRE(upload.get("data").get("12").get(0).get<std::string>() == "c");
+
+  BOOST_REQUIRE(test.format_columnar_rows(file, 0, columns, POST_KEY) == 2);
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").get(0).get<std::string>() == "1.5");
+  BOOST_REQUIRE(upload.get("data").get("10").get(1).get<std::string>() ==
+                "2015-01-01T00:00:01Z");
+
+  file.close();
+  std::remove(path.c_str());
+
+  // An empty file is an error, nothing is uploaded.
+  local_server server(test_offline_project);
+  test.set_base_URL(server.base_URL());
+  test.set_project_ID("94");
+  std::ofstream("test_empty.csv").close();
+  BOOST_REQUIRE(test.import_file("test_empty.csv", POST_KEY) == false);
+  BOOST_REQUIRE(server.posts().empty());
+  std::remove("test_empty.csv");
+
+  // With auto flush on, import_file and flush() each append to the dataset
+  // they made.
+  server.next_dataset = 7;
+  test.set_flush_policy(0, 0, 0);
+  BOOST_REQUIRE(test.start_auto_flush(POST_KEY) == true);
+  test.push_back("Number", 1.0);
+  BOOST_REQUIRE(test.flush() == true);                    // Makes dataset 7
+  std::ofstream("test_import.csv") << "Number\n1\n2\n3\n";
+  BOOST_REQUIRE(test.import_file("test_import.csv", POST_KEY) == true);  // 8
+  std::remove("test_import.csv");
+  test.push_back("Number", 2.0);
+  BOOST_REQUIRE(test.stop_auto_flush() == true);
+
+  std::vector<std::string> posts = server.posts();
+  BOOST_REQUIRE(posts.size() == 4);
+  BOOST_REQUIRE(parse(upload, posts[2]).empty());
+  BOOST_REQUIRE(upload.get("id").to_str() == "8");
+  BOOST_REQUIRE(parse(upload, posts[3]).empty());
+  BOOST_REQUIRE(upload.get("id").to_str() == "7");
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() == "[\"2\"]");
+}
+
+// Test removing the rows an upload sent, as incremental mode does after a
+// successful append (does not need iSENSE).
+BOOST_AUTO_TEST_CASE(incremental_append) {
+  iSENSE test;
+  BOOST_REQUIRE(test.parse_project_fields(test_offline_project) == true);
+  test.set_project_title("Incremental Test");
+  test.set_contributor_key("123");
+
+  test.push_back("Number", 1.0);
+  test.push_back("Number", 2.0);
+  test.push_back("Text", "a");
+  test.format_upload_string(APPEND_KEY);
+
+  // Rows pushed back after the upload string was made are kept.
+  test.push_back("Number", 3.0);
+  test.drop_sent_rows();
+  test.format_upload_string(APPEND_KEY);
+
+  value upload;
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() == "[\"3\"]");
+  BOOST_REQUIRE(upload.get("data").get("12").serialize() == "[]");
+
+  // Dropping twice doesn't remove anything else.
+  test.drop_sent_rows();
+  test.drop_sent_rows();
+  BOOST_REQUIRE(test.empty_project_check(APPEND_KEY, "incremental_append") == false);
+
+  // Clearing the data keeps the project and fields.
+  test.push_back("Text", "b");
+  test.clear_upload_data();
+  test.push_back("Text", "c");
+  test.format_upload_string(APPEND_KEY);
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("title").get<std::string>() == "Incremental Test");
+  BOOST_REQUIRE(upload.get("data").get("12").serialize() == "[\"c\"]");
+
+  // Rows pushed to a name that isn't a field can't be sent, so they're dropped
+  // instead of waiting forever.
+  test.drop_sent_rows();
+  test.push_back("Nmuber", 4.0);
+  test.push_vector("Txet", std::vector<std::string>({"d"}));
+  test.format_upload_string(APPEND_KEY);
+  test.drop_sent_rows();
+  BOOST_REQUIRE(test.empty_project_check(APPEND_KEY, "incremental_append") == false);
+}
+
+// Test the auto flush policy, and that rows the project has no field for
+// are dropped instead of uploaded (uses a local server).
+BOOST_AUTO_TEST_CASE(auto_flush_policy) {
+  local_server server(test_offline_project);
+  iSENSE test;
+  test.set_base_URL(server.base_URL());
+  test.set_project_ID("1");
+  test.set_project_title("Flush Test");
+  test.set_contributor_key("123");
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  BOOST_REQUIRE(test.flush_due(now) == false);
+
+  // Rows - the field with the most rows counts.
+  test.set_flush_policy(3, 0, 0);
+  test.push_back("Number", 1.0);
+  test.push_back("Text", "a");
+  test.push_back("Number", 2.0);
+  BOOST_REQUIRE(test.flush_due(now) == false);
+  test.push_back("Number", 3.0);
+  BOOST_REQUIRE(test.flush_due(now) == true);
+
+  // Bytes
+  test.clear_upload_data();
+  test.set_flush_policy(0, 20, 0);
+  test.push_back("Text", "0123456789");
+  BOOST_REQUIRE(test.flush_due(now) == false);
+  test.push_back("Text", "0123456789");
+  BOOST_REQUIRE(test.flush_due(now) == true);
+
+  // Time since the oldest row
+  test.clear_upload_data();
+  test.set_flush_policy(0, 0, 50);
+  test.push_back("Number", 1.0);
+  now = std::chrono::steady_clock::now();
+  BOOST_REQUIRE(test.flush_due(now) == false);
+  BOOST_REQUIRE(test.flush_due(now + std::chrono::milliseconds(51)) == true);
+
+  // The thread starts and stops. Nothing is waiting, so nothing is uploaded.
+  test.clear_upload_data();
+  test.set_flush_policy(1000, 0, 0);
+  BOOST_REQUIRE(test.start_auto_flush(POST_KEY) == true);
+  BOOST_REQUIRE(test.stop_auto_flush() == true);
+  BOOST_REQUIRE(test.start_auto_flush(APPEND_KEY) == false);
+
+  // Rows pushed to a name that isn't a field are dropped, not sent again
+  // and again by the thread.
+  int before = server.requests;
+  test.set_flush_policy(1, 0, 0);
+  BOOST_REQUIRE(test.start_auto_flush(POST_KEY) == true);
+  test.push_back("Nmuber", 1.0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  BOOST_REQUIRE(test.stop_auto_flush() == true);
+  BOOST_REQUIRE(server.posts().empty());
+  BOOST_REQUIRE(server.requests == before);
+  BOOST_REQUIRE(test.flush_due(std::chrono::steady_clock::now()) == false);
+}
+
+// Test timestamps (does not need iSENSE).
+BOOST_AUTO_TEST_CASE(timestamps) {
+  char buffer[TIMESTAMP_BUFFER_SIZE];
+  const long long second = NANOSECONDS_PER_SECOND;
+
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_timestamp(buffer, 0, TIMESTAMP_SECONDS)) ==
+                "1970-01-01T00:00:00Z");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_timestamp(buffer, 1318057629 * second +
+                                    123456789, TIMESTAMP_MILLISECONDS)) ==
+                "2011-10-08T07:07:09.123Z");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_timestamp(buffer, 951825600 * second,
+                                    TIMESTAMP_SECONDS)) == "2000-02-29T12:00:00Z");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_timestamp(buffer, 4107542400 * second,
+                                    TIMESTAMP_SECONDS)) == "2100-03-01T00:00:00Z");
+  BOOST_REQUIRE(std::string(buffer, iSENSE::format_timestamp(buffer, -1,
+                                    TIMESTAMP_NANOSECONDS)) ==
+                "1969-12-31T23:59:59.999999999Z");
+
+  // The thread safe version gives the same format as the old one.
+  std::string now(buffer, iSENSE::generate_timestamp(buffer, TIMESTAMP_MICROSECONDS));
+  BOOST_REQUIRE(now.size() == sizeof "2011-10-08T07:07:09.123456Z" - 1);
+  iSENSE test;
+  BOOST_REQUIRE(test.generate_timestamp().size() == sizeof "2011-10-08T07:07:09Z" - 1);
+
+  // Native timestamp column, formatted when the upload string is made.
+  BOOST_REQUIRE(test.parse_project_fields(test_offline_project) == true);
+  test.set_project_title("Timestamp Test");
+  test.set_contributor_key("123");
+  test.push_timestamp("Timestamp", 1318057629 * second + 1000000);
+  test.push_timestamp("Timestamp", 1318057629 * second + 2000000);
+  test.push_timestamp("Timestamp", 1318057630 * second);
+  test.format_upload_string(POST_KEY);
+
+  value upload;
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("10").serialize() ==
+                "[\"2011-10-08T07:07:09.001Z\",\"2011-10-08T07:07:09.002Z\","
+                "\"2011-10-08T07:07:10.000Z\"]");
+
+  // Pushing a string keeps the times, in order.
+  test.set_timestamp_digits(TIMESTAMP_SECONDS);
+  test.push_back("Timestamp", "later");
+  test.format_upload_string(POST_KEY);
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("10").get(2).get<std::string>() ==
+                "2011-10-08T07:07:10Z");
+  BOOST_REQUIRE(upload.get("data").get("10").get(3).get<std::string>() == "later");
+}
+
+// Test downsampling (does not need iSENSE).
+BOOST_AUTO_TEST_CASE(downsampling) {
+  iSENSE test;
+  BOOST_REQUIRE(test.parse_project_fields(test_offline_project) == true);
+  test.set_project_title("Downsample Test");
+  test.set_contributor_key("123");
+
+  BOOST_REQUIRE(test.set_downsampling("Number", DOWNSAMPLE_MEAN, 0) == false);
+  BOOST_REQUIRE(test.set_downsampling("Number", 42, 1) == false);
+  BOOST_REQUIRE(test.get_reduction_ratio("Number") == 1);
+
+  // Mean of every 4 rows, the times end up in the middle of each window.
+  const long long second = NANOSECONDS_PER_SECOND;
+  BOOST_REQUIRE(test.set_downsampling("Number", DOWNSAMPLE_MEAN, 4) == true);
+  BOOST_REQUIRE(test.set_downsampling("Timestamp", DOWNSAMPLE_MEAN, 4) == true);
+  for (int i = 0; i < 10; i++) {
+    test.push_back("Number", i);
+    test.push_timestamp("Timestamp", 1318057629 * second + i * second / 10);
+  }
+  test.format_upload_string(POST_KEY);
+
+  value upload;
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() == "[\"1.5\",\"5.5\"]");
+  BOOST_REQUIRE(upload.get("data").get("10").serialize() ==
+                "[\"2011-10-08T07:07:09.150Z\",\"2011-10-08T07:07:09.550Z\"]");
+  BOOST_REQUIRE(test.get_reduction_ratio("Number") == 5);
+
+  // The part full window is saved when downsampling is turned off.
+  BOOST_REQUIRE(test.set_downsampling("Number", DOWNSAMPLE_NONE, 0) == true);
+  test.format_upload_string(POST_KEY);
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() == "[\"1.5\",\"5.5\",\"8.5\"]");
+  BOOST_REQUIRE(test.get_reduction_ratio("Number") == 1);
+
+  // Max, then deadband.
+  const double values[] = {1, 5, 2, 0, 0, 7, 1.2, 1.4, 2, 2.1, 1.4};
+  test.clear_upload_data();
+  BOOST_REQUIRE(test.set_downsampling("Number", DOWNSAMPLE_MAX, 3) == true);
+  for (int i = 0; i < 6; i++) {
+    test.push_back("Number", values[i]);
+  }
+  BOOST_REQUIRE(test.set_downsampling("Number", DOWNSAMPLE_DEADBAND, 0.5) == true);
+  for (int i = 5; i < 11; i++) {
+    test.push_back("Number", values[i]);
+  }
+  test.format_upload_string(POST_KEY);
+  BOOST_REQUIRE(parse(upload, test.get_upload_string()).empty());
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() ==
+                "[\"5\",\"7\",\"7\",\"1.2\",\"2\",\"1.4\"]");
+
+  // LTTB keeps the first value, the peak of each bucket and the last value.
+  downsampler lttb(DOWNSAMPLE_LTTB, 4, 0);
+  const double signal[] = {0, 0, 0, 9, 0, 0, 0, 0, 0};
+  double ready[DOWNSAMPLE_MAX_READY];
+  std::vector<double> kept;
+  for (int i = 0; i < 9; i++) {
+    size_t count = lttb.push(signal[i], ready);
+    kept.insert(kept.end(), ready, ready + count);
+  }
+  BOOST_REQUIRE(kept.size() == 2 && kept[0] == 0 && kept[1] == 9);
+  BOOST_REQUIRE(lttb.finish(ready) == 2);
+  BOOST_REQUIRE(lttb.values_in() == 9 && lttb.values_out() == 4);
+}
+
+// Test that the compact encoding round trips numbers and timestamps, and that
+// only servers listing it in their project JSON are sent it.
+BOOST_AUTO_TEST_CASE(compact_upload) {
+  // Round trip, including values that don't change, big jumps and NaN.
+  std::vector<double> numbers, decoded_numbers;
+  for (int i = 0; i < 1000; i++) {
+    numbers.push_back(20 + std::floor(std::sin(i / 50.0) * 100) / 10);
+  }
+  numbers.push_back(-1e300);
+  numbers.push_back(NAN);
+  numbers.push_back(0);
+
+  std::string text, json;
+  compact_encode(text, &numbers[0], numbers.size());
+  BOOST_REQUIRE(compact_decode(text, decoded_numbers) == true);
+  BOOST_REQUIRE(decoded_numbers.size() == numbers.size());
+  BOOST_REQUIRE(memcmp(&decoded_numbers[0], &numbers[0], numbers.size() * sizeof(double)) == 0);
+
+  // Without the NaN etc. they are all decimals, which are much smaller.
+  numbers.resize(1000);
+  text.clear();
+  compact_encode(text, &numbers[0], numbers.size());
+  iSENSE::format_data(json, numbers, "11");
+  BOOST_REQUIRE(compact_decode(text, decoded_numbers) == true);
+  BOOST_REQUIRE(decoded_numbers == numbers);
+  BOOST_REQUIRE(text.size() * 3 < json.size());
+
+  const long long second = NANOSECONDS_PER_SECOND;
+  std::vector<long long> times, decoded_times;
+  for (int i = 0; i < 1000; i++) {
+    times.push_back(1318057629 * second + i * (second / 1000) + (i % 3) * 1000000);
+  }
+  times.push_back(-1);
+  times.push_back(LLONG_MAX / 1000000 * 1000000);
+
+  int digits = 0;
+  text.clear();
+  compact_encode(text, &times[0], times.size(), TIMESTAMP_MILLISECONDS);
+  BOOST_REQUIRE(compact_decode(text, decoded_times, digits) == true);
+  BOOST_REQUIRE(digits == TIMESTAMP_MILLISECONDS);
+  BOOST_REQUIRE(decoded_times.size() == times.size());
+  BOOST_REQUIRE(decoded_times[5] == times[5]);
+  BOOST_REQUIRE(decoded_times[1000] == -1000000);           // Rounded down
+  BOOST_REQUIRE(decoded_times[1001] == times[1001]);
+
+  BOOST_REQUIRE(compact_decode("not base64", decoded_numbers) == false);
+  BOOST_REQUIRE(compact_decode(text, decoded_numbers) == false);   // Wrong type
+
+  // A server that can read compact uploads gets them.
+  const std::string compact_project = "{\"id\":1,\"name\":\"Offline\","
+    "\"uploadEncodings\":[\"" + COMPACT_ENCODING + "\"],"
+    "\"fields\":[{\"id\":10,\"type\":1,\"name\":\"Timestamp\",\"unit\":\"\"},"
+    "{\"id\":11,\"type\":2,\"name\":\"Number\",\"unit\":\"m\"},"
+    "{\"id\":12,\"type\":3,\"name\":\"Text\",\"unit\":\"\"}]}";
+  local_server server(compact_project);
+
+  iSENSE test;
+  test.set_base_URL(server.base_URL());
+  test.set_project_ID("1");
+  test.set_project_title("Compact Test");
+  test.set_contributor_key("123");
+  test.set_compact_upload(true);
+  test.push_vector("Number", numbers);
+  for (int i = 0; i < 3; i++) {
+    test.push_timestamp("Timestamp", times[i]);
+    test.push_back("Text", "a");
+  }
+  BOOST_REQUIRE(test.post_json_key() == true);
+
+  std::vector<std::string> posts = server.posts();
+  BOOST_REQUIRE(posts.size() == 1);
+  value upload;
+  BOOST_REQUIRE(parse(upload, posts[0]).empty());
+  BOOST_REQUIRE(upload.get("encoding").get<std::string>() == COMPACT_ENCODING);
+  BOOST_REQUIRE(compact_decode(upload.get("data").get("11").get<std::string>(),
+                               decoded_numbers) == true);
+  BOOST_REQUIRE(memcmp(&decoded_numbers[0], &numbers[0], numbers.size() * sizeof(double)) == 0);
+  BOOST_REQUIRE(compact_decode(upload.get("data").get("10").get<std::string>(),
+                               decoded_times, digits) == true);
+  BOOST_REQUIRE(decoded_times.size() == 3 && decoded_times[2] == times[2]);
+  BOOST_REQUIRE(upload.get("data").get("12").serialize() == "[\"a\",\"a\",\"a\"]");
+
+  // Servers that don't list the encoding get plain JSON.
+  local_server plain(test_offline_project);
+  test.set_base_URL(plain.base_URL());
+  BOOST_REQUIRE(test.get_project_fields() == true);
+  BOOST_REQUIRE(test.post_json_key() == true);
+
+  posts = plain.posts();
+  BOOST_REQUIRE(posts.size() == 1);
+  BOOST_REQUIRE(parse(upload, posts[0]).empty());
+  BOOST_REQUIRE(upload.get("encoding").is<null>());
+  BOOST_REQUIRE(upload.get("data").get("11").get<array>().size() == numbers.size());
+}
+
+// Test that objects sharing an account check it with the server once, that a
+// 401 upload forgets it, and that turning the cache off checks every time.
+BOOST_AUTO_TEST_CASE(credential_cache) {
+  local_server server(test_offline_project);
+
+  // Many objects with the same account only check it once. The first answer
+  // is slow, so the others are waiting for it while it is being checked.
+  std::vector<std::unique_ptr<iSENSE> > objects;
+  for (int i = 0; i < 4; i++) {
+    objects.push_back(std::unique_ptr<iSENSE>(new iSENSE()));
+    objects[i]->set_base_URL(server.base_URL());
+  }
+  int before = server.requests;
+  server.delay_ms = 200;
+
+  std::vector<std::thread> threads;
+  std::atomic<int> valid(0);
+  for (int i = 0; i < 4; i++) {
+    threads.push_back(std::thread([&objects, &valid, i]() {
+      valid += objects[i]->set_email_password("a@b.c", "secret");
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  server.delay_ms = 0;
+  BOOST_REQUIRE(valid == 4);
+  BOOST_REQUIRE(server.requests == before + 1);
+  int after_first = server.requests;
+
+  // A different password is checked, and a wrong one is cached too.
+  server.status = HTTP_UNAUTHORIZED;
+  BOOST_REQUIRE(objects[1]->set_email_password("a@b.c", "wrong") == false);
+  BOOST_REQUIRE(objects[2]->set_email_password("a@b.c", "wrong") == false);
+  BOOST_REQUIRE(server.requests == after_first + 1);
+
+  // A 401 upload removes the account, so it is checked again.
+  objects[0]->set_project_ID("1");
+  objects[0]->set_project_title("Credential Test");
+  objects[0]->push_back("Text", "a");
+  BOOST_REQUIRE(objects[0]->post_json_email() == false);
+  BOOST_REQUIRE(objects[3]->set_email_password("a@b.c", "secret") == false);
+
+  // No cache: every check asks the server.
+  server.status = HTTP_AUTHORIZED;
+  iSENSE::set_credential_cache_ttl(0);
+  before = server.requests;
+  BOOST_REQUIRE(objects[1]->set_email_password("a@b.c", "secret") == true);
+  BOOST_REQUIRE(objects[2]->set_email_password("a@b.c", "secret") == true);
+  BOOST_REQUIRE(server.requests == before + 2);
+  iSENSE::set_credential_cache_ttl(CREDENTIAL_CACHE_SECONDS);
+}
+
+// Test that objects getting the same project at once share one request, and
+// that prefetched projects are kept for the TTL but failures aren't.
+BOOST_AUTO_TEST_CASE(project_cache) {
+  local_server server(test_offline_project);
+  iSENSE test;
+  test.set_base_URL(server.base_URL());
+
+  // Objects getting the same project at the same time share one request,
+  // even though finished projects aren't kept by default.
+  server.delay_ms = 100;
+  std::vector<std::unique_ptr<iSENSE> > objects;
+  std::vector<std::thread> threads;
+  std::atomic<int> loaded(0);
+  for (int i = 0; i < 4; i++) {
+    objects.push_back(std::unique_ptr<iSENSE>(new iSENSE()));
+    objects[i]->set_base_URL(server.base_URL());
+  }
+  for (int i = 0; i < 4; i++) {
+    threads.push_back(std::thread([&objects, &loaded, i]() {
+      objects[i]->set_project_ID("24");
+      loaded += objects[i]->get_field_ID("Number") == "11";
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  BOOST_REQUIRE(loaded == 4);
+  BOOST_REQUIRE(server.requests == 1);
+  server.delay_ms = 0;
+
+  // Once it's done, the next object asks the server again.
+  test.set_project_ID("24");
+  BOOST_REQUIRE(server.requests == 2);
+
+  // Prefetching needs a TTL, or the projects would be thrown away.
+  BOOST_REQUIRE(test.prefetch_projects({"21"}) == false);
+  BOOST_REQUIRE(server.requests == 2);
+
+  // Prefetched projects (the duplicate only once) need no more requests.
+  iSENSE::set_project_cache_ttl(60);
+  std::vector<std::string> IDs = {"21", "22", "23", "21"};
+  BOOST_REQUIRE(test.prefetch_projects(IDs) == true);
+  BOOST_REQUIRE(server.requests == 5);
+
+  for (int i = 0; i < 3; i++) {
+    iSENSE other;
+    other.set_base_URL(server.base_URL());
+    other.set_project_ID(IDs[i]);
+    BOOST_REQUIRE(other.get_field_ID("Number") == "11");
+  }
+  BOOST_REQUIRE(server.requests == 5);
+
+  // Failures aren't cached.
+  server.status = HTTP_NOT_FOUND;
+  BOOST_REQUIRE(test.prefetch_projects({"25"}) == false);
+  server.status = HTTP_AUTHORIZED;
+  BOOST_REQUIRE(test.prefetch_projects({"25"}) == true);
+  BOOST_REQUIRE(server.requests == 7);
+
+  // Turning the TTL off again empties the cache.
+  iSENSE::set_project_cache_ttl(0);
+  test.set_project_ID("21");
+  test.set_project_ID("21");
+  BOOST_REQUIRE(server.requests == 9);
+  iSENSE::set_project_cache_ttl(PROJECT_CACHE_SECONDS);
+}
+
+// Test getting a project's fields lazily or in the background instead of in
+// set_project_ID.
+BOOST_AUTO_TEST_CASE(deferred_fields) {
+  local_server server(test_offline_project);
+
+  // Lazy: nothing is asked for until the fields are needed. The base URL
+  // is set after the constructor, which starts over with that server.
+  iSENSE lazy("31", "Deferred Test", "Boost", "123", FIELDS_LAZY);
+  lazy.set_base_URL(server.base_URL());
+  BOOST_REQUIRE(server.requests == 0);
+  BOOST_REQUIRE(lazy.get_field_ID("Number") == "11");
+  BOOST_REQUIRE(server.requests == 1);
+
+  // Background: set_project_ID doesn't wait for the server.
+  server.delay_ms = 200;
+  iSENSE background;
+  background.set_base_URL(server.base_URL());
+  background.set_fields_mode(FIELDS_BACKGROUND);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  background.set_project_ID("32");
+  BOOST_REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+
+  std::shared_future<bool> ready = background.fields_ready();
+  BOOST_REQUIRE(ready.get() == true);
+  BOOST_REQUIRE(background.get_field_ID("Number") == "11");
+  BOOST_REQUIRE(server.requests == 2);
+  server.delay_ms = 0;
+
+  // Failures show up in the future.
+  server.status = HTTP_NOT_FOUND;
+  background.set_project_ID("33");
+  BOOST_REQUIRE(background.fields_ready().get() == false);
+  server.status = HTTP_AUTHORIZED;
+
+  // The constructor starts the background fetch without waiting for it
+  // (from the default server), the base URL set afterwards starts over.
+  start = std::chrono::steady_clock::now();
+  iSENSE early("34", "Deferred Test", "Boost", "123", FIELDS_BACKGROUND);
+  BOOST_REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+  early.set_base_URL(server.base_URL());
+  BOOST_REQUIRE(early.fields_ready().get() == true);
+  BOOST_REQUIRE(early.get_field_ID("Number") == "11");
+
+  // Changing the project (or dropping the object) doesn't wait for a fetch
+  // that's still running. Its result is thrown away.
+  server.delay_ms = 300;
+  std::vector<std::shared_future<bool> > dropped;
+  start = std::chrono::steady_clock::now();
+  {
+    iSENSE gone;
+    gone.set_base_URL(server.base_URL());
+    gone.set_fields_mode(FIELDS_BACKGROUND);
+    gone.set_project_ID("35");
+    dropped.push_back(gone.fields_ready());
+  }
+  background.set_project_ID("36");
+  dropped.push_back(background.fields_ready());
+  background.set_project_ID("37");
+  BOOST_REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(200));
+  BOOST_REQUIRE(background.fields_ready().get() == true);
+  BOOST_REQUIRE(background.get_field_ID("Number") == "11");
+  for (size_t i = 0; i < dropped.size(); i++) {
+    dropped[i].wait();
+  }
+
+  // Fields on the way when the object is cleared aren't used afterwards.
+  background.set_project_ID("38");
+  background.clear_data();
+  BOOST_REQUIRE(background.fields_ready().get() == false);
+  server.delay_ms = 0;
+}
+
+// Test that requests to one server share an HTTP/2 connection, and that
+// servers without HTTP/2 still get HTTP/1.1.
+BOOST_AUTO_TEST_CASE(http2_transport) {
+  h2c_server server(test_offline_project, 3);
+  std::string url = server.base_URL() + "/api/v1/projects/41";
+  http_transport transport(SHARED_HOST_CONNECTIONS);
+
+  // One request upgrades the connection, then three at once share it.
+  std::vector<std::string> bodies(4);
+  std::vector<CURLcode> results(4);
+  auto get = [&](int i) {
+    CURL *handle = curl_easy_init();
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &iSENSE::writeCallback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &bodies[i]);
+    results[i] = transport.perform(handle);
+    curl_easy_cleanup(handle);
+  };
+  get(0);
+  BOOST_REQUIRE(transport.last_version() == CURL_HTTP_VERSION_2_0);
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < 4; i++) {
+    threads.push_back(std::thread(get, i));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  for (int i = 0; i < 4; i++) {
+    BOOST_REQUIRE(results[i] == CURLE_OK);
+    BOOST_REQUIRE(bodies[i] == test_offline_project);
+  }
+  BOOST_REQUIRE(server.requests == 4);
+  BOOST_REQUIRE(server.max_streams == 3);
+  BOOST_REQUIRE(server.connections == 1);
+  BOOST_REQUIRE(transport.connections() == 1);
+
+  // An iSENSE object's GETs and POSTs go over the same connection.
+  iSENSE test;
+  test.set_http2(true);
+  test.set_base_URL(server.base_URL());
+  test.set_project_ID("42");
+  test.set_project_title("HTTP/2 Test");
+  test.set_contributor_key("123");
+  test.push_back("Number", "1");
+  BOOST_REQUIRE(test.get_field_ID("Number") == "11");
+  BOOST_REQUIRE(test.post_json_key() == true);
+  BOOST_REQUIRE(server.connections == 2);
+
+  // Servers without HTTP/2 get HTTP/1.1.
+  local_server old(test_offline_project);
+  iSENSE fallback;
+  fallback.set_http2(true);
+  fallback.set_base_URL(old.base_URL());
+  fallback.set_project_ID("43");
+  fallback.set_project_title("HTTP/1.1 Test");
+  fallback.set_contributor_key("123");
+  fallback.push_back("Number", "1");
+  BOOST_REQUIRE(fallback.get_field_ID("Number") == "11");
+  BOOST_REQUIRE(fallback.post_json_key() == true);
+  BOOST_REQUIRE(old.posts().size() == 1);
+}
+
+// Test uploading a media file and downloading media objects, resuming
+// partial downloads.
+BOOST_AUTO_TEST_CASE(media_objects) {
+  const std::string project =
+    "{\"id\":1,\"name\":\"Offline\",\"fields\":[],"
+    "\"dataSets\":[{\"id\":100,\"name\":\"First\",\"data\":[]}],"
+    "\"mediaObjects\":["
+    "{\"id\":7,\"name\":\"frame.png\",\"mediaType\":\"image\",\"src\":\"/media/7/frame.png\"},"
+    "{\"id\":8,\"name\":\"clip.wav\",\"mediaType\":\"audio\",\"src\":\"/media/8/clip.wav\","
+    "\"dataSetId\":100}]}";
+  local_server server(project);
+  std::string media;
+  for (int i = 0; i < 100000; i++) {
+    media += char(i * 7);
+  }
+  server.set_media(media);
+
+  iSENSE test;
+  test.set_base_URL(server.base_URL());
+  test.set_project_ID("51");
+  test.set_project_title("Media Test");
+  test.set_contributor_key("123");
+
+  std::vector<media_object> objects = test.get_media_objects();
+  BOOST_REQUIRE(objects.size() == 2);
+  BOOST_REQUIRE(objects[0].ID == "7" && objects[0].type == "image");
+  BOOST_REQUIRE(objects[0].URL == server.base_URL() + "/media/7/frame.png");
+  BOOST_REQUIRE(objects[0].dataset_ID.empty() && objects[1].dataset_ID == "100");
+
+  // Uploads send the whole file (binary) with the form.
+  std::string path = "media_upload.bin";
+  {
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file << media;
+  }
+  BOOST_REQUIRE(test.upload_media(path, POST_KEY, "First") == true);
+  std::string posted = server.posts().back();
+  BOOST_REQUIRE(posted.find(media) != std::string::npos);
+  BOOST_REQUIRE(posted.find("data_set") != std::string::npos);
+  BOOST_REQUIRE(posted.find("filename=\"media_upload.bin\"") != std::string::npos);
+  remove(path.c_str());
+
+  // Downloads into a file descriptor.
+  FILE *out = tmpfile();
+  BOOST_REQUIRE(test.download_media(objects[0], fileno(out)) == true);
+  BOOST_REQUIRE(ftell(out) == (long) media.size());
+  fclose(out);
+
+  // Many at once into a directory, carrying on from a .part file.
+  std::string directory = "media_download";
+  mkdir(directory.c_str(), 0755);
+  {
+    std::ofstream part((directory + "/7_frame.png.part").c_str(), std::ios::binary);
+    part << media.substr(0, 30000);
+  }
+  server.media_sent = 0;
+  BOOST_REQUIRE(test.download_media(objects, directory) == true);
+  BOOST_REQUIRE(server.media_sent == 2 * media.size() - 30000);
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    std::string name = directory + "/" + objects[i].ID + "_" + objects[i].name;
+    std::ifstream file(name.c_str(), std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    BOOST_REQUIRE(data == media);
+  }
+
+  // Files that are there already are skipped.
+  server.media_sent = 0;
+  BOOST_REQUIRE(test.download_media(objects, directory) == true);
+  BOOST_REQUIRE(server.media_sent == 0);
+
+  // Without range requests the download starts over.
+  std::string name = directory + "/8_clip.wav";
+  remove(name.c_str());
+  {
+    std::ofstream part((name + ".part").c_str(), std::ios::binary);
+    part << "junk";
+  }
+  server.ranges = false;
+  BOOST_REQUIRE(test.download_media(objects, directory) == true);
+  {
+    std::ifstream file(name.c_str(), std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    BOOST_REQUIRE(data == media);
+  }
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    remove((directory + "/" + objects[i].ID + "_" + objects[i].name).c_str());
+  }
+  rmdir(directory.c_str());
+}
+
+// Test call limits, with_timeout() and cancel() against a server that
+// doesn't answer.
+BOOST_AUTO_TEST_CASE(timeouts) {
+  iSENSE test;
+  test.set_project_title("Timeout Test");
+  test.set_contributor_key("123");
+  test.push_back("Number", "1");
+  test.set_timeouts(1000, 300, STALL_SECONDS);
+  std::chrono::steady_clock::time_point start;
+
+  // A call limit stops a server that doesn't answer.
+  {
+    local_server server(test_offline_project);
+    server.delay_ms = 1000;
+    test.set_base_URL(server.base_URL());
+
+    start = std::chrono::steady_clock::now();
+    test.set_project_ID("61");
+    BOOST_REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(900));
+    BOOST_REQUIRE(test.get_timeout_count() == 1);
+  }
+
+  // with_timeout is only for the next call. Calls made of many requests
+  // share it: append_key_byName has time to get the datasets, not to upload.
+  test.set_timeouts(1000, 0, STALL_SECONDS);
+  {
+    local_server server(test_offline_datasets);
+    server.delay_ms = 500;
+    test.set_base_URL(server.base_URL());
+
+    start = std::chrono::steady_clock::now();
+    BOOST_REQUIRE(test.with_timeout(800).append_key_byName("First") == false);
+    BOOST_REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1000));
+    BOOST_REQUIRE(test.get_timeout_count() == 2);
+    BOOST_REQUIRE(server.requests >= 1);
+
+    BOOST_REQUIRE(test.append_key_byName("First") == true);
+  }
+
+  // cancel() stops a call from another thread.
+  {
+    local_server server(test_offline_project);
+    server.delay_ms = 3000;
+    test.set_base_URL(server.base_URL());
+
+    std::thread canceller([&test]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      test.cancel();
+    });
+    start = std::chrono::steady_clock::now();
+    BOOST_REQUIRE(test.post_json_key() == false);
+    BOOST_REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(2000));
+    canceller.join();
+    BOOST_REQUIRE(test.get_timeout_count() == 2);
+  }
+}
+
+// Test that requests go to the fastest healthy endpoint, and which requests
+// move on to the next one when a server fails.
+BOOST_AUTO_TEST_CASE(endpoints) {
+  local_server slow(test_offline_project), fast(test_offline_project);
+  iSENSE::set_project_cache_ttl(0);             // Every read goes to a server
+  iSENSE test;
+  test.set_project_title("Endpoint Test");
+  test.set_contributor_key("123");
+  test.push_back("Number", "1");
+
+  // After probing, requests go to the server that answered first.
+  slow.delay_ms = 200;
+  test.set_endpoints({slow.base_URL(), fast.base_URL()});
+  BOOST_REQUIRE(test.probe_endpoints() == true);
+  BOOST_REQUIRE(slow.requests == 1 && fast.requests == 1);
+  test.set_project_ID("41");
+  BOOST_REQUIRE(test.get_field_ID("Number") == "11");
+  BOOST_REQUIRE(slow.requests == 1 && fast.requests == 2);
+
+  // So do searches and account checks.
+  fast.set_page("/api/v1/projects?&search=Endpoint", "[{\"name\":\"Endpoint Test\"}]");
+  BOOST_REQUIRE(test.get_projects_search("Endpoint").size() == 1);
+  BOOST_REQUIRE(test.set_email_password("a@b.c", "endpoints") == true);
+  BOOST_REQUIRE(slow.requests == 1 && fast.requests == 4);
+
+  // A server that can't be reached is skipped, by reads and uploads.
+  std::string dead = "http://127.0.0.1:1";
+  test.set_endpoints({dead, fast.base_URL()});
+  test.set_project_ID("42");
+  BOOST_REQUIRE(test.get_field_ID("Number") == "11");
+  BOOST_REQUIRE(fast.requests == 5);
+  test.set_endpoints({dead, fast.base_URL()});
+  BOOST_REQUIRE(test.post_json_key() == true);
+  BOOST_REQUIRE(fast.posts().size() == 1);
+
+  // Reads move on after a 5xx answer. Uploads don't, the server may have
+  // saved the dataset anyway.
+  slow.delay_ms = 0;
+  slow.status = 503;
+  test.set_endpoints({slow.base_URL(), fast.base_URL()});
+  test.set_project_ID("43");
+  BOOST_REQUIRE(test.get_field_ID("Number") == "11");
+  BOOST_REQUIRE(slow.requests == 2 && fast.requests == 7);
+  test.set_endpoints({slow.base_URL(), fast.base_URL()});
+  BOOST_REQUIRE(test.post_json_key() == false);
+  BOOST_REQUIRE(slow.requests == 3 && fast.posts().size() == 1);
+  iSENSE::set_project_cache_ttl(PROJECT_CACHE_SECONDS);
+}
+
+#ifdef ISENSE_COROUTINES
+// One task's work: append to a dataset by name (which gets the datasets
+// first), then read a dataset back.
+static isense_task<bool> append_and_read(async_iSENSE &client) {
+  bool appended = co_await client.append_key_byName("First");
+  std::vector<std::string> data = co_await client.get_dataset("First", "Number");
+  co_return appended && data.size() == 2 && data[0] == "1.5";
+}
+
+// Test running several async_iSENSE tasks on one reactor.
+BOOST_AUTO_TEST_CASE(coroutines) {
+  local_server server(test_offline_datasets);
+  request_reactor reactor;
+  const int count = 12;
+  std::vector<std::unique_ptr<iSENSE> > objects;
+  std::vector<std::unique_ptr<async_iSENSE> > clients;
+  std::vector<isense_task<bool> > tasks;
+
+  for (int i = 0; i < count; i++) {
+    objects.emplace_back(new iSENSE());
+    iSENSE &api = *objects.back();
+    api.set_base_URL(server.base_URL());
+    api.set_fields_mode(FIELDS_LAZY);
+    api.set_project_ID(std::to_string(70 + i));
+    api.set_project_title("Coroutine Test");
+    api.set_contributor_key("123");
+    api.push_back("Number", 1.0 * i);
+    clients.emplace_back(new async_iSENSE(api, reactor));
+    tasks.push_back(append_and_read(*clients.back()));
+  }
+
+  // Starting the tasks only hands their first requests to the reactor, run()
+  // does the rest of every task on this thread.
+  for (size_t i = 0; i < tasks.size(); i++) {
+    tasks[i].start();
+  }
+  BOOST_REQUIRE(reactor.running() == count);
+  BOOST_REQUIRE(server.requests == 0);
+  reactor.run();
+
+  for (size_t i = 0; i < tasks.size(); i++) {
+    BOOST_REQUIRE(tasks[i].done() && tasks[i].result() == true);
+  }
+  BOOST_REQUIRE(server.requests == 3 * count);
+  BOOST_REQUIRE(server.posts().size() == count);
+
+  // Failed requests come back as false.
+  server.status = HTTP_NOT_FOUND;
+  isense_task<bool> failed = clients[0]->post_json_key();
+  failed.start();
+  reactor.run();
+  BOOST_REQUIRE(failed.done() && failed.result() == false);
+  server.status = HTTP_AUTHORIZED;
+
+  // While an object's upload is waiting for the server, a second coroutine
+  // upload of it fails and a blocking one (on another thread) waits.
+  isense_task<bool> first = clients[1]->post_json_key();
+  isense_task<bool> second = clients[1]->post_json_key();
+  first.start();
+  second.start();
+  BOOST_REQUIRE(second.done() && second.result() == false);
+
+  int requests = server.requests;
+  bool blocked = false;
+  std::thread blocking([&] { blocked = objects[1]->post_json_key(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  BOOST_REQUIRE(server.requests == requests);
+  reactor.run();
+  blocking.join();
+  BOOST_REQUIRE(first.done() && first.result() == true && blocked == true);
+  BOOST_REQUIRE(server.requests == requests + 2);
+}
+#endif
+
+// Fields for the typed_schema test. The last two don't match the project.
+ISENSE_FIELD(schema_time, "Timestamp", FIELD_TIMESTAMP);
+ISENSE_FIELD(schema_number, "Number", FIELD_NUMBER);
+ISENSE_FIELD(schema_misspelt, "Nmuber", FIELD_NUMBER);
+ISENSE_FIELD(schema_text_as_number, "Text", FIELD_NUMBER);
+
+// Test that a typed schema is checked against the project once, uploads its
+// columns by field ID, and fails before uploading on a misspelt or mistyped field.
+BOOST_AUTO_TEST_CASE(typed_schema) {
+  local_server server(test_offline_datasets);
+  iSENSE test;
+  test.set_base_URL(server.base_URL());
+  test.set_project_ID("51");
+  test.set_project_title("Schema Test");
+  test.set_contributor_key("123");
+
+  typed_data<schema_number, schema_time> data;
+  const long long second = NANOSECONDS_PER_SECOND;
+  data.push_back<schema_number>(1.5);
+  data.push_back<schema_number>(2.5);
+  data.push_back<schema_time>(1318057629 * second);
+  BOOST_REQUIRE(data.rows() == 2);
+  BOOST_REQUIRE(data.column<schema_time>().size() == 1);
+
+  // The schema's columns go first, the other fields are empty.
+  BOOST_REQUIRE(data.upload(test, POST_KEY) == true);
+  std::vector<std::string> posts = server.posts();
+  BOOST_REQUIRE(posts.size() == 1);
+  value upload;
+  BOOST_REQUIRE(parse(upload, posts[0]).empty());
+  BOOST_REQUIRE(upload.get("title").get<std::string>() == "Schema Test");
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() == "[\"1.5\",\"2.5\"]");
+  BOOST_REQUIRE(upload.get("data").get("10").serialize() ==
+                "[\"2011-10-08T07:07:09.000Z\"]");
+  BOOST_REQUIRE(upload.get("data").get("12").serialize() == "[]");
+  BOOST_REQUIRE(posts[0].find("\"data\":{\"11\":") != std::string::npos);
+
+  // Appending by name finds the dataset's ID.
+  data.clear();
+  BOOST_REQUIRE(data.rows() == 0);
+  data.push_back<schema_number>(3);
+  BOOST_REQUIRE(data.upload(test, APPEND_KEY, "First") == true);
+  posts = server.posts();
+  BOOST_REQUIRE(posts.size() == 2);
+  BOOST_REQUIRE(parse(upload, posts[1]).empty());
+  BOOST_REQUIRE(upload.get("id").get<std::string>() == "100");
+  BOOST_REQUIRE(upload.get("data").get("11").serialize() == "[\"3\"]");
+  BOOST_REQUIRE(data.upload(test, APPEND_KEY, "Missing") == false);
+
+  // Names and types that don't match the project fail before uploading.
+  typed_data<schema_time, schema_misspelt> misspelt;
+  misspelt.push_back<schema_misspelt>(1);
+  BOOST_REQUIRE(misspelt.bind(test) == false);
+  BOOST_REQUIRE(misspelt.upload(test, POST_KEY) == false);
+  typed_data<schema_text_as_number> wrong_type;
+  wrong_type.push_back<schema_text_as_number>(1);
+  BOOST_REQUIRE(wrong_type.upload(test, POST_KEY) == false);
+  BOOST_REQUIRE(server.posts().size() == 2);
+
+  // Moving the object to another server's project binds again, with that
+  // project's field IDs.
+  local_server other("{\"id\":52,\"fields\":["
+                     "{\"id\":20,\"type\":1,\"name\":\"Timestamp\",\"unit\":\"\"},"
+                     "{\"id\":21,\"type\":2,\"name\":\"Number\",\"unit\":\"m\"}]}");
+  test.set_base_URL(other.base_URL());
+  test.set_project_ID("52");
+  BOOST_REQUIRE(data.upload(test, POST_KEY) == true);
+  BOOST_REQUIRE(other.posts().size() == 1);
+  BOOST_REQUIRE(parse(upload, other.posts()[0]).empty());
+  BOOST_REQUIRE(upload.get("data").get("21").serialize() == "[\"3\"]");
+  BOOST_REQUIRE(!upload.get("data").contains("11"));
+}
+
+// The biggest block this thread allocated while tracking_allocations was set
+// (for memory_budget). The local server's thread isn't counted.
+static thread_local bool tracking_allocations = false;
+static thread_local size_t largest_allocation = 0;
+
+// These are never inlined, otherwise GCC thinks the free() calls below are
+// mismatched with the operator new() calls (-Wmismatched-new-delete).
+#ifdef __GNUC__
+#define TEST_NOINLINE __attribute__((noinline))
+#else
+#define TEST_NOINLINE
+#endif
+
+TEST_NOINLINE void* operator new(size_t size) {
+  if (tracking_allocations) {
+    largest_allocation = std::max(largest_allocation, size);
+  }
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+TEST_NOINLINE void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+TEST_NOINLINE void operator delete(void *ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+// Test that rows over the memory budget are spilled to disk, that they are
+// all uploaded in order without reading them all back into memory, that
+// spilled rows of names that aren't fields are dropped, and that the segment
+// files are removed afterwards.
+BOOST_AUTO_TEST_CASE(memory_budget) {
+  local_server server(test_offline_project);
+  std::string directory = "spill_segments";
+  mkdir(directory.c_str(), 0755);
+  const size_t budget = 16384;
+  {
+    iSENSE test;
+    test.set_base_URL(server.base_URL());
+    test.set_project_ID("61");
+    test.set_project_title("Budget Test");
+    test.set_contributor_key("123");
+    test.set_incremental_append(true);
+    test.set_memory_budget(budget, directory);
+
+    // The memory used stays flat however much is pushed back.
+    const long long second = NANOSECONDS_PER_SECOND;
+    size_t most = 0;
+    for (int i = 0; i < 20000; i++) {
+      test.push_back("Number", i / 10.0);
+      test.push_timestamp("Timestamp", 1318057629 * second + i * (second / 1000));
+      if (i % 100 == 0) {
+        test.push_back("Text", "row " + std::to_string(i));
+      }
+      if (i % 4 == 0) {
+        test.push_back("Nmuber", i);
+      }
+      if (i % 50 == 0) {
+        most = std::max(most, test.get_resident_bytes());
+      }
+    }
+    BOOST_REQUIRE(most <= budget);
+    BOOST_REQUIRE(test.get_spilled_bytes() > 0);
+    BOOST_REQUIRE(test.get_spilled_bytes() < 25000 * 16 / 4);   // Compact segments
+
+    // Everything is read back in order when it's uploaded, a segment at a
+    // time (the upload is about 600KB of JSON).
+    tracking_allocations = true;
+    bool posted = test.post_json_key();
+    tracking_allocations = false;
+    BOOST_REQUIRE(posted == true);
+    BOOST_REQUIRE(largest_allocation <= 4 * budget);
+    std::vector<std::string> posts = server.posts();
+    BOOST_REQUIRE(posts.size() == 1);
+    BOOST_REQUIRE(posts[0].size() > 40 * budget);
+    value upload;
+    BOOST_REQUIRE(parse(upload, posts[0]).empty());
+    BOOST_REQUIRE(upload.get("data").get<object>().size() == 3);
+    const array &numbers = upload.get("data").get("11").get<array>();
+    const array &times = upload.get("data").get("10").get<array>();
+    const array &text = upload.get("data").get("12").get<array>();
+    BOOST_REQUIRE(numbers.size() == 20000 && times.size() == 20000 && text.size() == 200);
+    BOOST_REQUIRE(numbers[0].get<std::string>() == "0");
+    BOOST_REQUIRE(numbers[12345].get<std::string>() == "1234.5");
+    BOOST_REQUIRE(times[19999].get<std::string>() == "2011-10-08T07:07:28.999Z");
+    BOOST_REQUIRE(text[199].get<std::string>() == "row 19900");
+
+    // The rows that were sent are dropped, and their segments deleted.
+    BOOST_REQUIRE(test.get_spilled_bytes() == 0);
+    BOOST_REQUIRE(test.empty_project_check(POST_KEY, "memory_budget") == false);
+
+    // Segments that are left are deleted with the object.
+    for (int i = 0; i < 5000; i++) {
+      test.push_back("Number", i);
+    }
+    BOOST_REQUIRE(test.get_spilled_bytes() > 0);
+
+    // get_upload_string reads the spilled rows back into the string.
+    test.format_upload_string(POST_KEY);
+    value rest;
+    BOOST_REQUIRE(parse(rest, test.get_upload_string()).empty());
+    const array &left = rest.get("data").get("11").get<array>();
+    BOOST_REQUIRE(left.size() == 5000 && left[4999].get<std::string>() == "4999");
+  }
+  BOOST_REQUIRE(rmdir(directory.c_str()) == 0);
+}
+
+// Project page listing three datasets without their data, for project_sync.
+static std::string sync_listing(std::string second_points, bool with_third) {
+  return "{\"id\":90,\"name\":\"Sync\",\"fields\":["
+         "{\"id\":10,\"type\":1,\"name\":\"Timestamp\",\"unit\":\"\"},"
+         "{\"id\":11,\"type\":2,\"name\":\"Number\",\"unit\":\"m\"},"
+         "{\"id\":12,\"type\":3,\"name\":\"Text\",\"unit\":\"\"}],"
+         "\"dataSets\":["
+         "{\"id\":100,\"name\":\"First\",\"datapoints\":2},"
+         "{\"id\":101,\"name\":\"Second\",\"datapoints\":" + second_points + "}" +
+         (with_third ? ",{\"id\":102,\"name\":\"Third\",\"datapoints\":1}" : "") + "]}";
+}
+
+// Counts the GETs of single datasets.
+static size_t dataset_gets(local_server &server) {
+  std::vector<std::string> paths = server.gets();
+  size_t count = 0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    count += paths[i].find("/data_sets/") != std::string::npos;
+  }
+  return count;
+}
+
+// Test that sync_datasets downloads only new and changed datasets, leaves
+// out deleted ones, and keeps the last sync when a download fails.
+BOOST_AUTO_TEST_CASE(project_sync) {
+  local_server server(sync_listing("1", false));
+  server.set_page("/api/v1/data_sets/100?recur=true",
+                  "{\"id\":100,\"data\":[{\"10\":\"2015-01-01T00:00:00Z\",\"11\":\"1.5\",\"12\":\"a\"},"
+                  "{\"10\":\"2015-01-01T00:00:01Z\",\"11\":2,\"12\":\"b\"}]}");
+  server.set_page("/api/v1/data_sets/101?recur=true",
+                  "{\"id\":101,\"data\":[{\"11\":\"\",\"12\":\"c\"}]}");
+  server.set_page("/api/v1/data_sets/102?recur=true",
+                  "{\"id\":102,\"data\":[{\"11\":\"7\",\"12\":\"e\"}]}");
+
+  const std::string path = "project_sync.db";
+  iSENSE test;
+  test.set_base_URL(server.base_URL());
+  test.set_project_ID("90");
+  sync_counts counts;
+
+  // The first sync pulls down everything.
+  BOOST_REQUIRE(test.sync_datasets(path, &counts) == true);
+  BOOST_REQUIRE(counts.kept == 0 && counts.changed == 2 && counts.downloaded == 2);
+  BOOST_REQUIRE(dataset_gets(server) == 2);
+  {
+    columnar_file file;
+    BOOST_REQUIRE(file.open(path) == true);
+    BOOST_REQUIRE(file.rows() == 3 && file.datasets() == 2 && file.columns() == 3);
+    BOOST_REQUIRE(file.numbers(1)[0] == 1.5 && file.numbers(1)[1] == 2);
+    BOOST_REQUIRE(std::isnan(file.numbers(1)[2]));
+    BOOST_REQUIRE(file.text(2, 2).str() == "c");
+  }
+
+  // Nothing changed, so nothing is downloaded.
+  BOOST_REQUIRE(test.sync_datasets(path, &counts) == true);
+  BOOST_REQUIRE(counts.kept == 2 && counts.changed == 0 && counts.removed == 0);
+  BOOST_REQUIRE(dataset_gets(server) == 2);
+
+  // Only the changed and new datasets are, and kept rows stay the same.
+  server.set_page("/api/v1/projects/90", sync_listing("2", true));
+  server.set_page("/api/v1/data_sets/101?recur=true",
+                  "{\"id\":101,\"data\":[{\"11\":\"\",\"12\":\"c\"},{\"11\":\"3\",\"12\":\"d\"}]}");
+  BOOST_REQUIRE(test.sync_datasets(path, &counts) == true);
+  BOOST_REQUIRE(counts.kept == 1 && counts.changed == 2 && counts.downloaded == 2);
+  BOOST_REQUIRE(dataset_gets(server) == 4);
+  {
+    columnar_file file;
+    BOOST_REQUIRE(file.open(path) == true);
+    BOOST_REQUIRE(file.rows() == 5 && file.datasets() == 3);
+    BOOST_REQUIRE(file.text(0, 1).str() == "2015-01-01T00:00:01Z");
+    BOOST_REQUIRE(file.numbers(1)[3] == 3 && file.numbers(1)[4] == 7);
+    BOOST_REQUIRE(file.dataset_start(2) == 4 && file.dataset_name(2).str() == "Third");
+  }
+
+  // Deleted datasets are left out.
+  server.set_page("/api/v1/projects/90",
+                  "{\"id\":90,\"name\":\"Sync\",\"fields\":["
+                  "{\"id\":10,\"type\":1,\"name\":\"Timestamp\",\"unit\":\"\"},"
+                  "{\"id\":11,\"type\":2,\"name\":\"Number\",\"unit\":\"m\"},"
+                  "{\"id\":12,\"type\":3,\"name\":\"Text\",\"unit\":\"\"}],"
+                  "\"dataSets\":[{\"id\":102,\"name\":\"Third\",\"datapoints\":1}]}");
+  BOOST_REQUIRE(test.sync_datasets(path, &counts) == true);
+  BOOST_REQUIRE(counts.kept == 1 && counts.removed == 2 && counts.downloaded == 0);
+
+  // A failed download leaves the last sync as it was.
+  server.set_page("/api/v1/projects/90", sync_listing("1", true));
+  server.set_page("/api/v1/data_sets/100?recur=true", "not JSON");
+  BOOST_REQUIRE(test.sync_datasets(path, &counts) == false);
+  {
+    columnar_file file;
+    BOOST_REQUIRE(file.open(path) == true);
+    BOOST_REQUIRE(file.rows() == 1 && file.datasets() == 1);
+  }
+
+  BOOST_REQUIRE(std::remove(path.c_str()) == 0);
+  BOOST_REQUIRE(std::remove((path + SYNC_MANIFEST).c_str()) == 0);
+}
+
+// Project page listing one dataset, for dataset_queries.
+static std::string query_listing(std::string queries) {
+  return "{\"id\":91,\"name\":\"Query\",\"fields\":["
+         "{\"id\":10,\"type\":1,\"name\":\"Timestamp\",\"unit\":\"\"},"
+         "{\"id\":11,\"type\":2,\"name\":\"Number\",\"unit\":\"m\"}],"
+         "\"dataSets\":[{\"id\":200,\"name\":\"Samples\",\"datapoints\":10}]" +
+         queries + "}";
+}
+
+// Test that get_dataset picks a time window and row range out of a dataset,
+// and only sends the query along to servers that list support for it.
+BOOST_AUTO_TEST_CASE(dataset_queries) {
+  long long time = 0;
+  char buffer[TIMESTAMP_BUFFER_SIZE];
+  const long long times[] = {0, 1320736029123456789LL, -86400LL * NANOSECONDS_PER_SECOND - 1,
+                             951782400LL * NANOSECONDS_PER_SECOND};
+  for (size_t i = 0; i < 4; i++) {
+    size_t length = iSENSE::format_timestamp(buffer, times[i], 9);
+    BOOST_REQUIRE(iSENSE::parse_timestamp(buffer, length, time) && time == times[i]);
+  }
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2011-11-08T07:07:09", 19, time) &&
+                time == 1320736029 * NANOSECONDS_PER_SECOND);
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2011-11-08T12:37:09+05:30", 25, time) &&
+                time == 1320736029 * NANOSECONDS_PER_SECOND);
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2011-11-08T02:07:09.5-0500", 26, time) &&
+                time == 1320736029 * NANOSECONDS_PER_SECOND + NANOSECONDS_PER_SECOND / 2);
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2011-11-08T08:07:09+01", 22, time) &&
+                time == 1320736029 * NANOSECONDS_PER_SECOND);
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2011-11-08T07:07:09+5:30", 24, time) == false);
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2011-11-08T07:07:09+05:", 23, time) == false);
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2011-13-08T07:07:09Z", 20, time) == false);
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2011-11-08 07:07:09Z", 20, time) == false);
+
+  // Ten rows, one second apart. The third has a string in it to step over.
+  std::string rows = "{\"id\":200,\"name\":\"Samples\",\"data\":[";
+  for (int i = 0; i < 10; i++) {
+    rows += (i > 0 ? ", " : "") + std::string("{\"10\":\"2015-01-01T00:00:0") +
+            std::to_string(i) + "Z\"," + (i == 2 ? "\"9\":\"a \\\"}]\"," : "") +
+            "\"11\":" + std::to_string(i) + "}";
+  }
+  rows += "]}";
+
+  local_server server(query_listing(""));
+  server.set_page("/api/v1/data_sets/200?recur=true", rows);
+  iSENSE test;
+  test.set_base_URL(server.base_URL());
+  test.set_project_ID("91");
+
+  dataset_query query;
+  query.last = 3;
+  std::vector<std::string> data = test.get_dataset("Samples", "Number", query);
+  BOOST_REQUIRE(data.size() == 3 && data[0] == "7" && data[2] == "9");
+
+  query.last = 0;
+  query.offset = 2;
+  query.limit = 3;
+  data = test.get_dataset("Samples", "Number", query);
+  BOOST_REQUIRE(data.size() == 3 && data[0] == "2" && data[2] == "4");
+
+  // The window comes before the rows.
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2015-01-01T00:00:03Z", 20, query.start));
+  BOOST_REQUIRE(iSENSE::parse_timestamp("2015-01-01T00:00:08Z", 20, query.end));
+  query.time_field = "Timestamp";
+  query.offset = 1;
+  data = test.get_dataset("Samples", "Number", query);
+  BOOST_REQUIRE(data.size() == 3 && data[0] == "4" && data[2] == "6");
+  query.last = 2;
+  data = test.get_dataset("Samples", "Number", query);
+  BOOST_REQUIRE(data.size() == 2 && data[0] == "6" && data[1] == "7");
+
+  // Nothing was sent along to a server that doesn't list any queries.
+  std::vector<std::string> paths = server.gets();
+  BOOST_REQUIRE(std::count(paths.begin(), paths.end(), "/api/v1/data_sets/200?recur=true") == 4);
+  BOOST_REQUIRE(test.get_dataset("Samples", "Nmuber", query).empty());
+  BOOST_REQUIRE(test.get_dataset("Nothing", "Number", query).empty());
+
+  // A server that can take them gets them in the URL, and its rows are used
+  // as they are.
+  server.set_page("/api/v1/projects/91",
+                  query_listing(",\"dataQueries\":[\"fields\",\"window\",\"rows\"]"));
+  server.set_page("/api/v1/data_sets/200?recur=true&fields=11&time_field=10"
+                  "&start=2015-01-01T00:00:03.000000000Z&end=2015-01-01T00:00:08.000000000Z"
+                  "&last=2",
+                  "{\"id\":200,\"data\":[{\"11\":6},{\"11\":7}]}");
+  data = test.get_dataset("Samples", "Number", query);
+  BOOST_REQUIRE(data.size() == 2 && data[0] == "6" && data[1] == "7");
+
+  // Servers that don't list the datasets get the whole project.
+  local_server old(test_offline_project);
+  old.set_page("/api/v1/projects/92?recur=true", test_offline_datasets);
+  iSENSE fallback;
+  fallback.set_base_URL(old.base_URL());
+  fallback.set_project_ID("92");
+  dataset_query first;
+  first.last = 1;
+  data = fallback.get_dataset("First", "Number", first);
+  BOOST_REQUIRE(data.size() == 1 && data[0] == "2");
+}
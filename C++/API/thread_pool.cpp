@@ -0,0 +1,119 @@
+#include "include/thread_pool.h"
+
+thread_pool::thread_pool(int num_threads) {
+  queued = 0;
+  pending = 0;
+  next_queue = 0;
+  stopping = false;
+
+  if (num_threads <= 0) {
+    num_threads = hardware_threads();
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    queues.push_back(std::unique_ptr<task_queue>(new task_queue));
+  }
+  for (int i = 0; i < num_threads; i++) {
+    threads.push_back(std::thread(&thread_pool::run, this, i));
+  }
+}
+
+thread_pool::~thread_pool() {
+  wait();
+
+  {
+    std::lock_guard<std::mutex> guard(state_lock);
+    stopping = true;
+  }
+  work_ready.notify_all();
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+// Tasks are handed out to the threads' queues in turn.
+void thread_pool::submit(std::function<void()> task) {
+  std::lock_guard<std::mutex> guard(state_lock);
+
+  task_queue &queue = *queues[next_queue];
+  next_queue = (next_queue + 1) % queues.size();
+
+  {
+    std::lock_guard<std::mutex> queue_guard(queue.lock);
+    queue.tasks.push_back(task);
+  }
+  queued++;
+  pending++;
+  work_ready.notify_one();
+}
+
+void thread_pool::wait() {
+  std::unique_lock<std::mutex> guard(state_lock);
+  while (pending != 0) {
+    all_done.wait(guard);
+  }
+}
+
+int thread_pool::size() const {
+  return static_cast<int>(threads.size());
+}
+
+int thread_pool::hardware_threads() {
+  unsigned cores = std::thread::hardware_concurrency();
+  return cores == 0 ? 1 : static_cast<int>(cores);
+}
+
+// Take a task from the back of our own queue, or steal one from the front
+// of another thread's queue.
+bool thread_pool::take_task(int id, std::function<void()> &task) {
+  for (size_t i = 0; i < queues.size(); i++) {
+    bool own = (i == 0);
+    task_queue &queue = *queues[(id + i) % queues.size()];
+    std::lock_guard<std::mutex> guard(queue.lock);
+
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    if (own) {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+    } else {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void thread_pool::run(int id) {
+  std::function<void()> task;
+
+  while (true) {
+    if (take_task(id, task)) {
+      {
+        std::lock_guard<std::mutex> guard(state_lock);
+        queued--;
+      }
+
+      task();
+      task = std::function<void()>();     // Free anything the task held on to
+
+      std::lock_guard<std::mutex> guard(state_lock);
+      if (--pending == 0) {
+        all_done.notify_all();
+      }
+      continue;
+    }
+
+    // Nothing to do, sleep until a task is submitted.
+    std::unique_lock<std::mutex> guard(state_lock);
+    while (queued == 0 && !stopping) {
+      work_ready.wait(guard);
+    }
+    if (stopping && queued == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,150 @@
+#include "include/transport.h"
+
+// curl_multi_poll / curl_multi_wakeup are needed to hand requests over.
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define SHARED_TRANSPORT
+#endif
+
+http_transport::http_transport(long max_host_connections) {
+  connect_count = 0;
+  version = 0;
+  stopping = false;
+  multi = NULL;
+
+#ifdef SHARED_TRANSPORT
+  multi = curl_multi_init();
+  if (multi != NULL) {
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_host_connections);
+    thread = std::thread(&http_transport::run, this);
+  }
+#else
+  (void) max_host_connections;
+#endif
+}
+
+http_transport::~http_transport() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+#ifdef SHARED_TRANSPORT
+  if (thread.joinable()) {
+    curl_multi_wakeup(multi);
+    thread.join();
+  }
+#endif
+  if (multi != NULL) {
+    curl_multi_cleanup(multi);
+  }
+}
+
+CURLcode http_transport::perform(CURL *handle) {
+  curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2_0);
+
+#ifdef SHARED_TRANSPORT
+  if (multi != NULL) {
+    request current;
+    current.handle = handle;
+    current.result = CURLE_OK;
+    current.done = false;
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(handle, CURLOPT_PRIVATE, &current);
+
+    std::unique_lock<std::mutex> guard(lock);
+    queued.push_back(&current);
+    curl_multi_wakeup(multi);
+
+    while (!current.done) {
+      finished.wait(guard);
+    }
+    return current.result;
+  }
+#endif
+
+  CURLcode result = curl_easy_perform(handle);
+  count(handle);
+  return result;
+}
+
+long http_transport::connections() {
+  std::lock_guard<std::mutex> guard(lock);
+  return connect_count;
+}
+
+long http_transport::last_version() {
+  std::lock_guard<std::mutex> guard(lock);
+  return version;
+}
+
+// Adds up the connections a finished request opened.
+void http_transport::count(CURL *handle) {
+  long connects = 0, used = 0;
+  curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+  curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &used);
+
+  std::lock_guard<std::mutex> guard(lock);
+  connect_count += connects;
+  version = used;
+}
+
+// Adds the queued requests to the multi handle, runs everything that's
+// running until something happens, and wakes up the requests that are done.
+void http_transport::run() {
+#ifdef SHARED_TRANSPORT
+  std::vector<request *> adding;
+
+  while (true) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (stopping && queued.empty() && running.empty()) {
+        return;
+      }
+      adding.swap(queued);
+    }
+    for (size_t i = 0; i < adding.size(); i++) {
+      curl_multi_add_handle(multi, adding[i]->handle);
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      running.insert(running.end(), adding.begin(), adding.end());
+    }
+    adding.clear();
+
+    int still_running = 0;
+    curl_multi_perform(multi, &still_running);
+
+    CURLMsg *message;
+    int left;
+    bool any_done = false;
+    while ((message = curl_multi_info_read(multi, &left)) != NULL) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+      char *data = NULL;
+      curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &data);
+      request *done = reinterpret_cast<request *>(data);
+
+      CURLcode result = message->data.result;
+      curl_multi_remove_handle(multi, done->handle);
+      count(done->handle);
+
+      std::lock_guard<std::mutex> guard(lock);
+      done->result = result;
+      done->done = true;
+      for (size_t i = 0; i < running.size(); i++) {
+        if (running[i] == done) {
+          running.erase(running.begin() + i);
+          break;
+        }
+      }
+      any_done = true;
+    }
+    if (any_done) {
+      finished.notify_all();
+    }
+
+    curl_multi_poll(multi, NULL, 0, 1000, NULL);
+  }
+#endif
+}